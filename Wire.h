@@ -23,7 +23,9 @@
 #include <inttypes.h>
 #include "Stream.h"
 
+#ifndef BUFFER_LENGTH
 #define BUFFER_LENGTH 64
+#endif
 
 class TwoWire : public Stream
 {
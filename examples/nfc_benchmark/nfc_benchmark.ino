@@ -0,0 +1,244 @@
+/**
+  @file    nfc_benchmark.ino
+  @author  www.elechouse.com
+  @brief   example of measuring NFC scenarios for NFC_MODULE
+  
+    For this demo, send a letter through Serial to run a scenario with the
+    matching card in the field:
+      e - empty field poll cycle, no card
+      u - UID only tap, any type A card
+      m - Mifare 1K full dump, factory default keys
+      n - NTAG216 user memory read
+      i - 10 APDU ISO-DEP session, ISO14443-4 card
+      p - 1 KB P2P exchange, nfc_p2p_target running on another board
+      w - Mifare 1K ticket update, 3 blocks written and read back one by one
+      t - the same ticket update with MifareWriteBlocks()
+    Each run prints one JSON line with the result, wall time in ms, bytes
+    clocked on the I2C bus (whole reads, status polls included) and
+    commands sent, so runs can be compared.
+  
+  @section  HISTORY
+  
+  V1.0 initial version
+  
+    Copyright (c) 2012 www.elechouse.com  All right reserved.
+*/
+
+/** include library */
+#include "Wire.h"
+#include "nfc.h"
+
+/** define a nfc class */
+NFC_Module nfc;
+/** count bus bytes and commands only, no records */
+NFC_Trace counter(NULL, 0);
+
+u8 buf[64];
+
+/** factory default KeyA: 0xFF 0xFF 0xFF 0xFF 0xFF 0xFF */
+u8 key[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+/** SELECT NDEF Tag Application */
+const u8 select_ndef[] = {
+  0x00, 0xA4, 0x04, 0x00, 0x07, 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01, 0x00
+};
+
+/** ticket blocks, in the order the application updates them */
+const u8 ticket[3] = { 4, 8, 5 };
+
+u8 bench_empty(void)
+{
+  /** an empty field must not find a card */
+  return !nfc.InListPassiveTarget(buf);
+}
+
+u8 bench_uid(void)
+{
+  return nfc.InListPassiveTarget(buf);
+}
+
+u8 bench_mifare(void)
+{
+  u8 uid[NFC_UID_MAX_LEN], uid_len;
+  
+  if(!nfc.InListPassiveTarget(buf) || buf[0] != 4){
+    return 0;
+  }
+  uid_len = buf[0];
+  memcpy(uid, buf+1, uid_len);
+  for(u8 blk=0; blk<64; blk++){
+    if((blk & 3) == 0 && !nfc.MifareAuthentication(0, blk, uid, uid_len, key)){
+      return 0;
+    }
+    if(!nfc.MifareReadBlock(blk, buf)){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+u8 bench_ticket_seq(void)
+{
+  u8 uid[NFC_UID_MAX_LEN], uid_len, data[16];
+  
+  if(!nfc.InListPassiveTarget(buf) || buf[0] != 4){
+    return 0;
+  }
+  uid_len = buf[0];
+  memcpy(uid, buf+1, uid_len);
+  memset(data, 0x5A, sizeof(data));
+  for(u8 i=0; i<3; i++){
+    if(!nfc.MifareAuthentication(0, ticket[i], uid, uid_len, key) ||
+       !nfc.MifareWriteBlock(ticket[i], data) ||
+       !nfc.MifareReadBlock(ticket[i], buf) || memcmp(buf, data, 16)){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+u8 bench_ticket(void)
+{
+  u8 uid[NFC_UID_MAX_LEN], uid_len, data[16];
+  nfc_mf_write_t wr[3];
+  
+  if(!nfc.InListPassiveTarget(buf) || buf[0] != 4){
+    return 0;
+  }
+  uid_len = buf[0];
+  memcpy(uid, buf+1, uid_len);
+  memset(data, 0x5A, sizeof(data));
+  for(u8 i=0; i<3; i++){
+    wr[i].block = ticket[i];
+    wr[i].data = data;
+  }
+  /** one authentication per sector, written blocks read back */
+  return nfc.MifareWriteBlocks(wr, 3, 0, key, uid, uid_len, NFC_MF_VERIFY);
+}
+
+u8 bench_ntag(void)
+{
+  if(!nfc.InListPassiveTarget(buf) || buf[0] != 7){
+    return 0;
+  }
+  /** NTAG216 user memory: pages 4 to 225, 4 pages per READ. The last
+      READ starts at 222, a READ at 226 or later returns config pages */
+  for(u8 page=4; ; page+=4){
+    if(page > 222){
+      page = 222;
+    }
+    if(!nfc.MifareReadBlock(page, buf)){
+      return 0;
+    }
+    if(page == 222){
+      break;
+    }
+  }
+  return 1;
+}
+
+u8 bench_isodep(void)
+{
+  u16 len;
+  
+  if(!nfc.InListPassiveTarget(buf)){
+    return 0;
+  }
+  for(u8 i=0; i<10; i++){
+    len = sizeof(buf);
+    if(!nfc.ApduTransceive(1, select_ndef, sizeof(select_ndef), buf, &len)){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+u8 bench_p2p(void)
+{
+  u8 tx[32], len;
+  
+  if(!nfc.P2PInitiatorInit()){
+    return 0;
+  }
+  for(u8 i=0; i<32; i++){
+    memset(tx, i, sizeof(tx));
+    if(!nfc.P2PInitiatorTxRx(tx, sizeof(tx), buf, &len)){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void run(const char *name, u8 (*bench)(void))
+{
+  u32 start;
+  u8 ok;
+  
+  counter.clear();
+  nfc.Trace(&counter);
+  start = millis();
+  ok = bench();
+  start = millis() - start;
+  nfc.Trace(NULL);
+  
+  Serial.print("{\"scenario\":\"");
+  Serial.print(name);
+  Serial.print("\",\"ok\":");
+  Serial.print(ok, DEC);
+  Serial.print(",\"ms\":");
+  Serial.print(start, DEC);
+  Serial.print(",\"bus_bytes\":");
+  Serial.print(counter.bytes(), DEC);
+  Serial.print(",\"commands\":");
+  Serial.print(counter.commands(), DEC);
+  Serial.println("}");
+}
+
+void setup(void)
+{
+  Serial.begin(115200);
+  nfc.begin();
+  Serial.println("Benchmark Demo From Elechouse!");
+  
+  uint32_t versiondata = nfc.get_version();
+  if (! versiondata) {
+    Serial.print("Didn't find PN53x board");
+    while (1); // halt
+  }
+  
+  /** Set normal mode, and disable SAM */
+  nfc.SAMConfiguration();
+  
+  /** Bound activation retries, an empty field returns quickly */
+  nfc.RFPreset(NFC_RF_PRESET_FAST_POLL);
+}
+
+void loop(void)
+{
+  switch(Serial.read()){
+  case 'e':
+    run("empty_poll", bench_empty);
+    break;
+  case 'u':
+    run("uid_tap", bench_uid);
+    break;
+  case 'm':
+    run("mifare_1k_dump", bench_mifare);
+    break;
+  case 'n':
+    run("ntag216_read", bench_ntag);
+    break;
+  case 'i':
+    run("isodep_10_apdu", bench_isodep);
+    break;
+  case 'p':
+    run("p2p_1k", bench_p2p);
+    break;
+  case 'w':
+    run("mifare_ticket_seq", bench_ticket_seq);
+    break;
+  case 't':
+    run("mifare_ticket_txn", bench_ticket);
+    break;
+  }
+}
@@ -0,0 +1,68 @@
+/**
+  @file    nfc_bus_trace.ino
+  @author  www.elechouse.com
+  @brief   example of recording the I2C traffic of a tap for NFC_MODULE
+  
+    For this demo, every tap of a MF1S50 card is read while the bus traffic
+    is recorded, then the time, bytes and status polls of each command are
+    printed, followed by the raw records. Save the serial output to a file
+    to decode or compare it on a PC with nfc_trace of extras/host, or to
+    replay it there with TraceReplay.
+  
+  @section  HISTORY
+  
+  V1.0 initial version
+  
+    Copyright (c) 2012 www.elechouse.com  All right reserved.
+*/
+
+/** include library */
+#include "Wire.h"
+#include "nfc.h"
+
+/** define a nfc class */
+NFC_Module nfc;
+/** record buffer, about 40 bytes per command */
+u8 trace_mem[512];
+NFC_Trace trace(trace_mem, sizeof(trace_mem));
+
+void setup(void)
+{
+  Serial.begin(9600);
+  nfc.begin();
+  Serial.println("Bus Trace Demo From Elechouse!");
+  
+  uint32_t versiondata = nfc.get_version();
+  if (! versiondata) {
+    Serial.print("Didn't find PN53x board");
+    while (1); // halt
+  }
+  
+  /** Set normal mode, and disable SAM */
+  nfc.SAMConfiguration();
+  
+  /** Bound activation retries, an empty field returns quickly */
+  nfc.RFPreset(NFC_RF_PRESET_FAST_POLL);
+}
+
+void loop(void)
+{
+  u8 buf[32], block[16];
+  /** factory default KeyA: 0xFF 0xFF 0xFF 0xFF 0xFF 0xFF */
+  u8 key[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+  
+  trace.clear();
+  nfc.Trace(&trace);
+  if(nfc.InListPassiveTarget(buf) && buf[0] == 4){
+    if(nfc.MifareAuthentication(0, 4, buf+1, buf[0], key)){
+      nfc.MifareReadBlock(4, block);
+    }
+    nfc.Trace(NULL);
+    
+    trace.report();
+    trace.dump();
+    Serial.println();
+    delay(1000);
+  }
+  nfc.Trace(NULL);
+}
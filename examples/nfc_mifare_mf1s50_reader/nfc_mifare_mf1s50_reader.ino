@@ -19,6 +19,8 @@
 
 /** define a nfc class */
 NFC_Module nfc;
+/** remember cards in the field, so a card is read once per tap */
+NFC_UidCache uid_cache;
 
 void setup(void)
 {
@@ -39,6 +41,9 @@ void setup(void)
   
   /** Set normal mode, and disable SAM */
   nfc.SAMConfiguration();
+  
+  /** Bound activation retries, an empty field returns quickly */
+  nfc.RFPreset(NFC_RF_PRESET_FAST_POLL);
 }
 
 void loop(void)
@@ -47,10 +52,10 @@ void loop(void)
   
   
   /** Polling the mifar card, buf[0] is the length of the UID */
-  sta = nfc.InListPassiveTarget(buf);
+  sta = nfc.PollTap(buf, uid_cache);
   
-  /** check state and UID length */
-  if(sta && buf[0] == 4){
+  /** check new tap and UID length */
+  if(sta == NFC_TAP_NEW && buf[0] == 4){
     /** the card may be Mifare Classic card, try to read the block */  
     Serial.print("UUID length:");
     Serial.print(buf[0], DEC);
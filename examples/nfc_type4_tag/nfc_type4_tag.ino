@@ -0,0 +1,62 @@
+/**
+  @file    nfc_type4_tag.ino
+  @author  www.elechouse.com
+  @brief   example of NFC Forum Type 4 Tag emulation for NFC_MODULE.
+  
+    For this demo, NFC_MODULE presents an URL to a phone as a Type 4 Tag.
+  The NDEF file stays in flash and is read from there by the phone.
+  
+  @section  HISTORY
+  
+  V1.0 initial version
+  
+    Copyright (c) 2012 www.elechouse.com  All right reserved.
+*/
+
+/** include library */
+#include "nfc.h"
+
+/** define a nfc class */
+NFC_Module nfc;
+/** Type 4 Tag state */
+nfc_t4t_t tag;
+
+/** NDEF file: NLEN, then one URI record "http://www.elechouse.com" */
+const u8 ndef_file[] PROGMEM = {
+  0x00, 0x12,                                   // NLEN
+  0xD1, 0x01, 0x0E, 'U', NDEF_URIPREFIX_HTTP_WWWDOT,
+  'e', 'l', 'e', 'c', 'h', 'o', 'u', 's', 'e', '.', 'c', 'o', 'm'
+};
+
+void setup(void)
+{
+  Serial.begin(115200);
+  nfc.begin();
+  Serial.println("Type 4 Tag Demo From Elechouse!");
+  
+  uint32_t versiondata = nfc.get_version();
+  if (! versiondata) {
+    Serial.println("Didn't find PN53x board");
+    while (1); // halt
+  }
+  
+  /** Set normal mode, and disable SAM */
+  nfc.SAMConfiguration();
+  
+  /** serve the NDEF file, TargetPolling() arms the tag */
+  nfc.Type4Tag(&tag, ndef_file, sizeof(ndef_file));
+}
+
+void loop(void)
+{
+  switch(nfc.TargetPolling()){
+    case NFC_SRV_ACTIVATED:
+      Serial.println("Reader is sensed.");
+      break;
+    case NFC_SRV_RELEASED:
+      Serial.println("Reader left.");
+      break;
+    default:
+      break;
+  }
+}
@@ -0,0 +1,107 @@
+/**
+  @file    nfc_workflow.ino
+  @author  www.elechouse.com
+  @brief   example of a non-blocking card workflow for NFC_MODULE
+  
+    For this demo, a protothread waits for a MF1S50 card, authenticates
+    block 4 and reads blocks 4/5/6, while loop() keeps blinking the LED.
+    No call waits for the card, so other tasks run between the steps.
+  
+  @section  HISTORY
+  
+  V1.0 initial version
+  
+    Copyright (c) 2012 www.elechouse.com  All right reserved.
+*/
+
+/** include library */
+#include "Wire.h"
+#include "nfc.h"
+#include "nfc_pt.h"
+
+#define LED_PIN         13
+#define BLOCK_NUM       4
+
+/** define a nfc class */
+NFC_Module nfc;
+
+/** workflow state, locals do not survive a wait */
+nfc_pt_t reader_pt;
+u8 cmd_buf[NFC_STEP_CMD_LEN];
+u8 uid[NFC_UID_MAX_LEN+1], data[16], blk, ret;
+u32 led_time;
+
+/** factory default KeyA: 0xFF 0xFF 0xFF 0xFF 0xFF 0xFF */
+const u8 key[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+u8 reader(nfc_pt_t *pt)
+{
+  NFC_PT_BEGIN(pt);
+  
+  /** one 106 kbps type A target, uid[0] is the UID length */
+  NFC_PT_STEP(pt, nfc.StepInList(cmd_buf, uid, 1000), ret);
+  if(ret != NFC_CMD_DONE || uid[0] != 4){
+    /** no target, or not a 4 bytes UID card */
+    NFC_PT_RESTART(pt);
+  }
+  Serial.print("UUID:");
+  nfc.puthex(uid+1, uid[0]);
+  Serial.println();
+  
+  /** authenticate with KeyA */
+  NFC_PT_STEP(pt, nfc.StepMifareAuth(cmd_buf, 0, BLOCK_NUM, uid+1, uid[0],
+                                     key, 100), ret);
+  if(ret != NFC_CMD_DONE){
+    Serial.println("Authentication failed.");
+    NFC_PT_DELAY(pt, 1000);
+    NFC_PT_RESTART(pt);
+  }
+  
+  for(blk=BLOCK_NUM; blk<BLOCK_NUM+3; blk++){
+    NFC_PT_STEP(pt, nfc.StepMifareRead(cmd_buf, blk, data, 100), ret);
+    if(ret == NFC_CMD_DONE){
+      Serial.println("Read block successfully:");
+      nfc.puthex(data, 16);
+      Serial.println();
+    }
+  }
+  
+  /** give the card time to leave the field */
+  NFC_PT_DELAY(pt, 1000);
+  
+  NFC_PT_END(pt);
+}
+
+void setup(void)
+{
+  Serial.begin(9600);
+  nfc.begin();
+  Serial.println("NFC Workflow Demo From Elechouse!");
+  
+  uint32_t versiondata = nfc.get_version();
+  if (! versiondata) {
+    Serial.print("Didn't find PN53x board");
+    while (1); // halt
+  }
+  
+  /** Set normal mode, and disable SAM */
+  nfc.SAMConfiguration();
+  
+  /** Bound activation retries, an empty field returns quickly */
+  nfc.RFPreset(NFC_RF_PRESET_FAST_POLL);
+  
+  pinMode(LED_PIN, OUTPUT);
+  NFC_PT_INIT(&reader_pt);
+}
+
+void loop(void)
+{
+  /** one step of the card workflow, returns at once */
+  reader(&reader_pt);
+  
+  /** another task, runs while the card workflow waits */
+  if((u32)(millis() - led_time) >= 250){
+    led_time = millis();
+    digitalWrite(LED_PIN, !digitalRead(LED_PIN));
+  }
+}
@@ -0,0 +1,123 @@
+/*
+  apdu_test.cpp - ApduTransceive() against the ISO-DEP card of the PN532
+  emulator: one tap of 10 APDUs, timed on the virtual clock.
+
+  The tap selects the NDEF application and file, writes 100 bytes with a
+  C-APDU chained over three frames, reads them back, reads a record the
+  card hands out by 61xx and GET RESPONSE, and sends commands the card
+  answers with 6Cxx: a case 2 and a case 4 APDU, whose Le is replaced, and
+  a case 3 APDU, which gets Le appended. Every R-APDU is checked, and the
+  InDataExchange frames of the tap are counted against FRAMES.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+
+/** InDataExchange frames of the tap, per APDU */
+#define FRAMES  (1 + 1 + 3 + 1 + 1 + 4 + 2 + 2 + 2 + 1)
+
+static NFC_Module nfc;
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+static u8 rapdu[160];
+static u16 rlen;
+
+/** send capdu, 1 - the R-APDU is data, then sw */
+static u8 apdu(const u8 *capdu, u16 clen, const u8 *data, u16 len, u16 sw)
+{
+    rlen = sizeof(rapdu);
+    if(!nfc.ApduTransceive(1, capdu, clen, rapdu, &rlen)){
+        fprintf(stderr, "%02X %02X: no R-APDU\n", capdu[0], capdu[1]);
+        return 0;
+    }
+    if(rlen != len+2 || (len && memcmp(rapdu, data, len)) ||
+       rapdu[len] != (sw >> 8) || rapdu[len+1] != (u8)sw){
+        fprintf(stderr, "%02X %02X: %u bytes, SW %02X%02X\n", capdu[0],
+                capdu[1], rlen, rapdu[rlen-2], rapdu[rlen-1]);
+        return 0;
+    }
+    return 1;
+}
+
+int main(void)
+{
+    static PN532_Emu emu;
+    const u8 sel_app[12] = {
+        0x00, 0xA4, 0x04, 0x00, 0x07, 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01
+    };
+    const u8 sel_ndef[7] = { 0x00, 0xA4, 0x00, 0x0C, 0x02, 0xE1, 0x04 };
+    const u8 rd_0[5] = { 0x00, 0xB0, 0x00, 0x00, 0x32 };
+    const u8 rd_50[5] = { 0x00, 0xB0, 0x00, 0x32, 0x00 };
+    const u8 rd_end[5] = { 0x00, 0xB0, 0x00, 0x90, 0x10 };
+    const u8 rd_rec[5] = { 0x00, 0xB2, 0x01, 0x04, 0x00 };
+    const u8 get_data[5] = { 0x00, 0xCA, 0x00, 0x00, 0x00 };
+    const u8 serial[8] = { 0x53, 0x4E, 0x00, 0x00, 0x12, 0x34, 0x56, 0x78 };
+    const u8 case3[9] = { 0x80, 0xCB, 0x00, 0x00, 0x04, 0x11, 0x22, 0x33, 0x44 };
+    const u8 case4[10] = {
+        0x80, 0xCB, 0x00, 0x00, 0x04, 0x55, 0x66, 0x77, 0x88, 0x10
+    };
+    const u8 inv3[4] = { 0xEE, 0xDD, 0xCC, 0xBB };
+    const u8 inv4[4] = { 0xAA, 0x99, 0x88, 0x77 };
+    u8 upd[5+100], file[PN532_EMU_NDEF_SIZE], rec[PN532_EMU_RECORD_LEN];
+    u8 uid[NFC_UID_MAX_LEN+1];
+    NFC_Trace count(NULL, 0);
+    u32 t;
+    u16 i;
+
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+
+    /** UPDATE BINARY at 0, 100 bytes; the file reads back 0 past them */
+    upd[0] = 0x00;
+    upd[1] = 0xD6;
+    upd[2] = 0x00;
+    upd[3] = 0x00;
+    upd[4] = 100;
+    memset(file, 0, sizeof(file));
+    for(i=0; i<100; i++){
+        upd[5+i] = file[i] = i*7 + 3;
+    }
+    for(i=0; i<sizeof(rec); i++){
+        rec[i] = emu_record(i);
+    }
+
+    emu.field(PN532_EMU_ISO_DEP);
+    CHECK(nfc.InListPassiveTarget(uid));
+    nfc.Trace(&count);
+    t = micros();
+    CHECK(apdu(sel_app, sizeof(sel_app), NULL, 0, NFC_SW_OK));
+    CHECK(apdu(sel_ndef, sizeof(sel_ndef), NULL, 0, NFC_SW_OK));
+    CHECK(apdu(upd, sizeof(upd), NULL, 0, NFC_SW_OK));
+    CHECK(apdu(rd_0, sizeof(rd_0), file, 50, NFC_SW_OK));
+    /** Le 00 lowered to what fits in a frame */
+    CHECK(apdu(rd_50, sizeof(rd_50), file+50, NFC_APDU_MAX_LE, NFC_SW_OK));
+    /** 61xx, GET RESPONSE until 9000 */
+    CHECK(apdu(rd_rec, sizeof(rd_rec), rec, sizeof(rec), NFC_SW_OK));
+    /** 6C08: case 2, Le replaced */
+    CHECK(apdu(get_data, sizeof(get_data), serial, sizeof(serial), NFC_SW_OK));
+    /** 6C04: case 3, Le appended, the data is left alone */
+    CHECK(apdu(case3, sizeof(case3), inv3, sizeof(inv3), NFC_SW_OK));
+    /** 6C04: case 4, Le replaced */
+    CHECK(apdu(case4, sizeof(case4), inv4, sizeof(inv4), NFC_SW_OK));
+    /** an error status word is the R-APDU */
+    CHECK(apdu(rd_end, sizeof(rd_end), NULL, 0, NFC_SW_WRONG_P1P2));
+    t = micros() - t;
+    nfc.Trace(NULL);
+
+    CHECK(count.commands() == FRAMES);
+    CHECK(!emu.errors());
+    printf("10 APDUs in %lu us, %lu us per APDU, %u frames, %lu bus bytes\n",
+           (unsigned long)t, (unsigned long)t/10, count.commands(),
+           (unsigned long)count.bytes());
+    return failed;
+}
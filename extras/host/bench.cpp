@@ -0,0 +1,184 @@
+/*
+  bench.cpp - the scenarios of examples/nfc_benchmark on the host, against
+  the PN532 emulator. Prints one JSON object per scenario:
+
+    {"scenario":"uid_tap","ok":1,"us":11660,"bus_bytes":66,"commands":1,
+     "instructions":10234}
+
+  us is virtual time, bus_bytes and commands come from NFC_Trace, as on the
+  board. instructions counts user space instructions of the library and
+  the host runtime, the emulator is left out; it is null where perf events
+  are not available. Exits non-zero when a scenario fails, or when an
+  empty field poll does not take longer than a tap: with FAST_POLL, PN532
+  tries MxRtyPassiveActivation+1 times before it gives up. Also when the
+  ticket update of MifareWriteBlocks() takes as many commands as writing
+  and reading back the blocks one by one.
+
+    nfc_bench           all scenarios
+    nfc_bench mn        scenarios by the letters of the sketch
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "host.h"
+#include "pn532_emu.h"
+
+/** scenarios and objects of the sketch, so both measure the same code */
+#include "../../examples/nfc_benchmark/nfc_benchmark.ino"
+
+/** pause instruction counting while the emulator runs */
+class PerfBus : public HostBus
+{
+  public:
+    PerfBus(HostBus *dev, int fd) : dev(dev), fd(fd) {}
+    u8 write(u8 addr, const u8 *buf, u8 len)
+    {
+        pause();
+        u8 ret = dev->write(addr, buf, len);
+        resume();
+        return ret;
+    }
+    u8 read(u8 addr, u8 *buf, u8 len)
+    {
+        pause();
+        u8 ret = dev->read(addr, buf, len);
+        resume();
+        return ret;
+    }
+    void pause(void)
+    {
+        if(fd >= 0){
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    void resume(void)
+    {
+        if(fd >= 0){
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+  private:
+    HostBus *dev;
+    int fd;
+};
+
+static int perf_open(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static const struct{
+    char key;
+    const char *name;
+    u8 (*bench)(void);
+    u8 card;
+}scenario[] = {
+    { 'e', "empty_poll",     bench_empty,  PN532_EMU_NONE },
+    { 'u', "uid_tap",        bench_uid,    PN532_EMU_MIFARE_1K },
+    { 'm', "mifare_1k_dump", bench_mifare, PN532_EMU_MIFARE_1K },
+    { 'n', "ntag216_read",   bench_ntag,   PN532_EMU_NTAG216 },
+    { 'i', "isodep_10_apdu", bench_isodep, PN532_EMU_ISO_DEP },
+    { 'p', "p2p_1k",         bench_p2p,    PN532_EMU_P2P },
+    { 'w', "mifare_ticket_seq", bench_ticket_seq, PN532_EMU_MIFARE_1K },
+    { 't', "mifare_ticket_txn", bench_ticket,     PN532_EMU_MIFARE_1K },
+};
+
+int main(int argc, char **argv)
+{
+    static PN532_Emu emu;
+    const char *keys = (argc > 1) ? argv[1] : "eumnipwt";
+    int fd = perf_open();
+    PerfBus bus(&emu, fd);
+    int status = 0;
+    uint64_t empty_us = 0, tap_us = 0;
+    u16 seq_cmds = 0, txn_cmds = 0;
+
+    host_set_bus(&bus);
+
+    /** setup() of the sketch, without its banner */
+    nfc.begin();
+    if(!nfc.get_version() || !nfc.SAMConfiguration() ||
+       !nfc.RFPreset(NFC_RF_PRESET_FAST_POLL)){
+        fprintf(stderr, "PN532 setup failed\n");
+        return 1;
+    }
+
+    for(const char *k = keys; *k; k++){
+        for(unsigned i=0; i<sizeof(scenario)/sizeof(scenario[0]); i++){
+            long long count = 0;
+            uint64_t start;
+            u8 ok;
+
+            if(scenario[i].key != *k){
+                continue;
+            }
+            emu.field(scenario[i].card);
+            counter.clear();
+            nfc.Trace(&counter);
+            if(fd >= 0){
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+            start = host_time_us();
+            ok = scenario[i].bench();
+            start = host_time_us() - start;
+            if(fd >= 0){
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+                if(::read(fd, &count, sizeof(count)) != sizeof(count)){
+                    count = -1;
+                }
+            }
+            nfc.Trace(NULL);
+            if(*k == 'e'){
+                empty_us = start;
+            }else if(*k == 'u'){
+                tap_us = start;
+            }else if(*k == 'w'){
+                seq_cmds = counter.commands();
+            }else if(*k == 't'){
+                txn_cmds = counter.commands();
+            }
+
+            printf("{\"scenario\":\"%s\",\"ok\":%u,\"us\":%llu,"
+                   "\"bus_bytes\":%lu,\"commands\":%u,\"instructions\":",
+                   scenario[i].name, ok, (unsigned long long)start,
+                   (unsigned long)counter.bytes(), counter.commands());
+            if(fd >= 0 && count >= 0){
+                printf("%lld}\n", count);
+            }else{
+                printf("null}\n");
+            }
+            if(!ok){
+                status = 1;
+            }
+        }
+    }
+    if(empty_us && tap_us && empty_us <= tap_us){
+        fprintf(stderr, "empty field poll as fast as a tap\n");
+        status = 1;
+    }
+    if(seq_cmds && txn_cmds && txn_cmds >= seq_cmds){
+        fprintf(stderr, "ticket transaction as many round trips as one by one\n");
+        status = 1;
+    }
+    if(emu.errors()){
+        fprintf(stderr, "%lu frames with a bad checksum\n",
+                (unsigned long)emu.errors());
+        status = 1;
+    }
+    return status;
+}
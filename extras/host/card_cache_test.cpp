@@ -0,0 +1,189 @@
+/*
+  card_cache_test.cpp - MifareReadCached() and NtagReadCached() over
+  simulated tap sequences on the PN532 emulator, hit rate and exchanges
+  against reading the same blocks without a cache.
+
+  Mifare: three cards, a cache budget of two. Each tap reads blocks 8..14
+  with block 4 as change marker: a tap on a cached, unchanged card costs
+  the marker's authentication and READ, a miss the full read plus those.
+  Between taps the issuer updates card B and bumps its marker; the next
+  tap of B must read the new data. Card C evicts the least recently used
+  card. NTAG: one tag, READ_CNT is the marker; another reader's update
+  bumps the counter and drops the image. Exact hits, misses and exchanges
+  are checked, the data of every tap against the card.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+
+static NFC_Module nfc;
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+#define CARDS           3
+#define MARKER          4
+#define FIRST           8
+#define NUM             7
+/** auth 8, READ 8..11, auth 12, READ 12..14 */
+#define PLAIN_CMDS      9
+#define HIT_CMDS        2
+#define MISS_CMDS       (HIT_CMDS + PLAIN_CMDS)
+
+static u8 key[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+static u8 card[CARDS][1024];
+/** two Mifare cards of 16 blocks, one NTAG of 5 */
+static u8 mifare_mem[2*(sizeof(nfc_card_hdr_t) + 2 + 16*16)];
+static u8 ntag_mem[sizeof(nfc_card_hdr_t) + 1 + 5*16];
+
+static void card_init(u8 *m, u8 id)
+{
+    memset(m, 0, 1024);
+    m[0] = 0xC0 | id;
+    m[1] = 0x11 * id;
+    m[2] = 0x5A;
+    m[3] = 0x3C;
+    m[4] = m[0] ^ m[1] ^ m[2] ^ m[3];
+    m[5] = 0x08;
+    m[6] = 0x04;
+    for(u8 i=0; i<16; i++){
+        u8 *t = m + (i*4+3)*16;
+        memset(t, 0xFF, 16);
+        t[6] = 0xFF;
+        t[7] = 0x07;
+        t[8] = 0x80;
+        t[9] = 0x69;
+    }
+    for(u16 i=FIRST*16; i<(FIRST+NUM)*16; i++){
+        if((i/16 & 3) != 3){
+            m[i] = i + id;
+        }
+    }
+}
+
+/** the issuer writes a block and bumps the marker */
+static void issue(u8 *m, u8 blk)
+{
+    m[blk*16] ^= 0xA5;
+    m[MARKER*16]++;
+}
+
+/** tap card c, returns the exchanges of MifareReadCached() */
+static u16 mifare_tap(PN532_Emu &emu, NFC_CardCache &cache, u8 c)
+{
+    u8 uid[NFC_UID_MAX_LEN+1], buf[NUM*16], off;
+    u16 cmds;
+
+    emu.field(PN532_EMU_MIFARE_1K);
+    emu.memory(card[c], 1024);
+    CHECK(nfc.InListPassiveTarget(uid));
+    CHECK(uid[0] == 4 && !memcmp(uid+1, card[c], 4));
+
+    nfc.Exchanges(1);
+    CHECK(nfc.MifareReadCached(cache, uid+1, uid[0], 0, key, MARKER, FIRST,
+                               NUM, buf));
+    cmds = nfc.Exchanges();
+    for(u8 i=0; i<NUM; i++){
+        /** key A reads as zeros */
+        off = ((FIRST+i) & 3) == 3 ? 6 : 0;
+        CHECK(!memcmp(buf+16*i+off, card[c]+(FIRST+i)*16+off, 16-off));
+    }
+    return cmds;
+}
+
+static void mifare(PN532_Emu &emu)
+{
+    /** taps, '*' - the issuer updates card B before the next tap */
+    const char *seq = "ABAAB*BACABBA";
+    const char *hits = "..HHH.H.H.HH";
+    NFC_CardCache cache(mifare_mem, sizeof(mifare_mem), 16);
+    u16 taps = 0, hit, miss, cmds = 0, n, plain;
+
+    for(u8 c=0; c<CARDS; c++){
+        card_init(card[c], c);
+    }
+    for(const char *s=seq; *s; s++){
+        if(*s == '*'){
+            issue(card[1], 9);
+            continue;
+        }
+        n = mifare_tap(emu, cache, *s - 'A');
+        CHECK(n == (hits[taps] == 'H' ? HIT_CMDS : MISS_CMDS));
+        cmds += n;
+        taps++;
+    }
+    cache.stats(&hit, &miss);
+    CHECK(hit == 7*NUM && miss == 5*NUM);
+    CHECK(cmds == 7*HIT_CMDS + 5*MISS_CMDS);
+
+    plain = taps * PLAIN_CMDS;
+    printf("Mifare: %u taps, %u of %u blocks from cache (%u%%), "
+           "%u exchanges instead of %u (-%u%%)\n", taps, hit, hit+miss,
+           100*hit/(hit+miss), cmds, plain, 100*(plain-cmds)/plain);
+}
+
+/** tap the NTAG, pages 4..19 must be data; returns the exchanges */
+static u16 ntag_tap(NFC_CardCache &cache, const u8 *data)
+{
+    u8 uid[NFC_UID_MAX_LEN+1], buf[4*16];
+
+    CHECK(nfc.InListPassiveTarget(uid));
+    nfc.Exchanges(1);
+    CHECK(nfc.NtagReadCached(cache, uid+1, uid[0], 1, 4, buf));
+    CHECK(!memcmp(buf, data, sizeof(buf)));
+    return nfc.Exchanges();
+}
+
+static void ntag(PN532_Emu &emu)
+{
+    NFC_CardCache cache(ntag_mem, sizeof(ntag_mem), 5);
+    u8 uid[NFC_UID_MAX_LEN+1], data[4*16], page[4];
+    u16 hit, miss;
+
+    emu.field(PN532_EMU_NTAG216);
+    CHECK(nfc.InListPassiveTarget(uid));
+    for(u8 i=0; i<4; i++){
+        CHECK(nfc.MifareReadBlock(4+4*i, data+16*i));
+    }
+
+    /** READ_CNT, 4 READ, READ_CNT; then READ_CNT */
+    CHECK(ntag_tap(cache, data) == 6);
+    CHECK(ntag_tap(cache, data) == 1);
+    CHECK(ntag_tap(cache, data) == 1);
+
+    /** another reader writes page 5, its READ bumps the counter */
+    memcpy(page, data+4, 4);
+    page[0] ^= 0x5A;
+    CHECK(nfc.InListPassiveTarget(uid));
+    CHECK(nfc.NtagWriteDiff(5, 1, page, NULL));
+    memcpy(data+4, page, 4);
+
+    CHECK(ntag_tap(cache, data) == 6);
+    CHECK(ntag_tap(cache, data) == 1);
+    cache.stats(&hit, &miss);
+    CHECK(hit == 3*4 && miss == 2*4);
+    printf("NTAG: 5 taps, %u of %u blocks from cache, 15 exchanges "
+           "instead of 20\n", hit, hit+miss);
+}
+
+int main(void)
+{
+    static PN532_Emu emu;
+
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+
+    mifare(emu);
+    ntag(emu);
+
+    CHECK(!emu.errors());
+    return failed;
+}
@@ -0,0 +1,248 @@
+/*
+  ce_replay_test.cpp - card emulation, TargetPolling() and its APDU handler
+  table, against an emulated reader on a second board, see
+  host_run_boards().
+
+  The reader activates the emulated PICC with InListPassiveTarget() and
+  replays a recorded SELECT/READ BINARY sequence with ApduTransceive(),
+  then leaves the field and comes back, SESSIONS times. Every R-APDU must
+  match the recording: handlers are found by CLA and INS, an unknown one
+  answers 6D00, the file is served from PROGMEM, and a READ BINARY longer
+  than one frame comes back chained. The card must report one ACTIVATED
+  and RELEASED per session and one REQUEST per C-APDU. The card PN532 must
+  get the answer to every C-APDU within TURN_MAX_US of having it ready for
+  TgGetData. At 100 kHz I2C that is mostly bus time: the C-APDU frame is
+  read whole, 64 bytes in 5.8 ms, and the R-APDU written; the loop period
+  and the handler add the rest.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+
+#define SESSIONS        2
+#define LOOP_MS         1
+#define TURN_MAX_US     20000UL
+#define RUN_MAX_US      30000000ULL
+
+static NFC_Module nfc_r, nfc_c;
+static PN532_Emu emu_r, emu_c;
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+/**
+    the card: application F0 01 02 03 04 05 with file 0101, served as
+    PROGMEM data, a plain read on the host; main() fills it
+*/
+static const u8 app_aid[6] = { 0xF0, 0x01, 0x02, 0x03, 0x04, 0x05 };
+static u8 file[100];
+static const u8 serial[4] = { 0x5E, 0x71, 0xA1, 0x01 };
+
+typedef struct{
+    u8 app;
+    u8 sel;
+}card_t;
+
+static void on_select(const u8 *capdu, u8 len, nfc_rapdu_t *rsp, void *ctx)
+{
+    card_t *card = (card_t *)ctx;
+
+    rsp->sw = NFC_SW_FILE_NOT_FOUND;
+    if(capdu[2] == 0x04){
+        card->app = len == 5+sizeof(app_aid) && capdu[4] == sizeof(app_aid) &&
+                    !memcmp(capdu+5, app_aid, sizeof(app_aid));
+        card->sel = 0;
+        if(card->app){
+            rsp->sw = NFC_SW_OK;
+        }
+    }else if(card->app && len >= 7 && capdu[5] == 0x01 && capdu[6] == 0x01){
+        card->sel = 1;
+        rsp->sw = NFC_SW_OK;
+    }
+}
+
+static void on_read(const u8 *capdu, u8 len, nfc_rapdu_t *rsp, void *ctx)
+{
+    card_t *card = (card_t *)ctx;
+    u16 off = (capdu[2] << 8) | capdu[3], le;
+
+    if(!card->sel || off > sizeof(file)){
+        rsp->sw = card->sel ? NFC_SW_WRONG_P1P2 : NFC_SW_FILE_NOT_FOUND;
+        return;
+    }
+    le = (len > 4 && capdu[4]) ? capdu[4] : 256;
+    if(le > sizeof(file)-off){
+        le = sizeof(file)-off;
+    }
+    rsp->data = file + off;
+    rsp->len = le;
+    rsp->pgm = 1;
+    rsp->sw = NFC_SW_OK;
+}
+
+/** proprietary class only */
+static void on_get_data(const u8 *capdu, u8 len, nfc_rapdu_t *rsp, void *ctx)
+{
+    rsp->data = serial;
+    rsp->len = sizeof(serial);
+    rsp->sw = NFC_SW_OK;
+}
+
+static const nfc_apdu_entry_t table[3] = {
+    { NFC_APDU_ANY, 0xA4, on_select },
+    { 0x00, 0xB0, on_read },
+    { 0x80, 0xCA, on_get_data },
+};
+
+/** the recorded sequence, READ BINARY data comes from file */
+typedef struct{
+    u8 capdu[16];
+    u8 clen;
+    u8 sw[2];
+    u8 off, cnt;        // R-APDU data: file[off..off+cnt)
+    u8 fixed;           // R-APDU data: serial
+}step_t;
+
+static const step_t steps[] = {
+    /** READ BINARY before SELECT */
+    { { 0x00, 0xB0, 0x00, 0x00, 0x10 }, 5, { 0x6A, 0x82 }, 0, 0, 0 },
+    /** unknown application */
+    { { 0x00, 0xA4, 0x04, 0x00, 0x06, 0xF0, 0x01, 0x02, 0x03, 0x04, 0x06 },
+      11, { 0x6A, 0x82 }, 0, 0, 0 },
+    { { 0x00, 0xA4, 0x04, 0x00, 0x06, 0xF0, 0x01, 0x02, 0x03, 0x04, 0x05 },
+      11, { 0x90, 0x00 }, 0, 0, 0 },
+    /** file 0101 */
+    { { 0x00, 0xA4, 0x00, 0x0C, 0x02, 0x01, 0x01 }, 7, { 0x90, 0x00 },
+      0, 0, 0 },
+    { { 0x00, 0xB0, 0x00, 0x00, 0x10 }, 5, { 0x90, 0x00 }, 0, 16, 0 },
+    { { 0x00, 0xB0, 0x00, 0x10, 0x20 }, 5, { 0x90, 0x00 }, 16, 32, 0 },
+    /** Le 00, lowered by ApduTransceive(), chained by the card */
+    { { 0x00, 0xB0, 0x00, 0x30, 0x00 }, 5, { 0x90, 0x00 }, 48, 52, 0 },
+    /** past the end of the file */
+    { { 0x00, 0xB0, 0x00, 0x70, 0x10 }, 5, { 0x6B, 0x00 }, 0, 0, 0 },
+    /** GET DATA is proprietary, CLA 00 is not handled */
+    { { 0x80, 0xCA, 0x00, 0x00, 0x04 }, 5, { 0x90, 0x00 }, 0, 0, 1 },
+    { { 0x00, 0xCA, 0x00, 0x00, 0x04 }, 5, { 0x6D, 0x00 }, 0, 0, 0 },
+    { { 0x00, 0x20, 0x00, 0x01 }, 4, { 0x6D, 0x00 }, 0, 0, 0 },
+};
+#define STEPS   (sizeof(steps)/sizeof(steps[0]))
+
+class Reader : public HostBoard
+{
+  public:
+    Reader(HostBus *bus) : HostBoard(bus), good(0) {}
+    void run(void)
+    {
+        u8 uid[NFC_UID_MAX_LEN+1], rapdu[128];
+        const u8 expect_uid[5] = { 4, 0x08, 0x12, 0x34, 0x56 };
+        u16 rlen;
+        u32 start;
+
+        for(u8 s=0; s<SESSIONS; s++){
+            emu_r.link(&emu_c);
+            start = millis();
+            while(!nfc_r.InListPassiveTarget(uid)){
+                if(millis() - start > 1000){
+                    return;
+                }
+            }
+            CHECK(!memcmp(uid, expect_uid, sizeof(expect_uid)));
+            for(u8 i=0; i<STEPS; i++){
+                const step_t *st = &steps[i];
+                u8 cnt = st->fixed ? sizeof(serial) : st->cnt;
+                const u8 *data = st->fixed ? serial : file + st->off;
+
+                rlen = sizeof(rapdu);
+                if(!nfc_r.ApduTransceive(1, st->capdu, st->clen,
+                                         rapdu, &rlen)){
+                    fprintf(stderr, "step %u: no R-APDU\n", i);
+                    continue;
+                }
+                if(rlen == cnt+2 && !memcmp(rapdu, data, cnt) &&
+                   !memcmp(rapdu+cnt, st->sw, 2)){
+                    good++;
+                }else{
+                    fprintf(stderr, "step %u: %u bytes, SW %02X%02X\n", i,
+                            rlen, rapdu[rlen-2], rapdu[rlen-1]);
+                }
+            }
+            /** the reader is taken away */
+            emu_r.field(PN532_EMU_NONE);
+            delay(50);
+        }
+    }
+
+    u16 good;
+};
+
+class Card : public HostBoard
+{
+  public:
+    Card(HostBus *bus) : HostBoard(bus)
+    {
+        memset(events, 0, sizeof(events));
+        memset(&card, 0, sizeof(card));
+    }
+    void run(void)
+    {
+        u32 start = millis();
+        u8 ev;
+
+        nfc_c.SetApduHandlers(table, 3, &card);
+        while(events[NFC_SRV_RELEASED] < SESSIONS &&
+              millis() - start < RUN_MAX_US/1000){
+            ev = nfc_c.TargetPolling();
+            if(ev == NFC_SRV_ACTIVATED){
+                /** a new reader starts at the top */
+                card.app = 0;
+                card.sel = 0;
+            }
+            events[ev]++;
+            delay(LOOP_MS);
+        }
+    }
+
+    card_t card;
+    u16 events[NFC_SRV_RELEASED+1];
+};
+
+static void setup(NFC_Module &nfc, PN532_Emu &emu)
+{
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+}
+
+int main(void)
+{
+    Reader rd(&emu_r);
+    Card cd(&emu_c);
+    HostBoard *boards[2] = { &rd, &cd };
+
+    for(u8 i=0; i<sizeof(file); i++){
+        file[i] = i*13 + 1;
+    }
+    setup(nfc_r, emu_r);
+    CHECK(nfc_r.RFPreset(NFC_RF_PRESET_FAST_POLL));
+    setup(nfc_c, emu_c);
+
+    CHECK(host_run_boards(boards, 2, RUN_MAX_US));
+    CHECK(rd.good == SESSIONS*STEPS);
+    CHECK(cd.events[NFC_SRV_ACTIVATED] == SESSIONS);
+    CHECK(cd.events[NFC_SRV_REQUEST] == SESSIONS*STEPS);
+    CHECK(cd.events[NFC_SRV_RELEASED] == SESSIONS);
+    CHECK(emu_c.turnaround() && emu_c.turnaround() <= TURN_MAX_US);
+    printf("%u APDUs in %u sessions, turned around in %lu us at most\n",
+           (unsigned)(SESSIONS*STEPS), SESSIONS,
+           (unsigned long)emu_c.turnaround());
+
+    CHECK(!emu_r.errors() && !emu_c.errors());
+    return failed;
+}
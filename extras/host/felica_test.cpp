@@ -0,0 +1,192 @@
+/*
+  felica_test.cpp - FelicaPoll(), FelicaRead() and FelicaWrite() against the
+  FeliCa cards of the PN532 emulator.
+
+  Lite-S: polling by system code and request code, IDm and PMm against the
+  ID, D_ID and SYS_C blocks of the memory map, the 14 user blocks written
+  one a command, as the card takes, and read back packed, and the blocks
+  the card refuses. Standard: a read only and a read/write service, blocks
+  numbered past 255 (3 byte list elements), and reads across both services
+  in one command. Every batch is counted in InDataExchange frames: the
+  64-byte frame holds 2 blocks, so n blocks take (n+1)/2 commands.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+
+static NFC_Module nfc;
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+static const u8 lite_idm[8] = { 0x01, 0x2E, 0x4C, 0xD8, 0xA1, 0x02, 0x33, 0x71 };
+static const u8 lite_pmm[8] = { 0x00, 0xF1, 0x00, 0x00, 0x00, 0x01, 0x43, 0x00 };
+static const u8 std_idm[8] = { 0x01, 0x01, 0x06, 0x01, 0xCB, 0x0A, 0x8E, 0x12 };
+
+/** InDataExchange frames of the last batch */
+static NFC_Trace count(NULL, 0);
+
+static u8 read(const nfc_felica_t *card, const u16 *svc, u8 nsvc,
+               const nfc_felica_blk_t *blk, u8 nblk, u8 *data, u8 max)
+{
+    u8 ok;
+
+    count.clear();
+    nfc.Trace(&count);
+    ok = nfc.FelicaRead(card, svc, nsvc, blk, nblk, data, max);
+    nfc.Trace(NULL);
+    return ok;
+}
+
+static u8 write(const nfc_felica_t *card, const u16 *svc, u8 nsvc,
+                const nfc_felica_blk_t *blk, u8 nblk, const u8 *data, u8 max)
+{
+    u8 ok;
+
+    count.clear();
+    nfc.Trace(&count);
+    ok = nfc.FelicaWrite(card, svc, nsvc, blk, nblk, data, max);
+    nfc.Trace(NULL);
+    return ok;
+}
+
+static void lite_s(void)
+{
+    const u8 idata[5] = { FELICA_CMD_POLLING, 0xFF, 0xFF, 0x01, 0x00 };
+    const u16 rw = 0x0009, ro = 0x000B;
+    nfc_felica_blk_t blk[14];
+    nfc_felica_t card;
+    u8 buf[1+18], wdata[14*16], rdata[14*16];
+    u8 i;
+
+    /** raw: POL_RES length, IDm, PMm, system code */
+    CHECK(nfc.FelicaPoll(buf, sizeof(idata), (u8 *)idata));
+    CHECK(buf[0] == 18);
+    CHECK(!memcmp(buf+1, lite_idm, 8) && !memcmp(buf+9, lite_pmm, 8));
+    CHECK(buf[17] == 0x88 && buf[18] == 0xB4);
+
+    CHECK(!nfc.FelicaPoll(&card, 0x0003));
+    CHECK(nfc.FelicaPoll(&card, 0x88B4, NFC_FELICA_RC_NONE));
+    CHECK(card.sys == 0xFFFF);
+    CHECK(nfc.FelicaPoll(&card, 0xFFFF, NFC_FELICA_RC_SYSCODE,
+                         PN532_BRTY_424KBPS));
+    CHECK(card.sys == 0x88B4);
+    CHECK(!memcmp(card.idm, lite_idm, 8) && !memcmp(card.pmm, lite_pmm, 8));
+
+    /** ID, D_ID, SYS_C */
+    blk[0].svc = 0;
+    blk[0].num = 0x82;
+    blk[1].svc = 0;
+    blk[1].num = 0x83;
+    blk[2].svc = 0;
+    blk[2].num = 0x85;
+    CHECK(read(&card, &ro, 1, blk, 3, rdata, 4));
+    CHECK(count.commands() == 2);
+    CHECK(!memcmp(rdata, card.idm, 8));
+    CHECK(!memcmp(rdata+16, card.idm, 8) && !memcmp(rdata+24, card.pmm, 8));
+    CHECK(rdata[32] == 0x88 && rdata[33] == 0xB4);
+
+    /** S_PAD0..13: written one block a command, read back 2 a command */
+    for(i=0; i<14; i++){
+        blk[i].svc = 0;
+        blk[i].num = i;
+    }
+    for(i=0; i<sizeof(wdata); i++){
+        wdata[i] = i*11 + 5;
+    }
+    CHECK(!write(&card, &rw, 1, blk, 14, wdata, 0));
+    CHECK(write(&card, &rw, 1, blk, 14, wdata, 1));
+    CHECK(count.commands() == 14);
+    memset(rdata, 0, sizeof(rdata));
+    CHECK(read(&card, &ro, 1, blk, 14, rdata, 4));
+    CHECK(count.commands() == 7);
+    CHECK(!memcmp(rdata, wdata, sizeof(wdata)));
+    CHECK(read(&card, &rw, 1, blk, 14, rdata, 1));
+    CHECK(count.commands() == 14);
+
+    /** read only service, read only block, no block, CK */
+    CHECK(!write(&card, &ro, 1, blk, 1, wdata, 1));
+    blk[0].num = 0x82;
+    CHECK(!write(&card, &rw, 1, blk, 1, wdata, 1));
+    blk[0].num = 0x0F;
+    CHECK(!read(&card, &ro, 1, blk, 1, rdata, 4));
+    blk[0].num = 0x87;
+    CHECK(!read(&card, &ro, 1, blk, 1, rdata, 4));
+}
+
+static void standard(void)
+{
+    const u16 svc[2] = { 0x1009, 0x200B }, none = 0x300B;
+    nfc_felica_blk_t blk[12];
+    nfc_felica_t card;
+    u8 wdata[12*16], rdata[12*16];
+    u8 i;
+
+    CHECK(!nfc.FelicaPoll(&card, 0x88B4));
+    CHECK(nfc.FelicaPoll(&card, 0xFF03));
+    CHECK(card.sys == 0x0003 && !memcmp(card.idm, std_idm, 8));
+
+    /** blocks 250..261 of 1009, list elements go from 2 to 3 bytes */
+    for(i=0; i<12; i++){
+        blk[i].svc = 0;
+        blk[i].num = 250 + i;
+    }
+    for(i=0; i<sizeof(wdata); i++){
+        wdata[i] = i*7 + 1;
+    }
+    CHECK(write(&card, svc, 2, blk, 12, wdata, 0));
+    CHECK(count.commands() == 6);
+    CHECK(read(&card, svc, 2, blk, 12, rdata, 0));
+    CHECK(count.commands() == 6);
+    CHECK(!memcmp(rdata, wdata, sizeof(wdata)));
+
+    /** both services in one batch */
+    blk[0].num = 250;
+    blk[1].svc = 1;
+    blk[1].num = 0;
+    blk[2].num = 261;
+    blk[3].svc = 1;
+    blk[3].num = PN532_EMU_FELICA_RO-1;
+    blk[4].num = PN532_EMU_FELICA_RW-1;
+    CHECK(read(&card, svc, 2, blk, 5, rdata, 0));
+    CHECK(count.commands() == 3);
+    CHECK(!memcmp(rdata, wdata, 16));
+    CHECK(!memcmp(rdata+32, wdata+11*16, 16));
+    for(i=0; i<16; i++){
+        CHECK(rdata[16+i] == emu_felica_ro(i));
+        CHECK(rdata[48+i] == emu_felica_ro((PN532_EMU_FELICA_RO-1)*16 + i));
+        CHECK(rdata[64+i] == 0);
+    }
+
+    /** past the end of 1009, unknown service, write to 200B */
+    blk[0].num = PN532_EMU_FELICA_RW;
+    CHECK(!read(&card, svc, 2, blk, 1, rdata, 0));
+    CHECK(!read(&card, &none, 1, blk+2, 1, rdata, 0));
+    CHECK(!write(&card, svc, 2, blk+1, 1, wdata, 0));
+}
+
+int main(void)
+{
+    static PN532_Emu emu;
+
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+    CHECK(nfc.RFPreset(NFC_RF_PRESET_FAST_POLL));
+
+    emu.field(PN532_EMU_FELICA_LITE_S);
+    lite_s();
+    emu.field(PN532_EMU_FELICA);
+    standard();
+
+    CHECK(!emu.errors());
+    printf("FeliCa Lite-S and Standard memory maps read and written\n");
+    return failed;
+}
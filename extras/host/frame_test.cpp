@@ -0,0 +1,116 @@
+/*
+  frame_test.cpp - the constant command frames NFC_FRAME() builds at
+  compile time, against the framing write_segs() does at run time.
+
+  A bus that ACKs every command keeps the first frame written. Each
+  constant command goes out through the API that sends it from PROGMEM,
+  then its bytes through CmdStart(), framed at run time; both frames must
+  match byte for byte: GetFirmwareVersion, the default SAMConfiguration,
+  TgGetData, and the TgInitAsTarget frames of P2PTargetInit() and
+  TgInitAsTarget().
+*/
+
+#include <stdio.h>
+#include "nfc.h"
+#include "host.h"
+
+static NFC_Module nfc;
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+/** ACKs every command, answers nothing else; keeps the first frame */
+class CaptureBus : public HostBus
+{
+  public:
+    CaptureBus() : len(0) {}
+    u8 write(u8 addr, const u8 *buf, u8 n)
+    {
+        if(!len){
+            memcpy(frame, buf, n);
+            len = n;
+        }
+        return 1;
+    }
+    u8 read(u8 addr, u8 *buf, u8 n)
+    {
+        const u8 ack[7] = { PN532_I2C_READY, 0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00 };
+
+        memset(buf, 0, n);
+        memcpy(buf, ack, n < 7 ? n : 7);
+        return n;
+    }
+    void clear(void)
+    {
+        len = 0;
+    }
+
+    u8 frame[BUFFER_LENGTH];
+    u8 len;
+};
+
+static CaptureBus bus;
+
+/** the frame just sent matches cmd framed by CmdStart() */
+static u8 same_frame(const u8 *cmd, u8 clen, const char *name)
+{
+    u8 frame[BUFFER_LENGTH], len = bus.len;
+    u8 ok;
+
+    memcpy(frame, bus.frame, len);
+    bus.clear();
+    CHECK(nfc.CmdStart(cmd, clen));
+    nfc.CmdAbort();
+    ok = len == clen+8 && len == bus.len && !memcmp(frame, bus.frame, len);
+    if(!ok){
+        fprintf(stderr, "%s: %u bytes from PROGMEM, %u framed\n", name, len,
+                bus.len);
+    }
+    bus.clear();
+    return ok;
+}
+
+int main(void)
+{
+    const u8 get_version[1] = { PN532_COMMAND_GETFIRMWAREVERSION };
+    const u8 sam[4] = {
+        PN532_COMMAND_SAMCONFIGURATION, PN532_SAM_NORMAL_MODE, 20, 0
+    };
+    const u8 tg_get_data[1] = { PN532_COMMAND_TGGETDATA };
+    const u8 tg_init_dep[38] = {
+        PN532_COMMAND_TGINITASTARGET, 0x00, TG_INIT_DEFAULT(0x40), 0, 0
+    };
+    const u8 tg_init_picc[38] = {
+        PN532_COMMAND_TGINITASTARGET, PN532_TG_PICC_ONLY,
+        TG_INIT_DEFAULT(0x20), 0, 0
+    };
+    u8 buf[16], len;
+
+    host_set_bus(&bus);
+    nfc.begin();
+
+    bus.clear();
+    nfc.get_version();
+    CHECK(same_frame(get_version, sizeof(get_version), "GetFirmwareVersion"));
+
+    nfc.SAMConfiguration();
+    CHECK(same_frame(sam, sizeof(sam), "SAMConfiguration"));
+
+    nfc.P2PTargetTxRx(buf, 0, buf, &len);
+    CHECK(same_frame(tg_get_data, sizeof(tg_get_data), "TgGetData"));
+
+    nfc.P2PTargetInit();
+    CHECK(same_frame(tg_init_dep, sizeof(tg_init_dep), "P2PTargetInit"));
+
+    CHECK(nfc.TgInitAsTarget());
+    CHECK(same_frame(tg_init_picc, sizeof(tg_init_picc), "TgInitAsTarget"));
+
+    printf("5 compile-time frames match the run-time framing\n");
+    return failed;
+}
@@ -0,0 +1,140 @@
+/*
+  gpio_test.cpp - GPIOPin(), GPIOFlush() and WriteGPIO() against the GPIO
+  ports of the PN532 emulator, frames taken from a bus trace.
+
+  The ports are read once, on the first change. Changes to P3 and P7 are
+  merged into one WriteGPIO, 0E 80|P3 80|P7, sent ahead of the next
+  command; a pin set back to its level cancels it, and a write of the
+  level on the chip sends nothing. Unknown pins are refused. An update
+  that fails, here with the bus detached, stays queued and goes out in
+  full with the next command.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+#include "trace_log.h"
+
+static NFC_Module nfc;
+static u8 mem[1024];
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+static NFC_Trace trace(mem, sizeof(mem));
+
+/** command code of frame i of the trace, 0 - none */
+static u8 frame_cmd(u8 i, const u8 **data)
+{
+    trace_rec_t r;
+    u32 pos = 0;
+
+    while(trace_next(trace.data(), trace.length(), &pos, &r)){
+        /** 00 00 FF LEN LCS D4 CMD ... DCS 00 */
+        if(r.tx && r.n > 8 && r.data[5] == 0xD4 && !i--){
+            if(data){
+                *data = r.data;
+            }
+            return r.data[6];
+        }
+    }
+    return 0;
+}
+
+/** frame i is WriteGPIO of p3, p7, checksums included */
+static u8 write_gpio_is(u8 i, u8 p3, u8 p7)
+{
+    const u8 frame[11] = {
+        0x00, 0x00, 0xFF, 0x04, 0xFC, 0xD4, PN532_COMMAND_WRITEGPIO,
+        (u8)(0x80|p3), (u8)(0x80|p7),
+        (u8)(0x100 - ((0xD4 + PN532_COMMAND_WRITEGPIO + 0x100 + p3 + p7) & 0xFF)),
+        0x00
+    };
+    const u8 *f;
+
+    return frame_cmd(i, &f) == PN532_COMMAND_WRITEGPIO &&
+           !memcmp(f, frame, sizeof(frame));
+}
+
+static void start(void)
+{
+    trace.clear();
+    nfc.Trace(&trace);
+}
+
+static u16 stop(void)
+{
+    nfc.Trace(NULL);
+    CHECK(!trace.overflow());
+    return trace.commands();
+}
+
+int main(void)
+{
+    static PN532_Emu emu;
+    u8 p3, p7;
+
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+
+    /** read once, then queued */
+    start();
+    CHECK(nfc.GPIOPin(PN532_GPIO_P30, 0));
+    CHECK(nfc.GPIOPin(PN532_GPIO_P32, 0));
+    CHECK(nfc.GPIOPin(PN532_GPIO_P71, 0));
+    CHECK(stop() == 1);
+    CHECK(frame_cmd(0, NULL) == PN532_COMMAND_READGPIO);
+
+    /** merged into one frame ahead of the next command */
+    start();
+    CHECK(nfc.get_version());
+    CHECK(stop() == 2);
+    CHECK(write_gpio_is(0, 0x3A, 0x04));
+    CHECK(frame_cmd(1, NULL) == PN532_COMMAND_GETFIRMWAREVERSION);
+    CHECK(nfc.ReadGPIO(&p3, &p7));
+    CHECK(p3 == 0x3A && p7 == 0x04);
+
+    /** no-op and cancelled updates */
+    start();
+    CHECK(nfc.WriteGPIO(PN532_GPIO_P30, 0));
+    CHECK(nfc.GPIOPin(PN532_GPIO_P35, 0));
+    CHECK(nfc.GPIOPin(PN532_GPIO_P35, 1));
+    CHECK(nfc.GPIOFlush());
+    CHECK(nfc.get_version());
+    CHECK(stop() == 1);
+
+    /** at once */
+    start();
+    CHECK(nfc.WriteGPIO(PN532_GPIO_P72, 0));
+    CHECK(stop() == 1);
+    CHECK(write_gpio_is(0, 0x3A, 0x00));
+
+    start();
+    CHECK(!nfc.GPIOPin(6, 1));
+    CHECK(!nfc.GPIOPin(8, 1));
+    CHECK(!nfc.WriteGPIO(11, 1));
+    CHECK(stop() == 0);
+
+    /** failed: still queued, then sent in full */
+    CHECK(nfc.GPIOPin(PN532_GPIO_P31, 0));
+    host_set_bus(NULL);
+    CHECK(!nfc.GPIOFlush());
+    CHECK(!nfc.GPIOFlush());
+    host_set_bus(&emu);
+    start();
+    CHECK(nfc.get_version());
+    CHECK(stop() == 2);
+    CHECK(write_gpio_is(0, 0x38, 0x00));
+    CHECK(nfc.ReadGPIO(&p3, &p7));
+    CHECK(p3 == 0x38 && p7 == 0x00);
+
+    CHECK(!emu.errors());
+    printf("GPIO changes merged into one WriteGPIO, no-op writes skipped\n");
+    return failed;
+}
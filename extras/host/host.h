@@ -0,0 +1,68 @@
+/*
+  host.h - host runtime of the NFC library, see extras/host.
+
+  Wire talks to a HostBus instead of the TWI hardware, and time is a
+  virtual clock: delay() and every byte on the bus advance it, nothing
+  sleeps. Runs are deterministic and take no wall time.
+*/
+
+#ifndef host_h
+#define host_h
+
+#include <stdint.h>
+
+/** time of one I2C byte at 100 kHz, 8 data bits and ACK */
+#define HOST_I2C_BYTE_US    90
+
+/**
+    I2C device on the host bus. Wire calls it once per transfer, after the
+    clock has advanced by the transfer time.
+*/
+class HostBus
+{
+  public:
+    virtual ~HostBus() {}
+    /** one write transfer, returns 0 - NACK, 1 - ACK */
+    virtual uint8_t write(uint8_t addr, const uint8_t *buf, uint8_t len) = 0;
+    /** one read transfer of len bytes, returns bytes read, 0 - NACK */
+    virtual uint8_t read(uint8_t addr, uint8_t *buf, uint8_t len) = 0;
+};
+
+/** attach the device Wire talks to, NULL - every transfer NACKs */
+void host_set_bus(HostBus *bus);
+HostBus *host_bus(void);
+
+/** virtual clock, microseconds since start */
+uint64_t host_time_us(void);
+void host_advance_us(uint32_t us);
+
+/**
+    A board with its own PN532 for host_run_boards(), e.g. one side of a
+    P2P loopback. run() is its sketch, the board is done when it returns.
+*/
+class HostBoard
+{
+  public:
+    HostBoard(HostBus *bus) : bus(bus) {}
+    virtual ~HostBoard() {}
+    virtual void run(void) = 0;
+
+    HostBus *bus;           // Wire of this board talks to it
+};
+
+/**
+    Run boards side by side on the virtual clock until every run() has
+    returned or max_us has passed; returns 1 when all are done. Each board
+    runs on its own stack and keeps its own nfc_buf. A board gives way in
+    delay(), the board whose delay ends first goes on. The library has no
+    Wire transfer open there. Bus transfers of the boards do not overlap,
+    so a throughput measured here is a lower bound of two real buses.
+*/
+uint8_t host_run_boards(HostBoard **boards, uint8_t n, uint64_t max_us);
+/** delay() of a board, returns 0 when no boards run */
+uint8_t host_board_wait(uint64_t us);
+
+/** feed bytes to Serial.read() */
+void host_serial_input(const char *str);
+
+#endif
@@ -0,0 +1,115 @@
+/*
+  host_arduino.cpp - Arduino core functions for the host build, on top of
+  the virtual clock of host.h. Serial prints to stdout, EEPROM is an array.
+*/
+
+#include <stdio.h>
+#include <avr/eeprom.h>
+#include "Arduino.h"
+#include "host.h"
+
+HardwareSerial Serial;
+
+static uint64_t now_us;
+static const char *serial_in = "";
+static uint8_t eeprom[1024];
+
+uint64_t host_time_us(void)
+{
+    return now_us;
+}
+
+void host_advance_us(uint32_t us)
+{
+    now_us += us;
+}
+
+void host_serial_input(const char *str)
+{
+    serial_in = str ? str : "";
+}
+
+unsigned long millis(void)
+{
+    return (unsigned long)(now_us / 1000);
+}
+
+unsigned long micros(void)
+{
+    return (unsigned long)now_us;
+}
+
+void delay(unsigned long ms)
+{
+    if(!host_board_wait((uint64_t)ms * 1000)){
+        now_us += (uint64_t)ms * 1000;
+    }
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    now_us += us;
+}
+
+void pinMode(uint8_t, uint8_t)
+{
+}
+
+void digitalWrite(uint8_t, uint8_t)
+{
+}
+
+int digitalRead(uint8_t)
+{
+    return LOW;
+}
+
+void HardwareSerial::begin(unsigned long)
+{
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    return putchar(c) == EOF ? 0 : 1;
+}
+
+int HardwareSerial::available(void)
+{
+    return (int)strlen(serial_in);
+}
+
+int HardwareSerial::read(void)
+{
+    if(!*serial_in){
+        return -1;
+    }
+    return (uint8_t)*serial_in++;
+}
+
+int HardwareSerial::peek(void)
+{
+    return *serial_in ? (uint8_t)*serial_in : -1;
+}
+
+void HardwareSerial::flush(void)
+{
+    fflush(stdout);
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    size_t off = (size_t)src;
+
+    for(size_t i=0; i<n; i++){
+        ((uint8_t *)dst)[i] = eeprom[(off+i) % sizeof(eeprom)];
+    }
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+    size_t off = (size_t)dst;
+
+    for(size_t i=0; i<n; i++){
+        eeprom[(off+i) % sizeof(eeprom)] = ((const uint8_t *)src)[i];
+    }
+}
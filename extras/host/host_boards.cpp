@@ -0,0 +1,103 @@
+/*
+  host_boards.cpp - boards side by side on the virtual clock, see host.h.
+  Each board is a coroutine; the scheduler resumes the one whose delay()
+  ends first and swaps nfc_buf, the only global of the library, with it.
+*/
+
+#include <stdlib.h>
+#include <ucontext.h>
+#include "nfc.h"
+#include "host.h"
+
+#define HOST_BOARDS_MAX     4
+#define HOST_BOARD_STACK    (256*1024)
+
+typedef struct{
+    HostBoard *board;
+    ucontext_t ctx;
+    char *stack;
+    uint64_t wake;          // time its delay() ends
+    uint8_t done;
+    u8 buf[NFC_CMD_BUF_LEN];
+}board_t;
+
+static board_t board[HOST_BOARDS_MAX];
+static uint8_t nboards, cur, running;
+static ucontext_t sched;
+
+static void board_main(void)
+{
+    board[cur].board->run();
+    board[cur].done = 1;
+    /** uc_link returns to the scheduler */
+}
+
+uint8_t host_run_boards(HostBoard **boards, uint8_t n, uint64_t max_us)
+{
+    uint64_t start = host_time_us();
+    uint8_t i, next, all = 1;
+
+    if(running || n > HOST_BOARDS_MAX){
+        return 0;
+    }
+    nboards = n;
+    for(i=0; i<n; i++){
+        board[i].board = boards[i];
+        board[i].stack = (char *)malloc(HOST_BOARD_STACK);
+        board[i].wake = start;
+        board[i].done = 0;
+        memset(board[i].buf, 0, sizeof(board[i].buf));
+        getcontext(&board[i].ctx);
+        board[i].ctx.uc_stack.ss_sp = board[i].stack;
+        board[i].ctx.uc_stack.ss_size = HOST_BOARD_STACK;
+        board[i].ctx.uc_link = &sched;
+        makecontext(&board[i].ctx, board_main, 0);
+    }
+
+    running = 1;
+    cur = n-1;
+    while(host_time_us() - start < max_us){
+        /** earliest wake-up, ties go round */
+        next = 0xFF;
+        for(i=1; i<=n; i++){
+            uint8_t j = (cur+i) % n;
+
+            if(!board[j].done &&
+               (next == 0xFF || board[j].wake < board[next].wake)){
+                next = j;
+            }
+        }
+        if(next == 0xFF){
+            break;
+        }
+        if(board[next].wake > host_time_us()){
+            host_advance_us(board[next].wake - host_time_us());
+        }
+        cur = next;
+        host_set_bus(board[cur].board->bus);
+        memcpy(nfc_buf, board[cur].buf, NFC_CMD_BUF_LEN);
+        swapcontext(&sched, &board[cur].ctx);
+        memcpy(board[cur].buf, nfc_buf, NFC_CMD_BUF_LEN);
+    }
+    running = 0;
+
+    /** a board still waiting is left on its stack */
+    for(i=0; i<n; i++){
+        if(!board[i].done){
+            all = 0;
+        }else{
+            free(board[i].stack);
+        }
+    }
+    return all;
+}
+
+uint8_t host_board_wait(uint64_t us)
+{
+    if(!running){
+        return 0;
+    }
+    board[cur].wake = host_time_us() + us;
+    swapcontext(&board[cur].ctx, &sched);
+    return 1;
+}
@@ -0,0 +1,163 @@
+/*
+  host_wire.cpp - TwoWire of Wire.h for the host build. Transfers go to the
+  HostBus of host_set_bus() and advance the virtual clock by their time on
+  the bus. Buffers are BUFFER_LENGTH bytes, as on the board.
+*/
+
+#include "Arduino.h"
+#include "Wire.h"
+#include "host.h"
+
+uint8_t TwoWire::rxBuffer[BUFFER_LENGTH];
+uint8_t TwoWire::rxBufferIndex = 0;
+uint8_t TwoWire::rxBufferLength = 0;
+
+uint8_t TwoWire::txAddress = 0;
+uint8_t TwoWire::txBuffer[BUFFER_LENGTH];
+uint8_t TwoWire::txBufferIndex = 0;
+uint8_t TwoWire::txBufferLength = 0;
+
+uint8_t TwoWire::transmitting = 0;
+void (*TwoWire::user_onRequest)(void);
+void (*TwoWire::user_onReceive)(int);
+
+static HostBus *bus;
+
+void host_set_bus(HostBus *b)
+{
+    bus = b;
+}
+
+HostBus *host_bus(void)
+{
+    return bus;
+}
+
+TwoWire::TwoWire()
+{
+}
+
+void TwoWire::begin(void)
+{
+    rxBufferIndex = 0;
+    rxBufferLength = 0;
+    txBufferIndex = 0;
+    txBufferLength = 0;
+}
+
+void TwoWire::begin(uint8_t)
+{
+    begin();
+}
+
+void TwoWire::begin(int address)
+{
+    begin((uint8_t)address);
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity)
+{
+    uint8_t n = 0;
+
+    if(quantity > BUFFER_LENGTH){
+        quantity = BUFFER_LENGTH;
+    }
+    /** the device answers at the start of the transfer */
+    if(bus){
+        n = bus->read(address, rxBuffer, quantity);
+    }
+    /** address byte, then the data bytes unless NACKed */
+    host_advance_us(HOST_I2C_BYTE_US * (1 + n));
+    rxBufferIndex = 0;
+    rxBufferLength = n;
+    return n;
+}
+
+uint8_t TwoWire::requestFrom(int address, int quantity)
+{
+    return requestFrom((uint8_t)address, (uint8_t)quantity);
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+    transmitting = 1;
+    txAddress = address;
+    txBufferIndex = 0;
+    txBufferLength = 0;
+}
+
+void TwoWire::beginTransmission(int address)
+{
+    beginTransmission((uint8_t)address);
+}
+
+uint8_t TwoWire::endTransmission(void)
+{
+    uint8_t ack;
+
+    /** the device sees the data after the transfer */
+    host_advance_us(HOST_I2C_BYTE_US * (1 + txBufferLength));
+    ack = bus ? bus->write(txAddress, txBuffer, txBufferLength) : 0;
+    txBufferIndex = 0;
+    txBufferLength = 0;
+    transmitting = 0;
+    /** 2 - address NACKed, see twi_writeTo() */
+    return ack ? 0 : 2;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+    if(!transmitting || txBufferLength >= BUFFER_LENGTH){
+        return 0;
+    }
+    txBuffer[txBufferIndex++] = data;
+    txBufferLength = txBufferIndex;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t quantity)
+{
+    size_t n = 0;
+
+    while(n < quantity && write(data[n])){
+        n++;
+    }
+    return n;
+}
+
+int TwoWire::available(void)
+{
+    return rxBufferLength - rxBufferIndex;
+}
+
+int TwoWire::read(void)
+{
+    if(rxBufferIndex >= rxBufferLength){
+        return -1;
+    }
+    return rxBuffer[rxBufferIndex++];
+}
+
+int TwoWire::peek(void)
+{
+    if(rxBufferIndex >= rxBufferLength){
+        return -1;
+    }
+    return rxBuffer[rxBufferIndex];
+}
+
+void TwoWire::flush(void)
+{
+}
+
+void TwoWire::onReceive(void (*function)(int))
+{
+    user_onReceive = function;
+}
+
+void TwoWire::onRequest(void (*function)(void))
+{
+    user_onRequest = function;
+}
+
+TwoWire Wire = TwoWire();
@@ -0,0 +1,104 @@
+/*
+  lp_duty_test.cpp - the duty cycle of LowPowerPoll() on the virtual clock,
+  against the PN532 emulator with the LOW_POWER preset and an empty field.
+
+  One poll cycle, wake-up, InListPassiveTarget and PowerDown, is timed
+  alone first. Over RUN_MS the poll count must follow the period, PN532
+  must be in power down between polls, and LowPowerStats() must report the
+  awake time the cycle time predicts: cycle minus the wake-up delay, which
+  is spent before PN532 answers, per poll. Then a card must be found at
+  the next poll, or at once when the caller reports a wake-up IRQ.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+
+#define PERIOD_MS       250
+#define RUN_MS          10000
+#define LOOP_MS         1
+
+static NFC_Module nfc;
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+int main(void)
+{
+    static PN532_Emu emu;
+    nfc_lp_stats_t *st;
+    u8 buf[NFC_UID_MAX_LEN+1], found = 0;
+    u32 cycle, awake, polls, model, start, latency;
+    uint64_t t;
+
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+    CHECK(nfc.RFPreset(NFC_RF_PRESET_LOW_POWER));
+    emu.field(PN532_EMU_NONE);
+
+    /** PN532 is awake, the first call polls and powers down */
+    CHECK(!nfc.LowPowerPoll(buf, PERIOD_MS));
+    CHECK(emu.sleeping());
+
+    /** one cycle from power down, in microseconds */
+    host_advance_us(PERIOD_MS*1000UL);
+    t = host_time_us();
+    CHECK(!nfc.LowPowerPoll(buf, PERIOD_MS));
+    cycle = host_time_us() - t;
+    CHECK(emu.sleeping());
+    CHECK(nfc.LowPowerStats()->polls == 2);
+    CHECK(nfc.LowPowerStats()->wake_latency <= cycle/1000);
+
+    /** run, PN532 sleeps between polls */
+    start = millis();
+    awake = nfc.LowPowerStats()->awake;
+    polls = nfc.LowPowerStats()->polls;
+    while(millis() - start < RUN_MS){
+        CHECK(!nfc.LowPowerPoll(buf, PERIOD_MS));
+        CHECK(emu.sleeping());
+        host_advance_us(LOOP_MS*1000UL);
+    }
+    st = nfc.LowPowerStats();
+    polls = st->polls - polls;
+    awake = st->awake - awake;
+    CHECK(polls*(PERIOD_MS + cycle/1000) >= RUN_MS - PERIOD_MS);
+    CHECK(polls*PERIOD_MS <= RUN_MS + PERIOD_MS);
+    /** awake is taken in whole ms, allow 1 ms per poll */
+    model = polls*(cycle - NFC_WAKEUP_TIME*1000)/1000;
+    CHECK(awake + polls >= model && awake <= model + polls);
+    CHECK(st->total >= RUN_MS && st->awake < st->total);
+
+    /** a card comes, found at the next poll */
+    emu.field(PN532_EMU_MIFARE_1K);
+    start = millis();
+    while(millis() - start < 2*PERIOD_MS &&
+          !(found = nfc.LowPowerPoll(buf, PERIOD_MS))){
+        host_advance_us(LOOP_MS*1000UL);
+    }
+    latency = millis() - start;
+    CHECK(found && buf[0] == 4);
+    CHECK(latency <= PERIOD_MS + cycle/1000 + LOOP_MS);
+    /** the card keeps PN532 awake */
+    CHECK(!emu.sleeping());
+
+    /** gone, PN532 sleeps; a wake-up IRQ polls before the period */
+    emu.field(PN532_EMU_NONE);
+    CHECK(!nfc.LowPowerPoll(buf, PERIOD_MS));
+    CHECK(emu.sleeping());
+    emu.field(PN532_EMU_MIFARE_1K);
+    CHECK(!nfc.LowPowerPoll(buf, PERIOD_MS));
+    CHECK(nfc.LowPowerPoll(buf, PERIOD_MS, 1));
+
+    CHECK(!emu.errors());
+    printf("poll cycle %lu us, %lu polls in %u ms, awake %lu ms, "
+           "duty cycle %.2f%%\n", (unsigned long)cycle, (unsigned long)polls,
+           RUN_MS, (unsigned long)awake, 100.0*awake/RUN_MS);
+    return failed;
+}
@@ -0,0 +1,69 @@
+#!/bin/sh
+#
+# Build the NFC library in every NFC_USE_* configuration of nfc_config.h
+# and print the size of each one. Fails on any warning, and on NFC symbols
+# a configuration uses but does not build. The examples are checked in the
+# default configuration.
+#
+#   extras/host/matrix.sh > extras/host/sizes.txt
+#
+# By default it builds for the host with the stub headers in stub/; for
+# target numbers point it at the AVR toolchain:
+#
+#   CXX=avr-g++ SIZE=avr-size CXXFLAGS="-mmcu=atmega328p -Os" \
+#   INCLUDES="-I/path/to/arduino/cores/arduino -I/path/to/variants/standard" \
+#   extras/host/matrix.sh
+#
+
+HOST=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(cd "$HOST/../.." && pwd)
+CXX=${CXX:-g++}
+SIZE=${SIZE:-size}
+CXXFLAGS=${CXXFLAGS:--Os}
+INCLUDES=${INCLUDES:--I$HOST/stub}
+FLAGS="-std=gnu++11 -DARDUINO=105 -Wall -Wextra -Werror $CXXFLAGS $INCLUDES -I$ROOT"
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+OFF="-DNFC_USE_ISO14443=0 -DNFC_USE_FELICA=0 -DNFC_USE_P2P=0"
+OFF="$OFF -DNFC_USE_EMULATION=0 -DNFC_USE_DIAG=0"
+
+echo "| configuration | text | data | bss |"
+echo "|---|---:|---:|---:|"
+
+status=0
+for cfg in "" \
+    "-DNFC_USE_ISO14443=0" \
+    "-DNFC_USE_FELICA=0" \
+    "-DNFC_USE_P2P=0" \
+    "-DNFC_USE_EMULATION=0" \
+    "-DNFC_USE_DIAG=0" \
+    "$OFF" \
+    "-DNFC_USE_FELICA=0 -DNFC_USE_P2P=0 -DNFC_USE_EMULATION=0 -DNFC_USE_DIAG=0" \
+    "-DNFC_USE_ISO14443=0 -DNFC_USE_FELICA=0 -DNFC_USE_P2P=0 -DNFC_USE_DIAG=0" \
+    "-DNFC_CMD_BUF_LEN=132 -DBUFFER_LENGTH=132" \
+    "-DPN532DEBUG -DPN532_P2P_DEBUG"; do
+    rm -f "$OUT"/*.o
+    for src in "$ROOT"/nfc*.cpp; do
+        obj="$OUT/$(basename "$src" .cpp).o"
+        $CXX $FLAGS $cfg -c "$src" -o "$obj" || { status=1; continue; }
+    done
+    # NFC symbols used but built by no object of this configuration
+    nm -C --undefined-only "$OUT"/*.o | sed -n 's/^ *U //p' | sort -u |
+        grep -E "^(NFC_|nfc_|hextab|frame_)" > "$OUT/undef"
+    nm -C --defined-only "$OUT"/*.o | sed 's/^[0-9a-f]* [A-Za-z] //' |
+        sort -u > "$OUT/def"
+    missing=$(comm -23 "$OUT/undef" "$OUT/def")
+    if [ -n "$missing" ]; then
+        echo "missing in [${cfg:-default}]: $missing" >&2
+        status=1
+    fi
+    set -- $($SIZE -t "$OUT"/*.o | tail -1)
+    echo "| ${cfg:-default} | $1 | $2 | $3 |"
+done
+
+for ino in "$ROOT"/examples/*/*.ino; do
+    $CXX $FLAGS -fsyntax-only -x c++ -include Arduino.h "$ino" || status=1
+done
+
+exit $status
@@ -0,0 +1,197 @@
+/*
+  ndef_detect_test.cpp - Type4Tag() against an emulated reader on a second
+  board, see host_run_boards(), running the NDEF detection procedure of the
+  NFC Forum Type 4 Tag specification with ApduTransceive():
+
+    SELECT the NDEF application by name, SELECT the capability container,
+    READ BINARY it and check mapping version, MLe, MLc and the NDEF File
+    Control TLV, SELECT the NDEF file it names, READ BINARY NLEN, then the
+    message in MLe sized reads.
+
+  The bytes read must be the file served from PROGMEM, for a short URI
+  message and a vCard message several reads long, one reader session each.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+
+#define LOOP_MS         1
+#define RUN_MAX_US      30000000ULL
+#define VCARD_LEN       160
+
+static NFC_Module nfc_r, nfc_c;
+static PN532_Emu emu_r, emu_c;
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+/** NLEN, URI record "http://www.elechouse.com" */
+static const u8 uri_file[] PROGMEM = {
+    0x00, 0x12,
+    0xD1, 0x01, 0x0E, 'U', NDEF_URIPREFIX_HTTP_WWWDOT,
+    'e', 'l', 'e', 'c', 'h', 'o', 'u', 's', 'e', '.', 'c', 'o', 'm'
+};
+
+/** NLEN, MIME record text/vcard, the payload filled by main() */
+static u8 vcard_file[2+3+10+VCARD_LEN];
+
+static const u8 *files[2] = { uri_file, vcard_file };
+static const u16 sizes[2] = { sizeof(uri_file), sizeof(vcard_file) };
+
+/** one C-APDU, 0 - no R-APDU or SW not 9000 */
+static u8 apdu(const u8 *capdu, u8 clen, u8 *rapdu, u16 *rlen)
+{
+    *rlen = NFC_APDU_MAX_LE+2;
+    if(!nfc_r.ApduTransceive(1, capdu, clen, rapdu, rlen) || *rlen < 2 ||
+       rapdu[*rlen-2] != 0x90 || rapdu[*rlen-1] != 0x00){
+        return 0;
+    }
+    *rlen -= 2;
+    return 1;
+}
+
+/** the detection procedure, returns the NDEF file length read, 0 - failed */
+static u16 detect(u8 *out, u16 max)
+{
+    const u8 sel_app[13] = {
+        0x00, 0xA4, 0x04, 0x00, 0x07,
+        0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01, 0x00
+    };
+    u8 sel_file[7] = { 0x00, 0xA4, 0x00, 0x0C, 0x02, 0xE1, 0x03 };
+    u8 read[5] = { 0x00, 0xB0, 0x00, 0x00, 0x0F };
+    u8 r[NFC_APDU_MAX_LE+2], mle;
+    u16 rlen, size, off;
+
+    if(!apdu(sel_app, sizeof(sel_app), r, &rlen) ||
+       !apdu(sel_file, sizeof(sel_file), r, &rlen) ||
+       !apdu(read, sizeof(read), r, &rlen)){
+        return 0;
+    }
+    /** CCLEN, version 2.x, MLe, MLc, NDEF File Control TLV, read access */
+    CHECK(rlen == 15 && r[1] >= 15);
+    CHECK((r[2] >> 4) == 2);
+    mle = (r[3] || r[4] > NFC_APDU_MAX_LE) ? NFC_APDU_MAX_LE : r[4];
+    CHECK(mle >= 0x0F && (r[5] || r[6]));
+    CHECK(r[7] == 0x04 && r[8] == 0x06);
+    CHECK(r[13] == 0x00);
+    size = (r[11] << 8) | r[12];
+    if(rlen != 15 || r[7] != 0x04 || size > max || size < 2){
+        return 0;
+    }
+
+    sel_file[5] = r[9];
+    sel_file[6] = r[10];
+    read[4] = 2;
+    if(!apdu(sel_file, sizeof(sel_file), r, &rlen) ||
+       !apdu(read, sizeof(read), out, &rlen) || rlen != 2){
+        return 0;
+    }
+    /** NLEN, then the message */
+    size = ((out[0] << 8) | out[1]) + 2;
+    for(off=2; off<size; off+=rlen){
+        read[2] = off >> 8;
+        read[3] = off;
+        read[4] = (size-off > mle) ? mle : size-off;
+        if(!apdu(read, sizeof(read), out+off, &rlen) || rlen != read[4]){
+            return 0;
+        }
+    }
+    return size;
+}
+
+class Reader : public HostBoard
+{
+  public:
+    Reader(HostBus *bus) : HostBoard(bus), good(0) {}
+    void run(void)
+    {
+        u8 uid[NFC_UID_MAX_LEN+1], ndef[sizeof(vcard_file)];
+        u32 start;
+        u16 len;
+
+        for(u8 s=0; s<2; s++){
+            emu_r.link(&emu_c);
+            start = millis();
+            while(!nfc_r.InListPassiveTarget(uid)){
+                if(millis() - start > 1000){
+                    return;
+                }
+            }
+            memset(ndef, 0, sizeof(ndef));
+            len = detect(ndef, sizeof(ndef));
+            CHECK(len == sizes[s]);
+            if(len == sizes[s] && !memcmp(ndef, files[s], len)){
+                good++;
+            }
+            emu_r.field(PN532_EMU_NONE);
+            delay(50);
+        }
+    }
+
+    u8 good;
+};
+
+class Card : public HostBoard
+{
+  public:
+    Card(HostBus *bus) : HostBoard(bus), served(0) {}
+    void run(void)
+    {
+        u32 start = millis();
+
+        nfc_c.Type4Tag(&tag, files[0], sizes[0]);
+        while(served < 2 && millis() - start < RUN_MAX_US/1000){
+            if(nfc_c.TargetPolling() == NFC_SRV_RELEASED && ++served < 2){
+                /** the next reader gets the next file */
+                nfc_c.Type4Tag(&tag, files[served], sizes[served]);
+            }
+            delay(LOOP_MS);
+        }
+    }
+
+    nfc_t4t_t tag;
+    u8 served;
+};
+
+static void setup(NFC_Module &nfc, PN532_Emu &emu)
+{
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+}
+
+int main(void)
+{
+    Reader rd(&emu_r);
+    Card cd(&emu_c);
+    HostBoard *boards[2] = { &rd, &cd };
+    const u8 hdr[15] = {
+        0x00, sizeof(vcard_file)-2,
+        0xD2, 0x0A, VCARD_LEN, 't', 'e', 'x', 't', '/', 'v', 'c', 'a', 'r', 'd'
+    };
+    u16 i;
+
+    memcpy(vcard_file, hdr, sizeof(hdr));
+    for(i=sizeof(hdr); i<sizeof(vcard_file); i++){
+        vcard_file[i] = 'A' + i%26;
+    }
+    setup(nfc_r, emu_r);
+    CHECK(nfc_r.RFPreset(NFC_RF_PRESET_FAST_POLL));
+    setup(nfc_c, emu_c);
+
+    CHECK(host_run_boards(boards, 2, RUN_MAX_US));
+    CHECK(rd.good == 2);
+    CHECK(cd.served == 2);
+    printf("NDEF files of %u and %u bytes detected and read\n",
+           sizes[0], sizes[1]);
+
+    CHECK(!emu_r.errors() && !emu_c.errors());
+    return failed;
+}
@@ -0,0 +1,261 @@
+/*
+  p2p_loop_test.cpp - P2P between two boards, each with its own emulated
+  PN532, the target PN532 in the field of the initiator's. The initiator
+  streams STREAM_LEN bytes with P2PInitiatorStream(), the target takes
+  them with P2PTargetStream() and streams the same bytes back, both chained
+  with MI. Every byte is checked and the effective throughput, bytes both
+  ways over the time of the stream, is printed per session configuration:
+  passive 106 kbps, active 424 kbps, and 106 kbps switched to 424 by PSL.
+  424 kbps must be faster than 106.
+
+  Session configuration: NFCID3 and general bytes of each side must reach
+  the other in ATR_REQ/ATR_RES, and the TgInitAsTarget Mode must carry the
+  bit rate and framing.
+
+  InJumpForDEP retries: the first attempt is not ACKed, then the target
+  arms late, so P2PInitiatorInit() must send again after the failure and
+  then wait for the pending reply instead of sending once more.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+
+#define STREAM_LEN      4096
+#define RUN_MAX_US      60000000ULL
+#define TARGET_LATE_MS  200
+
+static NFC_Module nfc_i, nfc_t;
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+/** NACKs every transfer while closed */
+class GateBus : public HostBus
+{
+  public:
+    GateBus(HostBus *bus) : bus(bus), open(1) {}
+    u8 write(u8 addr, const u8 *buf, u8 len)
+    {
+        return open ? bus->write(addr, buf, len) : 0;
+    }
+    u8 read(u8 addr, u8 *buf, u8 len)
+    {
+        return open ? bus->read(addr, buf, len) : 0;
+    }
+
+    HostBus *bus;
+    u8 open;
+};
+
+/** one direction of the stream */
+typedef struct{
+    u16 tx, rx;
+    u8 bad;
+}stream_t;
+
+static u8 pattern(u16 i)
+{
+    return (u8)(i*7 + (i>>8));
+}
+
+static u8 source(u8 *buf, u8 max, u8 *more, void *ctx)
+{
+    stream_t *s = (stream_t *)ctx;
+    u8 n = (STREAM_LEN - s->tx < max) ? STREAM_LEN - s->tx : max;
+
+    for(u8 i=0; i<n; i++){
+        buf[i] = pattern(s->tx + i);
+    }
+    s->tx += n;
+    *more = s->tx < STREAM_LEN;
+    return n;
+}
+
+static u8 sink(const u8 *buf, u8 len, void *ctx)
+{
+    stream_t *s = (stream_t *)ctx;
+
+    for(u8 i=0; i<len; i++){
+        if(s->rx >= STREAM_LEN || buf[i] != pattern(s->rx)){
+            s->bad = 1;
+            return 0;
+        }
+        s->rx++;
+    }
+    return 1;
+}
+
+static const u8 gi[] = { 0x46, 0x66, 0x6D, 0x01, 0x01, 0x11 };
+static const u8 gt[] = { 0x46, 0x66, 0x6D, 0x01, 0x01, 0x10, 0x07, 0x01, 0x03 };
+static const u8 id3i[10] = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88,
+                             0x99, 0x10 };
+static const u8 id3t[10] = { 0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+                             0xA8, 0xA9 };
+static const u8 id1[3] = { 0x0A, 0x0B, 0x0C };
+
+class Initiator : public HostBoard
+{
+  public:
+    Initiator(HostBus *bus, const nfc_p2p_cfg_t *cfg) :
+        HostBoard(bus), cfg(cfg), ok(0), tries(0), us(0)
+    {
+        memset(&s, 0, sizeof(s));
+    }
+    void run(void)
+    {
+        GateBus *gate = (GateBus *)bus;
+        NFC_Trace count(NULL, 0);
+        u32 start = millis(), t;
+
+        nfc_i.P2PConfig(cfg);
+        /** not ACKed, nothing is pending */
+        gate->open = 0;
+        CHECK(!nfc_i.P2PInitiatorInit());
+        gate->open = 1;
+        nfc_i.Trace(&count);
+        while(!nfc_i.P2PInitiatorInit()){
+            tries++;
+            if(millis() - start > 1000){
+                nfc_i.Trace(NULL);
+                return;
+            }
+        }
+        nfc_i.Trace(NULL);
+        /** InJumpForDEP/PSL once, then InPSL */
+        CHECK(count.commands() ==
+              ((cfg->psl_baud == NFC_P2P_NO_PSL) ? 1 : 2));
+        if(cfg->psl_baud == NFC_P2P_NO_PSL){
+            /** Tg, NFCID3t DIDt BSt BRt TO PPt Gt */
+            CHECK(nfc_buf[8] == 1);
+            CHECK(!memcmp(nfc_buf+9, id3t, 10));
+            CHECK(nfc_buf[3] == 3+16+sizeof(gt));
+            CHECK(!memcmp(nfc_buf+24, gt, sizeof(gt)));
+        }
+        t = micros();
+        ok = nfc_i.P2PInitiatorStream(source, sink, &s);
+        us = micros() - t;
+    }
+
+    const nfc_p2p_cfg_t *cfg;
+    stream_t s;
+    u8 ok;
+    u16 tries;
+    u32 us;
+};
+
+class Target : public HostBoard
+{
+  public:
+    Target(HostBus *bus, const nfc_p2p_cfg_t *cfg) :
+        HostBoard(bus), cfg(cfg), ok(0), mode(0)
+    {
+        memset(&s, 0, sizeof(s));
+    }
+    void run(void)
+    {
+        u32 start;
+
+        nfc_t.P2PConfig(cfg);
+        delay(TARGET_LATE_MS);
+        start = millis();
+        while(!nfc_t.P2PTargetInit()){
+            if(millis() - start > 1000){
+                return;
+            }
+        }
+        /** Mode, ATR_REQ: LEN D4 00 NFCID3i DIDi BSi BRi PPi Gi */
+        mode = nfc_buf[7];
+        CHECK(nfc_buf[9] == 0xD4 && nfc_buf[10] == 0x00);
+        CHECK(!memcmp(nfc_buf+11, id3i, 10));
+        CHECK(nfc_buf[8] == 17+sizeof(gi));
+        CHECK(!memcmp(nfc_buf+25, gi, sizeof(gi)));
+        ok = nfc_t.P2PTargetStream(sink, source, &s);
+    }
+
+    const nfc_p2p_cfg_t *cfg;
+    stream_t s;
+    u8 ok, mode;
+};
+
+static void setup(NFC_Module &nfc, PN532_Emu &emu)
+{
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+}
+
+/** one session, returns bytes/s both ways */
+static u32 session(const char *name, PN532_Emu &emu_i, PN532_Emu &emu_t,
+                   const nfc_p2p_cfg_t *cfg_i, const nfc_p2p_cfg_t *cfg_t,
+                   u8 mode)
+{
+    GateBus gate(&emu_i);
+    Initiator in(&gate, cfg_i);
+    Target tg(&emu_t, cfg_t);
+    HostBoard *boards[2] = { &in, &tg };
+    u32 bps = 0;
+
+    emu_i.link(&emu_t);
+    CHECK(host_run_boards(boards, 2, RUN_MAX_US));
+    CHECK(in.ok && tg.ok);
+    CHECK(in.s.tx == STREAM_LEN && in.s.rx == STREAM_LEN && !in.s.bad);
+    CHECK(tg.s.tx == STREAM_LEN && tg.s.rx == STREAM_LEN && !tg.s.bad);
+    /** waited for the late target without sending again */
+    CHECK(in.tries > 0);
+    CHECK(tg.mode == mode);
+    if(in.us){
+        bps = (u32)(2ULL*STREAM_LEN*1000000/in.us);
+    }
+    printf("%-22s %8lu us %6lu bytes/s\n", name, (unsigned long)in.us,
+           (unsigned long)bps);
+    return bps;
+}
+
+int main(void)
+{
+    static PN532_Emu emu_i, emu_t;
+    nfc_p2p_cfg_t cfg_i, cfg_t;
+    u32 bps_106, bps_424, bps_psl;
+
+    setup(nfc_i, emu_i);
+    setup(nfc_t, emu_t);
+
+    /** each side has its own general bytes and NFCID3 */
+    memset(&cfg_i, 0, sizeof(cfg_i));
+    cfg_i.gb = gi;
+    cfg_i.gb_len = sizeof(gi);
+    cfg_i.nfcid3 = id3i;
+    cfg_i.psl_baud = NFC_P2P_NO_PSL;
+    cfg_t = cfg_i;
+    cfg_t.gb = gt;
+    cfg_t.gb_len = sizeof(gt);
+    cfg_t.nfcid3 = id3t;
+    cfg_t.nfcid1 = id1;
+
+    /** Mode: DEP, bit rate << 4, framing 00 ISO14443A, 01 active */
+    cfg_i.mode = cfg_t.mode = NFC_P2P_PASSIVE;
+    cfg_i.baud = cfg_t.baud = NFC_P2P_106K;
+    bps_106 = session("passive 106 kbps", emu_i, emu_t, &cfg_i, &cfg_t,
+                      PN532_TG_MODE_DEP);
+
+    cfg_i.mode = cfg_t.mode = NFC_P2P_ACTIVE;
+    cfg_i.baud = cfg_t.baud = NFC_P2P_424K;
+    bps_424 = session("active 424 kbps", emu_i, emu_t, &cfg_i, &cfg_t,
+                      PN532_TG_MODE_DEP | (NFC_P2P_424K << 4) | 0x01);
+
+    cfg_i.baud = cfg_t.baud = NFC_P2P_106K;
+    cfg_i.psl_baud = NFC_P2P_424K;
+    bps_psl = session("active 106 + PSL 424", emu_i, emu_t, &cfg_i, &cfg_t,
+                      PN532_TG_MODE_DEP | 0x01);
+
+    CHECK(bps_424 > bps_106 && bps_psl > bps_106);
+    CHECK(!emu_i.errors() && !emu_t.errors());
+    return failed;
+}
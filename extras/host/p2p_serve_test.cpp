@@ -0,0 +1,150 @@
+/*
+  p2p_serve_test.cpp - P2PTargetServe() against an emulated initiator that
+  sends bursts of requests, on two boards, see host_run_boards().
+
+  The initiator activates the target, sends BURST requests back to back
+  with P2PInitiatorTxRx(), each answered by the handler of the target, then
+  leaves the field and comes back, SESSIONS times. Every reply must match
+  its request, the target must report one ACTIVATED and one RELEASED per
+  session and one REQUEST per request, and a request must be answered in
+  REQ_MAX_MS, well below the 200 ms P2PTargetTxRx() sleeps. A round trip
+  is mostly I2C: the frames of both boards at HOST_I2C_BYTE_US a byte and
+  the 15 ms P2PInitiatorTxRx() waits before it sends.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+
+#define SESSIONS        3
+#define BURST           16
+#define REQ_MAX_MS      80
+#define LOOP_MS         1
+#define RUN_MAX_US      30000000ULL
+
+static NFC_Module nfc_i, nfc_t;
+static PN532_Emu emu_i, emu_t;
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+/** target handler: the request inverted, then its length */
+static u8 answer[NFC_DEP_CHUNK];
+
+static u8 handler(const u8 *rx, u8 rx_len, const u8 **tx, void *ctx)
+{
+    u8 i;
+
+    (*(u16 *)ctx)++;
+    for(i=0; i<rx_len && i<NFC_DEP_CHUNK-1; i++){
+        answer[i] = ~rx[i];
+    }
+    answer[i] = rx_len;
+    *tx = answer;
+    return i+1;
+}
+
+class Initiator : public HostBoard
+{
+  public:
+    Initiator(HostBus *bus) : HostBoard(bus), good(0), max_us(0) {}
+    void run(void)
+    {
+        u8 req[NFC_DEP_CHUNK], rsp[NFC_CMD_BUF_LEN], len, rlen, s, r, i;
+        u32 start, t;
+
+        for(s=0; s<SESSIONS; s++){
+            emu_i.link(&emu_t);
+            start = millis();
+            while(!nfc_i.P2PInitiatorInit()){
+                if(millis() - start > 1000){
+                    return;
+                }
+            }
+            for(r=0; r<BURST; r++){
+                len = 1 + (s*BURST + r) % (NFC_DEP_CHUNK-2);
+                for(i=0; i<len; i++){
+                    req[i] = s*BURST + r + i;
+                }
+                t = micros();
+                if(!nfc_i.P2PInitiatorTxRx(req, len, rsp, &rlen)){
+                    continue;
+                }
+                t = micros() - t;
+                if(t > max_us){
+                    max_us = t;
+                }
+                for(i=0; i<len && rsp[i] == (u8)~req[i]; i++){
+                }
+                if(rlen == len+1 && i == len && rsp[len] == len){
+                    good++;
+                }
+            }
+            /** the phone is taken away */
+            emu_i.field(PN532_EMU_NONE);
+            delay(50);
+        }
+    }
+
+    u16 good;
+    u32 max_us;
+};
+
+class Target : public HostBoard
+{
+  public:
+    Target(HostBus *bus) : HostBoard(bus), handled(0)
+    {
+        memset(events, 0, sizeof(events));
+    }
+    void run(void)
+    {
+        u32 start = millis();
+
+        /** a kiosk loop() */
+        while(events[NFC_SRV_RELEASED] < SESSIONS &&
+              millis() - start < RUN_MAX_US/1000){
+            events[nfc_t.P2PTargetServe(handler, &handled)]++;
+            delay(LOOP_MS);
+        }
+    }
+
+    u16 handled;
+    u16 events[NFC_SRV_RELEASED+1];
+};
+
+static void setup(NFC_Module &nfc, PN532_Emu &emu)
+{
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+}
+
+int main(void)
+{
+    Initiator in(&emu_i);
+    Target tg(&emu_t);
+    HostBoard *boards[2] = { &in, &tg };
+
+    setup(nfc_i, emu_i);
+    setup(nfc_t, emu_t);
+
+    CHECK(host_run_boards(boards, 2, RUN_MAX_US));
+    CHECK(in.good == SESSIONS*BURST);
+    CHECK(tg.handled == SESSIONS*BURST);
+    CHECK(tg.events[NFC_SRV_ACTIVATED] == SESSIONS);
+    CHECK(tg.events[NFC_SRV_REQUEST] == SESSIONS*BURST);
+    CHECK(tg.events[NFC_SRV_RELEASED] == SESSIONS);
+    CHECK(in.max_us <= REQ_MAX_MS*1000UL);
+    printf("%u requests in %u sessions, slowest answered in %lu us\n",
+           SESSIONS*BURST, SESSIONS, (unsigned long)in.max_us);
+
+    CHECK(!emu_i.errors() && !emu_t.errors());
+    return failed;
+}
@@ -0,0 +1,1460 @@
+/*
+  pn532_emu.cpp - PN532 on the host bus, see pn532_emu.h.
+*/
+
+#include "pn532_emu.h"
+
+static const u8 emu_ack[6] = { 0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00 };
+/** application level error frame, answer to an unknown command */
+static const u8 emu_err[8] = { 0x00, 0x00, 0xFF, 0x01, 0xFF, 0x7F, 0x81, 0x00 };
+
+/** ISO-DEP card: UID, ATS with TA(1) allowing 424 kbps both ways */
+static const u8 emu_dep_uid[7] = { 0x08, 0xA1, 0xB2, 0xC3, 0xD4, 0xE5, 0xF6 };
+static const u8 emu_ats[6] = { 0x06, 0x75, 0x77, 0x81, 0x02, 0x80 };
+/** byte on air at 106, 212 and 424 kbps */
+static const u8 emu_byte_us[3] = {
+    PN532_EMU_BYTE_106_US, PN532_EMU_BYTE_212_US, PN532_EMU_BYTE_424_US
+};
+/** ATS of a linked PN532 emulating a PICC */
+static const u8 emu_picc_ats[5] = { 0x05, 0x75, 0x33, 0x92, 0x03 };
+static const u8 emu_ndef_aid[7] = { 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01 };
+/** Type 4 CC, NDEF file E104 of PN532_EMU_NDEF_SIZE bytes */
+static const u8 emu_cc[15] = {
+    0x00, 0x0F, 0x20, 0x00, 0x3B, 0x00, 0x34,
+    0x04, 0x06, 0xE1, 0x04, 0x00, PN532_EMU_NDEF_SIZE, 0x00, 0x00
+};
+/** NLEN, URI record http://www.example.com */
+static const u8 emu_ndef_msg[] = {
+    0x00, 0x10, 0xD1, 0x01, 0x0C, 0x55, 0x01,
+    'e', 'x', 'a', 'm', 'p', 'l', 'e', '.', 'c', 'o', 'm'
+};
+/** ISO-DEP card: GET DATA serial number */
+static const u8 emu_serial[8] = { 0x53, 0x4E, 0x00, 0x00, 0x12, 0x34, 0x56, 0x78 };
+/** NTAG216 GET_VERSION */
+static const u8 emu_ntag_version[8] = {
+    0x00, 0x04, 0x04, 0x02, 0x01, 0x00, 0x13, 0x03
+};
+/** FeliCa cards: IDm, PMm, system code, blocks per Read/Write command */
+typedef struct{
+    u8 idm[8];
+    u8 pmm[8];
+    u16 sys;
+    u8 max_rd;
+    u8 max_wr;
+}emu_felica_t;
+
+static const emu_felica_t emu_felica[2] = {
+    /** Lite-S */
+    { { 0x01, 0x2E, 0x4C, 0xD8, 0xA1, 0x02, 0x33, 0x71 },
+      { 0x00, 0xF1, 0x00, 0x00, 0x00, 0x01, 0x43, 0x00 }, 0x88B4, 4, 1 },
+    /** Standard */
+    { { 0x01, 0x01, 0x06, 0x01, 0xCB, 0x0A, 0x8E, 0x12 },
+      { 0x01, 0x20, 0x22, 0x04, 0x27, 0x67, 0x4E, 0xFF }, 0x0003, 15, 11 },
+};
+
+/** DEP target: NFCID3t, DIDt, BSt, BRt, TO, PPt */
+static const u8 emu_atr_res[15] = {
+    0x01, 0xFE, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9,
+    0x00, 0x00, 0x00, 0x0E, 0x32
+};
+
+/** initiator without NFCID3i: NFCID3i of ATR_REQ */
+static const u8 emu_nfcid3i[10] = {
+    0x01, 0xFE, 0x0F, 0xBB, 0xBA, 0xA6, 0xC9, 0x89, 0x00, 0x00
+};
+
+#define EMU_ERR_TIMEOUT     0x01
+#define EMU_ERR_CRC         0x02
+#define EMU_ERR_PARAM       0x10
+#define EMU_ERR_AUTH        0x14
+#define EMU_ERR_STATE       0x27
+#define EMU_ERR_RELEASED    0x29
+
+/** FeliCa status flag 2 */
+#define EMU_SF_SERVICES     0xA1    // number of services
+#define EMU_SF_BLOCKS       0xA2    // number of blocks
+#define EMU_SF_LIST         0xA3    // block list element
+#define EMU_SF_BLOCK        0xA8    // block number, or access to it
+
+/** target side of a linked PN532 */
+#define EMU_TG_OFF          0
+#define EMU_TG_ARMED        1   // TgInitAsTarget waits for an initiator
+#define EMU_TG_ACTIVE       2
+
+PN532_Emu::PN532_Emu()
+{
+    qn = 0;
+    asleep = 0;
+    sleep_next = 0;
+    rty_passive = 0xFF;
+    ntag_cnt = 0;
+    nframes = 0;
+    nerrors = 0;
+    nwrites = 0;
+    chain_len = 0;
+    memset(reg, 0, sizeof(reg));
+    gpio[0] = 0x3F;
+    gpio[1] = 0x06;
+    peer = NULL;
+    card = PN532_EMU_NONE;
+    tg = EMU_TG_OFF;
+    tg_get = 0;
+    tg_put = 0;
+    tg_ready = 0;
+    tg_turn = 0;
+    ats(NULL);
+    psl_reject = 0;
+    field(PN532_EMU_NONE);
+}
+
+/** Put a card in the field with factory content, it is not activated. */
+void PN532_Emu::field(u8 card)
+{
+    u8 i;
+
+    /** the linked target leaves the field */
+    if(this->card == PN532_EMU_PEER && card != PN532_EMU_PEER && peer){
+        peer->tg_release();
+    }
+    this->card = card;
+    active = 0;
+    jump_cmd = 0;
+    in_wait = 0;
+    in_more = 0;
+    box_full = 0;
+    auth = 0xFF;
+    vset = 0;
+    app = 0;
+    file = 0;
+    rec_left = 0;
+    memset(mem, 0, sizeof(mem));
+    if(card == PN532_EMU_MIFARE_1K){
+        /** UID, BCC, SAK, ATQA, manufacturer data */
+        const u8 blk0[8] = { 0x4E, 0x7A, 0x13, 0xC5, 0x00, 0x08, 0x04, 0x00 };
+        memcpy(mem, blk0, sizeof(blk0));
+        mem[4] = mem[0] ^ mem[1] ^ mem[2] ^ mem[3];
+        /** sector trailers: KeyA FF.., access bits FF 07 80 69, KeyB FF.. */
+        for(i=0; i<16; i++){
+            u8 *t = mem + (i*4+3)*16;
+            memset(t, 0xFF, 16);
+            t[6] = 0xFF;
+            t[7] = 0x07;
+            t[8] = 0x80;
+            t[9] = 0x69;
+        }
+    }else if(card == PN532_EMU_NTAG216){
+        const u8 uid[7] = { 0x04, 0x5C, 0x21, 0x6A, 0x8B, 0x30, 0x80 };
+        memcpy(mem, uid, 3);
+        mem[3] = 0x88 ^ uid[0] ^ uid[1] ^ uid[2];
+        memcpy(mem+4, uid+3, 4);
+        mem[8] = uid[3] ^ uid[4] ^ uid[5] ^ uid[6];
+        mem[9] = 0x48;
+        /** CC: NDEF 1.0, 872 bytes, read/write; empty NDEF TLV */
+        mem[12] = 0xE1;
+        mem[13] = 0x10;
+        mem[14] = 0x6D;
+        mem[16] = 0x03;
+        mem[18] = 0xFE;
+        /** dynamic lock, CFG0 (AUTH0 FF), CFG1 */
+        mem[226*4+3] = 0xBD;
+        mem[227*4] = 0x04;
+        mem[227*4+3] = 0xFF;
+        mem[228*4+1] = 0x05;
+        memset(mem+229*4, 0xFF, 4);
+    }else if(card == PN532_EMU_FELICA_LITE_S){
+        /** ID: IDm, DFC; D_ID: IDm, PMm; SER_C; SYS_C; MC */
+        const emu_felica_t *f = &emu_felica[0];
+        memcpy(mem+0x82*16, f->idm, 8);
+        memcpy(mem+0x83*16, f->idm, 8);
+        memcpy(mem+0x83*16+8, f->pmm, 8);
+        mem[0x84*16] = 0x0B;
+        mem[0x85*16] = f->sys >> 8;
+        mem[0x85*16+1] = f->sys;
+        memset(mem+0x88*16, 0xFF, 3);
+        mem[0x88*16+3] = 0x01;
+    }else if(card == PN532_EMU_FELICA){
+        for(u16 j=0; j<PN532_EMU_FELICA_RO*16; j++){
+            mem[PN532_EMU_FELICA_RW*16+j] = emu_felica_ro(j);
+        }
+    }else if(card == PN532_EMU_TOPAZ_96 || card == PN532_EMU_TOPAZ_512){
+        /** UID0..6, CC */
+        const u8 blk0[12] = {
+            0x3B, 0x92, 0x16, 0x8E, 0x00, 0x00, 0x00, 0x00,
+            0xE1, 0x10, 0x0E, 0x00
+        };
+        memcpy(mem, blk0, sizeof(blk0));
+        if(card == PN532_EMU_TOPAZ_512){
+            mem[10] = 0x3F;
+        }
+    }
+    memset(ndef, 0, sizeof(ndef));
+    memcpy(ndef, emu_ndef_msg, sizeof(emu_ndef_msg));
+}
+
+/** Link two PN532s, peer is put in the field of this one. */
+void PN532_Emu::link(PN532_Emu *peer)
+{
+    this->peer = peer;
+    peer->peer = this;
+    field(PN532_EMU_PEER);
+}
+
+/** ATS of the ISO-DEP card from TL on, NULL - the default one */
+void PN532_Emu::ats(const u8 *ats)
+{
+    if(!ats || !ats[0] || ats[0] > sizeof(ats_buf)){
+        ats = emu_ats;
+    }
+    memcpy(ats_buf, ats, ats[0]);
+}
+
+/** the ISO-DEP card ignores PPS, InPSL times out */
+void PN532_Emu::reject_psl(u8 reject)
+{
+    psl_reject = reject;
+}
+
+/** card memory from address 0 */
+void PN532_Emu::memory(const u8 *data, u16 len)
+{
+    memcpy(mem, data, len < sizeof(mem) ? len : sizeof(mem));
+}
+
+u32 PN532_Emu::frames(void)
+{
+    return nframes;
+}
+
+u32 PN532_Emu::errors(void)
+{
+    return nerrors;
+}
+
+u32 PN532_Emu::writes(void)
+{
+    return nwrites;
+}
+
+u8 PN532_Emu::sleeping(void)
+{
+    return asleep;
+}
+
+u32 PN532_Emu::turnaround(void)
+{
+    return tg_turn;
+}
+
+u8 PN532_Emu::write(u8 addr, const u8 *buf, u8 len)
+{
+    u8 n, sum = 0;
+
+    if(addr != PN532_I2C_ADDRESS){
+        return 0;
+    }
+    /** an address match wakes PN532 up */
+    asleep = 0;
+
+    if(len >= 6 && !memcmp(buf, emu_ack, 6)){
+        /** host aborts the command in progress */
+        qn = 0;
+        sleep_next = 0;
+        return 1;
+    }
+
+    /** 00 00 FF LEN LCS D4 CMD ... DCS 00 */
+    n = (len >= 7) ? buf[3] : 0;
+    if(len < 7 || buf[0] || buf[1] || buf[2] != 0xFF || n < 2 ||
+       (u8)(n + buf[4]) || len < n+6 || buf[5] != 0xD4){
+        nerrors++;
+        return 1;
+    }
+    for(u8 i=0; i<=n; i++){
+        sum += buf[5+i];
+    }
+    if(sum){
+        nerrors++;
+        return 1;
+    }
+
+    nframes++;
+    qn = 0;
+    sleep_next = 0;
+    queue(emu_ack, sizeof(emu_ack), PN532_EMU_ACK_US);
+    command(buf[6], buf+7, n-2);
+    return 1;
+}
+
+u8 PN532_Emu::read(u8 addr, u8 *buf, u8 len)
+{
+    if(addr != PN532_I2C_ADDRESS || asleep || !len){
+        return 0;
+    }
+    if(!qn || q[0].ready > host_time_us()){
+        /** status byte 00: not ready */
+        memset(buf, 0, len);
+        return len;
+    }
+    buf[0] = PN532_I2C_READY;
+    for(u8 i=1; i<len; i++){
+        buf[i] = (i-1 < q[0].len) ? q[0].buf[i-1] : 0x00;
+    }
+    if(len > 1){
+        /** the frame is read, the next one or nothing follows */
+        qn--;
+        if(qn){
+            q[0] = q[1];
+        }else if(sleep_next){
+            sleep_next = 0;
+            asleep = 1;
+        }
+    }
+    return len;
+}
+
+void PN532_Emu::queue(const u8 *frame, u16 len, u32 us)
+{
+    uint64_t ready = host_time_us() + us;
+
+    if(qn >= 2){
+        return;
+    }
+    /** never before the ACK */
+    if(qn && ready < q[qn-1].ready){
+        ready = q[qn-1].ready;
+    }
+    memcpy(q[qn].buf, frame, len);
+    q[qn].len = len;
+    q[qn].ready = ready;
+    qn++;
+}
+
+void PN532_Emu::reply(u8 cmd, const u8 *d, u16 n, u32 us)
+{
+    u8 frame[PN532_EMU_FRAME_MAX], sum;
+    u16 i;
+
+    if(n > 253){
+        n = 253;
+    }
+    frame[0] = 0x00;
+    frame[1] = 0x00;
+    frame[2] = 0xFF;
+    frame[3] = n+2;
+    frame[4] = ~(n+2) + 1;
+    frame[5] = 0xD5;
+    frame[6] = cmd+1;
+    sum = 0xD5 + cmd+1;
+    for(i=0; i<n; i++){
+        frame[7+i] = d[i];
+        sum += d[i];
+    }
+    frame[7+n] = ~sum + 1;
+    frame[8+n] = 0x00;
+    queue(frame, n+9, us);
+}
+
+void PN532_Emu::error_frame(void)
+{
+    queue(emu_err, sizeof(emu_err), PN532_EMU_CMD_US);
+}
+
+void PN532_Emu::command(u8 cmd, const u8 *d, u8 n)
+{
+    u8 out[PN532_EMU_FRAME_MAX];
+    u16 olen = 0, i;
+    u32 us = PN532_EMU_CMD_US;
+
+    switch(cmd){
+    case PN532_COMMAND_GETFIRMWAREVERSION:
+        /** PN532, firmware 1.6, ISO14443A/B and ISO18092 */
+        out[0] = 0x32;
+        out[1] = 0x01;
+        out[2] = 0x06;
+        out[3] = 0x07;
+        olen = 4;
+        break;
+    case PN532_COMMAND_SAMCONFIGURATION:
+    case PN532_COMMAND_SETPARAMETERS:
+        break;
+    case PN532_COMMAND_DIAGNOSE:
+        if(n && d[0] == PN532_DIAG_ATTENTION_REQUEST){
+            out[0] = (active && (card == PN532_EMU_ISO_DEP ||
+                                 card == PN532_EMU_P2P ||
+                                 card == PN532_EMU_PEER)) ?
+                     0x00 : EMU_ERR_TIMEOUT;
+            olen = 1;
+            us = PN532_EMU_XCH_US;
+        }else if(n && d[0] == 0x00){
+            /** communication line test, echo */
+            memcpy(out, d, n);
+            olen = n;
+        }else{
+            error_frame();
+            return;
+        }
+        break;
+    case PN532_COMMAND_READREGISTER:
+        for(i=0; i+1<n; i+=2){
+            out[olen++] = reg[(d[i]<<8) | d[i+1]];
+        }
+        break;
+    case PN532_COMMAND_WRITEREGISTER:
+        for(i=0; i+2<n; i+=3){
+            reg[(d[i]<<8) | d[i+1]] = d[i+2];
+        }
+        break;
+    case PN532_COMMAND_READGPIO:
+        out[0] = gpio[0];
+        out[1] = gpio[1];
+        out[2] = 0x00;
+        olen = 3;
+        break;
+    case PN532_COMMAND_WRITEGPIO:
+        if(n > 0 && (d[0] & 0x80)){
+            gpio[0] = d[0] & 0x3F;
+        }
+        if(n > 1 && (d[1] & 0x80)){
+            gpio[1] = d[1] & 0x06;
+        }
+        break;
+    case PN532_COMMAND_RFCONFIGURATION:
+        if(n >= 4 && d[0] == PN532_RFCFG_MAXRETRIES){
+            rty_passive = d[3];
+        }
+        break;
+    case PN532_COMMAND_POWERDOWN:
+        out[0] = 0x00;
+        olen = 1;
+        sleep_next = 1;
+        break;
+    case PN532_COMMAND_INLISTPASSIVETARGET:
+        if(!in_list(d, n, out, &olen, &us)){
+            /** retries forever, no response until a card comes */
+            return;
+        }
+        break;
+    case PN532_COMMAND_INDATAEXCHANGE:
+        if(card == PN532_EMU_PEER && active && n && (d[0] & 0x3F) == 1){
+            /** answered when the target side has the reply */
+            in_dep(d, n);
+            return;
+        }
+        out[0] = exchange(d, n, out+1, &olen, &us);
+        olen++;
+        break;
+    case PN532_COMMAND_INCOMMUNICATETHRU:
+        out[0] = thru(d, n, out+1, &olen, &us);
+        olen++;
+        break;
+    case PN532_COMMAND_INPSL:
+        out[0] = EMU_ERR_STATE;
+        if(n < 3 || d[1] > PN532_BRTY_424KBPS || d[2] > PN532_BRTY_424KBPS){
+            out[0] = EMU_ERR_PARAM;
+        }else if(card == PN532_EMU_ISO_DEP && active && psl_reject){
+            /** the card ignores PPS, it stays at 106 kbps */
+            out[0] = EMU_ERR_TIMEOUT;
+            us = PN532_EMU_XCH_US;
+        }else if(active && (card == PN532_EMU_ISO_DEP ||
+                            card == PN532_EMU_PEER)){
+            /** bytes take the time of the slower direction */
+            out[0] = 0x00;
+            byte_us = emu_byte_us[d[1] < d[2] ? d[1] : d[2]];
+            if(card == PN532_EMU_PEER){
+                peer->byte_us = byte_us;
+            }
+            us = PN532_EMU_XCH_US;
+        }
+        olen = 1;
+        break;
+    case PN532_COMMAND_INJUMPFORDEP:
+    case PN532_COMMAND_INJUMPFORPSL:
+        if(card == PN532_EMU_PEER){
+            if(!in_jump(d, n, out, &olen)){
+                /** retried until the other side is a target */
+                memcpy(jump, d, n < sizeof(jump) ? n : sizeof(jump));
+                jump_len = n < sizeof(jump) ? n : sizeof(jump);
+                jump_cmd = cmd;
+                return;
+            }
+            us = PN532_EMU_ATR_US;
+            break;
+        }
+        us = PN532_EMU_ATR_US;
+        out[0] = EMU_ERR_TIMEOUT;
+        olen = 1;
+        if(card == PN532_EMU_P2P){
+            active = 1;
+            byte_us = (n > 1 && d[1] != NFC_P2P_106K) ?
+                      PN532_EMU_BYTE_424_US : PN532_EMU_BYTE_106_US;
+            out[0] = 0x00;
+            out[1] = 1;
+            memcpy(out+2, emu_atr_res, sizeof(emu_atr_res));
+            olen = 2 + sizeof(emu_atr_res);
+        }
+        break;
+    case PN532_COMMAND_INRELEASE:
+    case PN532_COMMAND_INDESELECT:
+        if(card == PN532_EMU_PEER && active){
+            peer->tg_release();
+        }
+        active = 0;
+        out[0] = 0x00;
+        olen = 1;
+        break;
+    case PN532_COMMAND_TGINITASTARGET:
+    case PN532_COMMAND_TGGETDATA:
+    case PN532_COMMAND_TGSETDATA:
+    case PN532_COMMAND_TGSETMETADATA:
+        target(cmd, d, n);
+        return;
+    default:
+        error_frame();
+        return;
+    }
+    reply(cmd, out, olen, us);
+}
+
+/** InListPassiveTarget, 0 - no response at all */
+u8 PN532_Emu::in_list(const u8 *d, u8 n, u8 *out, u16 *olen, u32 *us)
+{
+    u8 uid[7], len, found;
+
+    active = 0;
+    if(n >= 2 && (d[1] == PN532_BRTY_212KBPS || d[1] == PN532_BRTY_424KBPS)){
+        found = felica_poll(d+2, n-2, out, olen);
+    }else if(n >= 2 && d[1] == PN532_BRTY_JEWEL){
+        found = card == PN532_EMU_TOPAZ_96 || card == PN532_EMU_TOPAZ_512;
+    }else{
+        found = n >= 2 && d[1] == PN532_BRTY_ISO14443A &&
+                card != PN532_EMU_NONE && card != PN532_EMU_P2P &&
+                card != PN532_EMU_FELICA_LITE_S && card != PN532_EMU_FELICA &&
+                card != PN532_EMU_TOPAZ_96 && card != PN532_EMU_TOPAZ_512 &&
+                (card != PN532_EMU_PEER || in_picc(out, olen));
+    }
+    if(!found){
+        if(rty_passive == 0xFF){
+            return 0;
+        }
+        /** every try of MxRtyPassiveActivation waits for an answer */
+        out[0] = 0;
+        *olen = 1;
+        *us = (rty_passive + 1) * PN532_EMU_EMPTY_US;
+        return 1;
+    }
+
+    out[0] = 1;         // NbTg
+    out[1] = 1;         // Tg
+    *us = PN532_EMU_TRY_US;
+    if(card == PN532_EMU_FELICA_LITE_S || card == PN532_EMU_FELICA){
+        active = 1;
+        byte_us = emu_byte_us[d[1]];
+        return 1;
+    }
+    if(card == PN532_EMU_TOPAZ_96 || card == PN532_EMU_TOPAZ_512){
+        /** SENS_RES, JEWELID: UID0..3 */
+        out[2] = 0x0C;
+        out[3] = 0x00;
+        memcpy(out+4, mem, 4);
+        *olen = 8;
+        active = 1;
+        byte_us = PN532_EMU_BYTE_106_US;
+        return 1;
+    }
+    if(card == PN532_EMU_MIFARE_1K){
+        out[2] = 0x00;
+        out[3] = 0x04;
+        out[4] = 0x08;
+        memcpy(uid, mem, 4);
+        len = 4;
+    }else if(card == PN532_EMU_NTAG216){
+        out[2] = 0x00;
+        out[3] = 0x44;
+        out[4] = 0x00;
+        /** UID0..2 on page 0, UID3..6 on page 1 */
+        memcpy(uid, mem, 3);
+        memcpy(uid+3, mem+4, 4);
+        len = 7;
+    }else if(card == PN532_EMU_PEER){
+        *us += PN532_EMU_ATS_US;
+        active = 1;
+        byte_us = PN532_EMU_BYTE_106_US;
+        return 1;
+    }else{
+        out[2] = 0x03;
+        out[3] = 0x44;
+        out[4] = 0x20;
+        memcpy(uid, emu_dep_uid, 7);
+        len = 7;
+    }
+    out[5] = len;
+    memcpy(out+6, uid, len);
+    *olen = 6 + len;
+    if(card == PN532_EMU_ISO_DEP){
+        memcpy(out+*olen, ats_buf, ats_buf[0]);
+        *olen += ats_buf[0];
+        *us += PN532_EMU_ATS_US;
+    }
+
+    /** the firmware leaves the CIU at 106 kbps type A, CRC both ways */
+    reg[PN532_REG_CIU_TXMODE] = PN532_CIU_CRC_EN;
+    reg[PN532_REG_CIU_RXMODE] = PN532_CIU_CRC_EN;
+    reg[PN532_REG_CIU_MANUALRCV] &= ~PN532_CIU_PARITY_DISABLE;
+    reg[PN532_REG_CIU_BITFRAMING] &= ~PN532_CIU_TXLASTBITS;
+    active = 1;
+    auth = 0xFF;
+    vset = 0;
+    counted = 0;
+    app = 0;
+    file = 0;
+    chain_len = 0;
+    rec_left = 0;
+    byte_us = PN532_EMU_BYTE_106_US;
+    return 1;
+}
+
+/** InDataExchange: Tg [MI], data; returns the status byte */
+u8 PN532_Emu::exchange(const u8 *d, u8 n, u8 *out, u16 *olen, u32 *us)
+{
+    u8 sta = 0;
+
+    *olen = 0;
+    if(!n || !active || (d[0] & 0x3F) != 1){
+        return EMU_ERR_STATE;
+    }
+    *us = PN532_EMU_XCH_US;
+    switch(card){
+    case PN532_EMU_MIFARE_1K:
+        sta = mifare(d+1, n-1, out, olen, us);
+        break;
+    case PN532_EMU_NTAG216:
+        sta = ntag(d+1, n-1, out, olen, us);
+        break;
+    case PN532_EMU_ISO_DEP:
+        if(chain_len + n-1 > (int)sizeof(chain)){
+            chain_len = 0;
+            return EMU_ERR_TIMEOUT;
+        }
+        memcpy(chain+chain_len, d+1, n-1);
+        chain_len += n-1;
+        if(!(d[0] & NFC_MI)){
+            *olen = apdu(chain, chain_len, out);
+            chain_len = 0;
+        }
+        break;
+    case PN532_EMU_P2P:
+        memcpy(out, d+1, n-1);
+        *olen = n-1;
+        break;
+    case PN532_EMU_FELICA_LITE_S:
+    case PN532_EMU_FELICA:
+        sta = felica(d+1, n-1, out, olen, us);
+        break;
+    case PN532_EMU_TOPAZ_96:
+    case PN532_EMU_TOPAZ_512:
+        sta = topaz(d+1, n-1, out, olen);
+        break;
+    }
+    *us += (n-1 + *olen) * byte_us;
+    return sta;
+}
+
+/**
+    InCommunicateThru: Tg-less data, framed on air as the CIU registers say.
+    Without TX CRC the data must end in a valid CRC_A, or the card ignores
+    it; without RX CRC the card's CRC_A is passed on. No card takes frames
+    without parity. A 7-bit WUPA is answered by ATQA, which has no CRC,
+    and sends the card back to READY. Returns the status byte.
+*/
+u8 PN532_Emu::thru(const u8 *d, u8 n, u8 *out, u16 *olen, u32 *us)
+{
+    u8 tmp[PN532_EMU_FRAME_MAX], last, sta;
+    u16 crc;
+
+    *olen = 0;
+    *us = PN532_EMU_XCH_US;
+    last = reg[PN532_REG_CIU_BITFRAMING] & PN532_CIU_TXLASTBITS;
+    if(!active || (reg[PN532_REG_CIU_MANUALRCV] & PN532_CIU_PARITY_DISABLE)){
+        return EMU_ERR_TIMEOUT;
+    }
+    if(last){
+        if(n != 1 || last != 7 || d[0] != 0x52 ||
+           (reg[PN532_REG_CIU_TXMODE] & PN532_CIU_CRC_EN)){
+            return EMU_ERR_TIMEOUT;
+        }
+        out[0] = (card == PN532_EMU_MIFARE_1K) ? 0x04 : 0x44;
+        out[1] = (card == PN532_EMU_ISO_DEP) ? 0x03 : 0x00;
+        *olen = 2;
+        active = 0;
+        return (reg[PN532_REG_CIU_RXMODE] & PN532_CIU_CRC_EN) ? EMU_ERR_CRC : 0;
+    }
+
+    if(!(reg[PN532_REG_CIU_TXMODE] & PN532_CIU_CRC_EN)){
+        if(n < 3 || emu_crc_a(d, n-2) != (d[n-2] | (d[n-1] << 8))){
+            return EMU_ERR_TIMEOUT;
+        }
+        n -= 2;
+    }
+    tmp[0] = 1;
+    memcpy(tmp+1, d, n);
+    sta = exchange(tmp, n+1, out, olen, us);
+    if(!sta && !(reg[PN532_REG_CIU_RXMODE] & PN532_CIU_CRC_EN)){
+        crc = emu_crc_a(out, *olen);
+        out[(*olen)++] = crc;
+        out[(*olen)++] = crc >> 8;
+    }
+    return sta;
+}
+
+/** Mifare value block: value, ~value, value, addr ~addr addr ~addr */
+static u8 emu_value(const u8 *b, u32 *v)
+{
+    for(u8 i=0; i<4; i++){
+        if(b[i] != b[8+i] || (u8)~b[i] != b[4+i]){
+            return 0;
+        }
+    }
+    *v = b[0] | (b[1] << 8) | ((u32)b[2] << 16) | ((u32)b[3] << 24);
+    return b[12] == b[14] && b[13] == b[15] && (u8)~b[12] == b[13];
+}
+
+u8 PN532_Emu::mifare(const u8 *d, u8 n, u8 *out, u16 *olen, u32 *us)
+{
+    u8 blk = (n > 1) ? d[1] : 0xFF;
+    u8 *t;
+    u32 v;
+
+    if(blk >= 64){
+        return EMU_ERR_TIMEOUT;
+    }
+    switch(d[0]){
+    case MIFARE_CMD_AUTH_A:
+    case MIFARE_CMD_AUTH_B:
+        t = mem + ((blk|3)*16) + (d[0] == MIFARE_CMD_AUTH_A ? 0 : 10);
+        *us += PN532_EMU_AUTH_US;
+        if(n < 12 || memcmp(d+2, t, 6) || memcmp(d+8, mem, 4)){
+            auth = 0xFF;
+            return EMU_ERR_AUTH;
+        }
+        auth = blk/4;
+        vset = 0;
+        return 0;
+    case MIFARE_CMD_READ:
+        if(auth != blk/4){
+            return EMU_ERR_TIMEOUT;
+        }
+        memcpy(out, mem+blk*16, 16);
+        if((blk & 3) == 3){
+            /** keys never read back */
+            memset(out, 0, 6);
+        }
+        *olen = 16;
+        return 0;
+    case MIFARE_CMD_WRITE:
+        if(n < 18 || !blk || auth != blk/4){
+            return EMU_ERR_TIMEOUT;
+        }
+        memcpy(mem+blk*16, d+2, 16);
+        *us += PN532_EMU_PROG_US;
+        nwrites++;
+        return 0;
+    case MIFARE_CMD_DECREMENT:
+    case MIFARE_CMD_INCREMENT:
+    case MIFARE_CMD_RESTORE:
+        /** into the value register, the block is left as it is */
+        vset = 0;
+        if(n < 6 || auth != blk/4 || (blk & 3) == 3 ||
+           !emu_value(mem+blk*16, &v)){
+            return EMU_ERR_TIMEOUT;
+        }
+        /** the operand, little endian */
+        vreg = d[2] | (d[3] << 8) | ((u32)d[4] << 16) | ((u32)d[5] << 24);
+        if(d[0] == MIFARE_CMD_DECREMENT){
+            vreg = v - vreg;
+        }else if(d[0] == MIFARE_CMD_INCREMENT){
+            vreg = v + vreg;
+        }else{
+            vreg = v;
+        }
+        vaddr = mem[blk*16+12];
+        vset = 1;
+        return 0;
+    case MIFARE_CMD_TRANSFER:
+        if(!vset || !blk || auth != blk/4 || (blk & 3) == 3){
+            return EMU_ERR_TIMEOUT;
+        }
+        t = mem+blk*16;
+        for(u8 i=0; i<4; i++){
+            t[i] = vreg >> (8*i);
+            t[4+i] = ~t[i];
+            t[8+i] = t[i];
+        }
+        t[12] = t[14] = vaddr;
+        t[13] = t[15] = ~vaddr;
+        vset = 0;
+        *us += PN532_EMU_PROG_US;
+        nwrites++;
+        return 0;
+    }
+    return EMU_ERR_TIMEOUT;
+}
+
+u8 PN532_Emu::ntag(const u8 *d, u8 n, u8 *out, u16 *olen, u32 *us)
+{
+    u8 page = (n > 1) ? d[1] : 0xFF;
+
+    switch(d[0]){
+    case MIFARE_CMD_READ:
+        if(page >= PN532_EMU_NTAG_PAGES){
+            return EMU_ERR_TIMEOUT;
+        }
+        /** 4 pages, rolling over to page 0 at the end */
+        for(u8 i=0; i<4; i++){
+            u8 p = (page+i) % PN532_EMU_NTAG_PAGES;
+            if(p == 229 || p == 230){
+                /** PWD and PACK read as 0 */
+                memset(out+i*4, 0, 4);
+            }else{
+                memcpy(out+i*4, mem+p*4, 4);
+            }
+        }
+        *olen = 16;
+        if(!counted){
+            counted = 1;
+            ntag_cnt++;
+        }
+        return 0;
+    case NTAG_CMD_WRITE:
+        if(n < 6 || page < 2 || page >= PN532_EMU_NTAG_PAGES){
+            return EMU_ERR_TIMEOUT;
+        }
+        memcpy(mem+page*4, d+2, 4);
+        *us += PN532_EMU_PROG_US;
+        nwrites++;
+        return 0;
+    case MIFARE_CMD_WRITE:
+        /** compatibility write, first 4 of 16 bytes are written */
+        if(n < 18 || page < 2 || page >= PN532_EMU_NTAG_PAGES){
+            return EMU_ERR_TIMEOUT;
+        }
+        memcpy(mem+page*4, d+2, 4);
+        *us += PN532_EMU_PROG_US;
+        nwrites++;
+        return 0;
+    case NTAG_CMD_GET_VERSION:
+        memcpy(out, emu_ntag_version, sizeof(emu_ntag_version));
+        *olen = sizeof(emu_ntag_version);
+        return 0;
+    case NTAG_CMD_READ_SIG:
+        if(page != 0x00){
+            return EMU_ERR_TIMEOUT;
+        }
+        for(u8 i=0; i<NTAG_SIG_LEN; i++){
+            out[i] = emu_ntag_sig(i);
+        }
+        *olen = NTAG_SIG_LEN;
+        return 0;
+    case NTAG_CMD_READ_CNT:
+        if(page != NTAG_NFC_COUNTER){
+            return EMU_ERR_TIMEOUT;
+        }
+        out[0] = ntag_cnt;
+        out[1] = ntag_cnt >> 8;
+        out[2] = ntag_cnt >> 16;
+        *olen = 3;
+        return 0;
+    }
+    return EMU_ERR_TIMEOUT;
+}
+
+/** FeliCa Polling: 00 SC SC RC TSN, 0 - the card does not answer */
+u8 PN532_Emu::felica_poll(const u8 *d, u8 n, u8 *out, u16 *olen)
+{
+    const emu_felica_t *f;
+
+    if(card != PN532_EMU_FELICA_LITE_S && card != PN532_EMU_FELICA){
+        return 0;
+    }
+    f = &emu_felica[card == PN532_EMU_FELICA];
+    /** FF in a system code byte is a wildcard */
+    if(n < 5 || d[0] != FELICA_CMD_POLLING ||
+       (d[1] != 0xFF && d[1] != (f->sys >> 8)) ||
+       (d[2] != 0xFF && d[2] != (u8)f->sys)){
+        return 0;
+    }
+    /** NbTg, Tg, POL_RES: length, 01, IDm, PMm, [system code] */
+    out[0] = 1;
+    out[1] = 1;
+    out[2] = 18;
+    out[3] = 0x01;
+    memcpy(out+4, f->idm, 8);
+    memcpy(out+12, f->pmm, 8);
+    if(d[3] == NFC_FELICA_RC_SYSCODE){
+        out[2] = 20;
+        out[20] = f->sys >> 8;
+        out[21] = f->sys;
+    }
+    *olen = 2 + out[2];
+    return 1;
+}
+
+/**
+    block num of service svc, NULL - no such block or no such access.
+    Lite-S: user blocks 00-0D and REG 0E read/write, ID, D_ID, SER_C,
+    SYS_C, CKV read only, MC read/write; either service code reads.
+    Standard: service 1009 read/write, 200B read only.
+*/
+u8 *PN532_Emu::felica_block(u16 svc, u16 num, u8 wr)
+{
+    /** attribute 09: random access without key, 0B: the same, read only */
+    if(wr && (svc & 0x3F) != 0x09){
+        return NULL;
+    }
+    if(card == PN532_EMU_FELICA_LITE_S){
+        if((svc != 0x0009 && svc != 0x000B) ||
+           (num > 0x0E && num != 0x88 && (wr || num < 0x82 || num > 0x86))){
+            return NULL;
+        }
+        return mem + num*16;
+    }
+    if(svc == 0x1009 && num < PN532_EMU_FELICA_RW){
+        return mem + num*16;
+    }
+    if(svc == 0x200B && num < PN532_EMU_FELICA_RO){
+        return mem + (PN532_EMU_FELICA_RW + num)*16;
+    }
+    return NULL;
+}
+
+/**
+    FeliCa Read/Write Without Encryption: LEN CODE IDm NSVC services NBLK
+    block list [data]; the reply LEN CODE+1 IDm SF1 SF2 [NBLK data]
+*/
+u8 PN532_Emu::felica(const u8 *d, u8 n, u8 *out, u16 *olen, u32 *us)
+{
+    const emu_felica_t *f = &emu_felica[card == PN532_EMU_FELICA];
+    u8 *blk[16], i, k, nsvc, nblk, wr, sf = 0;
+    u16 svc[16], num;
+
+    if(n < 12 || d[0] != n || memcmp(d+2, f->idm, 8) ||
+       (d[1] != FELICA_CMD_READ_WO_ENC && d[1] != FELICA_CMD_WRITE_WO_ENC)){
+        return EMU_ERR_TIMEOUT;
+    }
+    wr = d[1] == FELICA_CMD_WRITE_WO_ENC;
+    i = 10;
+    nsvc = d[i++];
+    if(!nsvc || nsvc > 16 || i + 2*nsvc >= n){
+        sf = EMU_SF_SERVICES;
+        nblk = 0;
+    }else{
+        /** service codes are little endian */
+        for(k=0; k<nsvc; k++, i+=2){
+            svc[k] = d[i] | (d[i+1] << 8);
+        }
+        nblk = d[i++];
+        if(!nblk || nblk > (wr ? f->max_wr : f->max_rd)){
+            sf = EMU_SF_BLOCKS;
+        }
+    }
+    for(k=0; !sf && k<nblk; k++){
+        /** 80 SVC NUM, or SVC NUM_L NUM_H */
+        if(i + ((d[i] & 0x80) ? 2 : 3) > n || (d[i] & 0x70) ||
+           (d[i] & 0x0F) >= nsvc){
+            sf = EMU_SF_LIST;
+            break;
+        }
+        num = (d[i] & 0x80) ? d[i+1] : d[i+1] | (d[i+2] << 8);
+        blk[k] = felica_block(svc[d[i] & 0x0F], num, wr);
+        if(!blk[k]){
+            sf = EMU_SF_BLOCK;
+        }
+        i += (d[i] & 0x80) ? 2 : 3;
+    }
+    if(!sf && wr && i + 16*nblk != n){
+        sf = EMU_SF_BLOCKS;
+    }
+
+    out[1] = d[1]+1;
+    memcpy(out+2, f->idm, 8);
+    out[10] = sf ? 0xFF : 0x00;
+    out[11] = sf;
+    *olen = 12;
+    if(!sf && wr){
+        for(k=0; k<nblk; k++){
+            memcpy(blk[k], d+i+16*k, 16);
+        }
+        *us += PN532_EMU_PROG_US;
+        nwrites += nblk;
+    }else if(!sf){
+        out[12] = nblk;
+        for(k=0; k<nblk; k++){
+            memcpy(out+13+16*k, blk[k], 16);
+        }
+        *olen = 13 + 16*nblk;
+    }
+    out[0] = *olen;
+    return 0;
+}
+
+/**
+    Topaz: CMD ADD DATA(1 or 8) UID0..3, the UID is ignored by RID only.
+    Blocks 0..E of a Topaz 96, 0..3F of a Topaz 512.
+*/
+u8 PN532_Emu::topaz(const u8 *d, u8 n, u8 *out, u16 *olen)
+{
+    u8 big = card == PN532_EMU_TOPAZ_512;
+    u8 dlen = (d[0] == TOPAZ_CMD_READ8) ? 8 : 1;
+
+    if(n != 2+dlen+4 || (d[0] != TOPAZ_CMD_RID && memcmp(d+2+dlen, mem, 4))){
+        return EMU_ERR_TIMEOUT;
+    }
+    switch(d[0]){
+    case TOPAZ_CMD_RID:
+        out[0] = big ? 0x12 : 0x11;
+        out[1] = big ? 0x4C : 0x48;
+        memcpy(out+2, mem, 4);
+        *olen = 6;
+        return 0;
+    case TOPAZ_CMD_RALL:
+        out[0] = big ? 0x12 : 0x11;
+        out[1] = big ? 0x4C : 0x48;
+        memcpy(out+2, mem, 120);
+        *olen = TOPAZ_RALL_LEN;
+        return 0;
+    case TOPAZ_CMD_READ:
+        if(d[1] >= 120){
+            return EMU_ERR_TIMEOUT;
+        }
+        out[0] = d[1];
+        out[1] = mem[d[1]];
+        *olen = 2;
+        return 0;
+    case TOPAZ_CMD_READ8:
+        if(!big || d[1] >= 0x40){
+            return EMU_ERR_TIMEOUT;
+        }
+        out[0] = d[1];
+        memcpy(out+1, mem+d[1]*8, 8);
+        *olen = 9;
+        return 0;
+    }
+    return EMU_ERR_TIMEOUT;
+}
+
+/** byte i of FeliCa service 200B */
+u8 emu_felica_ro(u16 i)
+{
+    return (u8)(i*5 + 0x2B);
+}
+
+/** byte i of the NTAG originality signature */
+u8 emu_ntag_sig(u8 i)
+{
+    return (u8)(i*13 + 0x5C);
+}
+
+/** CRC_A: x^16+x^12+x^5+1, LSB first, preset 6363 */
+u16 emu_crc_a(const u8 *d, u16 n)
+{
+    u16 crc = 0x6363;
+
+    while(n--){
+        crc ^= *d++;
+        for(u8 b=0; b<8; b++){
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+/** byte i of the record READ RECORD returns */
+u8 emu_record(u16 i)
+{
+    return (u8)(i*3 + 0x11);
+}
+
+/**
+    NDEF application of a Type 4 tag, plus READ RECORD (61xx, GET
+    RESPONSE), GET DATA and a proprietary INS CB (6Cxx); returns R-APDU
+    length
+*/
+u16 PN532_Emu::apdu(const u8 *d, u16 n, u8 *out)
+{
+    u16 off, le, size, cnt;
+    const u8 *src;
+    u8 lc = (n > 4) ? d[4] : 0;
+
+    if(n < 4){
+        out[0] = 0x67;
+        out[1] = 0x00;
+        return 2;
+    }
+    out[0] = 0x90;
+    out[1] = 0x00;
+    switch(d[1]){
+    case 0xA4:
+        /** SELECT by name, or by file id within the application */
+        if(d[2] == 0x04 && lc == 7 && n >= 12 && !memcmp(d+5, emu_ndef_aid, 7)){
+            app = 1;
+            file = 0;
+            return 2;
+        }
+        if(d[2] == 0x00 && app && lc == 2 && n >= 7){
+            off = (d[5] << 8) | d[6];
+            if(off == 0xE103 || off == 0xE104){
+                file = off;
+                return 2;
+            }
+        }
+        if(d[2] == 0x04){
+            app = 0;
+            file = 0;
+        }
+        out[0] = 0x6A;
+        out[1] = 0x82;
+        return 2;
+    case 0xB0:
+        if(!file){
+            out[0] = 0x69;
+            out[1] = 0x86;
+            return 2;
+        }
+        off = (d[2] << 8) | d[3];
+        le = (n > 4 && d[4]) ? d[4] : 256;
+        src = (file == 0xE103) ? emu_cc : ndef;
+        size = (file == 0xE103) ? sizeof(emu_cc) : sizeof(ndef);
+        if(off > size){
+            out[0] = 0x6B;
+            out[1] = 0x00;
+            return 2;
+        }
+        cnt = (le < size-off) ? le : size-off;
+        memcpy(out, src+off, cnt);
+        out[cnt] = 0x90;
+        out[cnt+1] = 0x00;
+        return cnt+2;
+    case 0xB2:
+        /** READ RECORD: the record waits for GET RESPONSE */
+        rec_off = 0;
+        rec_left = PN532_EMU_RECORD_LEN;
+        out[0] = 0x61;
+        out[1] = rec_left;
+        return 2;
+    case 0xC0:
+        if(!rec_left){
+            out[0] = 0x69;
+            out[1] = 0x85;
+            return 2;
+        }
+        le = (n > 4 && d[4]) ? d[4] : 256;
+        cnt = (le < rec_left) ? le : rec_left;
+        for(off=0; off<cnt; off++){
+            out[off] = emu_record(rec_off + off);
+        }
+        rec_off += cnt;
+        rec_left -= cnt;
+        if(rec_left){
+            out[cnt] = 0x61;
+            out[cnt+1] = rec_left;
+        }else{
+            out[cnt] = 0x90;
+            out[cnt+1] = 0x00;
+        }
+        return cnt+2;
+    case 0xCA:
+        /** GET DATA: the serial number, Le must be its length */
+        if(n != 5 || d[4] != sizeof(emu_serial)){
+            out[0] = 0x6C;
+            out[1] = sizeof(emu_serial);
+            return 2;
+        }
+        memcpy(out, emu_serial, sizeof(emu_serial));
+        out[sizeof(emu_serial)] = 0x90;
+        out[sizeof(emu_serial)+1] = 0x00;
+        return sizeof(emu_serial)+2;
+    case 0xCB:
+        /** proprietary case 3/4: data inverted, Le must be Lc */
+        if(n < 5u+lc){
+            out[0] = 0x67;
+            out[1] = 0x00;
+            return 2;
+        }
+        if(n != 6u+lc || d[5+lc] != lc){
+            out[0] = 0x6C;
+            out[1] = lc;
+            return 2;
+        }
+        for(off=0; off<lc; off++){
+            out[off] = ~d[5+off];
+        }
+        out[lc] = 0x90;
+        out[lc+1] = 0x00;
+        return lc+2;
+    case 0xD6:
+        off = (d[2] << 8) | d[3];
+        if(file != 0xE104 || n < 5u+lc || off+lc > sizeof(ndef)){
+            out[0] = 0x69;
+            out[1] = 0x86;
+            return 2;
+        }
+        memcpy(ndef+off, d+5, lc);
+        return 2;
+    }
+    out[0] = 0x6D;
+    out[1] = 0x00;
+    return 2;
+}
+
+/** time of a DEP frame of n bytes on air */
+u32 PN532_Emu::air_us(u16 n)
+{
+    return PN532_EMU_XCH_US + n * byte_us;
+}
+
+/** InJumpForDEP/PSL to the linked PN532, 0 - it is not a target yet */
+u8 PN532_Emu::in_jump(const u8 *d, u8 n, u8 *out, u16 *olen)
+{
+    PN532_Emu *t = peer;
+    u8 req[64], len, i = 3, gi = 0, mode;
+
+    if(t->tg != EMU_TG_ARMED || n < 3){
+        return 0;
+    }
+    /** ActPass, BR, Next, [PassiveInitiatorData], [NFCID3i], [Gi] */
+    if(d[2] & 0x01){
+        i += (d[1] == NFC_P2P_106K) ? 4 : 5;
+    }
+    /** ATR_REQ: LEN D4 00 NFCID3i DIDi BSi BRi PPi [Gi] */
+    req[1] = 0xD4;
+    req[2] = 0x00;
+    if((d[2] & 0x02) && i+10 <= n){
+        memcpy(req+3, d+i, 10);
+        i += 10;
+    }else{
+        memcpy(req+3, emu_nfcid3i, 10);
+    }
+    if((d[2] & 0x04) && i < n){
+        gi = n-i;
+        if(gi > sizeof(req)-17){
+            gi = sizeof(req)-17;
+        }
+    }
+    req[13] = 0x00;
+    req[14] = 0x00;
+    req[15] = 0x00;
+    req[16] = gi ? 0x32 : 0x30;
+    memcpy(req+17, d+i, gi);
+    len = 17 + gi;
+    req[0] = len;
+
+    /** the target host gets Mode and the ATR_REQ */
+    mode = PN532_TG_MODE_DEP | (d[1] << 4) |
+           (d[0] ? 0x01 : (d[1] == NFC_P2P_106K ? 0x00 : 0x02));
+    out[0] = mode;
+    memcpy(out+1, req, len);
+    t->tg_activate(out, 1+len, PN532_EMU_ATR_US);
+
+    /** Status, Tg, NFCID3t DIDt BSt BRt TO PPt [Gt] */
+    out[0] = 0x00;
+    out[1] = 1;
+    memcpy(out+2, t->tg_cfg+25, 10);
+    out[12] = 0x00;
+    out[13] = 0x00;
+    out[14] = 0x00;
+    out[15] = 0x0E;
+    out[16] = t->tg_cfg[35] ? 0x32 : 0x30;
+    memcpy(out+17, t->tg_cfg+36, t->tg_cfg[35]);
+    *olen = 17 + t->tg_cfg[35];
+
+    active = 1;
+    jump_cmd = 0;
+    in_wait = 0;
+    in_more = 0;
+    box_full = 0;
+    byte_us = (d[1] != NFC_P2P_106K) ? PN532_EMU_BYTE_424_US :
+                                       PN532_EMU_BYTE_106_US;
+    t->byte_us = byte_us;
+    return 1;
+}
+
+/** InListPassiveTarget of the linked PN532 armed as PICC, 0 - it is not */
+u8 PN532_Emu::in_picc(u8 *out, u16 *olen)
+{
+    PN532_Emu *t = peer;
+    const u8 *cfg = t->tg_cfg;
+    u8 act[3];
+
+    if(t->tg != EMU_TG_ARMED || (cfg[0] & PN532_TG_DEP_ONLY)){
+        return 0;
+    }
+    /** SENS_RES, SEL_RES, NFCID1 08 + the 3 bytes given, ATS */
+    out[2] = cfg[2];
+    out[3] = cfg[1];
+    out[4] = cfg[6];
+    out[5] = 4;
+    out[6] = 0x08;
+    memcpy(out+7, cfg+3, 3);
+    memcpy(out+10, emu_picc_ats, sizeof(emu_picc_ats));
+    *olen = 10 + sizeof(emu_picc_ats);
+
+    /** the target host gets Mode, PICC at 106 kbps, and the RATS */
+    act[0] = PN532_TG_MODE_PICC;
+    act[1] = 0xE0;
+    act[2] = 0x80;
+    t->tg_activate(act, sizeof(act), PN532_EMU_ATS_US);
+    t->byte_us = PN532_EMU_BYTE_106_US;
+    in_wait = 0;
+    in_more = 0;
+    box_full = 0;
+    return 1;
+}
+
+/** InDataExchange to the linked target, the reply comes from its host */
+u8 PN532_Emu::in_dep(const u8 *d, u8 n)
+{
+    PN532_Emu *t = peer;
+
+    if(in_more){
+        /** the target chains its reply, ask for the next part */
+        in_more = 0;
+        in_wait = 1;
+        if(box_full){
+            t->tg_send();
+        }
+        return 1;
+    }
+    memcpy(t->box, d+1, n-1);
+    t->box_len = n-1;
+    t->box_mi = d[0] & NFC_MI;
+    t->box_full = 1;
+    /** a chained frame is acknowledged once the target host takes it */
+    in_wait = !t->box_mi;
+    t->tg_deliver();
+    return 1;
+}
+
+/** target side commands */
+void PN532_Emu::target(u8 cmd, const u8 *d, u8 n)
+{
+    u8 sta = EMU_ERR_RELEASED;
+
+    switch(cmd){
+    case PN532_COMMAND_TGINITASTARGET:
+        tg_cfg_len = n < sizeof(tg_cfg) ? n : sizeof(tg_cfg);
+        memset(tg_cfg, 0, sizeof(tg_cfg));
+        memcpy(tg_cfg, d, tg_cfg_len);
+        if(tg_cfg[35] > sizeof(tg_cfg)-36){
+            tg_cfg[35] = sizeof(tg_cfg)-36;
+        }
+        tg = EMU_TG_ARMED;
+        box_full = 0;
+        /** answered on activation, maybe by an initiator already waiting */
+        if(peer && peer->card == PN532_EMU_PEER && peer->jump_cmd){
+            u8 out[PN532_EMU_FRAME_MAX], jcmd = peer->jump_cmd;
+            u16 olen;
+
+            peer->in_jump(peer->jump, peer->jump_len, out, &olen);
+            peer->reply(jcmd, out, olen, PN532_EMU_ATR_US);
+        }
+        return;
+    case PN532_COMMAND_TGGETDATA:
+        if(tg == EMU_TG_ACTIVE){
+            tg_get = 1;
+            tg_deliver();
+            return;
+        }
+        break;
+    case PN532_COMMAND_TGSETDATA:
+    case PN532_COMMAND_TGSETMETADATA:
+        if(tg == EMU_TG_ACTIVE){
+            if(tg_ready){
+                /** the target host answers the frame it got */
+                if(host_time_us() - tg_ready > tg_turn){
+                    tg_turn = host_time_us() - tg_ready;
+                }
+                tg_ready = 0;
+            }
+            memcpy(peer->box, d, n);
+            peer->box_len = n;
+            peer->box_mi = (cmd == PN532_COMMAND_TGSETMETADATA) ? NFC_MI : 0;
+            peer->box_full = 1;
+            tg_put = cmd;
+            if(peer->in_wait){
+                tg_send();
+            }
+            return;
+        }
+        break;
+    }
+    reply(cmd, &sta, 1, PN532_EMU_CMD_US);
+}
+
+/** an initiator activated this target, TgInitAsTarget answers d */
+void PN532_Emu::tg_activate(const u8 *d, u8 n, u32 us)
+{
+    tg = EMU_TG_ACTIVE;
+    tg_get = 0;
+    tg_put = 0;
+    tg_ready = 0;
+    box_full = 0;
+    reply(PN532_COMMAND_TGINITASTARGET, d, n, us);
+}
+
+/** hand the frame from the initiator to TgGetData */
+void PN532_Emu::tg_deliver(void)
+{
+    u8 out[PN532_EMU_FRAME_MAX];
+
+    if(!tg_get || !box_full){
+        return;
+    }
+    out[0] = box_mi;
+    memcpy(out+1, box, box_len);
+    reply(PN532_COMMAND_TGGETDATA, out, 1+box_len, air_us(box_len));
+    tg_ready = q[qn-1].ready;
+    tg_get = 0;
+    box_full = 0;
+    if(box_mi){
+        /** ACK PDU to the initiator */
+        out[0] = 0x00;
+        peer->reply(PN532_COMMAND_INDATAEXCHANGE, out, 1, air_us(box_len));
+    }
+}
+
+/** hand the reply of TgSetData/TgSetMetaData to the waiting initiator */
+void PN532_Emu::tg_send(void)
+{
+    PN532_Emu *in = peer;
+    u8 out[PN532_EMU_FRAME_MAX];
+    u32 us = air_us(in->box_len);
+
+    out[0] = in->box_mi;
+    memcpy(out+1, in->box, in->box_len);
+    in->reply(PN532_COMMAND_INDATAEXCHANGE, out, 1+in->box_len, us);
+    in->in_wait = 0;
+    in->in_more = in->box_mi;
+    in->box_full = 0;
+    out[0] = 0x00;
+    reply(tg_put, out, 1, us);
+    tg_put = 0;
+}
+
+/** the initiator released the target, or left */
+void PN532_Emu::tg_release(void)
+{
+    u8 sta = EMU_ERR_RELEASED;
+
+    if(tg != EMU_TG_ACTIVE){
+        return;
+    }
+    tg = EMU_TG_OFF;
+    tg_ready = 0;
+    box_full = 0;
+    if(tg_get){
+        reply(PN532_COMMAND_TGGETDATA, &sta, 1, PN532_EMU_CMD_US);
+    }else if(tg_put){
+        reply(tg_put, &sta, 1, PN532_EMU_CMD_US);
+    }
+    tg_get = 0;
+    tg_put = 0;
+}
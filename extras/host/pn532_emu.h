@@ -0,0 +1,182 @@
+/*
+  pn532_emu.h - PN532 on the host bus, see extras/host.
+
+  Speaks the I2C frame protocol: checks LEN/LCS/DCS, ACKs a command, holds
+  the response until its ready time on the virtual clock and answers status
+  reads meanwhile. A status read (1 byte) leaves the response in place, a
+  longer read takes it. An ACK frame from the host aborts the command.
+  After PowerDown every read is NACKed until the next write.
+
+  Times are fixed per command, so runs are repeatable; they are in the
+  range of a PN532 at 106 kbps, not a model of one.
+
+  Two emulators can be linked, the initiator's field then holds the other
+  PN532 as target: TgInitAsTarget answers when InJumpForDEP/PSL activates
+  it as DEP target, or InListPassiveTarget as ISO14443-4A PICC, and frames
+  pass between InDataExchange on one side and TgGetData/TgSetData/
+  TgSetMetaData on the other, MI chaining included.
+  A response waiting on the other side is held, as on the air.
+*/
+
+#ifndef pn532_emu_h
+#define pn532_emu_h
+
+#include "nfc.h"
+#include "host.h"
+
+/** cards put in the field by PN532_Emu::field() */
+#define PN532_EMU_NONE          0
+#define PN532_EMU_MIFARE_1K     1
+#define PN532_EMU_NTAG216       2
+#define PN532_EMU_ISO_DEP       3   // ISO14443-4, NDEF application
+#define PN532_EMU_P2P           4   // DEP target, echoes every frame
+#define PN532_EMU_PEER          5   // the linked PN532, see link()
+#define PN532_EMU_FELICA_LITE_S 6   // system 88B4, services 0009/000B
+#define PN532_EMU_FELICA        7   // system 0003, services 1009/200B
+#define PN532_EMU_TOPAZ_96      8   // Jewel, HR0 11: RID, RALL, READ
+#define PN532_EMU_TOPAZ_512     9   // Jewel, HR0 12: READ8 as well
+
+/** timing, microseconds */
+#define PN532_EMU_ACK_US        200     // command to ACK
+#define PN532_EMU_CMD_US        600     // commands without RF
+#define PN532_EMU_TRY_US        1500    // passive activation of a card
+#define PN532_EMU_EMPTY_US      4800    // one try that finds no card
+#define PN532_EMU_ATS_US        1200    // RATS/ATS of an ISO-DEP card
+#define PN532_EMU_ATR_US        4000    // ATR_REQ/ATR_RES of a DEP target
+#define PN532_EMU_AUTH_US       2000    // Mifare authentication
+#define PN532_EMU_XCH_US        500     // card exchange overhead
+#define PN532_EMU_PROG_US       4100    // write to card memory
+#define PN532_EMU_BYTE_106_US   85      // one byte on air at 106 kbps
+#define PN532_EMU_BYTE_212_US   43      // one byte on air at 212 kbps
+#define PN532_EMU_BYTE_424_US   22      // one byte on air at 424 kbps
+
+/** PN532 frames of up to 255 data bytes */
+#define PN532_EMU_FRAME_MAX     (255+7)
+
+#define PN532_EMU_NTAG_PAGES    231
+#define PN532_EMU_NDEF_SIZE     128
+#define PN532_EMU_RECORD_LEN    120     // ISO-DEP READ RECORD, by GET RESPONSE
+#define PN532_EMU_FELICA_RW     300     // FeliCa blocks of service 1009
+#define PN532_EMU_FELICA_RO     8       // FeliCa blocks of service 200B
+
+/** byte i of the ISO-DEP record */
+u8 emu_record(u16 i);
+/** byte i of FeliCa service 200B, read only */
+u8 emu_felica_ro(u16 i);
+/** byte i of the NTAG originality signature */
+u8 emu_ntag_sig(u8 i);
+/** ISO14443-3 CRC_A of n bytes */
+u16 emu_crc_a(const u8 *d, u16 n);
+
+class PN532_Emu : public HostBus
+{
+  public:
+    PN532_Emu();
+    /** put card in the field, or take it out with PN532_EMU_NONE */
+    void field(u8 card);
+    /** put peer in the field as DEP target, both ways */
+    void link(PN532_Emu *peer);
+    /** ATS of the ISO-DEP card, from TL on; NULL - the default */
+    void ats(const u8 *ats);
+    /** the ISO-DEP card ignores PPS, InPSL times out */
+    void reject_psl(u8 reject);
+    /** card memory from address 0, e.g. a dump of a real card; after field() */
+    void memory(const u8 *data, u16 len);
+    u8 write(u8 addr, const u8 *buf, u8 len);
+    u8 read(u8 addr, u8 *buf, u8 len);
+    /** command frames processed, frames dropped on a bad checksum */
+    u32 frames(void);
+    u32 errors(void);
+    /** blocks and pages programmed on the cards, EEPROM wear */
+    u32 writes(void);
+    /** PN532 is in power down, until the next address match */
+    u8 sleeping(void);
+    /**
+        target side: longest time from a frame ready for TgGetData to the
+        TgSetData/TgSetMetaData answering it, microseconds
+    */
+    u32 turnaround(void);
+
+  private:
+    typedef struct{
+        u8 buf[PN532_EMU_FRAME_MAX];
+        u16 len;
+        uint64_t ready;
+    }rsp_t;
+
+    void command(u8 cmd, const u8 *d, u8 n);
+    void reply(u8 cmd, const u8 *d, u16 n, u32 us);
+    void error_frame(void);
+    void queue(const u8 *frame, u16 len, u32 us);
+    u8 in_list(const u8 *d, u8 n, u8 *out, u16 *olen, u32 *us);
+    u8 exchange(const u8 *d, u8 n, u8 *out, u16 *olen, u32 *us);
+    u8 mifare(const u8 *d, u8 n, u8 *out, u16 *olen, u32 *us);
+    u8 ntag(const u8 *d, u8 n, u8 *out, u16 *olen, u32 *us);
+    u8 felica_poll(const u8 *d, u8 n, u8 *out, u16 *olen);
+    u8 felica(const u8 *d, u8 n, u8 *out, u16 *olen, u32 *us);
+    u8 *felica_block(u16 svc, u16 num, u8 wr);
+    u8 topaz(const u8 *d, u8 n, u8 *out, u16 *olen);
+    u8 thru(const u8 *d, u8 n, u8 *out, u16 *olen, u32 *us);
+    u16 apdu(const u8 *d, u16 n, u8 *out);
+    u8 in_jump(const u8 *d, u8 n, u8 *out, u16 *olen);
+    u8 in_picc(u8 *out, u16 *olen);
+    u8 in_dep(const u8 *d, u8 n);
+    void target(u8 cmd, const u8 *d, u8 n);
+    void tg_activate(const u8 *d, u8 n, u32 us);
+    void tg_deliver(void);
+    void tg_send(void);
+    void tg_release(void);
+    u32 air_us(u16 n);
+
+    rsp_t q[2];             // ACK and response
+    u8 qn;
+    u8 asleep;
+    u8 sleep_next;          // power down once the response is read
+    u8 card;                // PN532_EMU_*
+    u8 active;              // card activated by InListPassiveTarget
+    u8 rty_passive;         // MxRtyPassiveActivation, 0xFF - forever
+    u8 byte_us;             // time of a byte on air
+    u8 auth;                // Mifare authenticated sector, 0xFF - none
+    u8 vset;                // Mifare value register loaded, for TRANSFER
+    u8 vaddr;
+    u32 vreg;
+    u8 counted;             // NTAG NFC counter bumped by this activation
+    u32 ntag_cnt;
+    u8 ats_buf[16];         // ISO-DEP, ATS from TL on
+    u8 psl_reject;
+    u8 app;                 // ISO-DEP, NDEF application selected
+    u16 file;               // ISO-DEP, selected file id
+    u8 chain[256];          // ISO-DEP, chained C-APDU
+    u16 chain_len;
+    u16 rec_off;            // ISO-DEP, record left for GET RESPONSE
+    u16 rec_left;
+    u32 nframes;
+    u32 nerrors;
+    u32 nwrites;
+    u8 reg[0x10000];
+    u8 gpio[2];
+    /** card memory, FeliCa Standard is the largest */
+    u8 mem[(PN532_EMU_FELICA_RW+PN532_EMU_FELICA_RO)*16];
+    u8 ndef[PN532_EMU_NDEF_SIZE];
+
+    /** linked PN532, initiator and target side */
+    PN532_Emu *peer;
+    u8 jump[64];            // InJumpForDEP/PSL waiting for the target
+    u8 jump_len;
+    u8 jump_cmd;            // 0 - none
+    u8 in_wait;             // InDataExchange waits for TgSetData
+    u8 in_more;             // last reply had MI, next exchange asks more
+    u8 tg;                  // EMU_TG_*
+    u8 tg_cfg[64];          // TgInitAsTarget parameters
+    u8 tg_cfg_len;
+    u8 tg_get;              // TgGetData waits for a frame
+    u8 tg_put;              // TgSetData/TgSetMetaData command waiting
+    u8 box[256];            // frame on the way to the host of this side
+    u8 box_len;
+    u8 box_mi;
+    u8 box_full;
+    uint64_t tg_ready;      // time the frame for TgGetData was ready
+    u32 tg_turn;
+};
+
+#endif
@@ -0,0 +1,70 @@
+/*
+  presence_test.cpp - TargetPresent() against the PN532 emulator while the
+  target leaves the field: present, then removed on the first failed probe,
+  then absent. Both probes are run, Diagnose on an ISO14443-4 card and a
+  block read on a Mifare card. A target number outside 1..2 must report
+  absent without a command sent to PN532.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+
+static NFC_Module nfc;
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+/** select the card, then take it away between two probes */
+static void leave(PN532_Emu &emu, u8 card, u8 probe, u8 block)
+{
+    u8 key[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    u8 uid[NFC_UID_MAX_LEN+1];
+    u16 ms = 0xFFFF;
+
+    emu.field(card);
+    CHECK(nfc.InListPassiveTarget(uid));
+    if(probe == NFC_PROBE_READ){
+        CHECK(nfc.MifareAuthentication(0, block, uid+1, uid[0], key));
+    }
+    CHECK(nfc.TargetPresent(1, probe, block, &ms) == NFC_TG_PRESENT);
+    CHECK(ms < 100);
+    CHECK(nfc.TargetPresent(1, probe, block) == NFC_TG_PRESENT);
+
+    emu.field(PN532_EMU_NONE);
+    CHECK(nfc.TargetPresent(1, probe, block) == NFC_TG_REMOVED);
+    CHECK(nfc.TargetPresent(1, probe, block) == NFC_TG_ABSENT);
+    CHECK(nfc.TargetPresent(1, probe, block) == NFC_TG_ABSENT);
+}
+
+int main(void)
+{
+    static PN532_Emu emu;
+    u32 frames;
+    u16 ms = 0xFFFF;
+
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+    CHECK(nfc.RFPreset(NFC_RF_PRESET_FAST_POLL));
+
+    leave(emu, PN532_EMU_ISO_DEP, NFC_PROBE_DIAGNOSE, 0);
+    leave(emu, PN532_EMU_MIFARE_1K, NFC_PROBE_READ, 4);
+
+    /** no bit of the target state for these */
+    frames = emu.frames();
+    CHECK(nfc.TargetPresent(0, NFC_PROBE_DIAGNOSE, 0, &ms) == NFC_TG_ABSENT);
+    CHECK(ms == 0);
+    CHECK(nfc.TargetPresent(3) == NFC_TG_ABSENT);
+    CHECK(nfc.TargetPresent(0xFF, NFC_PROBE_READ, 4) == NFC_TG_ABSENT);
+    CHECK(emu.frames() == frames);
+
+    CHECK(!emu.errors());
+    return failed;
+}
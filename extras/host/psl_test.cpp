@@ -0,0 +1,162 @@
+/*
+  psl_test.cpp - bit rate upgrade of InListPassiveTarget() for ISO14443-4A
+  cards, fed ATS variants by the PN532 emulator.
+
+  For each variant the InPSL frames of the selection are taken from a bus
+  trace: none when the ATS has no TA(1), allows 106 kbps only, or only
+  rates PN532 lacks, or when SetPSLPolicy() turns the upgrade off; else one
+  with the highest rate of each direction within the policy, a common one
+  when TA(1) asks for the same divisor both ways. Then a READ RECORD, 120
+  bytes in three GET RESPONSE frames, is timed: faster than at 106 kbps
+  after an InPSL, as fast otherwise. A card that ignores PPS must leave
+  the target selected, at 106 kbps.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+#include "trace_log.h"
+
+static NFC_Module nfc;
+static u8 mem[2048];
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+#define NO_PSL  0xFF
+
+typedef struct{
+    u8 ats[8];          // from TL on
+    u8 policy;          // SetPSLPolicy()
+    u8 brit, brti;      // InPSL sent, NO_PSL - none
+    const char *name;
+}variant_t;
+
+static const variant_t variants[] = {
+    { { 0x02, 0x05 }, PN532_BRTY_424KBPS, NO_PSL, 0, "no interface bytes" },
+    { { 0x05, 0x45, 0x00, 0x81, 0x80 }, PN532_BRTY_424KBPS, NO_PSL, 0,
+      "no TA(1)" },
+    { { 0x05, 0x15, 0x00, 0x80, 0x01 }, PN532_BRTY_424KBPS, NO_PSL, 0,
+      "TA(1) 106 only" },
+    { { 0x05, 0x15, 0x44, 0x80, 0x01 }, PN532_BRTY_424KBPS, NO_PSL, 0,
+      "TA(1) 848 only" },
+    { { 0x06, 0x75, 0x77, 0x81, 0x02, 0x80 }, PN532_BRTY_424KBPS,
+      PN532_BRTY_424KBPS, PN532_BRTY_424KBPS, "TA(1) up to 848" },
+    { { 0x05, 0x15, 0x13, 0x80, 0x01 }, PN532_BRTY_424KBPS,
+      PN532_BRTY_424KBPS, PN532_BRTY_212KBPS, "TA(1) DR 212/424, DS 212" },
+    { { 0x05, 0x15, 0x93, 0x80, 0x01 }, PN532_BRTY_424KBPS,
+      PN532_BRTY_212KBPS, PN532_BRTY_212KBPS, "TA(1) same divisor" },
+    { { 0x06, 0x75, 0x77, 0x81, 0x02, 0x80 }, PN532_BRTY_212KBPS,
+      PN532_BRTY_212KBPS, PN532_BRTY_212KBPS, "policy 212" },
+    { { 0x06, 0x75, 0x77, 0x81, 0x02, 0x80 }, NFC_PSL_OFF, NO_PSL, 0,
+      "policy off" },
+};
+#define VARIANTS    (sizeof(variants)/sizeof(variants[0]))
+
+/** InPSL frames of the trace; the last one in brit/brti */
+static u8 psl_frames(NFC_Trace &trace, u8 *brit, u8 *brti)
+{
+    trace_rec_t r;
+    u32 pos = 0;
+    u8 n = 0;
+
+    while(trace_next(trace.data(), trace.length(), &pos, &r)){
+        /** 00 00 FF LEN LCS D4 4E Tg BRit BRti DCS 00 */
+        if(r.tx && r.n >= 12 && r.data[5] == 0xD4 &&
+           r.data[6] == PN532_COMMAND_INPSL){
+            CHECK(r.data[3] == 5 && r.data[7] == 1);
+            *brit = r.data[8];
+            *brti = r.data[9];
+            n++;
+        }
+    }
+    return n;
+}
+
+/** READ RECORD on the selected card, 120 bytes by GET RESPONSE; us */
+static u32 read_record(void)
+{
+    const u8 capdu[5] = { 0x00, 0xB2, 0x01, 0x04, 0x00 };
+    u8 rapdu[PN532_EMU_RECORD_LEN+2];
+    u16 rlen = sizeof(rapdu);
+    u32 t = micros();
+
+    CHECK(nfc.ApduTransceive(1, capdu, sizeof(capdu), rapdu, &rlen));
+    CHECK(rlen == sizeof(rapdu) && rapdu[rlen-2] == 0x90);
+    return micros() - t;
+}
+
+/** select the card with ats, returns the InPSL frames */
+static u8 select(const u8 *ats, u8 *brit, u8 *brti, NFC_Trace &trace)
+{
+    u8 uid[NFC_UID_MAX_LEN+1];
+    PN532_Emu *emu = (PN532_Emu *)host_bus();
+
+    emu->field(PN532_EMU_ISO_DEP);
+    emu->ats(ats);
+    trace.clear();
+    nfc.Trace(&trace);
+    CHECK(nfc.InListPassiveTarget(uid));
+    nfc.Trace(NULL);
+    CHECK(!trace.overflow());
+    return psl_frames(trace, brit, brti);
+}
+
+int main(void)
+{
+    static PN532_Emu emu;
+    NFC_Trace trace(mem, sizeof(mem));
+    u8 brit, brti, n;
+    u32 base, t;
+
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+
+    /** 106 kbps both ways */
+    nfc.SetPSLPolicy(1, NFC_PSL_OFF);
+    CHECK(select(NULL, &brit, &brti, trace) == 0);
+    base = read_record();
+
+    for(u8 i=0; i<VARIANTS; i++){
+        const variant_t *v = &variants[i];
+
+        nfc.SetPSLPolicy(1, v->policy);
+        n = select(v->ats, &brit, &brti, trace);
+        t = read_record();
+        if(v->brit == NO_PSL){
+            CHECK(n == 0);
+            CHECK(t == base);
+        }else{
+            CHECK(n == 1 && brit == v->brit && brti == v->brti);
+            CHECK(t < base);
+        }
+        if(failed){
+            fprintf(stderr, "variant: %s\n", v->name);
+            return failed;
+        }
+        printf("%-26s InPSL %s, READ RECORD %lu us\n", v->name,
+               n ? "sent" : "none", (unsigned long)t);
+    }
+
+    /** the policy is per target, target 2 leaves target 1 alone */
+    nfc.SetPSLPolicy(1, PN532_BRTY_424KBPS);
+    nfc.SetPSLPolicy(2, NFC_PSL_OFF);
+    CHECK(select(NULL, &brit, &brti, trace) == 1);
+
+    /** the card ignores PPS: still selected, at 106 kbps */
+    emu.reject_psl(1);
+    CHECK(select(NULL, &brit, &brti, trace) == 1);
+    CHECK(read_record() == base);
+    emu.reject_psl(0);
+
+    CHECK(!emu.errors());
+    printf("READ RECORD at 106 kbps %lu us\n", (unsigned long)base);
+    return failed;
+}
@@ -0,0 +1,184 @@
+/*
+  register_test.cpp - ReadRegister(), WriteRegister() and WriteRegisterBits()
+  against the register file of the PN532 emulator, and their shadow cache.
+
+  Packing: the registers of each ReadRegister/WriteRegister frame are taken
+  from a bus trace, NFC_REG_READ_MAX or NFC_REG_WRITE_MAX a frame and the
+  rest in the next. Cache: a write of the cached value sends nothing, a
+  changed one sends only that register, and the oldest of more than
+  NFC_REG_CACHE_SIZE registers is written again. A bit field costs a read
+  and a write when not cached, a write when cached, nothing when the bits
+  are already set. Coherency: InListPassiveTarget and RFConfiguration
+  drop the cache, so a write after them reaches the chip; a write behind
+  the library's back, by a second NFC_Module, needs RegisterCacheClear().
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+#include "trace_log.h"
+
+static NFC_Module nfc;
+static u8 mem[1024];
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+#define REGS        30
+
+static NFC_Trace trace(mem, sizeof(mem));
+
+/** registers of ReadRegister/WriteRegister frame i of the trace */
+static u8 frame_regs(u8 cmd, u8 i)
+{
+    trace_rec_t r;
+    u32 pos = 0;
+
+    while(trace_next(trace.data(), trace.length(), &pos, &r)){
+        /** 00 00 FF LEN LCS D4 CMD (ADDR_H ADDR_L [VAL])... DCS 00 */
+        if(r.tx && r.n > 8 && r.data[5] == 0xD4 && r.data[6] == cmd &&
+           !i--){
+            return (r.data[3] - 2) / (cmd == PN532_COMMAND_READREGISTER ? 2 : 3);
+        }
+    }
+    return 0;
+}
+
+static void start(void)
+{
+    trace.clear();
+    nfc.Trace(&trace);
+}
+
+static u16 stop(void)
+{
+    nfc.Trace(NULL);
+    CHECK(!trace.overflow());
+    return trace.commands();
+}
+
+/** value on the chip, read past the cache */
+static u8 chip(u16 addr)
+{
+    u8 val = 0;
+
+    CHECK(nfc.ReadRegister(addr, &val));
+    return val;
+}
+
+static void packing(const u16 *addr, u8 *val)
+{
+    u8 got[REGS];
+    u8 i;
+
+    for(i=0; i<REGS; i++){
+        val[i] = i*9 + 2;
+    }
+    start();
+    CHECK(nfc.WriteRegister(addr, val, REGS));
+    CHECK(stop() == 2);
+    CHECK(frame_regs(PN532_COMMAND_WRITEREGISTER, 0) == NFC_REG_WRITE_MAX);
+    CHECK(frame_regs(PN532_COMMAND_WRITEREGISTER, 1) == REGS-NFC_REG_WRITE_MAX);
+
+    start();
+    CHECK(nfc.ReadRegister(addr, got, REGS));
+    CHECK(stop() == 2);
+    CHECK(frame_regs(PN532_COMMAND_READREGISTER, 0) == NFC_REG_READ_MAX);
+    CHECK(frame_regs(PN532_COMMAND_READREGISTER, 1) == REGS-NFC_REG_READ_MAX);
+    CHECK(!memcmp(got, val, REGS));
+}
+
+static void cache(const u16 *addr, u8 *val)
+{
+    const u16 *last = addr + REGS - NFC_REG_CACHE_SIZE;
+    u8 *lval = val + REGS - NFC_REG_CACHE_SIZE;
+
+    /** the last NFC_REG_CACHE_SIZE written are cached */
+    start();
+    CHECK(nfc.WriteRegister(last, lval, NFC_REG_CACHE_SIZE));
+    CHECK(stop() == 0);
+    lval[3] ^= 0x5A;
+    start();
+    CHECK(nfc.WriteRegister(last, lval, NFC_REG_CACHE_SIZE));
+    CHECK(stop() == 1);
+    CHECK(frame_regs(PN532_COMMAND_WRITEREGISTER, 0) == 1);
+    CHECK(chip(last[3]) == lval[3]);
+
+    /** the first was dropped for a later one */
+    start();
+    CHECK(nfc.WriteRegister(addr[0], val[0]));
+    CHECK(stop() == 1);
+
+    /** bit field: not cached, cached, unchanged */
+    start();
+    CHECK(nfc.WriteRegisterBits(addr[1], 0xF0, 0xA0));
+    CHECK(stop() == 2);
+    CHECK(chip(addr[1]) == ((val[1] & 0x0F) | 0xA0));
+    start();
+    CHECK(nfc.WriteRegisterBits(addr[1], 0x03, 0x01));
+    CHECK(stop() == 1);
+    CHECK(chip(addr[1]) == ((val[1] & 0x0C) | 0xA1));
+    start();
+    CHECK(nfc.WriteRegisterBits(addr[1], 0xF3, 0xA1));
+    CHECK(stop() == 0);
+}
+
+static void coherency(u16 addr)
+{
+    static NFC_Module other;
+    u8 uid[NFC_UID_MAX_LEN+1];
+
+    CHECK(nfc.WriteRegister(addr, 0x11));
+    CHECK(nfc.InListPassiveTarget(uid));
+    start();
+    CHECK(nfc.WriteRegister(addr, 0x11));
+    CHECK(stop() == 1);
+
+    CHECK(nfc.RFMaxRetryCOM(0));
+    start();
+    CHECK(nfc.WriteRegister(addr, 0x11));
+    CHECK(stop() == 1);
+
+    /** the shadow copy is stale */
+    CHECK(other.WriteRegister(addr, 0x22));
+    start();
+    CHECK(nfc.WriteRegister(addr, 0x11));
+    CHECK(stop() == 0);
+    CHECK(chip(addr) == 0x22);
+    nfc.RegisterCacheClear();
+    start();
+    CHECK(nfc.WriteRegister(addr, 0x11));
+    CHECK(stop() == 1);
+    CHECK(chip(addr) == 0x11);
+}
+
+int main(void)
+{
+    static PN532_Emu emu;
+    u16 addr[REGS];
+    u8 val[REGS];
+
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+    emu.field(PN532_EMU_MIFARE_1K);
+
+    for(u8 i=0; i<REGS; i++){
+        addr[i] = 0x6330 + i;
+    }
+    packing(addr, val);
+    cache(addr, val);
+    /** CIU_RFCfg, receiver gain */
+    coherency(0x6316);
+
+    CHECK(!emu.errors());
+    printf("%u registers in 2 frames each way, cache of %u\n", REGS,
+           NFC_REG_CACHE_SIZE);
+    return failed;
+}
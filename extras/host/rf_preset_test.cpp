@@ -0,0 +1,116 @@
+/*
+  rf_preset_test.cpp - the RFConfiguration frames RFPreset() sends for each
+  preset, taken from a bus trace against the PN532 emulator and compared
+  with the items and values of PN532UM written out by hand: MxRetries (5),
+  timings (2), analog settings of 106 kbps type A (0x0A) and RF field (1),
+  in that order. An unknown preset must send nothing.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+#include "trace_log.h"
+
+static NFC_Module nfc;
+static u8 mem[1024];
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+/** RFConfiguration data: item, then its values */
+typedef struct{
+    u8 len;
+    u8 data[12];
+}rf_item_t;
+
+#define ANALOG_106A(gain) \
+    { 12, { 0x0A, gain, 0xF4, 0x3F, 0x11, 0x4D, 0x85, 0x61, 0x6F, 0x26, \
+            0x62, 0x87 } }
+
+static const rf_item_t expect[NFC_RF_PRESET_NUM][4] = {
+    /** NFC_RF_PRESET_DEFAULT */
+    { { 4, { 0x05, 0xFF, 0x01, 0xFF } }, { 4, { 0x02, 0x00, 0x0B, 0x0A } },
+      ANALOG_106A(0x59), { 2, { 0x01, 0x01 } } },
+    /** NFC_RF_PRESET_FAST_POLL */
+    { { 4, { 0x05, 0xFF, 0x01, 0x01 } }, { 4, { 0x02, 0x00, 0x0B, 0x07 } },
+      ANALOG_106A(0x59), { 2, { 0x01, 0x01 } } },
+    /** NFC_RF_PRESET_LONG_RANGE */
+    { { 4, { 0x05, 0xFF, 0x01, 0x10 } }, { 4, { 0x02, 0x00, 0x0B, 0x0A } },
+      ANALOG_106A(0x79), { 2, { 0x01, 0x01 } } },
+    /** NFC_RF_PRESET_LOW_POWER */
+    { { 4, { 0x05, 0xFF, 0x01, 0x00 } }, { 4, { 0x02, 0x00, 0x0B, 0x06 } },
+      ANALOG_106A(0x59), { 2, { 0x01, 0x00 } } },
+};
+
+/** RFConfiguration frames of the trace, returns how many matched */
+static u8 check_frames(NFC_Trace &trace, const rf_item_t *items)
+{
+    trace_rec_t r;
+    u32 pos = 0;
+    u8 n = 0, sum;
+
+    while(trace_next(trace.data(), trace.length(), &pos, &r)){
+        /** 00 00 FF LEN LCS D4 32 item values DCS 00 */
+        if(!r.tx || r.n < 9 || r.data[5] != 0xD4){
+            continue;
+        }
+        CHECK(r.data[6] == PN532_COMMAND_RFCONFIGURATION);
+        CHECK(n < 4);
+        if(n >= 4){
+            return n;
+        }
+        CHECK(r.data[3] == items[n].len+2);
+        CHECK((u8)(r.data[3] + r.data[4]) == 0);
+        CHECK(!memcmp(r.data+7, items[n].data, items[n].len));
+        sum = 0;
+        for(u8 i=5; i<r.n-1; i++){
+            sum += r.data[i];
+        }
+        CHECK(sum == 0);
+        n++;
+    }
+    CHECK(pos == trace.length());
+    return n;
+}
+
+int main(void)
+{
+    static PN532_Emu emu;
+    NFC_Trace trace(mem, sizeof(mem));
+    u8 uid[NFC_UID_MAX_LEN+1];
+
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+
+    for(u8 p=0; p<NFC_RF_PRESET_NUM; p++){
+        trace.clear();
+        nfc.Trace(&trace);
+        CHECK(nfc.RFPreset(p));
+        nfc.Trace(NULL);
+        CHECK(!trace.overflow());
+        CHECK(trace.commands() == 4);
+        CHECK(check_frames(trace, expect[p]) == 4);
+    }
+
+    trace.clear();
+    nfc.Trace(&trace);
+    CHECK(!nfc.RFPreset(NFC_RF_PRESET_NUM));
+    CHECK(!nfc.RFPreset(0xFF));
+    nfc.Trace(NULL);
+    CHECK(trace.commands() == 0 && trace.bytes() == 0);
+
+    /** the emulator took MxRtyPassiveActivation from the frames */
+    CHECK(nfc.RFPreset(NFC_RF_PRESET_FAST_POLL));
+    emu.field(PN532_EMU_NONE);
+    CHECK(!nfc.InListPassiveTarget(uid));
+
+    CHECK(!emu.errors());
+    return failed;
+}
@@ -0,0 +1,46 @@
+/*
+  Arduino.h - host stand-in of the Arduino core, used to build the NFC
+  library on Linux, see extras/host. Time is a virtual clock driven by
+  delay() and the I2C bus, so host runs are deterministic; host.h has it.
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Stream.h"
+
+#define LOW     0
+#define HIGH    1
+#define INPUT   0
+#define OUTPUT  1
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+class HardwareSerial : public Stream
+{
+  public:
+    void begin(unsigned long baud);
+    virtual size_t write(uint8_t c);
+    virtual int available(void);
+    virtual int read(void);
+    virtual int peek(void);
+    virtual void flush(void);
+    using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+#endif
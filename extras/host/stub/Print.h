@@ -0,0 +1,78 @@
+/*
+  Print.h - host stand-in of the Arduino Print class, used to build the
+  NFC library on Linux, see extras/host.
+*/
+
+#ifndef Print_h
+#define Print_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class Print
+{
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+        size_t n = 0;
+        while(size--){
+            n += write(*buffer++);
+        }
+        return n;
+    }
+    size_t write(const char *str)
+    {
+        return write((const uint8_t *)str, strlen(str));
+    }
+
+    size_t print(const char str[]) { return write(str); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(long n, int base = DEC)
+    {
+        if(base == DEC && n < 0){
+            return print('-') + number(-(unsigned long)n, base);
+        }
+        return number((unsigned long)n, base);
+    }
+    size_t print(unsigned long n, int base = DEC) { return number(n, base); }
+
+    size_t println(void) { return write((const uint8_t *)"\r\n", 2); }
+    size_t println(const char str[]) { return print(str) + println(); }
+    size_t println(char c) { return print(c) + println(); }
+    size_t println(unsigned char n, int base = DEC) { return print(n, base) + println(); }
+    size_t println(int n, int base = DEC) { return print(n, base) + println(); }
+    size_t println(unsigned int n, int base = DEC) { return print(n, base) + println(); }
+    size_t println(long n, int base = DEC) { return print(n, base) + println(); }
+    size_t println(unsigned long n, int base = DEC) { return print(n, base) + println(); }
+
+  private:
+    size_t number(unsigned long n, int base)
+    {
+        char buf[8 * sizeof(long) + 1];
+        char *str = &buf[sizeof(buf) - 1];
+
+        *str = '\0';
+        if(base < 2){
+            base = 10;
+        }
+        do{
+            char c = n % base;
+            n /= base;
+            *--str = c < 10 ? c + '0' : c + 'A' - 10;
+        }while(n);
+        return write(str);
+    }
+};
+
+#endif
@@ -0,0 +1,20 @@
+/*
+  Stream.h - host stand-in of the Arduino Stream class, used to build the
+  NFC library on Linux, see extras/host.
+*/
+
+#ifndef Stream_h
+#define Stream_h
+
+#include "Print.h"
+
+class Stream : public Print
+{
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() = 0;
+};
+
+#endif
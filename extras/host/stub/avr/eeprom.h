@@ -0,0 +1,13 @@
+/*
+  avr/eeprom.h - host stand-in, the EEPROM is an array of the host runtime.
+*/
+
+#ifndef _AVR_EEPROM_H_
+#define _AVR_EEPROM_H_
+
+#include <stddef.h>
+
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_update_block(const void *src, void *dst, size_t n);
+
+#endif
@@ -0,0 +1,18 @@
+/*
+  avr/pgmspace.h - host stand-in, flash data is ordinary memory.
+*/
+
+#ifndef __PGMSPACE_H_
+#define __PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define memcpy_P memcpy
+#define memcmp_P memcmp
+
+#endif
@@ -0,0 +1,156 @@
+/*
+  thru_test.cpp - InCommunicateThru() against the NTAG216 of the PN532
+  emulator, which frames the data on air as CIU_TxMode, RxMode, ManualRCV
+  and BitFraming say.
+
+  READ_SIG with the default CRC both ways. READ with TX CRC off and the
+  CRC_A given by the caller, with a broken one the tag stays silent; with
+  RX CRC off the tag's CRC_A comes back with the page data. Frames without
+  parity reach no tag. A 7-bit WUPA without CRC gets ATQA, but not with
+  RX CRC on, since ATQA has none. Register frames are counted: the CIU
+  registers are read once after activation, and written only when a call
+  changes them, with nothing but the changed ones in the frame.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+#include "trace_log.h"
+
+static NFC_Module nfc;
+static u8 mem[2048];
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+static NFC_Trace trace(mem, sizeof(mem));
+static u8 rbuf[64], rlen;
+
+/** registers in frames of cmd, frames in *frames */
+static u8 regs(u8 cmd, u8 *frames)
+{
+    trace_rec_t r;
+    u32 pos = 0;
+    u8 n = 0;
+
+    *frames = 0;
+    while(trace_next(trace.data(), trace.length(), &pos, &r)){
+        /** 00 00 FF LEN LCS D4 CMD (ADDR_H ADDR_L [VAL])... DCS 00 */
+        if(r.tx && r.n > 8 && r.data[5] == 0xD4 && r.data[6] == cmd){
+            n += (r.data[3] - 2) / (cmd == PN532_COMMAND_READREGISTER ? 2 : 3);
+            (*frames)++;
+        }
+    }
+    return n;
+}
+
+/** InCommunicateThru() traced, returns its result */
+static u8 thru(const u8 *t, u8 tlen, u8 flags, u8 last_bits=0)
+{
+    u8 ok;
+
+    trace.clear();
+    nfc.Trace(&trace);
+    rlen = sizeof(rbuf);
+    ok = nfc.InCommunicateThru(t, tlen, rbuf, &rlen, flags, last_bits);
+    nfc.Trace(NULL);
+    CHECK(!trace.overflow());
+    return ok;
+}
+
+/** register frames of the last call: reads, then written registers */
+static void reg_frames(u8 reads, u8 written)
+{
+    u8 frames, n;
+
+    regs(PN532_COMMAND_READREGISTER, &frames);
+    CHECK(frames == reads);
+    n = regs(PN532_COMMAND_WRITEREGISTER, &frames);
+    CHECK(n == written && frames == (written ? 1 : 0));
+}
+
+int main(void)
+{
+    static PN532_Emu emu;
+    const u8 read_sig[2] = { NTAG_CMD_READ_SIG, 0x00 };
+    const u8 wupa[1] = { 0x52 };
+    const u8 read0[2] = { MIFARE_CMD_READ, 0x00 };
+    u8 uid[NFC_UID_MAX_LEN+1], page[16];
+    u8 read4[4] = { MIFARE_CMD_READ, 0x04 };
+    u16 crc;
+
+    /** ISO14443-3: READ of page 0 is 30 00 02 A8 on air */
+    CHECK(emu_crc_a(read0, 2) == 0xA802);
+
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+    emu.field(PN532_EMU_NTAG216);
+    CHECK(nfc.InListPassiveTarget(uid));
+    CHECK(nfc.MifareReadBlock(4, page));
+
+    /** read once after activation, already the default */
+    CHECK(thru(read_sig, 2, NFC_THRU_DEFAULT));
+    CHECK(trace.commands() == 2);
+    reg_frames(1, 0);
+    CHECK(rlen == NTAG_SIG_LEN);
+    for(u8 i=0; i<NTAG_SIG_LEN; i++){
+        CHECK(rbuf[i] == emu_ntag_sig(i));
+    }
+    CHECK(thru(read_sig, 2, NFC_THRU_DEFAULT));
+    CHECK(trace.commands() == 1);
+
+    /** TX CRC by the caller, then a broken one */
+    crc = emu_crc_a(read4, 2);
+    read4[2] = crc;
+    read4[3] = crc >> 8;
+    CHECK(thru(read4, 4, NFC_THRU_RX_CRC));
+    CHECK(trace.commands() == 2);
+    reg_frames(0, 1);
+    CHECK(rlen == 16 && !memcmp(rbuf, page, 16));
+    read4[3] ^= 0x01;
+    CHECK(!thru(read4, 4, NFC_THRU_RX_CRC));
+    CHECK(trace.commands() == 1);
+    read4[3] ^= 0x01;
+
+    /** the tag's CRC_A passed on */
+    CHECK(thru(read4, 2, NFC_THRU_TX_CRC));
+    CHECK(trace.commands() == 2);
+    reg_frames(0, 2);
+    CHECK(rlen == 18 && !memcmp(rbuf, page, 16));
+    crc = emu_crc_a(rbuf, 16);
+    CHECK(rbuf[16] == (u8)crc && rbuf[17] == (u8)(crc >> 8));
+
+    /** no parity, then back to the default in one frame */
+    CHECK(!thru(read4, 2, NFC_THRU_DEFAULT|NFC_THRU_NO_PARITY));
+    CHECK(thru(read4, 2, NFC_THRU_DEFAULT));
+    CHECK(trace.commands() == 2);
+    reg_frames(0, 1);
+    CHECK(rlen == 16 && !memcmp(rbuf, page, 16));
+
+    /** 7 bits: no ATQA with CRC checked, ATQA 44 00 without */
+    CHECK(!thru(wupa, 1, NFC_THRU_RX_CRC, 7));
+    CHECK(nfc.InListPassiveTarget(uid));
+    CHECK(!thru(wupa, 1, NFC_THRU_DEFAULT, 7));
+    /** TxLastBits stays, both CRC bits change */
+    CHECK(thru(wupa, 1, 0, 7));
+    CHECK(trace.commands() == 2);
+    reg_frames(0, 2);
+    CHECK(rlen == 2 && rbuf[0] == 0x44 && rbuf[1] == 0x00);
+
+    /** activation resets the CIU, which is read again */
+    CHECK(nfc.InListPassiveTarget(uid));
+    CHECK(thru(read_sig, 2, NFC_THRU_DEFAULT));
+    CHECK(trace.commands() == 2);
+    reg_frames(1, 0);
+
+    CHECK(!emu.errors());
+    printf("InCommunicateThru with CRC_A by the PN532 and by the caller\n");
+    return failed;
+}
@@ -0,0 +1,145 @@
+/*
+  topaz_test.cpp - InListJewel() and TopazReadAll() against the Topaz tags
+  of the PN532 emulator, loaded with dumps recorded from a Topaz 96 tag
+  and a Topaz 512 conference badge.
+
+  Built twice: with the default 64-byte frames, where a Topaz 512 is read
+  by RID and 15 READ8 and a Topaz 96 by RID and 120 READ, and with
+  NFC_CMD_BUF_LEN 132, where either is one RALL. The Topaz frames on the
+  bus are checked against the ones recorded for each, and the data
+  against the dump. A tag with another UID in the field must not answer.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+#include "trace_log.h"
+
+static NFC_Module nfc;
+static u8 mem[16384];
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+/** blocks 0..E: UID, CC, NDEF TLV with the URI http://www.elechouse.com */
+static const u8 dump_96[120] = {
+    0x3B, 0x92, 0x16, 0x8E, 0x00, 0x00, 0x00, 0x00,
+    0xE1, 0x10, 0x0E, 0x00, 0x03, 0x12, 0xD1, 0x01,
+    0x0E, 0x55, 0x01, 'e',  'l',  'e',  'c',  'h',
+    'o',  'u',  's',  'e',  '.',  'c',  'o',  'm',
+    0xFE,
+};
+
+/**
+    blocks 0..E: UID, CC, lock and memory control TLVs, NDEF TLV with the
+    URI https://conf.example/b/4711
+*/
+static const u8 dump_512[120] = {
+    0x6A, 0x2C, 0x01, 0x4E, 0x12, 0x00, 0x00, 0x00,
+    0xE1, 0x10, 0x3F, 0x00, 0x01, 0x03, 0xF2, 0x30,
+    0x33, 0x02, 0x03, 0xF0, 0x02, 0x03, 0x03, 0x18,
+    0xD1, 0x01, 0x14, 0x55, 0x04, 'c',  'o',  'n',
+    'f',  '.',  'e',  'x',  'a',  'm',  'p',  'l',
+    'e',  '/',  'b',  '/',  '4',  '7',  '1',  '1',
+    0xFE,
+};
+
+/** Topaz command of InDataExchange frame i of the trace, NULL - none */
+static const u8 *topaz_frame(NFC_Trace &trace, u16 i, u8 *len)
+{
+    trace_rec_t r;
+    u32 pos = 0;
+
+    while(trace_next(trace.data(), trace.length(), &pos, &r)){
+        /** 00 00 FF LEN LCS D4 40 Tg CMD ... DCS 00 */
+        if(r.tx && r.n > 10 && r.data[5] == 0xD4 &&
+           r.data[6] == PN532_COMMAND_INDATAEXCHANGE && !i--){
+            *len = r.data[3] - 3;
+            return r.data + 8;
+        }
+    }
+    return NULL;
+}
+
+/** frame i is CMD ADD DATA(dlen) UID0..3, or 4 zero bytes for RID */
+static u8 frame_is(NFC_Trace &trace, u16 i, u8 cmd, u8 add, u8 dlen,
+                   const u8 *uid)
+{
+    const u8 zero[8] = { 0 };
+    const u8 *f;
+    u8 len;
+
+    f = topaz_frame(trace, i, &len);
+    return f && len == 2+dlen+4 && f[0] == cmd && f[1] == add &&
+           !memcmp(f+2, zero, dlen) &&
+           !memcmp(f+2+dlen, cmd == TOPAZ_CMD_RID ? zero : uid, 4);
+}
+
+static void tag(PN532_Emu &emu, u8 type, const u8 *dump, u8 hr0)
+{
+    NFC_Trace trace(mem, sizeof(mem));
+    nfc_jewel_t card;
+    u8 buf[TOPAZ_RALL_LEN], other[8];
+    u16 frames, i;
+
+    emu.field(type);
+    emu.memory(dump, 120);
+    CHECK(nfc.InListJewel(&card));
+    CHECK(card.sens_res[0] == 0x0C && card.sens_res[1] == 0x00);
+    CHECK(!memcmp(card.id, dump, 4));
+
+    nfc.Trace(&trace);
+    memset(buf, 0, sizeof(buf));
+    CHECK(nfc.TopazReadAll(buf));
+    nfc.Trace(NULL);
+    CHECK(!trace.overflow());
+    CHECK(buf[0] == hr0 && !memcmp(buf+2, dump, 120));
+
+#if NFC_RSP_DATA_MAX > TOPAZ_RALL_LEN
+    frames = 1;
+    CHECK(frame_is(trace, 0, TOPAZ_CMD_RALL, 0x00, 1, dump));
+#else
+    CHECK(frame_is(trace, 0, TOPAZ_CMD_RID, 0x00, 1, dump));
+    if(hr0 == 0x12){
+        frames = 1 + 15;
+        for(i=0; i<15; i++){
+            CHECK(frame_is(trace, 1+i, TOPAZ_CMD_READ8, i, 8, dump));
+        }
+    }else{
+        frames = 1 + 120;
+        for(i=0; i<120; i++){
+            CHECK(frame_is(trace, 1+i, TOPAZ_CMD_READ, i, 1, dump));
+        }
+    }
+#endif
+    CHECK(trace.commands() == frames);
+    printf("Topaz HR0 %02X read in %u commands, %lu bus bytes\n", hr0,
+           trace.commands(), (unsigned long)trace.bytes());
+
+    /** another tag in the field ignores commands with this UID */
+    memcpy(other, dump, 8);
+    other[0] ^= 0xFF;
+    emu.memory(other, 8);
+    CHECK(!nfc.TopazReadAll(buf));
+}
+
+int main(void)
+{
+    static PN532_Emu emu;
+
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+
+    tag(emu, PN532_EMU_TOPAZ_96, dump_96, 0x11);
+    tag(emu, PN532_EMU_TOPAZ_512, dump_512, 0x12);
+
+    CHECK(!emu.errors());
+    return failed;
+}
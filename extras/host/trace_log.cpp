@@ -0,0 +1,182 @@
+/*
+  trace_log.cpp - reading NFC_Trace logs on the host, see trace_log.h.
+*/
+
+#include <stdio.h>
+#include <ctype.h>
+#include "trace_log.h"
+
+u8 trace_next(const u8 *log, u32 len, u32 *pos, trace_rec_t *rec)
+{
+    u32 i = *pos, h = NFC_TRACE_HDR_LEN;
+
+    if(i+NFC_TRACE_HDR_LEN > len){
+        return 0;
+    }
+    rec->tx = (log[i] & NFC_TRACE_TX) ? 1 : 0;
+    rec->t = (log[i+1] | (log[i+2]<<8)) * NFC_TRACE_TICK_US;
+    rec->req = rec->got = 0;
+    if(log[i] == NFC_TRACE_POLLS){
+        /** every poll is a 1 byte read */
+        rec->polls = log[i+NFC_TRACE_HDR_LEN];
+        rec->req = rec->got = 1;
+        rec->n = 1;
+    }else{
+        rec->polls = 0;
+        rec->n = log[i] & NFC_TRACE_LEN_MASK;
+        if(!rec->tx){
+            h = NFC_TRACE_RX_HDR_LEN;
+            if(i+h > len){
+                return 0;
+            }
+            rec->req = log[i+3];
+            rec->got = log[i+4];
+        }
+    }
+    rec->data = log+i+h;
+    if(i+h+rec->n > len){
+        return 0;
+    }
+    *pos = i+h+rec->n;
+    return 1;
+}
+
+u8 trace_busy(const trace_rec_t *rec)
+{
+    if(rec->tx){
+        return 0;
+    }
+    return rec->polls || (rec->n && !(rec->data[0] & PN532_I2C_READY));
+}
+
+u16 trace_commands(const u8 *log, u32 len, trace_cmd_t *cmd, u16 max)
+{
+    trace_rec_t r;
+    trace_cmd_t *c = NULL;
+    u32 pos = 0;
+    u16 num = 0;
+
+    while(trace_next(log, len, &pos, &r)){
+        /** a command frame: 00 00 FF LEN LCS D4 CMD ... */
+        if(r.tx && r.n > 6 && r.data[5] == 0xD4){
+            if(num == max){
+                break;
+            }
+            c = &cmd[num++];
+            memset(c, 0, sizeof(*c));
+            c->cmd = r.data[6];
+        }
+        if(!c){
+            continue;
+        }
+        if(r.tx){
+            c->tx += r.n;
+        }else if(r.polls){
+            c->rx += r.polls;
+            c->polls += r.polls;
+        }else{
+            c->rx += r.got;
+            if(r.n == 1){
+                c->polls++;
+            }else if(!trace_busy(&r)){
+                /** the first frame read is the ACK, the next the response */
+                if(!c->ack){
+                    c->ack = r.t;
+                }else if(!c->rsp){
+                    c->rsp = r.t;
+                }
+            }
+        }
+        c->end = r.t;
+    }
+    return num;
+}
+
+/** one line of dump(): TX time hex, RX time req/got hex, or POLL time
+    count; other lines, e.g. of report(), are skipped */
+static long text_line(const char *line, u8 *buf, u32 size, u32 len)
+{
+    char dir[8];
+    unsigned t, v, req, got;
+    int off, n;
+    u8 *h = buf+len;
+
+    if(sscanf(line, "%7s %u%n", dir, &t, &off) < 2){
+        return len;
+    }
+    if(len+NFC_TRACE_RX_HDR_LEN > size){
+        return -1;
+    }
+    h[1] = (u8)t;
+    h[2] = (u8)(t>>8);
+    if(!strcmp(dir, "POLL")){
+        if(sscanf(line+off, "%u", &v) != 1){
+            return -1;
+        }
+        h[0] = NFC_TRACE_POLLS;
+        h[3] = v;
+        return len+NFC_TRACE_HDR_LEN+1;
+    }
+    if(strcmp(dir, "TX") && strcmp(dir, "RX")){
+        return len;
+    }
+    h[0] = (dir[0] == 'T') ? NFC_TRACE_TX : 0;
+    len += NFC_TRACE_HDR_LEN;
+    line += off;
+    if(!h[0]){
+        if(sscanf(line, " %u/%u%n", &req, &got, &n) != 2){
+            return -1;
+        }
+        buf[len++] = req;
+        buf[len++] = got;
+        line += n;
+    }
+    while(*line == ' '){
+        line++;
+    }
+    while(sscanf(line, "%2x", &v) == 1){
+        if(len >= size || (h[0] & NFC_TRACE_LEN_MASK) == NFC_TRACE_REC_MAX){
+            return -1;
+        }
+        buf[len++] = v;
+        h[0]++;
+        line += 2;
+    }
+    return len;
+}
+
+long trace_load(const char *path, u8 *buf, u32 size)
+{
+    FILE *f = fopen(path, "rb");
+    char line[512];
+    long len = 0;
+    int c;
+
+    if(!f){
+        return -1;
+    }
+    c = fgetc(f);
+    if(isalpha(c)){
+        ungetc(c, f);
+        while(len >= 0 && fgets(line, sizeof(line), f)){
+            len = text_line(line, buf, size, len);
+        }
+    }else if(c != EOF){
+        ungetc(c, f);
+        len = fread(buf, 1, size, f);
+    }
+    fclose(f);
+    return len;
+}
+
+u8 trace_save(const char *path, const u8 *log, u32 len)
+{
+    FILE *f = fopen(path, "wb");
+    u8 ok;
+
+    if(!f){
+        return 0;
+    }
+    ok = fwrite(log, 1, len, f) == len;
+    return (fclose(f) == 0) && ok;
+}
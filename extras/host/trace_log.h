@@ -0,0 +1,50 @@
+/*
+  trace_log.h - reading NFC_Trace logs on the host, see extras/host.
+
+  A log is the record buffer of NFC_Trace (data(), length()) saved as it
+  is, or the text printed by NFC_Trace::dump(), e.g. from a serial
+  monitor; lines that are not records are skipped. trace_load() tells
+  them apart by the first byte: records are never longer than a bus
+  transfer, so a binary log can not start with a letter.
+*/
+
+#ifndef trace_log_h
+#define trace_log_h
+
+#include "nfc.h"
+
+/** largest log, NFC_Trace counts its length in u16 */
+#define TRACE_LOG_MAX       0x10000
+
+/** one record */
+typedef struct{
+    u8 tx;              // 1 - host to PN532
+    u8 polls;           // busy status polls of a NFC_TRACE_POLLS record
+    u32 t;              // microseconds since command issue
+    u8 req, got;        // read: bytes requested, transferred (0 - NACK)
+    u8 n;               // bytes recorded
+    const u8 *data;
+}trace_rec_t;
+
+/** one command, times in microseconds since its issue */
+typedef struct{
+    u8 cmd;             // command code
+    u32 ack;            // ACK read, 0 - none
+    u32 rsp;            // response read, 0 - none
+    u32 end;            // last bus transaction
+    u16 tx, rx;         // bytes written, bytes transferred by reads
+    u16 polls;          // busy status polls
+}trace_cmd_t;
+
+/** record at *pos, *pos moves past it. 0 - end of log */
+u8 trace_next(const u8 *log, u32 len, u32 *pos, trace_rec_t *rec);
+/** 1 - a busy status poll, or a read of PN532 not ready yet */
+u8 trace_busy(const trace_rec_t *rec);
+/** split a log into commands, returns their number */
+u16 trace_commands(const u8 *log, u32 len, trace_cmd_t *cmd, u16 max);
+/** read a binary or dump() log, returns its length, -1 - error */
+long trace_load(const char *path, u8 *buf, u32 size);
+/** write a binary log, 0 - failed */
+u8 trace_save(const char *path, const u8 *log, u32 len);
+
+#endif
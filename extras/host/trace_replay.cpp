@@ -0,0 +1,105 @@
+/*
+  trace_replay.cpp - plays an NFC_Trace log back, see trace_replay.h.
+*/
+
+#include "trace_replay.h"
+
+TraceReplay::TraceReplay(const u8 *log, u32 len)
+{
+    this->log = log;
+    this->len = len;
+    pos = 0;
+    t0 = 0;
+    nmis = 0;
+}
+
+u16 TraceReplay::mismatches(void)
+{
+    return nmis;
+}
+
+u8 TraceReplay::done(void)
+{
+    trace_rec_t r;
+    u32 p = pos;
+
+    /** status polls left over are no transactions of their own */
+    while(trace_next(log, len, &p, &r)){
+        if(!trace_busy(&r)){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+u8 TraceReplay::write(u8 addr, const u8 *buf, u8 n)
+{
+    trace_rec_t r;
+    u32 p = pos;
+
+    if(addr != PN532_I2C_ADDRESS){
+        return 0;
+    }
+    while(trace_next(log, len, &p, &r) && !r.tx){
+    }
+    if(p == pos || !r.tx){
+        /** past the end of the recording */
+        nmis++;
+        pos = len;
+        return 1;
+    }
+    if(r.n != n || memcmp(r.data, buf, n)){
+        nmis++;
+    }
+    pos = p;
+    /** the record time is at the start of the write, the clock has moved
+        on by the transfer */
+    t0 = host_time_us() - (uint64_t)HOST_I2C_BYTE_US*(1+n) - r.t;
+    return 1;
+}
+
+u8 TraceReplay::read(u8 addr, u8 *buf, u8 n)
+{
+    trace_rec_t r;
+    u32 p = pos, next, ready = 0;
+    u8 seen = 0;
+
+    if(addr != PN532_I2C_ADDRESS || !n){
+        return 0;
+    }
+    memset(buf, 0, n);
+    /** busy polls and the first status read seen ready tell when the
+        response was there, the frame read after them holds it */
+    for(;;){
+        next = p;
+        if(!trace_next(log, len, &next, &r) || r.tx){
+            return n;
+        }
+        if(!seen && !trace_busy(&r)){
+            seen = 1;
+            ready = r.t;
+        }
+        if(r.n != 1 && !trace_busy(&r)){
+            break;
+        }
+        p = next;
+    }
+    if(host_time_us() < t0 + ready){
+        return n;
+    }
+    if(n == 1 && r.n != 1){
+        buf[0] = PN532_I2C_READY;
+        return n;
+    }
+    if(r.req != n){
+        /** the library reads another length than it did */
+        nmis++;
+    }
+    pos = next;
+    if(!r.got){
+        /** recorded NACK */
+        return 0;
+    }
+    memcpy(buf, r.data, (r.n < n) ? r.n : n);
+    return (r.got < n) ? r.got : n;
+}
@@ -0,0 +1,47 @@
+/*
+  trace_replay.h - plays an NFC_Trace log back as the PN532 on the host
+  bus, see extras/host.
+
+  Run the code of the recorded session against it, with a new NFC_Trace
+  attached, and compare both logs per command (nfc_trace diff). Each write
+  is matched with the next recorded one and restarts the clock of its
+  command. A recorded read is served once the virtual time since the
+  command reaches the time it was recorded at. Until then status reads are
+  busy. So the responses come as late as in the field, and a change in the
+  library shows up as a change of polls, bytes and time.
+
+    TraceReplay replay(log, len);
+    host_set_bus(&replay);
+    nfc.Trace(&trace);
+    ... the session ...
+    replay.mismatches(), replay.done()
+
+  Reads that ask for more bytes than were recorded get zeros for the rest.
+*/
+
+#ifndef trace_replay_h
+#define trace_replay_h
+
+#include "host.h"
+#include "trace_log.h"
+
+class TraceReplay : public HostBus
+{
+  public:
+    TraceReplay(const u8 *log, u32 len);
+    u8 write(u8 addr, const u8 *buf, u8 len);
+    u8 read(u8 addr, u8 *buf, u8 len);
+    /** writes that differ from the recording, or come after its end */
+    u16 mismatches(void);
+    /** 1 - every recorded transaction has been played */
+    u8 done(void);
+
+  private:
+    const u8 *log;
+    u32 len;
+    u32 pos;                // next record
+    uint64_t t0;            // issue of the current command
+    u16 nmis;
+};
+
+#endif
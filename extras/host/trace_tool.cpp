@@ -0,0 +1,155 @@
+/*
+  trace_tool.cpp - nfc_trace, decodes NFC_Trace logs on a PC, see
+  trace_log.h for the log formats.
+
+    nfc_trace dump LOG          records, in the text format of dump()
+    nfc_trace report LOG        time, bytes and polls of each command
+    nfc_trace diff OLD NEW      the same, side by side, for a replay
+
+  report splits the time of a command into the wait for its ACK and the
+  wait for its response after the ACK; total runs to the start of the
+  last transaction. diff exits with 1 when the commands differ, or NEW
+  spends more time or bytes than OLD.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "trace_log.h"
+
+#define TOOL_CMD_MAX    4096
+
+static u8 log_a[TRACE_LOG_MAX], log_b[TRACE_LOG_MAX];
+static trace_cmd_t cmd_a[TOOL_CMD_MAX], cmd_b[TOOL_CMD_MAX];
+
+static long load(const char *path, u8 *buf)
+{
+    long len = trace_load(path, buf, TRACE_LOG_MAX);
+
+    if(len < 0){
+        fprintf(stderr, "nfc_trace: can not read %s\n", path);
+        exit(2);
+    }
+    return len;
+}
+
+static void ms(u32 us)
+{
+    printf(" %7lu.%lu", (unsigned long)(us/1000), (unsigned long)(us%1000/100));
+}
+
+static int dump(const u8 *log, u32 len)
+{
+    trace_rec_t r;
+    u32 pos = 0;
+
+    while(trace_next(log, len, &pos, &r)){
+        if(r.polls){
+            printf("POLL %lu %u\n", (unsigned long)(r.t/NFC_TRACE_TICK_US),
+                   r.polls);
+            continue;
+        }
+        printf("%s %lu ", r.tx ? "TX" : "RX",
+               (unsigned long)(r.t/NFC_TRACE_TICK_US));
+        if(!r.tx){
+            printf("%u/%u ", r.req, r.got);
+        }
+        for(u8 i=0; i<r.n; i++){
+            printf("%02X", r.data[i]);
+        }
+        printf("\n");
+    }
+    if(pos != len){
+        printf("TRUNCATED\n");
+    }
+    return 0;
+}
+
+static int report(const u8 *log, u32 len)
+{
+    u16 num = trace_commands(log, len, cmd_a, TOOL_CMD_MAX), i;
+    u32 total = 0, tx = 0, rx = 0, polls = 0;
+
+    printf("   #  cmd      ack ms   resp ms  total ms    tx    rx  polls\n");
+    for(i=0; i<num; i++){
+        trace_cmd_t *c = &cmd_a[i];
+
+        printf("%4u   %02X", i+1, c->cmd);
+        ms(c->ack);
+        ms(c->rsp > c->ack ? c->rsp - c->ack : 0);
+        ms(c->end);
+        printf(" %5u %5u %6u\n", c->tx, c->rx, c->polls);
+        total += c->end;
+        tx += c->tx;
+        rx += c->rx;
+        polls += c->polls;
+    }
+    printf("      all                    ");
+    ms(total);
+    printf(" %5lu %5lu %6lu\n", (unsigned long)tx, (unsigned long)rx,
+           (unsigned long)polls);
+    return 0;
+}
+
+static int diff(const u8 *a, u32 alen, const u8 *b, u32 blen)
+{
+    u16 na = trace_commands(a, alen, cmd_a, TOOL_CMD_MAX);
+    u16 nb = trace_commands(b, blen, cmd_b, TOOL_CMD_MAX);
+    u16 i, n = (na > nb) ? na : nb;
+    u32 ta = 0, tb = 0, ba = 0, bb = 0;
+    int status = 0;
+
+    printf("   #  cmd    old ms    new ms  old bytes  new bytes"
+           "  old polls  new polls\n");
+    for(i=0; i<n; i++){
+        trace_cmd_t *x = (i < na) ? &cmd_a[i] : NULL;
+        trace_cmd_t *y = (i < nb) ? &cmd_b[i] : NULL;
+
+        if(!x || !y || x->cmd != y->cmd){
+            printf("%4u   %02X/%02X  commands differ\n", i+1,
+                   x ? x->cmd : 0, y ? y->cmd : 0);
+            status = 1;
+            break;
+        }
+        printf("%4u   %02X ", i+1, x->cmd);
+        ms(x->end);
+        ms(y->end);
+        printf(" %10u %10u %10u %10u%s\n", x->tx + x->rx, y->tx + y->rx,
+               x->polls, y->polls,
+               (y->end > x->end || y->tx + y->rx > x->tx + x->rx) ? "  *" : "");
+        ta += x->end;
+        tb += y->end;
+        ba += x->tx + x->rx;
+        bb += y->tx + y->rx;
+    }
+    printf("      all ");
+    ms(ta);
+    ms(tb);
+    printf(" %10lu %10lu\n", (unsigned long)ba, (unsigned long)bb);
+    if(tb > ta || bb > ba){
+        status = 1;
+    }
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    long alen, blen;
+
+    if(argc == 3 && !strcmp(argv[1], "dump")){
+        alen = load(argv[2], log_a);
+        return dump(log_a, alen);
+    }
+    if(argc == 3 && !strcmp(argv[1], "report")){
+        alen = load(argv[2], log_a);
+        return report(log_a, alen);
+    }
+    if(argc == 4 && !strcmp(argv[1], "diff")){
+        alen = load(argv[2], log_a);
+        blen = load(argv[3], log_b);
+        return diff(log_a, alen, log_b, blen);
+    }
+    fprintf(stderr, "usage: nfc_trace dump LOG\n"
+                    "       nfc_trace report LOG\n"
+                    "       nfc_trace diff OLD NEW\n");
+    return 2;
+}
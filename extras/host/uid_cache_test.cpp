@@ -0,0 +1,103 @@
+/*
+  uid_cache_test.cpp - PollTap() and the UID cache TTL on the virtual
+  clock, against the PN532 emulator. A card held on the reader is one tap;
+  a card missed for less than the TTL is still the same tap; a card gone
+  for longer is reported removed once, between TTL and TTL plus one poll
+  cycle after it was last seen, and is new when it comes back. The TTL
+  check must survive millis() wrapping around.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+
+#define POLL_GAP_MS     20
+#define HOLD_POLLS      30
+
+static NFC_Module nfc;
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+/** one poll of the sketch loop, then the rest of the loop */
+static u8 poll(NFC_UidCache &cache, u8 *buf)
+{
+    u8 ev = nfc.PollTap(buf, cache);
+
+    host_advance_us(POLL_GAP_MS*1000UL);
+    return ev;
+}
+
+int main(void)
+{
+    static PN532_Emu emu;
+    NFC_UidCache cache;
+    nfc_uid_entry_t removed;
+    u8 buf[NFC_UID_MAX_LEN+1], uid[NFC_UID_MAX_LEN+1], ev, n;
+    u32 seen, gone;
+
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+    CHECK(nfc.RFPreset(NFC_RF_PRESET_FAST_POLL));
+
+    /** empty field */
+    CHECK(poll(cache, buf) == NFC_TAP_NONE);
+
+    /** card held: one new tap, then present */
+    emu.field(PN532_EMU_MIFARE_1K);
+    CHECK(poll(cache, uid) == NFC_TAP_NEW);
+    for(n=0; n<HOLD_POLLS; n++){
+        CHECK(poll(cache, buf) == NFC_TAP_PRESENT);
+    }
+    CHECK(!memcmp(buf, uid, uid[0]+1));
+    CHECK(cache.find(uid+1, uid[0], PN532_BRTY_ISO14443A) != NULL);
+
+    /** missed for less than the TTL, e.g. a card tilted away */
+    emu.field(PN532_EMU_NONE);
+    seen = millis();
+    while(millis() - seen + POLL_GAP_MS < NFC_UID_TTL/2){
+        CHECK(poll(cache, buf) == NFC_TAP_NONE);
+    }
+    emu.field(PN532_EMU_MIFARE_1K);
+    CHECK(poll(cache, buf) == NFC_TAP_PRESENT);
+
+    /** gone: removed once, after the TTL */
+    seen = millis();
+    emu.field(PN532_EMU_NONE);
+    while((ev = poll(cache, buf)) == NFC_TAP_NONE &&
+          millis() - seen < 10*NFC_UID_TTL){
+    }
+    gone = millis() - seen;
+    CHECK(ev == NFC_TAP_REMOVED);
+    CHECK(!memcmp(buf, uid, uid[0]+1));
+    CHECK(gone > NFC_UID_TTL && gone <= NFC_UID_TTL + 2*POLL_GAP_MS + 50);
+    CHECK(poll(cache, buf) == NFC_TAP_NONE);
+    CHECK(cache.find(uid+1, uid[0], PN532_BRTY_ISO14443A) == NULL);
+
+    /** back: a new tap */
+    emu.field(PN532_EMU_MIFARE_1K);
+    CHECK(poll(cache, buf) == NFC_TAP_NEW);
+
+    /** the cache alone, across the wrap of millis() */
+    cache.clear();
+    CHECK(cache.update(uid+1, uid[0], 0, 0xFFFFFF00UL) == NFC_TAP_NEW);
+    CHECK(cache.update(uid+1, uid[0], 0, 0x00000010UL) == NFC_TAP_PRESENT);
+    CHECK(!cache.expire(0x00000010UL + NFC_UID_TTL, &removed));
+    CHECK(cache.expire(0x00000011UL + NFC_UID_TTL, &removed));
+    CHECK(removed.uid_len == uid[0]);
+    /** same UID read with another technology is another card */
+    CHECK(cache.update(uid+1, uid[0], 0, 0) == NFC_TAP_NEW);
+    CHECK(cache.update(uid+1, uid[0], PN532_BRTY_ISO14443B, 0) == NFC_TAP_NEW);
+
+    CHECK(!emu.errors());
+    printf("card removed %lu ms after it was last seen, TTL %u ms\n",
+           (unsigned long)gone, NFC_UID_TTL);
+    return failed;
+}
@@ -0,0 +1,126 @@
+/*
+  value_test.cpp - Mifare value blocks against the Mifare 1K of the PN532
+  emulator, which keeps DECREMENT, INCREMENT and RESTORE results in its
+  value register until TRANSFER writes them.
+
+  MifareValueEncode()/Decode() round trip, and reject a block with any
+  byte of the pattern broken. ValueDebit(), ValueCredit() and ValueCopy()
+  are each one operation and one TRANSFER, two InDataExchange frames, and
+  the value read back must be the sum. A card lost between the two keeps
+  the old value. Operations on a block that is no value block, on a
+  sector trailer, or a TRANSFER out of the authenticated sector must fail
+  and leave the card alone.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+
+static NFC_Module nfc;
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+static u8 uid[NFC_UID_MAX_LEN+1];
+static u8 key[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+/** InDataExchange frames of the last operation */
+static NFC_Trace count(NULL, 0);
+
+static s32 value(u8 block)
+{
+    s32 v = 0x7FFFFFFF;
+
+    CHECK(nfc.MifareValueRead(block, &v));
+    return v;
+}
+
+static void select(void)
+{
+    CHECK(nfc.InListPassiveTarget(uid));
+    CHECK(nfc.MifareAuthentication(0, 4, uid+1, uid[0], key));
+}
+
+static void codec(void)
+{
+    const s32 v[4] = { 0, 1000, -1, 0x12345678 };
+    u8 b[16], addr;
+    s32 got;
+
+    for(u8 i=0; i<4; i++){
+        nfc.MifareValueEncode(v[i], 4+i, b);
+        CHECK(nfc.MifareValueDecode(b, &got, &addr));
+        CHECK(got == v[i] && addr == 4+i);
+        for(u8 j=0; j<16; j++){
+            b[j] ^= 0x01;
+            CHECK(!nfc.MifareValueDecode(b, &got));
+            b[j] ^= 0x01;
+        }
+    }
+}
+
+int main(void)
+{
+    static PN532_Emu emu;
+    const u8 op[6] = { MIFARE_CMD_DECREMENT, 4, 0x64, 0x00, 0x00, 0x00 };
+    u8 blk[16], zero[16], rlen;
+
+    codec();
+
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+    emu.field(PN532_EMU_MIFARE_1K);
+    select();
+
+    CHECK(nfc.MifareValueWrite(4, 1000));
+    CHECK(value(4) == 1000);
+
+    nfc.Trace(&count);
+    CHECK(nfc.ValueDebit(4, 250));
+    nfc.Trace(NULL);
+    CHECK(count.commands() == 2);
+    CHECK(value(4) == 750);
+
+    /** into the backup block, the source keeps its value */
+    count.clear();
+    nfc.Trace(&count);
+    CHECK(nfc.ValueCredit(4, 100, 5));
+    nfc.Trace(NULL);
+    CHECK(count.commands() == 2);
+    CHECK(value(4) == 750 && value(5) == 850);
+
+    CHECK(nfc.ValueCopy(5, 6));
+    CHECK(value(6) == 850);
+    CHECK(nfc.ValueDebit(6, 900));
+    CHECK(value(6) == -50);
+
+    /** the card leaves after DECREMENT, before TRANSFER */
+    rlen = 0;
+    CHECK(nfc.InDataExchange(0, 1, op, sizeof(op), NULL, &rlen) == 1);
+    select();
+    CHECK(value(4) == 750);
+    CHECK(nfc.ValueDebit(4, 100));
+    CHECK(value(4) == 650);
+
+    /** a sector trailer, TRANSFER to another sector, not a value block */
+    memset(zero, 0, sizeof(zero));
+    CHECK(!nfc.ValueCredit(7, 1));
+    select();
+    CHECK(!nfc.ValueDebit(4, 1, 8));
+    select();
+    CHECK(value(4) == 650);
+    CHECK(nfc.MifareAuthentication(0, 8, uid+1, uid[0], key));
+    CHECK(nfc.MifareReadBlock(8, blk) && !memcmp(blk, zero, 16));
+    CHECK(!nfc.ValueDebit(8, 1));
+
+    CHECK(!emu.errors());
+    printf("value blocks debited, credited and copied, 2 frames each\n");
+    return failed;
+}
@@ -0,0 +1,266 @@
+/*
+  workflow_test.cpp - runs protothread workflows of nfc_pt.h side by side
+  on the virtual clock, against the PN532 emulator, and measures how long
+  one pass of loop() is held by them: the loop jitter other tasks see.
+
+  A Mifare reader (list, auth, read 4/5/6, write 4) and then a P2P
+  initiator share the PN532 with a status task that asks for the firmware
+  version every few milliseconds. Each pass of loop() also spends
+  LOOP_TASK_US on other work. The worst pass must stay under JITTER_MAX_US
+  and well under the time the same tap takes with the blocking calls. A
+  pass holds at most a response read and, when a step is done, the next
+  command sent with its ACK, about 6 ms each at 100 kHz.
+
+  The frame checks of CmdPoll() are tested on the way: a response longer
+  than the rlen of the command, and one with a bad DCS, must fail.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+#include "nfc_pt.h"
+
+#define LOOP_TASK_US    100
+#define JITTER_MAX_US   15000
+#define RUN_MAX_US      5000000UL
+#define READER_ROUNDS   3
+#define P2P_FRAMES      8
+
+static NFC_Module nfc;
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+/** flips a byte of the next response frame read */
+class CorruptBus : public HostBus
+{
+  public:
+    CorruptBus(HostBus *bus, u8 index) : bus(bus), index(index) {}
+    u8 write(u8 addr, const u8 *buf, u8 len)
+    {
+        return bus->write(addr, buf, len);
+    }
+    u8 read(u8 addr, u8 *buf, u8 len)
+    {
+        u8 n = bus->read(addr, buf, len);
+
+        /** status byte and the frame, not the 1 byte status poll */
+        if(n > 1+index && buf[0] == PN532_I2C_READY && buf[4]){
+            buf[1+index] ^= 0x01;
+        }
+        return n;
+    }
+
+  private:
+    HostBus *bus;
+    u8 index;
+};
+
+static const u8 key[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+/** reader workflow */
+static nfc_pt_t reader_pt;
+static u8 reader_cmd[NFC_STEP_CMD_LEN];
+static u8 uid[NFC_UID_MAX_LEN+1], block[16], wblock[16], blk, ret_r;
+static u8 rounds, reader_err;
+
+static u8 reader(nfc_pt_t *pt)
+{
+    NFC_PT_BEGIN(pt);
+
+    NFC_PT_STEP(pt, nfc.StepInList(reader_cmd, uid, 100), ret_r);
+    if(ret_r != NFC_CMD_DONE || uid[0] != 4){
+        reader_err++;
+        NFC_PT_RESTART(pt);
+    }
+    NFC_PT_STEP(pt, nfc.StepMifareAuth(reader_cmd, 0, 4, uid+1, uid[0], key,
+                                       100), ret_r);
+    if(ret_r != NFC_CMD_DONE){
+        reader_err++;
+        NFC_PT_RESTART(pt);
+    }
+    for(blk=4; blk<7; blk++){
+        NFC_PT_STEP(pt, nfc.StepMifareRead(reader_cmd, blk, block, 100), ret_r);
+        if(ret_r != NFC_CMD_DONE){
+            reader_err++;
+            NFC_PT_RESTART(pt);
+        }
+        if(blk == 4){
+            memcpy(wblock, block, 16);
+            wblock[0] = rounds+1;
+        }
+    }
+    NFC_PT_STEP(pt, nfc.StepMifareWrite(reader_cmd, 4, wblock, 100), ret_r);
+    if(ret_r != NFC_CMD_DONE){
+        reader_err++;
+        NFC_PT_RESTART(pt);
+    }
+    rounds++;
+    NFC_PT_DELAY(pt, 20);
+
+    NFC_PT_END(pt);
+}
+
+/** P2P initiator workflow, the target echoes every frame */
+static nfc_pt_t p2p_pt;
+static u8 p2p_cmd[2+NFC_DEP_CHUNK];
+static u8 tx[NFC_DEP_CHUNK], rx[NFC_DEP_CHUNK], rx_len, ret_p;
+static u8 frames, p2p_err;
+
+static u8 p2p(nfc_pt_t *pt)
+{
+    NFC_PT_BEGIN(pt);
+
+    tx[0] = frames;
+    rx_len = sizeof(rx);
+    NFC_PT_STEP(pt, nfc.StepP2PTxRx(p2p_cmd, tx, sizeof(tx), rx, &rx_len,
+                                    100), ret_p);
+    if(ret_p != NFC_CMD_DONE || rx_len != sizeof(tx) ||
+       memcmp(rx, tx, sizeof(tx))){
+        p2p_err++;
+    }
+    frames++;
+
+    NFC_PT_END(pt);
+}
+
+/** status task, firmware version with the default rlen */
+static nfc_pt_t status_pt;
+static u8 status_cmd[1] = { PN532_COMMAND_GETFIRMWAREVERSION };
+static u8 ret_s;
+static u16 versions, status_err;
+
+static u8 status(nfc_pt_t *pt)
+{
+    u8 len;
+
+    NFC_PT_BEGIN(pt);
+
+    NFC_PT_AWAIT(pt, nfc, status_cmd, 1, 0, 50, ret_s);
+    nfc.CmdResponse(&len);
+    if(ret_s == NFC_CMD_DONE && len == 4){
+        versions++;
+    }else{
+        status_err++;
+    }
+    NFC_PT_DELAY(pt, 5);
+
+    NFC_PT_END(pt);
+}
+
+/** loop() until done() or the time limit, returns the worst pass */
+static u32 run(u8 (*task)(nfc_pt_t *), nfc_pt_t *pt, u8 (*done)(void))
+{
+    uint64_t start = host_time_us(), t;
+    u32 worst = 0;
+
+    NFC_PT_INIT(pt);
+    NFC_PT_INIT(&status_pt);
+    while(!done() && host_time_us() - start < RUN_MAX_US){
+        t = host_time_us();
+        task(pt);
+        status(&status_pt);
+        if(host_time_us() - t > worst){
+            worst = host_time_us() - t;
+        }
+        /** the rest of the firmware */
+        host_advance_us(LOOP_TASK_US);
+    }
+    /** let the status task finish its command */
+    while(nfc.CmdBusy() && host_time_us() - start < RUN_MAX_US){
+        status(&status_pt);
+        host_advance_us(LOOP_TASK_US);
+    }
+    return worst;
+}
+
+static u8 reader_done(void)
+{
+    return rounds >= READER_ROUNDS;
+}
+
+static u8 p2p_done(void)
+{
+    return frames >= P2P_FRAMES;
+}
+
+/** the reader round with the blocking calls, returns its time */
+static u32 blocking_tap(void)
+{
+    uint64_t t = host_time_us();
+    u8 id[16], buf[16], b4[16];
+
+    CHECK(nfc.InListPassiveTarget(id) && id[0] == 4);
+    CHECK(nfc.MifareAuthentication(0, 4, id+1, id[0], (u8 *)key));
+    CHECK(nfc.MifareReadBlock(4, b4));
+    CHECK(nfc.MifareReadBlock(5, buf));
+    CHECK(nfc.MifareReadBlock(6, buf));
+    CHECK(nfc.MifareWriteBlock(4, b4));
+    return host_time_us() - t;
+}
+
+/** one command through the engine, to completion */
+static u8 command(const u8 *cmd, u8 len, u8 rlen)
+{
+    u8 ret;
+
+    while((ret = nfc.CmdStep(cmd, len, rlen, 50)) == NFC_CMD_BUSY){
+        host_advance_us(LOOP_TASK_US);
+    }
+    return ret;
+}
+
+int main(void)
+{
+    static PN532_Emu emu;
+    u32 blocking, jitter_r, jitter_p;
+    u8 len, cmd[1] = { PN532_COMMAND_GETFIRMWAREVERSION };
+
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+    CHECK(nfc.RFPreset(NFC_RF_PRESET_FAST_POLL));
+
+    /** response frame checks: fits, too long for rlen, bad DCS */
+    CHECK(command(cmd, 1, 13) == NFC_CMD_DONE);
+    CHECK(nfc.CmdResponse(&len) && len == 4);
+    CHECK(command(cmd, 1, 12) == NFC_CMD_FAILED);
+    CHECK(!nfc.CmdBusy());
+    CorruptBus dcs(&emu, 5+6);
+    host_set_bus(&dcs);
+    CHECK(command(cmd, 1, 0) == NFC_CMD_FAILED);
+    host_set_bus(&emu);
+    CHECK(command(cmd, 1, 0) == NFC_CMD_DONE);
+
+    emu.field(PN532_EMU_MIFARE_1K);
+    blocking = blocking_tap();
+    jitter_r = run(reader, &reader_pt, reader_done);
+    CHECK(rounds == READER_ROUNDS && !reader_err);
+
+    /** the last round wrote its number to block 4 */
+    u8 id[16], buf[16];
+    CHECK(nfc.InListPassiveTarget(id));
+    CHECK(nfc.MifareAuthentication(0, 4, id+1, id[0], (u8 *)key));
+    CHECK(nfc.MifareReadBlock(4, buf) && buf[0] == READER_ROUNDS);
+
+    emu.field(PN532_EMU_P2P);
+    CHECK(nfc.P2PInitiatorInit());
+    jitter_p = run(p2p, &p2p_pt, p2p_done);
+    CHECK(frames == P2P_FRAMES && !p2p_err);
+
+    CHECK(versions > 0 && !status_err);
+    CHECK(!emu.errors());
+    CHECK(jitter_r <= JITTER_MAX_US && jitter_p <= JITTER_MAX_US);
+    CHECK(jitter_r*4 < blocking);
+
+    printf("blocking tap %lu us, worst loop pass: reader %lu us, "
+           "p2p %lu us, %u status commands\n", (unsigned long)blocking,
+           (unsigned long)jitter_r, (unsigned long)jitter_p, versions);
+    return failed;
+}
@@ -0,0 +1,102 @@
+/*
+  write_blocks_test.cpp - MifareWriteBlocks() against the Mifare 1K of the
+  PN532 emulator, counted in commands.
+
+  A ticket update of 3 blocks in 2 sectors, given out of order, costs one
+  authentication per sector and one WRITE per block, plus one READ per
+  block with NFC_MF_VERIFY, and every block reads back as written. A list
+  with block 0 or a sector trailer is refused before any command, unless
+  NFC_MF_ALLOW_TRAILER is given.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+
+static NFC_Module nfc;
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+static u8 uid[NFC_UID_MAX_LEN+1];
+static u8 key[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+static NFC_Trace count(NULL, 0);
+
+/** MifareWriteBlocks() of blocks with data, returns its result */
+static u8 write(const u8 *blocks, u8 num, const u8 *data, u8 flags)
+{
+    nfc_mf_write_t wr[4];
+    u8 ok;
+
+    for(u8 i=0; i<num; i++){
+        wr[i].block = blocks[i];
+        wr[i].data = data + 16*i;
+    }
+    count.clear();
+    nfc.Trace(&count);
+    ok = nfc.MifareWriteBlocks(wr, num, 0, key, uid+1, uid[0], flags);
+    nfc.Trace(NULL);
+    return ok;
+}
+
+/** block as written */
+static u8 is(u8 block, const u8 *data)
+{
+    u8 buf[16];
+
+    return nfc.MifareAuthentication(0, block, uid+1, uid[0], key) &&
+           nfc.MifareReadBlock(block, buf) && !memcmp(buf, data, 16);
+}
+
+int main(void)
+{
+    static PN532_Emu emu;
+    const u8 ticket[3] = { 8, 5, 4 };
+    const u8 bad[2][2] = { { 4, 0 }, { 5, 7 } };
+    const u8 trailer[1] = { 7 };
+    u8 data[4*16], tr[16];
+
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+    emu.field(PN532_EMU_MIFARE_1K);
+    CHECK(nfc.InListPassiveTarget(uid));
+
+    for(u8 i=0; i<sizeof(data); i++){
+        data[i] = i*3 + 1;
+    }
+    /** 2 authentications, 3 WRITEs */
+    CHECK(write(ticket, 3, data, 0));
+    CHECK(count.commands() == 2 + 3);
+    /** and 3 READs */
+    data[0] ^= 0xFF;
+    CHECK(write(ticket, 3, data, NFC_MF_VERIFY));
+    CHECK(count.commands() == 2 + 3 + 3);
+    CHECK(is(8, data) && is(5, data+16) && is(4, data+32));
+
+    for(u8 i=0; i<2; i++){
+        CHECK(!write(bad[i], 2, data+16, 0));
+        CHECK(count.commands() == 0);
+    }
+    CHECK(is(4, data+32) && is(5, data+16));
+
+    /** the factory trailer, written back as it is */
+    memset(tr, 0xFF, sizeof(tr));
+    tr[7] = 0x07;
+    tr[8] = 0x80;
+    tr[9] = 0x69;
+    CHECK(!write(trailer, 1, tr, NFC_MF_VERIFY));
+    CHECK(write(trailer, 1, tr, NFC_MF_ALLOW_TRAILER));
+    CHECK(count.commands() == 2);
+    CHECK(is(4, data+32));
+
+    CHECK(!emu.errors());
+    printf("3 blocks in 2 sectors: %u commands with verify\n", 2 + 3 + 3);
+    return failed;
+}
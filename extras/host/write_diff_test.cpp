@@ -0,0 +1,161 @@
+/*
+  write_diff_test.cpp - MifareWriteDiff() and NtagWriteDiff() against the
+  Mifare 1K and NTAG216 of the PN532 emulator, which counts the blocks and
+  pages it programs.
+
+  Each update is counted in commands and in writes: only changed blocks or
+  pages are written, a sector without changes is not authenticated, and
+  without the current contents they are read first, 4 NTAG pages a READ.
+  Ranges that would reach block 0, a sector trailer, pages 0..3 or the
+  configuration pages behind the NTAG216 user memory, and ranges past
+  block or page 255, which would wrap around to 0, are refused before
+  anything is written. A cached image follows the writes.
+*/
+
+#include <stdio.h>
+#include "pn532_emu.h"
+
+static NFC_Module nfc;
+static int failed;
+
+#define CHECK(cond)                                                         \
+    do{                                                                     \
+        if(!(cond)){                                                        \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failed = 1;                                                     \
+        }                                                                   \
+    }while(0)
+
+static u8 uid[NFC_UID_MAX_LEN+1];
+static u8 key[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+static u8 cache_mem[sizeof(nfc_card_hdr_t) + 2 + 16*16];
+static PN532_Emu emu;
+static u32 wr0;
+
+/** start counting */
+static void count(void)
+{
+    nfc.Exchanges(1);
+    wr0 = emu.writes();
+}
+
+/** commands and card writes since count() */
+static u8 counted(u16 cmds, u32 writes)
+{
+    return nfc.Exchanges() == cmds && emu.writes() - wr0 == writes;
+}
+
+static u8 mf_diff(u8 first, u8 num, const u8 *image, const u8 *current,
+                  u8 flags=0, NFC_CardCache *cache=NULL)
+{
+    count();
+    return nfc.MifareWriteDiff(first, num, image, current, 0, key, uid+1,
+                               uid[0], flags, cache);
+}
+
+static void mifare(void)
+{
+    NFC_CardCache cache(cache_mem, sizeof(cache_mem), 16);
+    u8 cur[8*16], img[8*16], buf[8*16];
+
+    emu.field(PN532_EMU_MIFARE_1K);
+    CHECK(nfc.InListPassiveTarget(uid));
+    CHECK(nfc.MifareReadCached(cache, uid+1, uid[0], 0, key, 4, 4, 8, cur));
+    memcpy(img, cur, sizeof(img));
+
+    /** unchanged: nothing at all */
+    CHECK(mf_diff(4, 3, img, cur));
+    CHECK(counted(0, 0));
+
+    /** block 5: auth, WRITE */
+    img[16] = 0x55;
+    CHECK(mf_diff(4, 3, img, cur, 0, &cache));
+    CHECK(counted(2, 1));
+    memcpy(cur, img, sizeof(cur));
+
+    /**
+        blocks 9 and 10, in a range with the trailers 7 and 11 as they are:
+        sector 2 authenticated, 2 WRITEs, 2 READs to verify
+    */
+    img[5*16] = 0x99;
+    img[6*16+15] = 0xAA;
+    CHECK(!mf_diff(4, 8, img, cur));
+    CHECK(counted(0, 0));
+    CHECK(mf_diff(4, 8, img, cur, NFC_MF_ALLOW_TRAILER|NFC_MF_VERIFY, &cache));
+    CHECK(counted(1 + 2 + 2, 2));
+    memcpy(cur, img, sizeof(cur));
+
+    /** read first: auth, READ 8..10, WRITE 8 */
+    img[4*16+1] = 0x88;
+    CHECK(mf_diff(8, 3, img+4*16, NULL, 0, &cache));
+    CHECK(counted(1 + 3 + 1, 1));
+
+    /** the image follows the writes: only the marker is read */
+    count();
+    CHECK(nfc.MifareReadCached(cache, uid+1, uid[0], 0, key, 4, 4, 8, buf));
+    CHECK(counted(2, 0));
+    CHECK(!memcmp(buf, img, sizeof(buf)));
+
+    /** 250..259 would be 250..255, 0..3 */
+    CHECK(!mf_diff(250, 10, img, NULL, NFC_MF_ALLOW_TRAILER));
+    CHECK(counted(0, 0));
+    CHECK(!mf_diff(0, 3, img, NULL));
+    CHECK(counted(0, 0));
+}
+
+static u8 ntag_diff(u8 page, u8 num, const u8 *image, const u8 *current,
+                    u8 flags=0)
+{
+    count();
+    return nfc.NtagWriteDiff(page, num, image, current, flags);
+}
+
+static void ntag(void)
+{
+    u8 cur[8*4], img[8*4], buf[16];
+
+    emu.field(PN532_EMU_NTAG216);
+    CHECK(nfc.InListPassiveTarget(uid));
+    CHECK(nfc.MifareReadBlock(4, cur) && nfc.MifareReadBlock(8, cur+16));
+    memcpy(img, cur, sizeof(img));
+
+    /** pages 5 and 9 */
+    img[1*4] = 0x05;
+    img[5*4] = 0x09;
+    CHECK(ntag_diff(4, 8, img, cur));
+    CHECK(counted(2, 2));
+    memcpy(cur, img, sizeof(cur));
+
+    /** read first: READ 4, WRITE 6, READ 8 */
+    img[2*4] = 0x06;
+    CHECK(ntag_diff(4, 8, img, NULL));
+    CHECK(counted(3, 1));
+    CHECK(nfc.MifareReadBlock(4, buf) && !memcmp(buf, img, 16));
+
+    /** past page 39: GET_VERSION, the NTAG216 user memory ends at 225 */
+    CHECK(ntag_diff(222, 4, img, img));
+    CHECK(counted(1, 0));
+    CHECK(!ntag_diff(223, 4, img, img));
+    CHECK(counted(1, 0));
+
+    /** UID pages, pages past 255 even with NFC_NTAG_ALLOW_CONFIG */
+    CHECK(!ntag_diff(2, 4, img, NULL));
+    CHECK(counted(0, 0));
+    CHECK(!ntag_diff(250, 8, img, NULL, NFC_NTAG_ALLOW_CONFIG));
+    CHECK(counted(0, 0));
+}
+
+int main(void)
+{
+    host_set_bus(&emu);
+    nfc.begin();
+    CHECK(nfc.get_version());
+    CHECK(nfc.SAMConfiguration());
+
+    mifare();
+    ntag();
+
+    CHECK(!emu.errors());
+    printf("diff writes: only changed blocks and pages programmed\n");
+    return failed;
+}
@@ -8,6 +8,7 @@
 
     NOTE:
         IRQ pin is unused.
+        Protocol modules are in nfc_*.cpp, selected in nfc_config.h.
 
 	@section  HISTORY
     V1.1    Add fuction about Peer to Peer communication
@@ -27,7 +28,6 @@
 
 #include "nfc.h"
 
-u8 hextab[17]="0123456789ABCDEF";
 u8 ack[6]={
     0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00
 };
@@ -35,6 +35,33 @@ u8 nfc_version[6]={
     0x00, 0xFF, 0x06, 0xFA, 0xD5, 0x03
 };
 
+/** CIU analog settings for 106 kbps type A, PN532 defaults */
+const u8 rf_analog_106a[11] PROGMEM = {
+    0x59, 0xF4, 0x3F, 0x11, 0x4D, 0x85, 0x61, 0x6F, 0x26, 0x62, 0x87
+};
+
+/** RFPreset() table:
+    MxRtyATR, MxRtyPSL, MxRtyPassiveActivation, ATR_RES timeout,
+    retry timeout, CIU_RFCfg (RX gain), RF field */
+const u8 rf_preset[NFC_RF_PRESET_NUM][7] PROGMEM = {
+    /** NFC_RF_PRESET_DEFAULT */
+    { 0xFF, 0x01, 0xFF, PN532_TIMEOUT_102_4MS, PN532_TIMEOUT_51_2MS, 0x59, 1 },
+    /** NFC_RF_PRESET_FAST_POLL */
+    { 0xFF, 0x01, 0x01, PN532_TIMEOUT_102_4MS, PN532_TIMEOUT_6_4MS, 0x59, 1 },
+    /** NFC_RF_PRESET_LONG_RANGE */
+    { 0xFF, 0x01, 0x10, PN532_TIMEOUT_102_4MS, PN532_TIMEOUT_51_2MS, 0x79, 1 },
+    /** NFC_RF_PRESET_LOW_POWER */
+    { 0xFF, 0x01, 0x00, PN532_TIMEOUT_102_4MS, PN532_TIMEOUT_3_2MS, 0x59, 0 },
+};
+
+/** constant commands, framed at compile time */
+const u8 frame_get_version[] PROGMEM =
+    NFC_FRAME(PN532_COMMAND_GETFIRMWAREVERSION);
+const u8 frame_sam_normal[] PROGMEM =
+    NFC_FRAME(PN532_COMMAND_SAMCONFIGURATION, PN532_SAM_NORMAL_MODE, 20, 0);
+const u8 frame_tg_get_data[] PROGMEM =
+    NFC_FRAME(PN532_COMMAND_TGGETDATA);
+
 /** data buffer */
 u8 nfc_buf[NFC_CMD_BUF_LEN];
 
@@ -46,7 +73,35 @@ u8 nfc_buf[NFC_CMD_BUF_LEN];
 /*****************************************************************************/
 NFC_Module::NFC_Module(void)
 {
-
+    tg_seen = 0;
+    asleep = 1;
+    lp_begin = 0;
+    cmd_count = 0;
+    reg_num = 0;
+    reg_next = 0;
+    gpio_valid = 0;
+    gpio_pending = 0;
+    cmd_rlen = 0;
+    cmd_owner = NULL;
+#if NFC_USE_DIAG
+    trace = NULL;
+#endif
+#if NFC_USE_P2P
+    p2p_cfg = NULL;
+    dep_sent = 0;
+#endif
+#if NFC_USE_P2P || NFC_USE_EMULATION
+    tg_state = NFC_STA_IDLE;
+#endif
+#if NFC_USE_EMULATION
+    ce_table = NULL;
+    ce_num = 0;
+    ce_ctx = NULL;
+#endif
+#if NFC_USE_ISO14443
+    psl_max[0] = PN532_BRTY_424KBPS;
+    psl_max[1] = PN532_BRTY_424KBPS;
+#endif
 }
 
 /*****************************************************************************/
@@ -62,6 +117,8 @@ void NFC_Module::begin(void)
     u8 i;
 #endif
     Wire.begin();
+    /** PN532 may be in power down after reset */
+    asleep = 1;
 #ifdef PN532DEBUG
     for(i=0; i<16; i++){
         Serial.write((u8)hextab[i]);
@@ -86,8 +143,7 @@ u32 NFC_Module::get_version(void)
 {
     u32 version;
 
-    nfc_buf[0] = PN532_COMMAND_GETFIRMWAREVERSION;
-    if(!write_cmd_check_ack(nfc_buf, 1)){
+    if(!write_frame_check_ack(frame_get_version)){
         return 0;
     }
     wait_ready();
@@ -129,19 +185,25 @@ u8 NFC_Module::SAMConfiguration(u8 mode, u8 timeout, u8 irq)
 #ifdef PN532DEBUG
     Serial.print("SAMConfiguration\n");
 #endif
-	nfc_buf[0] = PN532_COMMAND_SAMCONFIGURATION;
-	nfc_buf[1] = mode; // normal mode;
-	nfc_buf[2] = timeout; // timeout 50ms * 20 = 1 second
-	nfc_buf[3] = irq; // use IRQ pin!
+    if(mode == PN532_SAM_NORMAL_MODE && timeout == 20 && irq == 0){
+        if(!write_frame_check_ack(frame_sam_normal)){
+            return 0;
+        }
+    }else{
+        nfc_buf[0] = PN532_COMMAND_SAMCONFIGURATION;
+        nfc_buf[1] = mode; // normal mode;
+        nfc_buf[2] = timeout; // timeout 50ms * 20 = 1 second
+        nfc_buf[3] = irq; // use IRQ pin!
 
-    if(!write_cmd_check_ack(nfc_buf, 4)){
-        return 0;
+        if(!write_cmd_check_ack(nfc_buf, 4)){
+            return 0;
+        }
     }
 
 	// read data packet
 	read_dt(nfc_buf, 8);
 
-	return  (nfc_buf[6] == PN532_COMMAND_SAMCONFIGURATION);
+	return  (nfc_buf[NFC_FRAME_ID_INDEX] == (PN532_COMMAND_SAMCONFIGURATION+1));
 }
 
 /*****************************************************************************/
@@ -192,137 +254,136 @@ u8 NFC_Module::InListPassiveTarget(u8 *buf, u8 brty,
     if(nfc_buf[NFC_FRAME_ID_INDEX-1] != 0xD5){
         return 0;
     }
-	
+#ifdef PN532DEBUG
     puthex(nfc_buf, nfc_buf[3]+6);
     Serial.println();
+#endif
 
     if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_INLISTPASSIVETARGET+1)){
         return 0;
     }
-//    if(nfc_buf[NFC_FRAME_ID_INDEX+1]!=1){
-//#ifdef PN532DEBUG
-//        Serial.println(nfc_buf[NFC_FRAME_ID_INDEX+1],DEC);
-//#endif
-//        return 0;
-//    }
+    /** NbTg targets are now selected, TargetPresent() tracks them */
+    tg_seen = (1 << nfc_buf[NFC_FRAME_ID_INDEX+1]) - 1;
+    /** with bounded MxRtyPassiveActivation, an empty field returns NbTg=0 */
+    if(!nfc_buf[NFC_FRAME_ID_INDEX+1]){
+        return 0;
+    }
     if(brty == PN532_BRTY_ISO14443A){
-        /** UUID length */
+        /** UUID length, 4, 7 or 10 bytes */
         buf[0] = nfc_buf[12];
+        if(buf[0] > NFC_UID_MAX_LEN){
+            return 0;
+        }
 
-        for(u8 i=1; i<5; i++){
+        for(u8 i=1; i<=buf[0]; i++){
             buf[i] = nfc_buf[12+i];
         }
-    }else{
-        buf[0] = nfc_buf[3];
-        memcpy(buf, nfc_buf+5, nfc_buf[3]);
-    }
-
-    return 1;
-}
 
-u8 NFC_Module::FelicaPoll(u8 *buf, u8 len, u8 *idata)
-{
-	static u8 sta=0;
-	if(!sta){
-		nfc_buf[0] = PN532_COMMAND_INLISTPASSIVETARGET;
-		nfc_buf[1] = 0x02;
-		nfc_buf[2] = 0x02;
-		if(len){
-			memcpy(nfc_buf+3, idata, len);
-		}
-		if(!write_cmd_check_ack(nfc_buf, 3+len)){
-			return 0;
-		}
-#ifdef PN532DEBUG
-		puthex(nfc_buf, 3+len);
-		Serial.println();
+#if NFC_USE_ISO14443
+        /** ISO14443-4 compliant, upgrade bit rate as the ATS allows */
+        u8 brit, brti, tg = nfc_buf[8];
+        if((nfc_buf[11] & 0x20) && (tg == 1 || tg == 2) &&
+           ats_baud(nfc_buf+13+buf[0], psl_max[tg-1], &brit, &brti)){
+            in_psl(tg, brit, brti);
+        }
 #endif
-	//	puthex(nfc_buf, 3+len);
-	    Serial.println("Send command");
-	}
-    sta = 1;
-    /** "Waiting for IRQ (indicates card presence)" */
-    wait_ready();
-	wait_ready();
-	wait_ready();
-#ifdef PN532DEBUG
-	Serial.print(" Found Card.\n");
+#if NFC_USE_FELICA
+    }else if(brty == PN532_BRTY_212KBPS || brty == PN532_BRTY_424KBPS){
+        /** Tg, POL_RES length, 01, IDm, PMm, [system code] */
+        buf[0] = nfc_buf[9]-2;
+        if(nfc_buf[9] < 18 || nfc_buf[9] > 20 || nfc_buf[10] != 0x01){
+            return 0;
+        }
+        memcpy(buf+1, nfc_buf+11, buf[0]);
 #endif
-    read_dt(nfc_buf,40);
-	puthex(nfc_buf, nfc_buf[3]+6);
-    Serial.println();
-    if(nfc_buf[NFC_FRAME_ID_INDEX-1] != 0xD5){
-        return 0;
-    }
-	sta = 0;
-    puthex(nfc_buf, nfc_buf[3]+6);
-    Serial.println();
-
-    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_INLISTPASSIVETARGET+1)){
+#if NFC_USE_ISO14443
+    }else if(brty == PN532_BRTY_ISO14443B){
+        /** Tg, ATQB(12): 50 PUPI(4) AppData(4) ProtInfo(3), ATTRIB_RES */
+        if(nfc_buf[9] != 0x50){
+            return 0;
+        }
+        buf[0] = 4;
+        memcpy(buf+1, nfc_buf+10, 4);
+    }else if(brty == PN532_BRTY_JEWEL){
+        /** Tg, SENS_RES(2), JEWELID(4), kept for Topaz commands */
+        buf[0] = 4;
+        memcpy(buf+1, nfc_buf+11, 4);
+        memcpy(jewel_id, nfc_buf+11, 4);
+#endif
+    }else{
         return 0;
     }
-//    if(nfc_buf[NFC_FRAME_ID_INDEX+1]!=1){
-//#ifdef PN532DEBUG
-//        Serial.println(nfc_buf[NFC_FRAME_ID_INDEX+1],DEC);
-//#endif
-//        return 0;
-//    }
-    buf[0] = nfc_buf[3];
-    memcpy(buf, nfc_buf+5, nfc_buf[3]);
-
 
     return 1;
 }
 
 /*****************************************************************************/
 /*!
-	@brief  Mifare funciton. Authentication a block for more operation.
-	@param  type - key type. 0-KEYA, 1-KEYB
-	@param  block - block to Authentication
-	@param  uuid - pointer to selected card's UUID
-	@param  uuid_len - UUID length
-	@param  key - pointer to key buffer.
+	@brief  Exchange one frame with a target. The reply is read from the bus
+        straight into r_buf.
+	@param  mode - NFC_MI, more frames of this command follow; 0 otherwise
+	@param  tg - logical number of the target
+	@param  t_buf - data to send
+	@param  t_len - data length, NFC_DEP_CHUNK at most
+	@param  r_buf - buffer of the received data
+	@param  r_len - in: r_buf size; out: received length
 	@return 0 - failed
             1 - successfully
+            NFC_DEP_MORE - target chains its reply, call again with no data
 */
 /*****************************************************************************/
-u8 NFC_Module::MifareAuthentication(u8 type, u8 block,
-                                    u8 *uuid, u8 uuid_len, u8 *key)
+u8 NFC_Module::InDataExchange(u8 mode, u8 tg, const u8 *t_buf, u8 t_len,
+                              u8 *r_buf, u8 *r_len)
 {
-    u8 i;
-    nfc_buf[0] = PN532_COMMAND_INDATAEXCHANGE;
-    nfc_buf[1] = 1; // logical number of the relevant target
-    nfc_buf[2] = MIFARE_CMD_AUTH_A+type;
-    nfc_buf[3] = block;
-
-    for(i=0; i<6; i++){
-        nfc_buf[4+i] = key[i];
-    }
-    for(i=0; i<uuid_len; i++){
-        nfc_buf[10+i] = uuid[i];
+    nfc_seg_t seg;
+    u8 len = 0;
+
+    seg.buf = t_buf;
+    seg.len = t_len;
+    seg.pgm = 0;
+    if(!r_len){
+        r_len = &len;
     }
+    return in_exchange(mode, tg, &seg, 1, r_buf, r_len);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Raw transceive with the selected target, the PN532 adds no
+        protocol framing. CRC, parity and the bits of the last byte are set
+        per call; registers are only written when they differ from what the
+        previous call left.
+	@param  t_buf - data to send
+	@param  t_len - data length, NFC_DEP_CHUNK at most
+	@param  r_buf - buffer of the received data
+	@param  r_len - in: r_buf size; out: received length
+	@param  flags - NFC_THRU_TX_CRC, NFC_THRU_RX_CRC, NFC_THRU_NO_PARITY
+	@param  last_bits - valid bits of the last byte sent, 0 - all 8
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::InCommunicateThru(const u8 *t_buf, u8 t_len, u8 *r_buf,
+                                 u8 *r_len, u8 flags, u8 last_bits)
+{
+    nfc_seg_t seg[2];
+    u8 cmd = PN532_COMMAND_INCOMMUNICATETHRU;
 
-    if(!write_cmd_check_ack( nfc_buf, (10+uuid_len) )){
+    if(!thru_config(flags, last_bits)){
         return 0;
     }
 
-    wait_ready();
-    read_dt(nfc_buf, 8);
-#if 0
-    if(nfc_buf[5] == 0xD5){
-        Serial.print("Authentication receive:");
-        puthex(nfc_buf, nfc_buf[3]+6);
-        Serial.println();
-    }
-#endif
-    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_INDATAEXCHANGE+1)){
-#ifdef PN532DEBUG
-        puthex(nfc_buf, 20);
-        Serial.println("Authentication fail.");
-#endif
+    seg[0].buf = &cmd;
+    seg[0].len = 1;
+    seg[0].pgm = 0;
+    seg[1].buf = t_buf;
+    seg[1].len = t_len;
+    seg[1].pgm = 0;
+    if(!write_segs_check_ack(seg, 2)){
         return 0;
     }
-    if(nfc_buf[NFC_FRAME_ID_INDEX+1]){
+    if(read_data(PN532_COMMAND_INCOMMUNICATETHRU, r_buf, r_len, 200) &
+       NFC_STATUS_ERR_MASK){
         return 0;
     }
     return 1;
@@ -330,561 +391,773 @@ u8 NFC_Module::MifareAuthentication(u8 type, u8 block,
 
 /*****************************************************************************/
 /*!
-	@brief  Mifare funciton. Read a block.
-	@param  block - block to read
-	@param  buf - pointer to data buffer.
+	@brief  Set CRC, parity and TxLastBits for InCommunicateThru(). The CIU
+        registers are read in one frame when they are not in the shadow
+        cache, e.g. after a target was activated, and only changed ones are
+        written back.
+	@param  flags - see InCommunicateThru()
+	@param  last_bits - valid bits of the last byte, 0 - all 8
 	@return 0 - failed
             1 - successfully
 */
 /*****************************************************************************/
-u8 NFC_Module::MifareReadBlock(u8 block, u8 *buf)
+u8 NFC_Module::thru_config(u8 flags, u8 last_bits)
 {
-    nfc_buf[0] = PN532_COMMAND_INDATAEXCHANGE;
-    nfc_buf[1] = 1; // logical number of the relevant target
-    nfc_buf[2] = MIFARE_CMD_READ;
-    nfc_buf[3] = block;
+    static const u16 addr[4] = {
+        PN532_REG_CIU_TXMODE, PN532_REG_CIU_RXMODE,
+        PN532_REG_CIU_MANUALRCV, PN532_REG_CIU_BITFRAMING
+    };
+    u8 val[4], i, j;
+
+    for(i=0; i<4; i++){
+        j = reg_find(addr[i]);
+        if(j == 0xFF){
+            break;
+        }
+        val[i] = reg_cache[j].val;
+    }
+    if(i < 4){
+        if(!ReadRegister(addr, val, 4)){
+            return 0;
+        }
+        for(i=0; i<4; i++){
+            reg_set(addr[i], val[i]);
+        }
+    }
 
-    if(!write_cmd_check_ack(nfc_buf, 4)){
-        return 0;
+    val[0] &= ~PN532_CIU_CRC_EN;
+    if(flags & NFC_THRU_TX_CRC){
+        val[0] |= PN532_CIU_CRC_EN;
     }
-    wait_ready();
-    read_dt(nfc_buf, 26);
-/**
-    if(nfc_buf[5] == 0xD5){
-        Serial.print("Block receive:");
-        puthex(nfc_buf, nfc_buf[3]+6);
-        Serial.println();
+    val[1] &= ~PN532_CIU_CRC_EN;
+    if(flags & NFC_THRU_RX_CRC){
+        val[1] |= PN532_CIU_CRC_EN;
+    }
+    val[2] &= ~PN532_CIU_PARITY_DISABLE;
+    if(flags & NFC_THRU_NO_PARITY){
+        val[2] |= PN532_CIU_PARITY_DISABLE;
     }
+    /** StartSend is a trigger, never write it back */
+    val[3] = (val[3] & ~(0x80|PN532_CIU_TXLASTBITS)) |
+             (last_bits & PN532_CIU_TXLASTBITS);
+
+    return WriteRegister(addr, val, 4);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  InDataExchange with data gathered from segments.
+	@param  mode, tg, r_buf, r_len - see InDataExchange()
+	@param  seg - data segments to send
+	@param  num - number of segments
+	@return see InDataExchange()
 */
-    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_INDATAEXCHANGE+1)){
-#ifdef PN532DEBUG
-        puthex(nfc_buf, 20);
-        Serial.println("Authentication fail.");
-#endif
-        return 0;
+/*****************************************************************************/
+u8 NFC_Module::in_exchange(u8 mode, u8 tg, const nfc_seg_t *seg, u8 num,
+                           u8 *r_buf, u8 *r_len)
+{
+    nfc_seg_t frame[3];
+    u8 hdr[2], sta;
+
+    hdr[0] = PN532_COMMAND_INDATAEXCHANGE;
+    hdr[1] = tg | (mode & NFC_MI);
+    frame[0].buf = hdr;
+    frame[0].len = 2;
+    frame[0].pgm = 0;
+    for(u8 i=0; i<num && i<2; i++){
+        frame[1+i] = seg[i];
     }
-    if(nfc_buf[NFC_FRAME_ID_INDEX+1]){
+    if(!write_segs_check_ack(frame, 1+(num<2 ? num : 2))){
         return 0;
     }
 
-    memcpy(buf, nfc_buf+8, 16);
+    sta = read_data(PN532_COMMAND_INDATAEXCHANGE, r_buf, r_len, 200);
+    if(sta & NFC_STATUS_ERR_MASK){
+        return 0;
+    }
+    return (sta & NFC_MI) ? NFC_DEP_MORE : 1;
+}
 
-    return 1;
+/*****************************************************************************/
+/*!
+	@brief  PN532 InPSL command, change bit rates of an activated target.
+	@param  tg - logical number of the target
+	@param  brit - bit rate initiator to target, PN532_BRTY_*
+	@param  brti - bit rate target to initiator, PN532_BRTY_*
+	@return 0 - failed, target keeps its bit rate
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::in_psl(u8 tg, u8 brit, u8 brti)
+{
+    nfc_buf[0] = PN532_COMMAND_INPSL;
+    nfc_buf[1] = tg;
+    nfc_buf[2] = brit;
+    nfc_buf[3] = brti;
+    return exchange(4, 10);
 }
 
 /*****************************************************************************/
 /*!
-	@brief  Mifare funciton. Write to a block.
-	@param  block - block to write
-	@param  buf - pointer to data buffer.
+	@brief  Read PN532 registers, as many per frame as fit in nfc_buf.
+	@param  addr - register addresses
+	@param  val - returns the values
+	@param  num - number of registers
 	@return 0 - failed
             1 - successfully
 */
 /*****************************************************************************/
-u8 NFC_Module::MifareWriteBlock(u8 block, u8 *buf)
+u8 NFC_Module::ReadRegister(const u16 *addr, u8 *val, u8 num)
 {
-    nfc_buf[0] = PN532_COMMAND_INDATAEXCHANGE;
-    nfc_buf[1] = 1; // logical number of the relevant target
-    nfc_buf[2] = MIFARE_CMD_WRITE;
-    nfc_buf[3] = block;
-
-    memcpy(nfc_buf+4, buf, 16);
-
-    if(!write_cmd_check_ack(nfc_buf, 20)){
-        return 0;
-    }
-    wait_ready();
-    read_dt(nfc_buf, 26);
-    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_INDATAEXCHANGE+1)){
-#ifdef PN532DEBUG
-        puthex(nfc_buf, 20);
-        Serial.println("Authentication fail.");
-#endif
-        return 0;
-    }
-    if(nfc_buf[NFC_FRAME_ID_INDEX+1]){
-        return 0;
+    u8 i, n;
+
+    while(num){
+        n = (num > NFC_REG_READ_MAX) ? NFC_REG_READ_MAX : num;
+        nfc_buf[0] = PN532_COMMAND_READREGISTER;
+        for(i=0; i<n; i++){
+            nfc_buf[1+2*i] = addr[i] >> 8;
+            nfc_buf[2+2*i] = addr[i];
+        }
+        if(!exchange_raw(1+2*n, n)){
+            return 0;
+        }
+        memcpy(val, nfc_buf+7, n);
+        addr += n;
+        val += n;
+        num -= n;
     }
     return 1;
 }
 
 /*****************************************************************************/
 /*!
-	@brief  Configure PN532 as Initiator
-	@param  NONE
+	@brief  Read one PN532 register.
+	@param  addr - register address
+	@param  val - returns the value
 	@return 0 - failed
             1 - successfully
 */
 /*****************************************************************************/
-u8 NFC_Module::P2PInitiatorInit()
+u8 NFC_Module::ReadRegister(u16 addr, u8 *val)
 {
-    /** avoid resend command */
-    static u8 send_flag=1;
-    nfc_buf[0] = PN532_COMMAND_INJUMPFORDEP;
-    nfc_buf[1] = 0x01; // avtive mode
-    nfc_buf[2] = 0x02; // 201Kbps
-    nfc_buf[3] = 0x01;
-
-    nfc_buf[4] = 0x00;
-    nfc_buf[5] = 0xFF;
-    nfc_buf[6] = 0xFF;
-    nfc_buf[7] = 0x00;
-    nfc_buf[8] = 0x00;
+    return ReadRegister(&addr, val, 1);
+}
 
-    if(send_flag){
-        send_flag = 0;
-        if(!write_cmd_check_ack(nfc_buf, 9)){
-#ifdef PN532_P2P_DEBUG
-            Serial.println("InJumpForDEP sent fialed\n");
-#endif
+/*****************************************************************************/
+/*!
+	@brief  Write PN532 registers, as many per frame as fit in nfc_buf.
+        Registers whose shadow copy already holds the value are skipped,
+        nothing is sent if all of them are.
+	@param  addr - register addresses
+	@param  val - values to write
+	@param  num - number of registers
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::WriteRegister(const u16 *addr, const u8 *val, u8 num)
+{
+    u8 i, j, first, n;
+
+    for(first=0; first<num; first=i){
+        nfc_buf[0] = PN532_COMMAND_WRITEREGISTER;
+        n = 0;
+        for(i=first; i<num && n<NFC_REG_WRITE_MAX; i++){
+            j = reg_find(addr[i]);
+            if(j != 0xFF && reg_cache[j].val == val[i]){
+                continue;
+            }
+            nfc_buf[1+3*n] = addr[i] >> 8;
+            nfc_buf[2+3*n] = addr[i];
+            nfc_buf[3+3*n] = val[i];
+            n++;
+        }
+        if(!n){
+            continue;
+        }
+        if(!exchange_raw(1+3*n, 0)){
+            /** the PN532 state is unknown now */
+            reg_num = 0;
             return 0;
         }
-#ifdef PN532_P2P_DEBUG
-        Serial.println("InJumpForDEP sent ******\n");
-#endif
-    }
-    wait_ready(10);
-    read_dt(nfc_buf, 25);
-
-    if(nfc_buf[5] != 0xD5){
-//        Serial.println("InJumpForDEP sent read failed");
-        return 0;
-    }
-
-    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_INJUMPFORDEP+1)){
-#ifdef PN532_P2P_DEBUG
-        puthex(nfc_buf, nfc_buf[3]+7);
-        Serial.println("Initiator init failed");
-#endif
-        return 0;
-    }
-    if(nfc_buf[NFC_FRAME_ID_INDEX+1]){
-        return 0;
+        for(j=first; j<i; j++){
+            reg_set(addr[j], val[j]);
+        }
     }
-
-#ifdef PN532_P2P_DEBUG
-    Serial.println("InJumpForDEP read success");
-#endif
-    send_flag = 1;
     return 1;
 }
 
 /*****************************************************************************/
 /*!
-	@brief  Configure PN532 as Target.
-	@param  NONE.
+	@brief  Write one PN532 register, skipped if the shadow copy matches.
+	@param  addr - register address
+	@param  val - value to write
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::WriteRegister(u16 addr, u8 val)
+{
+    return WriteRegister(&addr, &val, 1);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Read-modify-write of a bit field. The current value comes from
+        the shadow copy when there is one, otherwise it is read first.
+	@param  addr - register address
+	@param  mask - bits to change
+	@param  bits - new value of the masked bits
 	@return 0 - failed
             1 - successfully
 */
 /*****************************************************************************/
-u8 NFC_Module::P2PTargetInit()
-{
-    /** avoid resend command */
-    static u8 send_flag=1;
-    nfc_buf[0] = PN532_COMMAND_TGINITASTARGET;
-    /** 14443-4A Card only */
-    nfc_buf[1] = 0x00;
-
-    /** SENS_RES */
-    nfc_buf[2] = 0x04;
-    nfc_buf[3] = 0x00;
-
-    /** NFCID1 */
-    nfc_buf[4] = 0x12;
-    nfc_buf[5] = 0x34;
-    nfc_buf[6] = 0x56;
-
-    /** SEL_RES */
-    nfc_buf[7] = 0x40;      // DEP only mode
-
-    /**Parameters to build POL_RES (18 bytes including system code) */
-    nfc_buf[8] = 0x01;
-    nfc_buf[9] = 0xFE;
-    nfc_buf[10] = 0xA2;
-    nfc_buf[11] = 0xA3;
-    nfc_buf[12] = 0xA4;
-    nfc_buf[13] = 0xA5;
-    nfc_buf[14] = 0xA6;
-    nfc_buf[15] = 0xA7;
-    nfc_buf[16] = 0xC0;
-    nfc_buf[17] = 0xC1;
-    nfc_buf[18] = 0xC2;
-    nfc_buf[19] = 0xC3;
-    nfc_buf[20] = 0xC4;
-    nfc_buf[21] = 0xC5;
-    nfc_buf[22] = 0xC6;
-    nfc_buf[23] = 0xC7;
-    nfc_buf[24] = 0xFF;
-    nfc_buf[25] = 0xFF;
-    /** NFCID3t */
-    nfc_buf[26] = 0xAA;
-    nfc_buf[27] = 0x99;
-    nfc_buf[28] = 0x88;
-    nfc_buf[29] = 0x77;
-    nfc_buf[30] = 0x66;
-    nfc_buf[31] = 0x55;
-    nfc_buf[32] = 0x44;
-    nfc_buf[33] = 0x33;
-    nfc_buf[34] = 0x22;
-    nfc_buf[35] = 0x11;
-    /** Length of general bytes  */
-    nfc_buf[36] = 0x00;
-    /** Length of historical bytes  */
-    nfc_buf[37] = 0x00;
-
-    if(send_flag){
-        send_flag = 0;
-        if(!write_cmd_check_ack(nfc_buf, 38)){
-            send_flag = 1;
+u8 NFC_Module::WriteRegisterBits(u16 addr, u8 mask, u8 bits)
+{
+    u8 i, val;
+
+    i = reg_find(addr);
+    if(i != 0xFF){
+        val = reg_cache[i].val;
+    }else{
+        if(!ReadRegister(addr, &val)){
             return 0;
         }
-#ifdef PN532_P2P_DEBUG
-        Serial.println("Target init sent.");
-#endif
+        /** cache what is on the chip so an unchanged field is not sent */
+        reg_set(addr, val);
     }
+    return WriteRegister(addr, (val & ~mask) | (bits & mask));
+}
 
-    wait_ready(10);
-    read_dt(nfc_buf, 24);
-
-    if(nfc_buf[5] != 0xD5){
-        return 0;
-    }
+/*****************************************************************************/
+/*!
+	@brief  Forget the shadow register values, e.g. after the PN532 was
+        reset behind the library's back.
+	@param  NONE
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Module::RegisterCacheClear(void)
+{
+    reg_num = 0;
+}
 
-    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_TGINITASTARGET+1)){
-#ifdef PN532_P2P_DEBUG
-        puthex(nfc_buf, nfc_buf[3]+7);
-        Serial.println("Target init fail.");
-#endif
-        return 0;
+/*****************************************************************************/
+/*!
+	@brief  Find a register in the shadow cache.
+	@param  addr - register address
+	@return index in reg_cache, 0xFF - not cached
+*/
+/*****************************************************************************/
+u8 NFC_Module::reg_find(u16 addr)
+{
+    for(u8 i=0; i<reg_num; i++){
+        if(reg_cache[i].addr == addr){
+            return i;
+        }
     }
-
-    send_flag = 1;
-#ifdef PN532_P2P_DEBUG
-    Serial.println("TgInitAsTarget read success");
-#endif
-    return 1;
+    return 0xFF;
 }
 
 /*****************************************************************************/
 /*!
-	@brief  Initiator send and reciev data.
-    @param  tx_buf --- data send buffer, user sets
-            tx_len --- data send legth, user sets.
-            rx_buf --- data recieve buffer, returned by P2PInitiatorTxRx
-            rx_len --- data receive length, returned by P2PInitiatorTxRx
-	@return 0 - send failed
-            1 - send successfully
+	@brief  Store a register value in the shadow cache, the oldest slot is
+        reused when it is full.
+	@param  addr - register address
+	@param  val - value on the chip
+	@return NONE
 */
 /*****************************************************************************/
-u8 NFC_Module::P2PInitiatorTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len)
+void NFC_Module::reg_set(u16 addr, u8 val)
 {
-//    wait_ready();
-//    wait_ready();
-    wait_ready(15);
-    nfc_buf[0] = PN532_COMMAND_INDATAEXCHANGE;
-    nfc_buf[1] = 0x01; // logical number of the relevant target
-
-    memcpy(nfc_buf+2, t_buf, t_len);
+    u8 i = reg_find(addr);
 
-    if(!write_cmd_check_ack(nfc_buf, t_len+2)){
-        return 0;
+    if(i == 0xFF){
+        if(reg_num < NFC_REG_CACHE_SIZE){
+            i = reg_num++;
+        }else{
+            i = reg_next;
+            reg_next = (reg_next+1) % NFC_REG_CACHE_SIZE;
+        }
+        reg_cache[i].addr = addr;
     }
-#ifdef PN532_P2P_DEBUG
-    Serial.println("Initiator DataExchange sent.");
-#endif
-
-    wait_ready(200);
+    reg_cache[i].val = val;
+}
 
-    read_dt(nfc_buf, 60);
-    if(nfc_buf[5] != 0xD5){
+/*****************************************************************************/
+/*!
+	@brief  Read GPIO ports P3 and P7, the shadow copy is refreshed.
+	@param  p3 - optional, returns P30..P35 in bits 0..5
+	@param  p7 - optional, returns P71, P72 in bits 1, 2
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::ReadGPIO(u8 *p3, u8 *p7)
+{
+    nfc_buf[0] = PN532_COMMAND_READGPIO;
+    if(!exchange_raw(1, 3)){
         return 0;
     }
-
-#ifdef PN532_P2P_DEBUG
-    Serial.println("Initiator DataExchange Get.");
-#endif
-
-    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_INDATAEXCHANGE+1)){
-#ifdef PN532_P2P_DEBUG
-        puthex(nfc_buf, nfc_buf[3]+7);
-        Serial.println("Send data failed");
-#endif
-        return 0;
+    gpio_p3 = nfc_buf[7] & PN532_GPIO_P3_MASK;
+    gpio_p7 = nfc_buf[8] & PN532_GPIO_P7_MASK;
+    gpio_q3 = gpio_p3;
+    gpio_q7 = gpio_p7;
+    gpio_valid = 1;
+    gpio_pending = 0;
+    if(p3){
+        *p3 = gpio_p3;
     }
-
-    if(nfc_buf[NFC_FRAME_ID_INDEX+1]){
-#ifdef PN532_P2P_DEBUG
-        Serial.print("InExchangeData Error:");
-        puthex(nfc_buf, nfc_buf[3]+7);
-        Serial.println();
-#endif
-        return 0;
+    if(p7){
+        *p7 = gpio_p7;
     }
-
-#ifdef PN532_P2P_DEBUG
-    puthex(nfc_buf, nfc_buf[3]+7);
-    Serial.println();
-#endif
-    /** return read data */
-    *r_len = nfc_buf[3]-3;
-    memcpy(r_buf, nfc_buf+8, *r_len);
     return 1;
 }
 
 /*****************************************************************************/
 /*!
-	@brief  Target sends and recievs data.
-    @param  tx_buf --- data send buffer, user sets
-            tx_len --- data send legth, user sets.
-            rx_buf --- data recieve buffer, returned by P2PInitiatorTxRx
-            rx_len --- data receive length, returned by P2PInitiatorTxRx
-	@return 0 - send failed
-            1 - send successfully
+	@brief  Queue a GPIO pin change. Changes are merged into one WriteGPIO
+        which is sent by GPIOFlush() or ahead of the next command; setting a
+        pin back to the level on the chip cancels the update. The ports are
+        read once if their state is not known yet.
+        Merging saves a WriteGPIO per extra pin change, but the one that is
+        sent is still a full round trip of its own before the next command.
+	@param  pin - PN532_GPIO_P30..PN532_GPIO_P35, PN532_GPIO_P71, P72
+	@param  level - 0 or 1
+	@return 0 - failed
+            1 - successfully
 */
 /*****************************************************************************/
-u8 NFC_Module::P2PTargetTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len)
+u8 NFC_Module::GPIOPin(u8 pin, u8 level)
 {
-    nfc_buf[0] = PN532_COMMAND_TGGETDATA;
-    if(!write_cmd_check_ack(nfc_buf, 1)){
-        return 0;
-    }
-    wait_ready(100);
-    read_dt(nfc_buf, 60);
-    if(nfc_buf[5] != 0xD5){
-        return 0;
-    }
-
-    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_TGGETDATA+1)){
-#ifdef PN532_P2P_DEBUG
-        puthex(nfc_buf, 20);
-        Serial.println("Target GetData failed");
-#endif
-        return 0;
-    }
-    if(nfc_buf[NFC_FRAME_ID_INDEX+1]){
- #ifdef PN532_P2P_DEBUG
-        Serial.print("TgGetData Error:");
-        puthex(nfc_buf, nfc_buf[3]+7);
-        Serial.println();
-#endif
+    u8 *q, bit;
+
+    if(pin <= PN532_GPIO_P35){
+        q = &gpio_q3;
+        bit = 1 << pin;
+    }else if(pin == PN532_GPIO_P71 || pin == PN532_GPIO_P72){
+        q = &gpio_q7;
+        bit = 1 << (pin-8);
+    }else{
         return 0;
     }
-
-#ifdef PN532_P2P_DEBUG
-    Serial.println("TgGetData:");
-    puthex(nfc_buf, nfc_buf[3]+7);
-    Serial.println();
-#endif
-
-    /** return read data */
-    *r_len = nfc_buf[3]-3;
-    memcpy(r_buf, nfc_buf+8, *r_len);
-
-    nfc_buf[0] = PN532_COMMAND_TGSETDATA;
-    memcpy(nfc_buf+1, t_buf, t_len);
-
-    if(!write_cmd_check_ack(nfc_buf, 1+t_len)){
+    if(!gpio_valid && !ReadGPIO()){
         return 0;
     }
-    wait_ready(100);
-    read_dt(nfc_buf, 26);
 
-    if(nfc_buf[5] != 0xD5){
-        return 0;
-    }
-    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_TGSETDATA+1)){
-#ifdef PN532_P2P_DEBUG
-        puthex(nfc_buf, 20);
-        Serial.println("Send data failed");
-#endif
-        return 0;
-    }
-    if(nfc_buf[NFC_FRAME_ID_INDEX+1]){
-        return 0;
+    if(level){
+        *q |= bit;
+    }else{
+        *q &= ~bit;
     }
-
+    gpio_pending = (gpio_q3 != gpio_p3) || (gpio_q7 != gpio_p7);
     return 1;
 }
 
-
-
 /*****************************************************************************/
 /*!
-	@brief  Unfinished
-	@param
-	@return 0 - send failed
-            1 - send successfully
+	@brief  Send queued GPIO changes now. A failed update, here or ahead of
+        another command, stays queued and is sent again.
+	@param  NONE
+	@return 0 - failed, the update is still queued
+            1 - successfully, or nothing to send
 */
 /*****************************************************************************/
-u8 NFC_Module::TgInitAsTarget()
-{
-    nfc_buf[0] = PN532_COMMAND_TGINITASTARGET;
-    /** 14443-4A Card only */
-    nfc_buf[1] = 0x04;
-
-    /** SENS_RES */
-    nfc_buf[2] = 0x04;
-    nfc_buf[3] = 0x00;
-
-    /** NFCID1 */
-    nfc_buf[4] = 0x12;
-    nfc_buf[5] = 0x34;
-    nfc_buf[6] = 0x56;
-
-    /** SEL_RES */
-    nfc_buf[7] = 0x60;
-
-    /**Parameters to build POL_RES (18 bytes including system code) */
-    nfc_buf[8] = 0x01;
-    nfc_buf[9] = 0xFE;
-    nfc_buf[10] = 0xA2;
-    nfc_buf[11] = 0xA3;
-    nfc_buf[12] = 0xA4;
-    nfc_buf[13] = 0xA5;
-    nfc_buf[14] = 0xA6;
-    nfc_buf[15] = 0xA7;
-    nfc_buf[16] = 0xC0;
-    nfc_buf[17] = 0xC1;
-    nfc_buf[18] = 0xC2;
-    nfc_buf[19] = 0xC3;
-    nfc_buf[20] = 0xC4;
-    nfc_buf[21] = 0xC5;
-    nfc_buf[22] = 0xC6;
-    nfc_buf[23] = 0xC7;
-    nfc_buf[24] = 0xFF;
-    nfc_buf[25] = 0xFF;
-    /** NFCID3t */
-    nfc_buf[26] = 0xAA;
-    nfc_buf[27] = 0x99;
-    nfc_buf[28] = 0x88;
-    nfc_buf[29] = 0x77;
-    nfc_buf[30] = 0x66;
-    nfc_buf[31] = 0x55;
-    nfc_buf[32] = 0x44;
-    nfc_buf[33] = 0x33;
-    nfc_buf[34] = 0x22;
-    nfc_buf[35] = 0x11;
-    /** Length of general bytes  */
-    nfc_buf[36] = 0x00;
-    /** Length of historical bytes  */
-    nfc_buf[37] = 0x00;
-
-    if(!write_cmd_check_ack(nfc_buf, 38)){
+u8 NFC_Module::GPIOFlush(void)
+{
+    if(!gpio_pending){
+        return 1;
+    }
+    return gpio_send();
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Set a GPIO pin at once, no frame is sent if it is unchanged.
+	@param  pin - see GPIOPin()
+	@param  level - 0 or 1
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::WriteGPIO(u8 pin, u8 level)
+{
+    if(!GPIOPin(pin, level)){
         return 0;
     }
+    return GPIOFlush();
+}
 
+/*****************************************************************************/
+/*!
+	@brief  Send the queued GPIO state with WriteGPIO. Uses its own buffer
+        since nfc_buf may hold the command about to be sent.
+	@param  NONE
+	@return 0 - failed, the update stays queued
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::gpio_send(void)
+{
+    nfc_seg_t seg;
+    u8 buf[9];
+
+    /** cleared while sending, write_segs() would send it again */
+    gpio_pending = 0;
+    buf[0] = PN532_COMMAND_WRITEGPIO;
+    buf[1] = PN532_GPIO_VALIDATIONBIT | gpio_q3;
+    buf[2] = PN532_GPIO_VALIDATIONBIT | gpio_q7;
+    seg.buf = buf;
+    seg.len = 3;
+    seg.pgm = 0;
+    write_segs(&seg, 1);
+    if(!check_ack()){
+        return gpio_fail();
+    }
+    wait_ready();
+    read_dt(buf, 9);
+    if(buf[5] != 0xD5 || buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_WRITEGPIO+1)){
+        return gpio_fail();
+    }
+    gpio_p3 = gpio_q3;
+    gpio_p7 = gpio_q7;
     return 1;
 }
 
 /*****************************************************************************/
 /*!
-	@brief  Unfinished
-	@param
-	@return
+	@brief  Keep a GPIO update queued after WriteGPIO failed. The ports on
+        the chip are unknown now, so the queued state differs from any
+        state GPIOPin() can set, and is sent again in full.
+	@param  NONE
+	@return 0
 */
 /*****************************************************************************/
-u8 NFC_Module::TargetPolling()
+u8 NFC_Module::gpio_fail(void)
 {
-    static poll_sta_type sta;
-    static u8 count=0;
-    wait_ready();
-    read_dt(nfc_buf, 30);
-#ifdef PN532DEBUG
-    delay(300);
-    puthex(nfc_buf, 9);
-    Serial.println();
-#endif
-    switch(sta){
-        case NFC_STA_TAG:
-            break;
-        case NFC_STA_GETDATA:
-            count++;
-            if(count > 10){
-                Serial.println("*************Reinit Target************");
-                /** Target release */
-                TgInitAsTarget();
-                Serial.println("*************Reinit Target************");
-                sta = NFC_STA_TAG;
-            }
-            break;
-        case NFC_STA_SETDATA:
-            break;
+    gpio_p3 = 0xFF;
+    gpio_p7 = 0xFF;
+    gpio_pending = 1;
+    return 0;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Number of commands sent to PN532, to count the round trips of
+        an operation.
+	@param  reset - 1, restart counting after returning the count
+	@return commands sent since the last reset
+*/
+/*****************************************************************************/
+u16 NFC_Module::Exchanges(u8 reset)
+{
+    u16 n = cmd_count;
+
+    if(reset){
+        cmd_count = 0;
     }
-    if(nfc_buf[5] == 0xD5){
-        puthex(nfc_buf, nfc_buf[3]+6);
-        switch(nfc_buf[NFC_FRAME_ID_INDEX]){
-            case PN532_COMMAND_TGINITASTARGET+1:
-                Serial.println("TgInitTatget");
-                nfc_buf[0] = PN532_COMMAND_TGGETDATA;
-                sta = NFC_STA_GETDATA;
-                count=0;
-                if(!write_cmd_check_ack(nfc_buf, 1)){
-                    return 0;
-                }
-                break;
-            case PN532_COMMAND_TGRESPONSETOINITIATOR+1:
-                Serial.println("TgResponseToInitiator");
-                break;
-            case PN532_COMMAND_TGGETINITIATORCOMMAND+1:
-                Serial.println("TgGetInitiatorCommand");
-                break;
-            case PN532_COMMAND_TGGETDATA+1:
-                Serial.println("TgGetData");
-                if(!nfc_buf[NFC_FRAME_ID_INDEX+1]){
-                    Serial.println("TgGetData Success.");
-                    switch(nfc_buf[NFC_FRAME_ID_INDEX+2]){
-                        case 0x60:
-                            nfc_buf[0] = PN532_COMMAND_TGSETDATA;
-                            nfc_buf[1] = 0x00;
-                            nfc_buf[2] = 0xFF;
-                            if(!write_cmd_check_ack(nfc_buf, 3)){
-                                return 0;
-                            }
-                            break;
-                        case 0x30:
-                            nfc_buf[0] = PN532_COMMAND_TGSETDATA;
-                            for(u8 i=1; i<17; i++){
-                                nfc_buf[i] = i;
-                            }
-                            if(!write_cmd_check_ack(nfc_buf, 17)){
-                                return 0;
-                            }
-                            break;
-                        default:
-                            Serial.println("TgGetData Error.");
-                            wait_ready();
-                            /** Target release */
-                            TgInitAsTarget();
-                            break;
-                    }
-
-                }else{
-                    /** Target release */
-                    TgInitAsTarget();
-                }
-                break;
-            case PN532_COMMAND_TGSETDATA+1:
-                Serial.println("TgSetData");
-                if(!nfc_buf[NFC_FRAME_ID_INDEX+1]){
-                    Serial.println("TgSetData Success.");
-                    nfc_buf[0] = PN532_COMMAND_TGGETDATA;
-                    sta = NFC_STA_GETDATA;
-                    count=0;
-                    if(!write_cmd_check_ack(nfc_buf, 1)){
-                        /**  */
-                        Serial.println("SetData check error.");
-                        return 0;
-                    }
-                }
-                break;
-            default:
-                Serial.println("Undifined command");
-                break;
+    return n;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Send a command without waiting for its response, CmdPoll()
+        collects it later. Only the ACK is waited for.
+	@param  cmd - command code and parameters
+	@param  len - command length
+	@param  rlen - response frame bytes to read, NFC_CMD_BUF_LEN-2 at most;
+        0, or less than NFC_CMD_RLEN_MIN, reads NFC_CMD_BUF_LEN-2
+	@return 0 - failed, or another command is in flight
+            1 - sent
+*/
+/*****************************************************************************/
+u8 NFC_Module::CmdStart(const u8 *cmd, u8 len, u8 rlen)
+{
+    nfc_seg_t seg;
+
+    if(cmd_rlen){
+        return 0;
+    }
+    /** cmd_rlen 0 would leave the command sent but the engine idle */
+    if(rlen < NFC_CMD_RLEN_MIN || rlen > NFC_CMD_BUF_LEN-2){
+        rlen = NFC_CMD_BUF_LEN-2;
+    }
+    seg.buf = cmd;
+    seg.len = len;
+    seg.pgm = 0;
+    if(!write_segs_check_ack(&seg, 1)){
+        return 0;
+    }
+    cmd_owner = cmd;
+    cmd_code = cmd[0];
+    cmd_rlen = rlen;
+    cmd_time = millis();
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Check once whether the response of CmdStart() is there, never
+        waits for it.
+	@param  NONE
+	@return NFC_CMD_BUSY - not yet
+            NFC_CMD_DONE - response read, see CmdResponse()
+            NFC_CMD_FAILED - bad response, longer than the rlen of
+            CmdStart(), or no command in flight
+*/
+/*****************************************************************************/
+u8 NFC_Module::CmdPoll(void)
+{
+    u8 rlen = cmd_rlen, sum = 0;
+
+    if(!rlen){
+        return NFC_CMD_FAILED;
+    }
+    if(read_sta() != PN532_I2C_READY){
+        return NFC_CMD_BUSY;
+    }
+    read_dt(nfc_buf, rlen);
+    cmd_rlen = 0;
+    /** frame must fit in what has been read, and LCS/DCS must hold */
+    if(nfc_buf[3] < 2 || nfc_buf[3] > rlen-7 || (u8)(nfc_buf[3]+nfc_buf[4]) ||
+       nfc_buf[5] != 0xD5 || nfc_buf[NFC_FRAME_ID_INDEX] != (cmd_code+1)){
+        return NFC_CMD_FAILED;
+    }
+    for(u8 i=0; i<=nfc_buf[3]; i++){
+        sum += nfc_buf[5+i];
+    }
+    return sum ? NFC_CMD_FAILED : NFC_CMD_DONE;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  One step of a command for a polling loop or protothread: starts
+        it when the engine is free, then polls it. The cmd pointer tells the
+        callers apart, each needs its own command buffer.
+	@param  cmd - command code and parameters
+	@param  len - command length
+	@param  rlen - response frame bytes to read
+	@param  ms - abort the command after ms, 0 - no timeout
+	@return NFC_CMD_BUSY - call again
+            NFC_CMD_DONE - response read, see CmdResponse()
+            NFC_CMD_FAILED - failed or timed out
+*/
+/*****************************************************************************/
+u8 NFC_Module::CmdStep(const u8 *cmd, u8 len, u8 rlen, u16 ms)
+{
+    if(!cmd_rlen){
+        return CmdStart(cmd, len, rlen) ? NFC_CMD_BUSY : NFC_CMD_FAILED;
+    }
+    if(cmd_owner != cmd){
+        /** someone else's command is in flight */
+        return NFC_CMD_BUSY;
+    }
+    if(ms && (u32)(millis() - cmd_time) >= ms){
+        CmdAbort();
+        return NFC_CMD_FAILED;
+    }
+    return CmdPoll();
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Response data of the last command completed by CmdPoll().
+	@param  len - returns the data length
+	@return pointer to the data following the response code
+*/
+/*****************************************************************************/
+u8 *NFC_Module::CmdResponse(u8 *len)
+{
+    *len = nfc_buf[3]-2;
+    return nfc_buf+NFC_FRAME_ID_INDEX+1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Abort the command in flight, PN532 drops it on an ACK frame.
+	@param  NONE
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Module::CmdAbort(void)
+{
+    if(!cmd_rlen){
+        return;
+    }
+    bus_tx();
+    for(u8 i=0; i<6; i++){
+        send(ack[i]);
+    }
+    Wire.endTransmission();
+    cmd_rlen = 0;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Whether a command of CmdStart() is waiting for its response.
+	@param  NONE
+	@return 0 - idle, 1 - busy
+*/
+/*****************************************************************************/
+u8 NFC_Module::CmdBusy(void)
+{
+    return cmd_rlen != 0;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  One CmdStep() of an InDataExchange, or another command that
+        answers with a status byte: a response with an error status fails.
+	@param  cmd - command code and parameters
+	@param  len - command length
+	@param  rlen - response frame bytes to read
+	@param  ms - abort after ms, 0 - no timeout
+	@return NFC_CMD_BUSY, NFC_CMD_DONE or NFC_CMD_FAILED, see CmdStep()
+*/
+/*****************************************************************************/
+u8 NFC_Module::step_exchange(const u8 *cmd, u8 len, u8 rlen, u16 ms)
+{
+    u8 ret = CmdStep(cmd, len, rlen, ms);
+
+    if(ret == NFC_CMD_DONE &&
+       (nfc_buf[3] < 3 || (nfc_buf[NFC_FRAME_ID_INDEX+1] & NFC_STATUS_ERR_MASK))){
+        return NFC_CMD_FAILED;
+    }
+    return ret;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  InListPassiveTarget() as a step of CmdStep(), for a protothread:
+        lists one 106 kbps type A target without blocking. The command is
+        built in cmd when the engine is free, and cmd identifies the caller.
+	@param  cmd - command buffer of the caller, NFC_STEP_CMD_LEN bytes
+	@param  buf - buf[0] UUID length, UUID from buf[1]
+	@param  ms - abort after ms, 0 - no timeout
+	@return NFC_CMD_BUSY - call again
+            NFC_CMD_DONE - target selected, UUID in buf
+            NFC_CMD_FAILED - failed, timed out or no target
+*/
+/*****************************************************************************/
+u8 NFC_Module::StepInList(u8 *cmd, u8 *buf, u16 ms)
+{
+    u8 ret;
+
+    if(!cmd_rlen){
+        cmd[0] = PN532_COMMAND_INLISTPASSIVETARGET;
+        cmd[1] = 1;
+        cmd[2] = PN532_BRTY_ISO14443A;
+    }
+    /** Tg SENS_RES SEL_RES NFCIDLength NFCID1 [ATS], as InListPassiveTarget */
+    ret = CmdStep(cmd, 3, 40, ms);
+    if(ret != NFC_CMD_DONE){
+        return ret;
+    }
+    tg_seen = (1 << nfc_buf[NFC_FRAME_ID_INDEX+1]) - 1;
+    if(!nfc_buf[NFC_FRAME_ID_INDEX+1] || nfc_buf[12] > NFC_UID_MAX_LEN ||
+       nfc_buf[3] < 8+nfc_buf[12]){
+        return NFC_CMD_FAILED;
+    }
+    buf[0] = nfc_buf[12];
+    memcpy(buf+1, nfc_buf+13, buf[0]);
+    return NFC_CMD_DONE;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Check whether a selected target is still in the field, without
+        the waits and anticollision of a new InListPassiveTarget.
+	@param  tg - logical number of the target, 1 or 2
+	@param  probe - NFC_PROBE_DIAGNOSE, Diagnose attention request test,
+                    ISO14443-4 and DEP targets only. Diagnose takes no
+                    target number, it tests the target PN532 exchanged
+                    with last, so with two targets selected tg only picks
+                    the state that is updated.
+                    NFC_PROBE_READ, read of one block/page, for Mifare
+                    Classic the block must be in the authenticated sector.
+	@param  block - block/page read by NFC_PROBE_READ
+	@param  ms - optional, returns probe latency in milliseconds
+	@return NFC_TG_ABSENT - target is not in the field
+            NFC_TG_PRESENT - target answered
+            NFC_TG_REMOVED - target left the field since last check
+*/
+/*****************************************************************************/
+u8 NFC_Module::TargetPresent(u8 tg, u8 probe, u8 block, u16 *ms)
+{
+    u32 start = millis();
+    u8 cmd, len, present = 0;
+
+    /** PN532 selects 2 targets at most, tg_seen has a bit for each */
+    if(tg < 1 || tg > 2){
+        if(ms){
+            *ms = 0;
         }
+        return NFC_TG_ABSENT;
+    }
+    if(probe == NFC_PROBE_DIAGNOSE){
+        cmd = PN532_COMMAND_DIAGNOSE;
+        nfc_buf[0] = cmd;
+        nfc_buf[1] = PN532_DIAG_ATTENTION_REQUEST;
+        len = 2;
     }else{
-        Serial.println(".");
+        cmd = PN532_COMMAND_INDATAEXCHANGE;
+        nfc_buf[0] = cmd;
+        nfc_buf[1] = tg;
+        nfc_buf[2] = MIFARE_CMD_READ;
+        nfc_buf[3] = block;
+        len = 4;
     }
-    return 1;
+
+    if(write_cmd_check_ack(nfc_buf, len)){
+        wait_ready();
+        read_dt(nfc_buf, 10);
+        present = (nfc_buf[5] == 0xD5) &&
+                  (nfc_buf[NFC_FRAME_ID_INDEX] == (cmd+1)) &&
+                  !nfc_buf[NFC_FRAME_ID_INDEX+1];
+    }
+
+    if(ms){
+        *ms = millis() - start;
+    }
+    if(present){
+        tg_seen |= 1 << (tg-1);
+        return NFC_TG_PRESENT;
+    }
+    if(tg_seen & (1 << (tg-1))){
+        tg_seen &= ~(1 << (tg-1));
+        return NFC_TG_REMOVED;
+    }
+    return NFC_TG_ABSENT;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Poll for a card and report tap events instead of raw detections,
+        so a card held on the reader is processed once per physical tap.
+	@param  buf - buf[0] UUID length; buf[1]... UUID, of the new, present or
+                  removed card
+	@param  cache - UID cache keeping track of the cards in the field
+	@param  brty - baud rate, see InListPassiveTarget()
+	@return NFC_TAP_NONE - no card, nothing changed
+            NFC_TAP_NEW - a card entered the field
+            NFC_TAP_PRESENT - the card is still in the field
+            NFC_TAP_REMOVED - a card has not been seen for the cache TTL
+*/
+/*****************************************************************************/
+u8 NFC_Module::PollTap(u8 *buf, NFC_UidCache &cache, u8 brty)
+{
+    nfc_uid_entry_t removed;
+
+    if(InListPassiveTarget(buf, brty)){
+        return cache.update(buf+1, buf[0], brty, millis());
+    }
+
+    if(cache.expire(millis(), &removed)){
+        buf[0] = removed.uid_len;
+        memcpy(buf+1, removed.uid, removed.uid_len);
+        return NFC_TAP_REMOVED;
+    }
+    return NFC_TAP_NONE;
 }
 
 /*****************************************************************************/
@@ -910,6 +1183,326 @@ u8 NFC_Module::SetParameters(u8 para)
     return 1;
 }
 
+/*****************************************************************************/
+/*!
+	@brief  PN532 RFConfiguration command. Details in NXP's PN532UM.pdf
+	@param  item - PN532_RFCFG_*
+	@param  data - pointer to configuration data
+	@param  len - configuration data length
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::RFConfiguration(u8 item, const u8 *data, u8 len)
+{
+    nfc_buf[0] = PN532_COMMAND_RFCONFIGURATION;
+    nfc_buf[1] = item;
+    memcpy(nfc_buf+2, data, len);
+
+    if(!write_cmd_check_ack(nfc_buf, 2+len)){
+        return 0;
+    }
+    wait_ready();
+    read_dt(nfc_buf, 8);
+    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_RFCONFIGURATION+1)){
+        return 0;
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Switch RF field on or off.
+	@param  on - 0 RF field off, 1 RF field on
+	@param  autorfca - 1 enable automatic RF collision avoidance
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::RFField(u8 on, u8 autorfca)
+{
+    u8 cfg = (on ? PN532_RFCFG_FIELD_ON : 0) |
+             (autorfca ? PN532_RFCFG_FIELD_AUTORFCA : 0);
+    return RFConfiguration(PN532_RFCFG_FIELD, &cfg, 1);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Set timeouts, PN532_TIMEOUT_*.
+	@param  atr_res - ATR_RES timeout, default PN532_TIMEOUT_102_4MS
+	@param  retry - timeout of InCommunicateThru, default PN532_TIMEOUT_51_2MS
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::RFTimings(u8 atr_res, u8 retry)
+{
+    u8 cfg[3];
+    cfg[0] = 0x00;      // RFU
+    cfg[1] = atr_res;
+    cfg[2] = retry;
+    return RFConfiguration(PN532_RFCFG_TIMINGS, cfg, 3);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Set retries of InCommunicateThru/InDataExchange on timeout.
+	@param  retry - number of retries, default 0
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::RFMaxRetryCOM(u8 retry)
+{
+    return RFConfiguration(PN532_RFCFG_MAXRTYCOM, &retry, 1);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Set activation retries. Bounding passive activation retries keeps
+        InListPassiveTarget short when no card is in the field.
+	@param  atr - ATR_REQ retries, default PN532_RETRY_FOREVER
+	@param  psl - PSL_REQ retries, default 1
+	@param  passive - passive activation retries, default PN532_RETRY_FOREVER
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::RFMaxRetries(u8 atr, u8 psl, u8 passive)
+{
+    u8 cfg[3];
+    cfg[0] = atr;
+    cfg[1] = psl;
+    cfg[2] = passive;
+    return RFConfiguration(PN532_RFCFG_MAXRETRIES, cfg, 3);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Set CIU analog settings.
+	@param  item - PN532_RFCFG_ANALOG_106A, 11 bytes
+                   PN532_RFCFG_ANALOG_212_424, 8 bytes
+                   PN532_RFCFG_ANALOG_TYPEB, 3 bytes
+                   PN532_RFCFG_ANALOG_ISO14443_4, 9 bytes
+	@param  data - pointer to register values
+	@param  len - register values length
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::RFAnalog(u8 item, const u8 *data, u8 len)
+{
+    u8 need;
+    switch(item){
+        case PN532_RFCFG_ANALOG_106A:
+            need = 11;
+            break;
+        case PN532_RFCFG_ANALOG_212_424:
+            need = 8;
+            break;
+        case PN532_RFCFG_ANALOG_TYPEB:
+            need = 3;
+            break;
+        case PN532_RFCFG_ANALOG_ISO14443_4:
+            need = 9;
+            break;
+        default:
+            return 0;
+    }
+    if(len != need){
+        return 0;
+    }
+    return RFConfiguration(item, data, len);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Apply a group of RF settings.
+	@param  preset - NFC_RF_PRESET_DEFAULT, PN532 power-on settings
+                     NFC_RF_PRESET_FAST_POLL, short empty-field poll cycle
+                     NFC_RF_PRESET_LONG_RANGE, max RX gain, more retries
+                     NFC_RF_PRESET_LOW_POWER, single activation try and RF
+                        field off until next command
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::RFPreset(u8 preset)
+{
+    u8 cfg[11];
+
+    if(preset >= NFC_RF_PRESET_NUM){
+        return 0;
+    }
+    memcpy_P(cfg, rf_preset[preset], 7);
+
+    if(!RFMaxRetries(cfg[0], cfg[1], cfg[2])){
+        return 0;
+    }
+    if(!RFTimings(cfg[3], cfg[4])){
+        return 0;
+    }
+
+    u8 rfcfg = cfg[5], field = cfg[6];
+    memcpy_P(cfg, rf_analog_106a, 11);
+    cfg[0] = rfcfg;
+    if(!RFAnalog(PN532_RFCFG_ANALOG_106A, cfg, 11)){
+        return 0;
+    }
+    return RFField(field);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Put PN532 into power down mode. The next command wakes it up
+        through I2C.
+	@param  wakeup - wake-up sources, PN532_WAKEUP_*
+	@param  irq - 1 PN532 generates an IRQ when woken up by another source
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::PowerDown(u8 wakeup, u8 irq)
+{
+    nfc_buf[0] = PN532_COMMAND_POWERDOWN;
+    nfc_buf[1] = wakeup | PN532_WAKEUP_I2C;
+    nfc_buf[2] = irq;
+
+    if(!write_cmd_check_ack(nfc_buf, 3)){
+        return 0;
+    }
+    wait_ready();
+    read_dt(nfc_buf, 9);
+    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_POWERDOWN+1)){
+        return 0;
+    }
+    if(nfc_buf[NFC_FRAME_ID_INDEX+1]){
+        return 0;
+    }
+    asleep = 1;
+    lp_sleep = millis();
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Duty-cycled polling. Call it from loop(), PN532 is kept in power
+        down and woken up once every period ms, or at once when woken is set.
+        A card keeps PN532 awake until it leaves the field.
+	@param  buf - same as InListPassiveTarget()
+	@param  period - polling period, ms
+	@param  woken - 1 PN532 IRQ signalled a wake-up (PN532_WAKEUP_RF)
+	@param  wakeup - wake-up sources while sleeping, PN532_WAKEUP_*
+	@return 0 - no card
+            1 - card found
+*/
+/*****************************************************************************/
+u8 NFC_Module::LowPowerPoll(u8 *buf, u16 period, u8 woken, u8 wakeup)
+{
+    u32 now = millis();
+
+    if(!lp_begin){
+        lp_begin = now;
+        memset(&lp_stats, 0, sizeof(lp_stats));
+    }
+    if(asleep && !woken && (u32)(now - lp_sleep) < period){
+        return 0;
+    }
+
+    u8 wake = asleep;
+    u8 sta = InListPassiveTarget(buf);
+    lp_stats.polls++;
+    if(wake){
+        lp_stats.wake_latency = millis() - lp_wake;
+    }
+    if(sta){
+        return 1;
+    }
+
+    /** awake from wake-up to PowerDown answered */
+    if(PowerDown(wakeup, (wakeup & PN532_WAKEUP_RF) ? 1 : 0)){
+        lp_stats.awake += lp_sleep - lp_wake;
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  LowPowerPoll() statistics, duty cycle is awake/total.
+	@param  NONE
+	@return pointer to statistics
+*/
+/*****************************************************************************/
+nfc_lp_stats_t *NFC_Module::LowPowerStats(void)
+{
+    lp_stats.total = lp_begin ? millis() - lp_begin : 0;
+    return &lp_stats;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  send command in nfc_buf and read the response back to nfc_buf,
+        for commands answering with a status byte.
+	@param  len - command length
+	@param  rlen - response frame length to read
+	@param  ms - maximum time to wait for the response
+	@return 0 - failed, or status reports an error
+            1 - successfully, MI bit is in nfc_buf[NFC_FRAME_ID_INDEX+1],
+                data starts at nfc_buf+8, length nfc_buf[3]-3
+*/
+/*****************************************************************************/
+u8 NFC_Module::exchange(u8 len, u8 rlen, u8 ms)
+{
+    u8 cmd = nfc_buf[0];
+
+    if(!write_cmd_check_ack(nfc_buf, len)){
+        return 0;
+    }
+    wait_ready(ms);
+    read_dt(nfc_buf, rlen);
+
+    if(nfc_buf[5] != 0xD5){
+        return 0;
+    }
+    if(nfc_buf[NFC_FRAME_ID_INDEX] != (cmd+1)){
+        return 0;
+    }
+    if(nfc_buf[NFC_FRAME_ID_INDEX+1] & NFC_STATUS_ERR_MASK){
+        return 0;
+    }
+    /** frame must fit in what has been read */
+    if(nfc_buf[3] < 3 || nfc_buf[3] > rlen-7){
+        return 0;
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Send nfc_buf and read a reply without status byte, as returned
+        by ReadRegister, WriteRegister, ReadGPIO and WriteGPIO.
+	@param  len - command length
+	@param  n - expected data length
+	@return 0 - failed, 1 - reply data in nfc_buf[7..]
+*/
+/*****************************************************************************/
+u8 NFC_Module::exchange_raw(u8 len, u8 n)
+{
+    u8 cmd = nfc_buf[0];
+
+    if(!write_cmd_check_ack(nfc_buf, len)){
+        return 0;
+    }
+    wait_ready();
+    read_dt(nfc_buf, 9+n);
+
+    if(nfc_buf[5] != 0xD5 || nfc_buf[NFC_FRAME_ID_INDEX] != (cmd+1) ||
+       nfc_buf[3] != 2+n){
+        return 0;
+    }
+    return 1;
+}
+
 /*****************************************************************************/
 /*!
 	@brief  send frame to PN532 and wait for ack
@@ -922,6 +1515,34 @@ u8 NFC_Module::SetParameters(u8 para)
 u8 NFC_Module::write_cmd_check_ack(u8 *cmd, u8 len)
 {
     write_cmd(cmd, len);
+    return check_ack();
+}
+
+/*****************************************************************************/
+/*!
+	@brief  send frame gathered from segments to PN532 and wait for ack
+	@param  seg - pointer to segment list
+	@param  num - number of segments
+	@return 0 - send failed
+            1 - send successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::write_segs_check_ack(const nfc_seg_t *seg, u8 num)
+{
+    write_segs(seg, num);
+    return check_ack();
+}
+
+/*****************************************************************************/
+/*!
+	@brief  wait for ack of the command just sent
+	@param  NONE
+	@return 0 - no ack
+            1 - ack'd
+*/
+/*****************************************************************************/
+u8 NFC_Module::check_ack(void)
+{
     wait_ready();
 #ifdef PN532DEBUG
 	Serial.println("IRQ received");
@@ -948,11 +1569,19 @@ u8 NFC_Module::write_cmd_check_ack(u8 *cmd, u8 len)
 /*****************************************************************************/
 inline u8 NFC_Module::send(u8 data)
 {
+    u8 ret;
+
 #if ARDUINO >= 100
-    return Wire.write((u8)data);
+    ret = Wire.write((u8)data);
 #else
-    return Wire.send((u8)data);
+    ret = Wire.send((u8)data);
+#endif
+#if NFC_USE_DIAG
+    if(trace && ret){
+        trace->put(data);
+    }
 #endif
+    return ret;
 }
 
 /*****************************************************************************/
@@ -964,44 +1593,62 @@ inline u8 NFC_Module::send(u8 data)
 /*****************************************************************************/
 inline u8 NFC_Module::receive(void)
 {
+    u8 data;
+
 #if ARDUINO >= 100
-    return Wire.read();
+    data = Wire.read();
 #else
-    return Wire.receive();
+    data = Wire.receive();
+#endif
+#if NFC_USE_DIAG
+    if(trace){
+        trace->put(data);
+    }
 #endif
+    return data;
 }
 
 /*****************************************************************************/
 /*!
-	@brief  Send a byte by hex format
-	@param  data - the byte
+	@brief  Start an I2C write to PN532, a new record when bus trace is on.
+	@param  NONE
 	@return NONE
 */
 /*****************************************************************************/
-void NFC_Module::puthex(u8 data)
+void NFC_Module::bus_tx(void)
 {
-    Serial.write(hextab[(data>>4)&0x0F]);
-    Serial.write(hextab[data&0x0F]);
-    Serial.write(' ');
+#if NFC_USE_DIAG
+    if(trace){
+        trace->rec(NFC_TRACE_TX);
+    }
+#endif
+    Wire.beginTransmission(PN532_I2C_ADDRESS);
 }
 
 /*****************************************************************************/
 /*!
-	@brief  Send hexadecimal data through Serial with specified length.
-	@param  buf - pointer of data buffer.
-	@param  len - length need to send.
-	@return NONE
+	@brief  Read len bytes from PN532 into the Wire buffer, a new record
+        when bus trace is on.
+	@param  len - bytes to read, including the I2C status byte
+	@return bytes read, 0 - PN532 did not answer
 */
 /*****************************************************************************/
-void NFC_Module::puthex(u8 *buf, u32 len)
+u8 NFC_Module::bus_rx(u8 len)
 {
-    u32 i;
-    for(i=0; i<len; i++)
-    {
-        Serial.write(hextab[(buf[i]>>4)&0x0F]);
-        Serial.write(hextab[buf[i]&0x0F]);
-        Serial.write(' ');
+    u8 n;
+
+#if NFC_USE_DIAG
+    if(trace){
+        trace->rec(0);
+    }
+#endif
+    n = Wire.requestFrom((u8)PN532_I2C_ADDRESS, len);
+#if NFC_USE_DIAG
+    if(trace){
+        trace->xfer(len, n);
     }
+#endif
+    return n;
 }
 
 /*****************************************************************************/
@@ -1014,18 +1661,40 @@ void NFC_Module::puthex(u8 *buf, u32 len)
 /*****************************************************************************/
 void NFC_Module::write_cmd(u8 *cmd, u8 len)
 {
-    uint8_t checksum;
+    nfc_seg_t seg;
 
-    len++;
+    seg.buf = cmd;
+    seg.len = len;
+    seg.pgm = 0;
+    write_segs(&seg, 1);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Write data frame to PN532, the frame data is gathered from
+        several segments in RAM or PROGMEM, without copying them to nfc_buf.
+	@param  seg - pointer to segment list
+	@param  num - number of segments
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Module::write_segs(const nfc_seg_t *seg, u8 num)
+{
+    uint8_t checksum, len, data;
+
+    len = 1;
+    for(u8 j=0; j<num; j++){
+        len += seg[j].len;
+    }
+
+    cmd_start(seg[0].pgm ? pgm_read_byte(seg[0].buf) : seg[0].buf[0]);
 
 #ifdef PN532DEBUG
     Serial.print("Sending: ");
 #endif
 
-    delay(2);     // or whatever the delay is for waking up the board
-
     // I2C START
-    Wire.beginTransmission(PN532_I2C_ADDRESS);
+    bus_tx();
     checksum = PN532_PREAMBLE + PN532_PREAMBLE + PN532_STARTCODE2;
     send(PN532_PREAMBLE);
     send(PN532_PREAMBLE);
@@ -1046,16 +1715,20 @@ void NFC_Module::write_cmd(u8 *cmd, u8 len)
     puthex(PN532_HOSTTOPN532);
 #endif
 
-    for (uint8_t i=0; i<len-1; i++)
+    for (uint8_t j=0; j<num; j++)
     {
-        if(send(cmd[i])){
-            checksum += cmd[i];
+        for (uint8_t i=0; i<seg[j].len; i++)
+        {
+            data = seg[j].pgm ? pgm_read_byte(seg[j].buf+i) : seg[j].buf[i];
+            if(send(data)){
+                checksum += data;
 #ifdef PN532DEBUG
-            puthex(cmd[i]);
+                puthex(data);
 #endif
-        }else{
-            i--;
-            delay(1);
+            }else{
+                i--;
+                delay(1);
+            }
         }
     }
 
@@ -1072,6 +1745,103 @@ void NFC_Module::write_cmd(u8 *cmd, u8 len)
 #endif
 }
 
+/*****************************************************************************/
+/*!
+	@brief  Housekeeping before a command goes out: queued GPIO update,
+        command count, register cache and wake-up delay.
+	@param  cmd - command code
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Module::cmd_start(u8 cmd)
+{
+    /** a queued GPIO update goes out ahead of the command, a failed one
+        stays queued and GPIOFlush() reports it */
+    if(gpio_pending){
+        gpio_send();
+    }
+
+    cmd_count++;
+#if NFC_USE_DIAG
+    if(trace){
+        trace->issue();
+    }
+#endif
+    switch(cmd){
+    /** PN532 firmware reloads CIU registers for these */
+    case PN532_COMMAND_SAMCONFIGURATION:
+    case PN532_COMMAND_RFCONFIGURATION:
+    case PN532_COMMAND_INLISTPASSIVETARGET:
+    case PN532_COMMAND_INJUMPFORDEP:
+    case PN532_COMMAND_INJUMPFORPSL:
+    case PN532_COMMAND_INATR:
+    case PN532_COMMAND_INPSL:
+    case PN532_COMMAND_INAUTOPOLL:
+    case PN532_COMMAND_TGINITASTARGET:
+    case PN532_COMMAND_POWERDOWN:
+        reg_num = 0;
+        break;
+    }
+
+    /** waking up the board only costs time after PowerDown */
+    if(asleep){
+        delay(NFC_WAKEUP_TIME);
+        asleep = 0;
+        lp_wake = millis();
+    }
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Write a complete frame from PROGMEM to PN532, see NFC_FRAME().
+        LEN and checksums are already in the frame, bytes go straight to
+        the bus.
+	@param  frame - frame in PROGMEM
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Module::write_frame(const u8 *frame)
+{
+    u8 len, data;
+
+    cmd_start(pgm_read_byte(frame+NFC_FRAME_ID_INDEX));
+    len = pgm_read_byte(frame+3) + 7;
+
+#ifdef PN532DEBUG
+    Serial.print("Sending: ");
+#endif
+    bus_tx();
+    for(u8 i=0; i<len; i++){
+        data = pgm_read_byte(frame+i);
+        if(send(data)){
+#ifdef PN532DEBUG
+            puthex(data);
+#endif
+        }else{
+            i--;
+            delay(1);
+        }
+    }
+    Wire.endTransmission();
+#ifdef PN532DEBUG
+    Serial.write('\n');
+#endif
+}
+
+/*****************************************************************************/
+/*!
+	@brief  send frame from PROGMEM to PN532 and wait for ack
+	@param  frame - frame in PROGMEM, see NFC_FRAME()
+	@return 0 - send failed
+            1 - send successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::write_frame_check_ack(const u8 *frame)
+{
+    write_frame(frame);
+    return check_ack();
+}
+
 /*****************************************************************************/
 /*!
 	@brief  Read data frame from PN532.
@@ -1088,12 +1858,12 @@ void NFC_Module::read_dt(u8 *buf, u8 len)
     Serial.print("Reading: ");
 #endif
     // Start read (n+1 to take into account leading 0x01 with I2C)
-    Wire.requestFrom((u8)PN532_I2C_ADDRESS, (u8)(len+2));
+    bus_rx(len+2);
     // Discard the leading 0x01
     receive();
+    /** requestFrom() has buffered the whole frame, no need to pace reads */
     for (u8 i=0; i<len; i++)
     {
-        delay(1);
         buf[i] = receive();
 #if 0
         if((len!=6)&&i==3&&(buf[0]==0)&&(buf[1]==0)&&(buf[2]==0xFF)){
@@ -1113,6 +1883,48 @@ void NFC_Module::read_dt(u8 *buf, u8 len)
 #endif
 }
 
+/*****************************************************************************/
+/*!
+	@brief  Read a response frame with status byte, copying its data from
+        the bus straight to dst. The frame is read in one I2C transfer, so
+        it carries NFC_RSP_DATA_MAX data bytes at most.
+	@param  cmd - command the response belongs to
+	@param  dst - data buffer
+	@param  dlen - in: dst size; out: data length
+	@param  ms - maximum time to wait for the response
+	@return status byte, 0xFF - no or broken response
+*/
+/*****************************************************************************/
+u8 NFC_Module::read_data(u8 cmd, u8 *dst, u8 *dlen, u8 ms)
+{
+    u8 hdr[8], i, n;
+
+    if(wait_ready(ms) != PN532_I2C_READY){
+        return 0xFF;
+    }
+
+    /** status byte, 00 00 FF LEN LCS D5 CMD+1 STATUS, data, DCS 00 */
+    n = (*dlen > NFC_CMD_BUF_LEN-11) ? NFC_CMD_BUF_LEN : *dlen+11;
+    bus_rx(n);
+    receive();
+    for(i=0; i<8; i++){
+        hdr[i] = receive();
+    }
+    if(hdr[5] != 0xD5 || hdr[6] != (cmd+1) || hdr[3] < 3){
+        return 0xFF;
+    }
+
+    n = hdr[3]-3;
+    if(n > *dlen || n > NFC_RSP_DATA_MAX){
+        return 0xFF;
+    }
+    for(i=0; i<n; i++){
+        dst[i] = receive();
+    }
+    *dlen = n;
+    return hdr[7];
+}
+
 /*****************************************************************************/
 /*!
 	@brief  read ack frame from PN532
@@ -1134,35 +1946,156 @@ u8 NFC_Module::read_ack(void)
 
 /*****************************************************************************/
 /*!
-	@brief  DISCARD
-	@param
-	@return
+	@brief  Read the I2C status byte of PN532.
+	@param  NONE
+	@return PN532_I2C_READY - response is available
+            PN532_I2C_BUSY - PN532 is still busy, or did not answer
 */
 /*****************************************************************************/
 u8 NFC_Module::read_sta(void)
 {
-    /**
-    uint8_t x = digitalRead(_irq);
-
-    if (x == 1)
+    /** a NACK reads as 0xFF, which must not pass for ready */
+    if(!bus_rx(1)){
+        return PN532_I2C_BUSY;
+    }
+    if(receive() & PN532_I2C_READY){
+        return PN532_I2C_READY;
+    }
     return PN532_I2C_BUSY;
-      else
-    return PN532_I2C_READY;
-*/
-    delay(NFC_WAIT_TIME);
-    return PN532_I2C_READY;
 }
 
 /*****************************************************************************/
 /*!
 	@brief  Because of IRQ pin is unused, use this function to wait for PN532
-        being ready.
-	@param  NONE.
-	@return Always return ready.
+        being ready. The I2C status byte is polled every millisecond, so it
+        returns as soon as the response is available.
+	@param  ms - maximum time to wait.
+	@return PN532_I2C_READY - response is available
+            PN532_I2C_BUSY - timeout
 */
 /*****************************************************************************/
 u8 NFC_Module::wait_ready(u8 ms)
 {
-    delay(ms);
-    return PN532_I2C_READY;
+    do{
+        if(read_sta() == PN532_I2C_READY){
+            return PN532_I2C_READY;
+        }
+        delay(1);
+    }while(ms--);
+    return PN532_I2C_BUSY;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  UID cache constructor.
+	@param  ttl - time in ms a card may be missed before it is removed
+*/
+/*****************************************************************************/
+NFC_UidCache::NFC_UidCache(u16 ttl)
+{
+    this->ttl = ttl;
+    clear();
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Forget all cards.
+	@param  NONE
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_UidCache::clear(void)
+{
+    for(u8 i=0; i<NFC_UID_CACHE_SIZE; i++){
+        entry[i].uid_len = 0;
+    }
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Hash UID and technology to a cache entry.
+	@param  uid - pointer to UID
+	@param  uid_len - UID length
+	@param  tech - technology the UID was read with
+	@return entry index
+*/
+/*****************************************************************************/
+u8 NFC_UidCache::slot(const u8 *uid, u8 uid_len, u8 tech)
+{
+    u8 h = tech;
+    for(u8 i=0; i<uid_len; i++){
+        h = (h << 1 | h >> 7) ^ uid[i];
+    }
+    return h & (NFC_UID_CACHE_SIZE-1);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Look up a card.
+	@param  uid - pointer to UID
+	@param  uid_len - UID length
+	@param  tech - technology the UID was read with
+	@return pointer to the cache entry, NULL if the card is not cached
+*/
+/*****************************************************************************/
+nfc_uid_entry_t *NFC_UidCache::find(const u8 *uid, u8 uid_len, u8 tech)
+{
+    nfc_uid_entry_t *e = &entry[slot(uid, uid_len, tech)];
+
+    if(e->uid_len != uid_len || e->tech != tech ||
+       memcmp(e->uid, uid, uid_len)){
+        return NULL;
+    }
+    return e;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Record that a card has been seen. A cached card sharing the entry
+        is evicted and will be reported as new on its next tap.
+	@param  uid - pointer to UID
+	@param  uid_len - UID length
+	@param  tech - technology the UID was read with
+	@param  now - current time, ms
+	@return NFC_TAP_NEW - card was not cached, entry result is cleared
+            NFC_TAP_PRESENT - card is still in the field
+*/
+/*****************************************************************************/
+u8 NFC_UidCache::update(const u8 *uid, u8 uid_len, u8 tech, u32 now)
+{
+    nfc_uid_entry_t *e = find(uid, uid_len, tech);
+
+    if(e && (u32)(now - e->seen) <= ttl){
+        e->seen = now;
+        return NFC_TAP_PRESENT;
+    }
+
+    e = &entry[slot(uid, uid_len, tech)];
+    memcpy(e->uid, uid, uid_len);
+    e->uid_len = uid_len;
+    e->tech = tech;
+    e->result = 0;
+    e->seen = now;
+    return NFC_TAP_NEW;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Remove one card which has not been seen for ttl ms.
+	@param  now - current time, ms
+	@param  removed - returns the removed entry
+	@return 0 - no card removed
+            1 - a card is removed
+*/
+/*****************************************************************************/
+u8 NFC_UidCache::expire(u32 now, nfc_uid_entry_t *removed)
+{
+    for(u8 i=0; i<NFC_UID_CACHE_SIZE; i++){
+        if(entry[i].uid_len && (u32)(now - entry[i].seen) > ttl){
+            *removed = entry[i];
+            entry[i].uid_len = 0;
+            return 1;
+        }
+    }
+    return 0;
 }
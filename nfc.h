@@ -34,6 +34,7 @@
 #endif
 #include <avr/pgmspace.h>
 #include <Wire.h>
+#include "nfc_config.h"
 
 #ifndef __TYPE_REDEFINE
 #define __TYPE_REDEFINE
@@ -157,6 +158,11 @@ typedef int32_t  s32;
 #define PN532_GPIO_P33                      (3)
 #define PN532_GPIO_P34                      (4)
 #define PN532_GPIO_P35                      (5)
+/** P7 pins, bit (pin-8) of port P7 */
+#define PN532_GPIO_P71                      (9)
+#define PN532_GPIO_P72                      (10)
+#define PN532_GPIO_P3_MASK                  (0x3F)
+#define PN532_GPIO_P7_MASK                  (0x06)
 
 #define PN532_SAM_NORMAL_MODE               (0x01)
 #define PN532_SAM_VIRTUAL_CARD              (0x02)
@@ -169,18 +175,497 @@ typedef int32_t  s32;
 #define PN532_BRTY_424KBPS                  0x02
 #define PN532_BRTY_JEWEL                    0x04
 
-//#define PN532DEBUG
-//#define PN532_P2P_DEBUG
+// Topaz (Jewel) Commands
+#define TOPAZ_CMD_RALL                      (0x00)
+#define TOPAZ_CMD_READ                      (0x01)
+#define TOPAZ_CMD_READ8                     (0x02)
+#define TOPAZ_CMD_RID                       (0x78)
+/** RALL reply: HR0 HR1 and blocks 0..E */
+#define TOPAZ_RALL_LEN                      122
+
+// FeliCa Commands
+#define FELICA_CMD_POLLING                  (0x00)
+#define FELICA_CMD_READ_WO_ENC              (0x06)
+#define FELICA_CMD_WRITE_WO_ENC             (0x08)
+#define NFC_FELICA_RC_NONE                  (0x00)
+#define NFC_FELICA_RC_SYSCODE               (0x01)
+
+/** MifareWriteBlocks() flags */
+#define NFC_MF_VERIFY                       (0x01)
+#define NFC_MF_ALLOW_TRAILER                (0x02)
+/** NtagWriteDiff() flag: pages outside the user memory may be written */
+#define NFC_NTAG_ALLOW_CONFIG               (0x02)
+
+/** registers per ReadRegister/WriteRegister frame, bounded by nfc_buf */
+#define NFC_REG_READ_MAX                    (24)
+#define NFC_REG_WRITE_MAX                   (16)
+/** shadow cache of written registers */
+#define NFC_REG_CACHE_SIZE                  (8)
+
+/** CIU registers used by InCommunicateThru() */
+#define PN532_REG_CIU_TXMODE                (0x6302)
+#define PN532_REG_CIU_RXMODE                (0x6303)
+#define PN532_REG_CIU_MANUALRCV             (0x630D)
+#define PN532_REG_CIU_BITFRAMING            (0x633D)
+#define PN532_CIU_CRC_EN                    (0x80)
+#define PN532_CIU_PARITY_DISABLE            (0x10)
+#define PN532_CIU_TXLASTBITS                (0x07)
+
+/** InCommunicateThru() framing flags */
+#define NFC_THRU_TX_CRC                     (0x01)
+#define NFC_THRU_RX_CRC                     (0x02)
+#define NFC_THRU_NO_PARITY                  (0x04)
+#define NFC_THRU_DEFAULT                    (NFC_THRU_TX_CRC|NFC_THRU_RX_CRC)
+
+/** SetPSLPolicy(): stay at 106Kbps */
+#define NFC_PSL_OFF                         0x00
+
+/** RFConfiguration items */
+#define PN532_RFCFG_FIELD                   (0x01)
+#define PN532_RFCFG_TIMINGS                 (0x02)
+#define PN532_RFCFG_MAXRTYCOM               (0x04)
+#define PN532_RFCFG_MAXRETRIES              (0x05)
+#define PN532_RFCFG_ANALOG_106A             (0x0A)
+#define PN532_RFCFG_ANALOG_212_424          (0x0B)
+#define PN532_RFCFG_ANALOG_TYPEB            (0x0C)
+#define PN532_RFCFG_ANALOG_ISO14443_4       (0x0D)
+
+#define PN532_RFCFG_FIELD_AUTORFCA          (0x02)
+#define PN532_RFCFG_FIELD_ON                (0x01)
+
+/** RFConfiguration timeouts, n > 0: 100us * 2^(n-1) */
+#define PN532_TIMEOUT_NONE                  (0x00)
+#define PN532_TIMEOUT_3_2MS                 (0x06)
+#define PN532_TIMEOUT_6_4MS                 (0x07)
+#define PN532_TIMEOUT_12_8MS                (0x08)
+#define PN532_TIMEOUT_51_2MS                (0x0A)
+#define PN532_TIMEOUT_102_4MS               (0x0B)
+
+/** infinite retries */
+#define PN532_RETRY_FOREVER                 (0xFF)
+
+/** RFPreset() presets */
+#define NFC_RF_PRESET_DEFAULT               (0x00)
+#define NFC_RF_PRESET_FAST_POLL             (0x01)  // 2 activation tries
+#define NFC_RF_PRESET_LONG_RANGE            (0x02)  // max RX gain
+#define NFC_RF_PRESET_LOW_POWER             (0x03)  // 1 try, field off
+#define NFC_RF_PRESET_NUM                   4
+
+/** More Information bit of Tg and status byte, DEP/ISO-DEP chaining */
+#define NFC_MI                              (0x40)
+#define NFC_STATUS_ERR_MASK                 (0x3F)
+/** InDataExchange(): more data pending, fetch it with another call */
+#define NFC_DEP_MORE                        (0x02)
+/** ApduTransceive(): max GET RESPONSE/wrong Le rounds per APDU */
+#define NFC_APDU_MAX_ROUNDS                 8
+/**
+    Longest reply data of one response frame: PN532 hands a reassembled
+    ISO-DEP chain to the host in a single frame, and the frame has to fit
+    in nfc_buf and the Wire buffer. ApduTransceive() lowers Le to fit.
+*/
+#define NFC_RSP_DATA_MAX                    (NFC_CMD_BUF_LEN-9)
+#define NFC_APDU_MAX_LE                     (NFC_RSP_DATA_MAX-2)
+/** max payload of one chained frame, fits in nfc_buf and the Wire buffer */
+#define NFC_DEP_CHUNK                       (NFC_CMD_BUF_LEN-16)
+
+/** P2P session configuration */
+#define NFC_P2P_PASSIVE                     (0x00)
+#define NFC_P2P_ACTIVE                      (0x01)
+#define NFC_P2P_106K                        (0x00)
+#define NFC_P2P_212K                        (0x01)
+#define NFC_P2P_424K                        (0x02)
+#define NFC_P2P_NO_PSL                      (0xFF)
+
+/** TgInitAsTarget mode */
+#define PN532_TG_PASSIVE_ONLY               (0x01)
+#define PN532_TG_DEP_ONLY                   (0x02)
+#define PN532_TG_PICC_ONLY                  (0x04)
+
+/** TgInitAsTarget response: Mode byte of the activation, not a status */
+#define PN532_TG_MODE_FRAMING               (0x03)  // 00 - ISO14443A/Mifare
+#define PN532_TG_MODE_DEP                   (0x04)
+#define PN532_TG_MODE_PICC                  (0x08)
+
+/** PowerDown wake-up sources */
+#define PN532_WAKEUP_INT0                   (0x01)
+#define PN532_WAKEUP_INT1                   (0x02)
+#define PN532_WAKEUP_RF                     (0x08)
+#define PN532_WAKEUP_HSU                    (0x10)
+#define PN532_WAKEUP_SPI                    (0x20)
+#define PN532_WAKEUP_GPIO                   (0x40)
+#define PN532_WAKEUP_I2C                    (0x80)
+
+/** time PN532 needs to leave power down, ms */
+#define NFC_WAKEUP_TIME                     2
+
 #define NFC_WAIT_TIME                       30
-#define NFC_CMD_BUF_LEN                     64
+
+/** CmdStep()/CmdPoll() results */
+#define NFC_CMD_FAILED                      0
+#define NFC_CMD_DONE                        1
+#define NFC_CMD_BUSY                        2
+/** shortest response frame, 00 00 FF LEN LCS D5 CMD+1 DCS 00 */
+#define NFC_CMD_RLEN_MIN                    9
+/** command buffer of the Step*() functions, the Mifare write is longest */
+#define NFC_STEP_CMD_LEN                    20
 #define NFC_FRAME_ID_INDEX                  6
 
+/** TargetPresent() probe types */
+#define NFC_PROBE_DIAGNOSE                  (0x00)  // ISO14443-4 / DEP targets
+#define NFC_PROBE_READ                      (0x01)  // Mifare Classic/Ultralight
+
+/** TargetPresent() return value */
+#define NFC_TG_ABSENT                       (0x00)
+#define NFC_TG_PRESENT                      (0x01)
+#define NFC_TG_REMOVED                      (0x02)  // first probe failed after present
+
+#define PN532_DIAG_ATTENTION_REQUEST        (0x06)
+
+/** UID cache, NFC_UID_CACHE_SIZE must be a power of 2 */
+#define NFC_UID_CACHE_SIZE                  4
+#define NFC_UID_MAX_LEN                     10
+#define NFC_UID_TTL                         300     // ms
+
+/** PollTap() events */
+#define NFC_TAP_NONE                        (0x00)
+#define NFC_TAP_NEW                         (0x01)
+#define NFC_TAP_PRESENT                     (0x02)
+#define NFC_TAP_REMOVED                     (0x03)
+
 typedef enum{
     NFC_STA_TAG,
     NFC_STA_GETDATA,
     NFC_STA_SETDATA,
+    NFC_STA_IDLE,
 }poll_sta_type;
 
+/** P2PTargetServe() events */
+#define NFC_SRV_IDLE                        (0x00)
+#define NFC_SRV_ACTIVATED                   (0x01)
+#define NFC_SRV_REQUEST                     (0x02)
+#define NFC_SRV_RELEASED                    (0x03)
+
+/** card emulation */
+#define NFC_APDU_ANY                        (0xFF)  // handler matches any CLA
+#define NFC_SW_OK                           (0x9000)
+#define NFC_SW_WRONG_LENGTH                 (0x6700)
+#define NFC_SW_FILE_NOT_FOUND               (0x6A82)
+#define NFC_SW_WRONG_P1P2                   (0x6B00)
+#define NFC_SW_INS_NOT_SUPPORTED            (0x6D00)
+/** nfc_rapdu_t.pgm, internal: data sent, status word pending */
+#define NFC_RSP_PENDING_SW                  (0x80)
+
+/** NFC Forum Type 4 Tag emulation */
+#define NFC_T4T_NONE                        (0x00)
+#define NFC_T4T_CC                          (0x01)
+#define NFC_T4T_NDEF                        (0x02)
+
+/** PN532 status: target released by initiator */
+#define PN532_STATUS_RELEASED               (0x29)
+
+typedef struct{
+    u8 uid[NFC_UID_MAX_LEN];
+    u8 uid_len;         // 0 - free entry
+    u8 tech;            // baud rate / modulation type, PN532_BRTY_*
+    u8 result;          // application transaction result
+    u32 seen;           // last seen time, ms
+}nfc_uid_entry_t;
+
+/**
+    Fixed-size, direct-mapped cache of recently seen UIDs. A tap is reported
+    as new only once, until the card has not been seen for ttl ms.
+    Time is passed in by the caller, so any clock can drive it.
+*/
+class NFC_UidCache{
+public:
+    NFC_UidCache(u16 ttl=NFC_UID_TTL);
+    u8 update(const u8 *uid, u8 uid_len, u8 tech, u32 now);
+    u8 expire(u32 now, nfc_uid_entry_t *removed);
+    nfc_uid_entry_t *find(const u8 *uid, u8 uid_len, u8 tech);
+    void clear(void);
+private:
+    u8 slot(const u8 *uid, u8 uid_len, u8 tech);
+
+    nfc_uid_entry_t entry[NFC_UID_CACHE_SIZE];
+    u16 ttl;
+};
+
+/** NTAG WRITE of one page */
+#define NTAG_CMD_WRITE                      (0xA2)
+/** NTAG GET_VERSION, storage size byte: 0x0F, 0x11, 0x13 - NTAG213/5/6 */
+#define NTAG_CMD_GET_VERSION                (0x60)
+#define NTAG_VERSION_SIZE_INDEX             (6)
+/** NTAG user memory starts at page 4, pages 0..3 are UID, lock and CC */
+#define NTAG_USER_FIRST                     (4)
+/** NTAG READ_CNT, NFC counter */
+#define NTAG_CMD_READ_CNT                   (0x39)
+#define NTAG_NFC_COUNTER                    (0x02)
+/** NTAG READ_SIG, originality signature, by InCommunicateThru() */
+#define NTAG_CMD_READ_SIG                   (0x3C)
+#define NTAG_SIG_LEN                        (32)
+
+/** card image cache entry header, followed by valid bitmap and blocks */
+typedef struct{
+    u8 uid[NFC_UID_MAX_LEN];
+    u8 uid_len;         // 0 - free entry
+    u8 age;             // LRU rank, 0 - most recent
+    u8 marker[4];       // change marker seen when the image was read
+}nfc_card_hdr_t;
+
+#if NFC_USE_ISO14443
+/**
+    UID-keyed cache of card images in a buffer given by the caller, 16 bytes
+    per block: a Mifare block, or 4 NTAG pages. Blocks are filled as they are
+    read and dropped together when the card's change marker differs. The
+    least recently used card is evicted when the buffer is full.
+*/
+class NFC_CardCache{
+public:
+    NFC_CardCache(u8 *mem, u16 size, u8 blocks);
+    nfc_card_hdr_t *find(const u8 *uid, u8 uid_len);
+    nfc_card_hdr_t *add(const u8 *uid, u8 uid_len);
+    u8 *block(nfc_card_hdr_t *e, u8 blk);
+    u8 valid(nfc_card_hdr_t *e, u8 blk);
+    void set_valid(nfc_card_hdr_t *e, u8 blk);
+    void invalidate(nfc_card_hdr_t *e);
+    void clear(void);
+    void save(u16 ee_addr);
+    void load(u16 ee_addr);
+    void stats(u16 *hit, u16 *miss);
+    void count(u8 is_hit);
+private:
+    nfc_card_hdr_t *entry(u8 i);
+    void touch(nfc_card_hdr_t *e);
+
+    u8 *mem;
+    u16 esize;          // bytes per card
+    u8 nblk;            // blocks per card
+    u8 num;             // cards that fit in mem
+    u16 hit, miss;      // blocks served from cache / read from the card
+};
+#endif
+
+/**
+    bus trace record: header, time since command issue (LE), for a read the
+    bytes requested and transferred, then the bytes recorded
+*/
+#define NFC_TRACE_TX                        (0x80)  // header: host to PN532
+#define NFC_TRACE_LEN_MASK                  (0x7F)  // header: bytes recorded
+#define NFC_TRACE_HDR_LEN                   (3)
+#define NFC_TRACE_RX_HDR_LEN                (5)
+#define NFC_TRACE_TICK_US                   (100)   // time unit of records
+#define NFC_TRACE_REC_MAX                   (0x7E)  // bytes of a record
+/** header of a run of busy status polls, one count byte follows the time */
+#define NFC_TRACE_POLLS                     (0x7F)
+
+#if NFC_USE_DIAG
+/**
+    Recorder of the I2C traffic between host and PN532, in a buffer given by
+    the caller. Every bus transaction is one record: direction, time since
+    the command was issued, and the bytes moved. A read also records how
+    many bytes were requested from Wire and how many it transferred; only
+    the bytes the library consumed are kept. A command frame (D4 in byte 5
+    of a TX record) starts a new command. Consecutive busy status
+    polls are one NFC_TRACE_POLLS record with the time of the first poll
+    and their count. Recording stops when the buffer is full, so the start
+    of a slow session is kept. Commands and bus bytes are counted on, a
+    recorder without buffer only counts. A record keeps the first
+    NFC_TRACE_REC_MAX bytes of a longer transfer.
+*/
+class NFC_Trace{
+public:
+    NFC_Trace(u8 *mem, u16 size);
+    void clear(void);
+    const u8 *data(void);
+    u16 length(void);
+    u8 overflow(void);
+    u32 bytes(void);
+    u16 commands(void);
+    void dump(void);
+    void report(void);
+private:
+    friend class NFC_Module;
+    void issue(void);
+    void rec(u8 dir);
+    void xfer(u8 req, u8 got);
+    void put(u8 data);
+
+    u8 *mem;
+    u16 size;
+    u16 len;
+    u16 hdr;            // header of the open record
+    u16 poll;           // last record, if busy status polls
+    u8 tx;              // open record is a write
+    u8 full;
+    u32 t0;             // micros() when the command was issued
+    u32 nbytes;         // bus bytes since clear()
+    u16 ncmd;           // commands since clear()
+};
+#endif
+
+/**
+    Stream source, fills buf with up to max bytes and returns the number of
+    bytes written. *more is set to 0 with the last bytes of the stream.
+*/
+typedef u8 (*nfc_source_t)(u8 *buf, u8 max, u8 *more, void *ctx);
+/** Stream sink, consumes len bytes. Returns 0 to abort the transfer. */
+typedef u8 (*nfc_sink_t)(const u8 *buf, u8 len, void *ctx);
+
+/**
+    P2P session configuration, see P2PConfig(). NULL pointers select the
+    library defaults.
+*/
+typedef struct{
+    u8 mode;            // NFC_P2P_ACTIVE or NFC_P2P_PASSIVE
+    u8 baud;            // NFC_P2P_106K, NFC_P2P_212K or NFC_P2P_424K
+    u8 psl_baud;        // initiator, switch speed by PSL, or NFC_P2P_NO_PSL
+    const u8 *gb;       // general bytes of ATR_REQ/ATR_RES
+    u8 gb_len;
+    const u8 *nfcid3;   // 10 bytes NFCID3i/NFCID3t
+    const u8 *nfcid1;   // target, 3 bytes NFCID1
+}nfc_p2p_cfg_t;
+
+/**
+    P2P target request handler, rx holds the request. Points *tx to the
+    reply and returns its length, NFC_DEP_CHUNK bytes at most.
+*/
+typedef u8 (*nfc_p2p_handler_t)(const u8 *rx, u8 rx_len, const u8 **tx,
+                                void *ctx);
+
+/** R-APDU of a card emulation handler */
+typedef struct{
+    const u8 *data;     // response data without status word, NULL - none
+    u8 len;             // response data length
+    u8 pgm;             // 1 - data is in PROGMEM, sent without copying
+    u16 sw;             // status word, e.g. NFC_SW_OK
+}nfc_rapdu_t;
+
+/**
+    C-APDU handler, capdu holds CLA INS P1 P2 [Lc data] [Le]. Fills rsp,
+    whose data must stay valid until the next call of TargetPolling().
+*/
+typedef void (*nfc_apdu_handler_t)(const u8 *capdu, u8 len, nfc_rapdu_t *rsp,
+                                   void *ctx);
+
+typedef struct{
+    u8 cla;             // class, NFC_APDU_ANY - any
+    u8 ins;             // instruction
+    nfc_apdu_handler_t fn;
+}nfc_apdu_entry_t;
+
+/**
+    Type 4 Tag state, see Type4Tag(). The NDEF file lives in PROGMEM and
+    starts with its 2 bytes NLEN, followed by the NDEF message.
+*/
+typedef struct{
+    const u8 *file;     // NDEF file in PROGMEM
+    u16 len;            // NDEF file length, NLEN + 2
+    u8 app;             // 1 - NDEF application selected
+    u8 sel;             // selected file, NFC_T4T_*
+    u8 cc[15];          // capability container, sized for this file
+}nfc_t4t_t;
+
+typedef struct{
+    u32 awake;          // ms spent awake since LowPowerPoll() started
+    u32 total;          // ms since LowPowerPoll() started
+    u16 wake_latency;   // ms from wake-up to first poll answered
+    u16 polls;          // number of polls
+}nfc_lp_stats_t;
+
+typedef struct{
+    u8 atqb[12];        // 50 PUPI(4) AppData(4) ProtInfo(3)
+    u8 attrib_len;
+    u8 attrib[8];       // ATTRIB_RES
+}nfc_typeb_t;
+
+typedef struct{
+    u8 sens_res[2];
+    u8 id[4];           // JEWELID
+}nfc_jewel_t;
+
+typedef struct{
+    u8 idm[8];
+    u8 pmm[8];
+    u16 sys;            // system code, 0xFFFF if not requested
+}nfc_felica_t;
+
+/** FeliCa block list element */
+typedef struct{
+    u8 svc;             // index into the service code list
+    u16 num;            // block number
+}nfc_felica_blk_t;
+
+/** Mifare Classic block write, see MifareWriteBlocks() */
+typedef struct{
+    u8 block;
+    const u8 *data;     // 16 bytes
+}nfc_mf_write_t;
+
+/** shadow copy of a PN532 register */
+typedef struct{
+    u16 addr;
+    u8 val;
+}nfc_reg_t;
+
+/** one part of a command frame, see write_segs() */
+typedef struct{
+    const u8 *buf;
+    u8 len;
+    u8 pgm;             // 1 - buf is in PROGMEM
+}nfc_seg_t;
+
+/** frame LEN and checksums of constant commands, computed by the compiler */
+constexpr u8 nfc_frame_sum(void)
+{
+    return 0;
+}
+template<typename... T>
+constexpr u8 nfc_frame_sum(u8 data, T... rest)
+{
+    return data + nfc_frame_sum(rest...);
+}
+template<typename... T>
+constexpr u8 nfc_frame_len(T... data)
+{
+    return sizeof...(data);
+}
+
+/**
+    Complete host to PN532 frame of a constant command, for a PROGMEM array
+    sent by write_frame(): NFC_FRAME(PN532_COMMAND_TGGETDATA)
+*/
+#define NFC_FRAME(...)                                                      \
+    {                                                                       \
+        PN532_PREAMBLE, PN532_PREAMBLE, PN532_STARTCODE2,                   \
+        (u8)(1+nfc_frame_len(__VA_ARGS__)),                                 \
+        (u8)-(1+nfc_frame_len(__VA_ARGS__)),                                \
+        PN532_HOSTTOPN532, __VA_ARGS__,                                     \
+        (u8)-(PN532_HOSTTOPN532+nfc_frame_sum(__VA_ARGS__)),                \
+        PN532_POSTAMBLE                                                     \
+    }
+
+/** TgInitAsTarget defaults, from SENS_RES to NFCID3t */
+#define TG_INIT_DEFAULT(sel_res)                                            \
+    /** SENS_RES */                                                         \
+    0x04, 0x00,                                                             \
+    /** NFCID1 */                                                           \
+    0x12, 0x34, 0x56,                                                       \
+    /** SEL_RES */                                                          \
+    sel_res,                                                                \
+    /** Parameters to build POL_RES (18 bytes including system code) */     \
+    0x01, 0xFE, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,                         \
+    0xC0, 0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7,                         \
+    0xFF, 0xFF,                                                             \
+    /** NFCID3t */                                                          \
+    0xAA, 0x99, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11
+
+/** shared by the library modules */
+extern u8 nfc_buf[NFC_CMD_BUF_LEN];
+extern const u8 frame_tg_get_data[] PROGMEM;
+#if NFC_USE_DIAG
+extern u8 hextab[17];
+#endif
+
 class NFC_Module{
 public:
     NFC_Module();
@@ -190,35 +675,246 @@ public:
 
     u8 InListPassiveTarget(u8 *buf, u8 brty=PN532_BRTY_ISO14443A,
                             u8 len=0, u8 *idata=NULL, u8 maxtg=1);
-    u8 InDataExchange(u8 mode, u8 tg, u8 *buf=NULL, u8 len=0);
+#if NFC_USE_ISO14443
+    void SetPSLPolicy(u8 tg, u8 max_br);
+#endif
+    u8 InDataExchange(u8 mode, u8 tg, const u8 *t_buf=NULL, u8 t_len=0,
+                      u8 *r_buf=NULL, u8 *r_len=NULL);
+    u8 InCommunicateThru(const u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len,
+                         u8 flags=NFC_THRU_DEFAULT, u8 last_bits=0);
+#if NFC_USE_ISO14443
+    u8 InListTypeB(nfc_typeb_t *card, u8 afi=0x00);
+    u8 InListJewel(nfc_jewel_t *card);
+    u8 TopazReadAll(u8 *buf);
+    u8 ApduTransceive(u8 tg, const u8 *capdu, u16 clen,
+                      u8 *rapdu, u16 *rlen);
     u8 MifareAuthentication(u8 type, u8 block, u8 *uuid, u8 uuid_len, u8 *key);
     u8 MifareReadBlock(u8 block, u8 *buf);
     u8 MifareWriteBlock(u8 block, u8 *buf);
+    u8 MifareWriteBlocks(nfc_mf_write_t *wr, u8 num, u8 type, u8 *key,
+                         u8 *uuid, u8 uuid_len, u8 flags=0);
+    u8 MifareWriteDiff(u8 first, u8 num, const u8 *image, const u8 *current,
+                       u8 type, u8 *key, u8 *uuid, u8 uuid_len, u8 flags=0,
+                       NFC_CardCache *cache=NULL);
+    u8 NtagWriteDiff(u8 page, u8 num, const u8 *image, const u8 *current,
+                     u8 flags=0, NFC_CardCache *cache=NULL,
+                     const u8 *uid=NULL, u8 uid_len=0);
+    void MifareValueEncode(s32 value, u8 addr, u8 *block);
+    u8 MifareValueDecode(const u8 *block, s32 *value, u8 *addr=NULL);
+    u8 MifareValueWrite(u8 block, s32 value);
+    u8 MifareValueRead(u8 block, s32 *value);
+    u8 ValueDebit(u8 block, u32 amount, u8 dst=0xFF);
+    u8 ValueCredit(u8 block, u32 amount, u8 dst=0xFF);
+    u8 ValueCopy(u8 src, u8 dst);
+#endif
+    u8 ReadRegister(const u16 *addr, u8 *val, u8 num);
+    u8 ReadRegister(u16 addr, u8 *val);
+    u8 WriteRegister(const u16 *addr, const u8 *val, u8 num);
+    u8 WriteRegister(u16 addr, u8 val);
+    u8 WriteRegisterBits(u16 addr, u8 mask, u8 bits);
+    void RegisterCacheClear(void);
+    u8 ReadGPIO(u8 *p3=NULL, u8 *p7=NULL);
+    u8 GPIOPin(u8 pin, u8 level);
+    u8 GPIOFlush(void);
+    u8 WriteGPIO(u8 pin, u8 level);
+#if NFC_USE_ISO14443
+    u8 MifareReadCached(NFC_CardCache &cache, u8 *uuid, u8 uuid_len,
+                        u8 type, u8 *key, u8 marker, u8 first, u8 num,
+                        u8 *buf);
+    u8 NtagReadCached(NFC_CardCache &cache, const u8 *uid, u8 uid_len,
+                      u8 first, u8 num, u8 *buf);
+#endif
+    u16 Exchanges(u8 reset=0);
+
+    u8 CmdStart(const u8 *cmd, u8 len, u8 rlen=NFC_CMD_BUF_LEN-2);
+    u8 CmdPoll(void);
+    u8 CmdStep(const u8 *cmd, u8 len, u8 rlen, u16 ms=0);
+    u8 *CmdResponse(u8 *len);
+    void CmdAbort(void);
+    u8 CmdBusy(void);
+    u8 StepInList(u8 *cmd, u8 *buf, u16 ms=0);
+#if NFC_USE_ISO14443
+    u8 StepMifareAuth(u8 *cmd, u8 type, u8 block, const u8 *uuid,
+                      u8 uuid_len, const u8 *key, u16 ms=0);
+    u8 StepMifareRead(u8 *cmd, u8 block, u8 *buf, u16 ms=0);
+    u8 StepMifareWrite(u8 *cmd, u8 block, const u8 *buf, u16 ms=0);
+#endif
+    u8 TargetPresent(u8 tg=1, u8 probe=NFC_PROBE_DIAGNOSE, u8 block=0,
+                     u16 *ms=NULL);
+    u8 PollTap(u8 *buf, NFC_UidCache &cache, u8 brty=PN532_BRTY_ISO14443A);
 
+#if NFC_USE_P2P
     u8 P2PInitiatorInit();
     u8 P2PTargetInit();
     u8 P2PInitiatorTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len);
     u8 P2PTargetTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len);
+    void P2PConfig(const nfc_p2p_cfg_t *cfg);
+    u8 P2PInitiatorPSL(u8 baud);
+    u8 P2PTargetServe(nfc_p2p_handler_t handler, void *ctx);
+    u8 P2PInitiatorStream(nfc_source_t src, nfc_sink_t sink, void *ctx);
+    u8 P2PTargetStream(nfc_sink_t sink, nfc_source_t src, void *ctx);
+    u8 StepP2PTxRx(u8 *cmd, const u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len,
+                   u16 ms=0);
+#endif
 
+#if NFC_USE_EMULATION
+    void SetApduHandlers(const nfc_apdu_entry_t *table, u8 num,
+                         void *ctx=NULL);
     u8 TgInitAsTarget();
     u8 TargetPolling();
+    void Type4Tag(nfc_t4t_t *tag, const u8 *file, u16 len);
+#endif
     u8 SetParameters(u8 para);
 
+    u8 RFConfiguration(u8 item, const u8 *data, u8 len);
+    u8 RFField(u8 on, u8 autorfca=0);
+    u8 RFTimings(u8 atr_res, u8 retry);
+    u8 RFMaxRetryCOM(u8 retry);
+    u8 RFMaxRetries(u8 atr=PN532_RETRY_FOREVER, u8 psl=0x01,
+                    u8 passive=PN532_RETRY_FOREVER);
+    u8 RFAnalog(u8 item, const u8 *data, u8 len);
+    u8 RFPreset(u8 preset);
+
+    u8 PowerDown(u8 wakeup=PN532_WAKEUP_I2C, u8 irq=0);
+    u8 LowPowerPoll(u8 *buf, u16 period, u8 woken=0,
+                    u8 wakeup=PN532_WAKEUP_I2C);
+    nfc_lp_stats_t *LowPowerStats(void);
+
+#if NFC_USE_FELICA
 	u8 FelicaPoll(u8 *buf, u8 len, u8 *idata);
-	
+    u8 FelicaPoll(nfc_felica_t *card, u16 sys=0xFFFF,
+                  u8 rc=NFC_FELICA_RC_SYSCODE, u8 brty=PN532_BRTY_212KBPS);
+    u8 FelicaRead(const nfc_felica_t *card, const u16 *svc, u8 nsvc,
+                  const nfc_felica_blk_t *blk, u8 nblk, u8 *data, u8 max=0);
+    u8 FelicaWrite(const nfc_felica_t *card, const u16 *svc, u8 nsvc,
+                   const nfc_felica_blk_t *blk, u8 nblk, const u8 *data,
+                   u8 max=0);
+#endif
+
+#if NFC_USE_DIAG
     void puthex(u8 *buf, u32 len);
     void puthex(u8 data);
+    void Trace(NFC_Trace *trace);
+#endif
 private:
 
 	inline u8 send(u8 data);
 	inline u8 receive();
+	void bus_tx(void);
+	u8 bus_rx(u8 len);
 
 	void write_cmd(u8 *cmd, u8 len);
 	u8 write_cmd_check_ack(u8 *cmd, u8 len);
+	void write_segs(const nfc_seg_t *seg, u8 num);
+	void write_frame(const u8 *frame);
+	u8 write_frame_check_ack(const u8 *frame);
+	void cmd_start(u8 cmd);
+	u8 write_segs_check_ack(const nfc_seg_t *seg, u8 num);
+	u8 check_ack(void);
+	u8 read_data(u8 cmd, u8 *dst, u8 *dlen, u8 ms=NFC_WAIT_TIME);
+	u8 in_exchange(u8 mode, u8 tg, const nfc_seg_t *seg, u8 num,
+	               u8 *r_buf, u8 *r_len);
+#if NFC_USE_ISO14443
+	u8 in_chain(u8 tg, const u8 *t_buf, u16 t_len, s16 le,
+	            u8 *r_buf, u16 *r_len);
+#endif
 	void read_dt(u8 *buf, u8 len);
 	u8 read_sta(void);
 	u8 wait_ready(u8 ms=NFC_WAIT_TIME);
 	u8 read_ack(void);
+	u8 exchange(u8 len, u8 rlen, u8 ms=NFC_WAIT_TIME);
+	u8 exchange_raw(u8 len, u8 n);
+	u8 step_exchange(const u8 *cmd, u8 len, u8 rlen, u16 ms);
+	u8 gpio_send(void);
+	u8 gpio_fail(void);
+	u8 thru_config(u8 flags, u8 last_bits);
+#if NFC_USE_ISO14443
+	u8 ntag_read_cnt(u8 *marker);
+	u8 ntag_user_end(void);
+#endif
+	u8 reg_find(u16 addr);
+	void reg_set(u16 addr, u8 val);
+	u8 in_psl(u8 tg, u8 brit, u8 brti);
+#if NFC_USE_FELICA
+	u8 felica_cmd(u8 code, const nfc_felica_t *card, const u16 *svc, u8 nsvc,
+	              const nfc_felica_blk_t *blk, u8 nblk,
+	              const u8 *wdata, u8 *rdata);
+#endif
+#if NFC_USE_ISO14443
+	u8 mifare_write(u8 block, const u8 *data);
+	u8 mifare_value_op(u8 cmd, u8 block, u32 operand, u8 dst);
+	u8 topaz_cmd(u8 cmd, u8 add, const u8 *data, u8 dlen,
+	             u8 *rbuf, u8 *rlen);
+	u8 ats_baud(const u8 *ats, u8 max_br, u8 *brit, u8 *brti);
+#endif
+#if NFC_USE_P2P
+	u8 tg_init_frame(u8 mode, u8 sel_res, const nfc_p2p_cfg_t *cfg);
+#endif
+#if NFC_USE_EMULATION
+	u8 ce_send(void);
+#endif
+
+#if NFC_USE_P2P
+    /** P2P session configuration, NULL - defaults */
+    const nfc_p2p_cfg_t *p2p_cfg;
+    /** InJumpForDEP/PSL is sent, P2PInitiatorInit() waits for its reply */
+    u8 dep_sent;
+#endif
+#if NFC_USE_P2P || NFC_USE_EMULATION
+    /** target side state, P2PTargetInit() and P2PTargetServe() */
+    poll_sta_type tg_state;
+#endif
+#if NFC_USE_ISO14443
+    /** JEWELID of the selected Topaz tag */
+    u8 jewel_id[4];
+
+    /** highest bit rate negotiated by PSL, per target */
+    u8 psl_max[2];
+#endif
+
+#if NFC_USE_EMULATION
+    /** card emulation handler table and R-APDU being sent */
+    const nfc_apdu_entry_t *ce_table;
+    u8 ce_num;
+    void *ce_ctx;
+    nfc_rapdu_t ce_rsp;
+#endif
+
+    /** values last written to CIU registers, dropped by commands that
+        reload the CIU configuration */
+    nfc_reg_t reg_cache[NFC_REG_CACHE_SIZE];
+    u8 reg_num;
+    u8 reg_next;
+
+    /** GPIO shadow: ports on the chip and the state queued by GPIOPin() */
+    u8 gpio_p3, gpio_p7;
+    u8 gpio_q3, gpio_q7;
+    u8 gpio_valid;      // gpio_p3/gpio_p7 are known
+    u8 gpio_pending;    // queued state differs, sent before next command
+
+    /** non-blocking command in flight, see CmdStart() */
+    const u8 *cmd_owner;
+    u8 cmd_code;
+    u8 cmd_rlen;        // response length to read, 0 - idle
+    u32 cmd_time;       // when the command was sent
+
+    /** commands sent since the last Exchanges(1) */
+    u16 cmd_count;
+
+#if NFC_USE_DIAG
+    /** bus traffic recorder, NULL - off */
+    NFC_Trace *trace;
+#endif
+
+    /** bit n-1 is set while target n is known to be in the field */
+    u8 tg_seen;
+
+    /** PN532 is in power down, next command needs NFC_WAKEUP_TIME */
+    u8 asleep;
+    u32 lp_sleep;       // time of last PowerDown
+    u32 lp_wake;        // time of last wake-up
+    u32 lp_begin;       // time of first LowPowerPoll, 0 - not started
+    nfc_lp_stats_t lp_stats;
 };
 
 #endif /** __NFC_H */
@@ -0,0 +1,67 @@
+/*****************************************************************************/
+/*!
+    @file     nfc_config.h
+    @author   www.elechouse.com
+	@brief      NFC Module I2C library build configuration.
+	Set a module to 0 to leave it out of the build. Its functions are then
+	not declared, and its code, tables and member variables take no flash
+	or SRAM. The core (frame engine, InListPassiveTarget, InDataExchange,
+	InCommunicateThru, registers, GPIO, RF configuration, power down and
+	the UID cache) is always built.
+
+    NOTE:
+        Arduino compiles libraries separately from the sketch, so edit this
+        file, or pass the flags to the compiler; a #define in the sketch
+        does not reach the library.
+
+    Copyright (c) 2012 www.elechouse.com  All right reserved.
+*/
+/*****************************************************************************/
+
+#ifndef __NFC_CONFIG_H
+#define __NFC_CONFIG_H
+
+//#define PN532DEBUG
+//#define PN532_P2P_DEBUG
+
+/** Mifare Classic, NTAG, ISO-DEP APDUs, Type B, Jewel/Topaz, card cache */
+#ifndef NFC_USE_ISO14443
+#define NFC_USE_ISO14443                    1
+#endif
+
+/** FeliCa polling, Read/Write Without Encryption */
+#ifndef NFC_USE_FELICA
+#define NFC_USE_FELICA                      1
+#endif
+
+/** Peer to Peer initiator and target */
+#ifndef NFC_USE_P2P
+#define NFC_USE_P2P                         1
+#endif
+
+/** card emulation: TgInitAsTarget, TargetPolling, Type 4 Tag */
+#ifndef NFC_USE_EMULATION
+#define NFC_USE_EMULATION                   1
+#endif
+
+/** puthex() and its hex table */
+#ifndef NFC_USE_DIAG
+#define NFC_USE_DIAG                        1
+#endif
+
+/**
+    nfc_buf, and the longest frame written to or read from PN532, 255 at
+    most. The Wire buffer, BUFFER_LENGTH, must be as long. 132 and up lets
+    TopazReadAll() read a Topaz with one RALL.
+*/
+#ifndef NFC_CMD_BUF_LEN
+#define NFC_CMD_BUF_LEN                     64
+#endif
+
+/** debug output is printed with puthex() */
+#if defined(PN532DEBUG) || defined(PN532_P2P_DEBUG)
+#undef NFC_USE_DIAG
+#define NFC_USE_DIAG                        1
+#endif
+
+#endif /** __NFC_CONFIG_H */
@@ -0,0 +1,395 @@
+/*****************************************************************************/
+/*!
+    @file     nfc_diag.cpp
+    @author   www.elechouse.com
+	@brief      NFC Module I2C library, hex dump helpers and bus trace.
+	Built when NFC_USE_DIAG is set in nfc_config.h.
+
+    Copyright (c) 2012 www.elechouse.com  All right reserved.
+*/
+/*****************************************************************************/
+
+#include "nfc.h"
+
+#if NFC_USE_DIAG
+
+u8 hextab[17]="0123456789ABCDEF";
+
+/*****************************************************************************/
+/*!
+	@brief  Send a byte by hex format
+	@param  data - the byte
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Module::puthex(u8 data)
+{
+    Serial.write(hextab[(data>>4)&0x0F]);
+    Serial.write(hextab[data&0x0F]);
+    Serial.write(' ');
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Send hexadecimal data through Serial with specified length.
+	@param  buf - pointer of data buffer.
+	@param  len - length need to send.
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Module::puthex(u8 *buf, u32 len)
+{
+    u32 i;
+    for(i=0; i<len; i++)
+    {
+        Serial.write(hextab[(buf[i]>>4)&0x0F]);
+        Serial.write(hextab[buf[i]&0x0F]);
+        Serial.write(' ');
+    }
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Record the I2C traffic with PN532 into trace, see NFC_Trace.
+	@param  trace - recorder, NULL - stop recording
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Module::Trace(NFC_Trace *trace)
+{
+    this->trace = trace;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Bus trace constructor.
+	@param  mem - record buffer, NULL - count only
+	@param  size - size of mem
+*/
+/*****************************************************************************/
+NFC_Trace::NFC_Trace(u8 *mem, u16 size)
+{
+    this->mem = mem;
+    this->size = size;
+    t0 = 0;
+    clear();
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Drop all records and counts, and record again.
+	@param  NONE
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Trace::clear(void)
+{
+    nbytes = 0;
+    ncmd = 0;
+    len = 0;
+    hdr = 0xFFFF;
+    poll = 0xFFFF;
+    tx = 0;
+    full = 0;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Recorded log, to save or send it to a host.
+	@param  NONE
+	@return pointer to the records
+*/
+/*****************************************************************************/
+const u8 *NFC_Trace::data(void)
+{
+    return mem;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Recorded log length.
+	@param  NONE
+	@return bytes used in the buffer
+*/
+/*****************************************************************************/
+u16 NFC_Trace::length(void)
+{
+    return len;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Whether recording stopped on a full buffer.
+	@param  NONE
+	@return 0 - complete log, 1 - later traffic is missing
+*/
+/*****************************************************************************/
+u8 NFC_Trace::overflow(void)
+{
+    return full;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Bytes moved on the bus, counted on after the buffer is full.
+	@param  NONE
+	@return bytes written to PN532 and transferred by reads since clear(),
+            the whole requestFrom() length, not only the bytes consumed
+*/
+/*****************************************************************************/
+u32 NFC_Trace::bytes(void)
+{
+    return nbytes;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Commands issued, counted on after the buffer is full.
+	@param  NONE
+	@return commands sent to PN532 since clear()
+*/
+/*****************************************************************************/
+u16 NFC_Trace::commands(void)
+{
+    return ncmd;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  A command is issued, later record times are counted from now.
+	@param  NONE
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Trace::issue(void)
+{
+    ncmd++;
+    t0 = micros();
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Open a record for a new bus transaction. The record before is
+        closed, a busy status poll following another one is dropped and
+        counted in the NFC_TRACE_POLLS record of the first.
+	@param  dir - NFC_TRACE_TX, or 0 for a read from PN532
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Trace::rec(u8 dir)
+{
+    u32 t;
+    u8 n = (dir & NFC_TRACE_TX) ? NFC_TRACE_HDR_LEN : NFC_TRACE_RX_HDR_LEN;
+
+    if(hdr != 0xFFFF && mem[hdr] == 1 &&
+       !(mem[hdr+NFC_TRACE_RX_HDR_LEN] & PN532_I2C_READY)){
+        if(poll != 0xFFFF && (mem[poll] != NFC_TRACE_POLLS ||
+                              mem[poll+NFC_TRACE_HDR_LEN] < 0xFF)){
+            if(mem[poll] != NFC_TRACE_POLLS){
+                mem[poll] = NFC_TRACE_POLLS;
+                mem[poll+NFC_TRACE_HDR_LEN] = 1;
+            }
+            mem[poll+NFC_TRACE_HDR_LEN]++;
+            /** the poll record shrinks to header and count */
+            len = poll+NFC_TRACE_HDR_LEN+1;
+        }else{
+            poll = hdr;
+        }
+    }else{
+        poll = 0xFFFF;
+    }
+
+    hdr = 0xFFFF;
+    tx = dir & NFC_TRACE_TX;
+    if(full || len+n > size){
+        full = 1;
+        return;
+    }
+    t = (micros() - t0)/NFC_TRACE_TICK_US;
+    if(t > 0xFFFF){
+        t = 0xFFFF;
+    }
+    hdr = len;
+    mem[len++] = dir;
+    mem[len++] = (u8)t;
+    mem[len++] = (u8)(t>>8);
+    if(!tx){
+        /** filled in by xfer() */
+        mem[len++] = 0;
+        mem[len++] = 0;
+    }
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Length of the read of the open record, once Wire has done it.
+	@param  req - bytes requested
+	@param  got - bytes transferred, 0 - PN532 did not answer
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Trace::xfer(u8 req, u8 got)
+{
+    if(tx){
+        return;
+    }
+    /** Wire has clocked all of them, used or not */
+    nbytes += got;
+    if(hdr == 0xFFFF){
+        return;
+    }
+    mem[hdr+3] = req;
+    mem[hdr+4] = got;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Add a bus byte to the open record.
+	@param  data - the byte
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Trace::put(u8 data)
+{
+    if(tx){
+        nbytes++;
+    }
+    if(hdr == 0xFFFF){
+        return;
+    }
+    if(len >= size){
+        full = 1;
+        hdr = 0xFFFF;
+        return;
+    }
+    if((mem[hdr]&NFC_TRACE_LEN_MASK) == NFC_TRACE_REC_MAX){
+        /** frames longer than a record are cut, see NFC_CMD_BUF_LEN */
+        return;
+    }
+    mem[len++] = data;
+    mem[hdr]++;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Header length of record r.
+*/
+/*****************************************************************************/
+static u8 rec_hdr_len(const u8 *r)
+{
+    return (r[0] & NFC_TRACE_TX || r[0] == NFC_TRACE_POLLS) ?
+           NFC_TRACE_HDR_LEN : NFC_TRACE_RX_HDR_LEN;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Print all records through Serial, one per line:
+        TX, time in 0.1 ms since command issue, bytes; RX, time, bytes
+        requested/transferred, bytes recorded; or POLL, time of the first
+        busy status poll, number of polls.
+	@param  NONE
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Trace::dump(void)
+{
+    u16 i, t;
+    u8 n, h;
+
+    for(i=0; i+NFC_TRACE_HDR_LEN <= len; i+=h+n){
+        h = rec_hdr_len(mem+i);
+        n = (mem[i] == NFC_TRACE_POLLS) ? 1 : (mem[i] & NFC_TRACE_LEN_MASK);
+        t = mem[i+1] | (mem[i+2]<<8);
+        if(mem[i] == NFC_TRACE_POLLS){
+            Serial.print("POLL ");
+            Serial.print(t, DEC);
+            Serial.print(' ');
+            Serial.println(mem[i+3], DEC);
+            continue;
+        }
+        Serial.print((mem[i] & NFC_TRACE_TX) ? "TX " : "RX ");
+        Serial.print(t, DEC);
+        Serial.print(' ');
+        if(!(mem[i] & NFC_TRACE_TX)){
+            Serial.print(mem[i+3], DEC);
+            Serial.print('/');
+            Serial.print(mem[i+4], DEC);
+            Serial.print(' ');
+        }
+        for(u8 j=0; j<n; j++){
+            Serial.write(hextab[(mem[i+h+j]>>4)&0x0F]);
+            Serial.write(hextab[mem[i+h+j]&0x0F]);
+        }
+        Serial.println();
+    }
+    if(full){
+        Serial.println("OVERFLOW");
+    }
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Print one line per command through Serial: command code, time
+        from issue to last bus transaction, bytes written and transferred
+        by reads, and status polls spent waiting for the response.
+	@param  NONE
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Trace::report(void)
+{
+    u16 i, t, end = 0, tx = 0, rx = 0, polls = 0;
+    u8 n, h = 0, cmd = 0, open = 0;
+
+    for(i=0; ; i+=h+n){
+        u8 last = (i+NFC_TRACE_HDR_LEN > len);
+        u8 *r = mem+i;
+
+        h = last ? 0 : rec_hdr_len(r);
+        n = last ? 0 : (r[0] == NFC_TRACE_POLLS) ? 1 :
+                       (r[0] & NFC_TRACE_LEN_MASK);
+        /** a command frame: 00 00 FF LEN LCS D4 CMD ... */
+        if(open && (last || ((r[0] & NFC_TRACE_TX) && n > 6 && r[3+5] == 0xD4))){
+            Serial.print("CMD ");
+            Serial.write(hextab[(cmd>>4)&0x0F]);
+            Serial.write(hextab[cmd&0x0F]);
+            Serial.print(" time ");
+            Serial.print(end/10, DEC);
+            Serial.print('.');
+            Serial.print(end%10, DEC);
+            Serial.print("ms tx ");
+            Serial.print(tx, DEC);
+            Serial.print(" rx ");
+            Serial.print(rx, DEC);
+            Serial.print(" polls ");
+            Serial.println(polls, DEC);
+            open = 0;
+        }
+        if(last){
+            break;
+        }
+        t = r[1] | (r[2]<<8);
+        if((r[0] & NFC_TRACE_TX) && n > 6 && r[3+5] == 0xD4){
+            open = 1;
+            cmd = r[3+6];
+            tx = rx = polls = 0;
+        }
+        if(r[0] == NFC_TRACE_POLLS){
+            rx += r[3];
+            polls += r[3];
+        }else if(r[0] & NFC_TRACE_TX){
+            tx += n;
+        }else{
+            rx += r[4];
+            if(r[4] == 1){
+                polls++;
+            }
+        }
+        end = t;
+    }
+    if(full){
+        Serial.println("OVERFLOW");
+    }
+}
+
+#endif /** NFC_USE_DIAG */
@@ -0,0 +1,333 @@
+/*****************************************************************************/
+/*!
+    @file     nfc_emulation.cpp
+    @author   www.elechouse.com
+	@brief      NFC Module I2C library, card emulation.
+	Built when NFC_USE_EMULATION is set in nfc_config.h.
+
+    Copyright (c) 2012 www.elechouse.com  All right reserved.
+*/
+/*****************************************************************************/
+
+#include "nfc.h"
+
+#if NFC_USE_EMULATION
+
+/** TgInitAsTarget(): ISO14443-4A PICC only, SEL_RES 0x20 */
+const u8 frame_tg_init_picc[] PROGMEM =
+    NFC_FRAME(PN532_COMMAND_TGINITASTARGET, PN532_TG_PICC_ONLY,
+              TG_INIT_DEFAULT(0x20), 0, 0);
+
+/** Type 4 Tag: NDEF application name and capability container */
+const u8 t4t_aid[7] PROGMEM = {
+    0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01
+};
+const u8 t4t_cc[15] PROGMEM = {
+    0x00, 0x0F,             // CCLEN
+    0x20,                   // mapping version 2.0
+    0x00, NFC_DEP_CHUNK-2,  // MLe, R-APDU data fits in one frame
+    0x00, NFC_DEP_CHUNK-6,  // MLc
+    0x04, 0x06,             // NDEF File Control TLV
+    0xE1, 0x04,             // NDEF file identifier
+    0x00, 0x00,             // maximum NDEF file size, set by Type4Tag()
+    0x00,                   // read access granted
+    0xFF                    // no write access
+};
+
+/*****************************************************************************/
+/*!
+	@brief  Register the C-APDU handler table of card emulation.
+	@param  table - handler table, CLA NFC_APDU_ANY matches any class.
+                    It must stay valid while card emulation runs.
+	@param  num - number of table entries
+	@param  ctx - user pointer passed to the handlers
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Module::SetApduHandlers(const nfc_apdu_entry_t *table, u8 num,
+                                 void *ctx)
+{
+    ce_table = table;
+    ce_num = num;
+    ce_ctx = ctx;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Arm PN532 as ISO14443-4A PICC for card emulation, TargetPolling()
+        waits for the reader.
+	@param  NONE
+	@return 0 - send failed
+            1 - send successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::TgInitAsTarget()
+{
+    /** 14443-4A Card only, SEL_RES 0x20: ISO14443-4 compliant */
+    if(!write_frame_check_ack(frame_tg_init_picc)){
+        tg_state = NFC_STA_IDLE;
+        return 0;
+    }
+    tg_state = NFC_STA_TAG;
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Non-blocking card emulation engine, call it from loop(). Each
+        C-APDU got by TgGetData is dispatched through the SetApduHandlers()
+        table by CLA/INS, and the R-APDU is sent by TgSetData, chained with
+        TgSetMetaData when longer than one frame. Response data is streamed
+        from RAM or PROGMEM without copying.
+	@param  NONE
+	@return NFC_SRV_IDLE - nothing happened
+            NFC_SRV_ACTIVATED - a reader activated the PICC
+            NFC_SRV_REQUEST - a C-APDU has been answered
+            NFC_SRV_RELEASED - reader left, PICC is re-armed
+*/
+/*****************************************************************************/
+u8 NFC_Module::TargetPolling()
+{
+    u8 i, ret = NFC_SRV_IDLE;
+
+    if(tg_state == NFC_STA_IDLE){
+        TgInitAsTarget();
+        return NFC_SRV_IDLE;
+    }
+
+    if(read_sta() != PN532_I2C_READY){
+        return NFC_SRV_IDLE;
+    }
+    read_dt(nfc_buf, NFC_CMD_BUF_LEN-2);
+
+    if(nfc_buf[5] != 0xD5 ||
+       (tg_state == NFC_STA_TAG ?
+        (nfc_buf[NFC_FRAME_ID_INDEX+1] &
+         (PN532_TG_MODE_PICC|PN532_TG_MODE_FRAMING)) != PN532_TG_MODE_PICC :
+        (nfc_buf[NFC_FRAME_ID_INDEX+1] & NFC_STATUS_ERR_MASK)) ||
+       (tg_state == NFC_STA_GETDATA && nfc_buf[3] > NFC_CMD_BUF_LEN-9)){
+        /** released, deselected or broken frame, wait for next reader */
+        TgInitAsTarget();
+        return NFC_SRV_RELEASED;
+    }
+
+    switch(tg_state){
+        case NFC_STA_TAG:
+            ret = NFC_SRV_ACTIVATED;
+            break;
+        case NFC_STA_GETDATA:
+            /** nfc_buf+8: CLA INS P1 P2 ... */
+            ce_rsp.data = NULL;
+            ce_rsp.len = 0;
+            ce_rsp.pgm = 0;
+            ce_rsp.sw = NFC_SW_INS_NOT_SUPPORTED;
+            if(nfc_buf[NFC_FRAME_ID_INDEX+1] & NFC_MI){
+                /** chained C-APDU does not fit in nfc_buf */
+                ce_rsp.sw = NFC_SW_WRONG_LENGTH;
+            }else if(nfc_buf[3] < 3+4){
+                ce_rsp.sw = NFC_SW_WRONG_LENGTH;
+            }else{
+                for(i=0; i<ce_num; i++){
+                    if(ce_table[i].ins == nfc_buf[9] &&
+                       (ce_table[i].cla == NFC_APDU_ANY ||
+                        ce_table[i].cla == nfc_buf[8])){
+                        ce_table[i].fn(nfc_buf+8, nfc_buf[3]-3, &ce_rsp,
+                                       ce_ctx);
+                        break;
+                    }
+                }
+            }
+            if(!ce_send()){
+                TgInitAsTarget();
+                return NFC_SRV_RELEASED;
+            }
+            return NFC_SRV_REQUEST;
+        case NFC_STA_SETDATA:
+            if(ce_rsp.len || ce_rsp.pgm == NFC_RSP_PENDING_SW){
+                /** next part of a chained R-APDU */
+                if(!ce_send()){
+                    TgInitAsTarget();
+                    return NFC_SRV_RELEASED;
+                }
+                return NFC_SRV_IDLE;
+            }
+            break;
+        default:
+            break;
+    }
+
+    if(!write_frame_check_ack(frame_tg_get_data)){
+        TgInitAsTarget();
+        return NFC_SRV_RELEASED;
+    }
+    tg_state = NFC_STA_GETDATA;
+    return ret;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Send the next part of ce_rsp. Data and status word go out with
+        TgSetData when they fit in a frame, otherwise a data chunk goes out
+        with TgSetMetaData (MI set).
+	@param  NONE
+	@return 0 - send failed
+            1 - send successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::ce_send(void)
+{
+    nfc_seg_t seg[3];
+    u8 cmd, sw[2], len;
+
+    if(ce_rsp.len+2 > NFC_DEP_CHUNK){
+        cmd = PN532_COMMAND_TGSETMETADATA;
+        len = (ce_rsp.len > NFC_DEP_CHUNK) ? NFC_DEP_CHUNK : ce_rsp.len;
+    }else{
+        cmd = PN532_COMMAND_TGSETDATA;
+        len = ce_rsp.len;
+    }
+    sw[0] = ce_rsp.sw >> 8;
+    sw[1] = ce_rsp.sw;
+
+    seg[0].buf = &cmd;
+    seg[0].len = 1;
+    seg[0].pgm = 0;
+    seg[1].buf = ce_rsp.data;
+    seg[1].len = len;
+    seg[1].pgm = ce_rsp.pgm & 0x01;
+    seg[2].buf = sw;
+    seg[2].len = (cmd == PN532_COMMAND_TGSETDATA) ? 2 : 0;
+    seg[2].pgm = 0;
+    if(!write_segs_check_ack(seg, 3)){
+        return 0;
+    }
+
+    ce_rsp.data += len;
+    ce_rsp.len -= len;
+    if(cmd == PN532_COMMAND_TGSETMETADATA && !ce_rsp.len){
+        /** all data sent, status word follows alone */
+        ce_rsp.pgm = NFC_RSP_PENDING_SW;
+    }else if(cmd == PN532_COMMAND_TGSETDATA){
+        ce_rsp.pgm = 0;
+    }
+    tg_state = NFC_STA_SETDATA;
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Type 4 Tag SELECT handler, NDEF application by name, CC and NDEF
+        files by identifier.
+	@param  capdu, len, rsp, ctx - see nfc_apdu_handler_t, ctx is nfc_t4t_t
+	@return NONE
+*/
+/*****************************************************************************/
+static void t4t_select(const u8 *capdu, u8 len, nfc_rapdu_t *rsp, void *ctx)
+{
+    nfc_t4t_t *tag = (nfc_t4t_t *)ctx;
+    u16 fid;
+
+    rsp->sw = NFC_SW_FILE_NOT_FOUND;
+    if(len < 5 || len < 5+capdu[4]){
+        rsp->sw = NFC_SW_WRONG_LENGTH;
+        return;
+    }
+    if(capdu[2] == 0x04){
+        /** select by name */
+        tag->app = (capdu[4] == sizeof(t4t_aid)) &&
+                   !memcmp_P(capdu+5, t4t_aid, sizeof(t4t_aid));
+        tag->sel = NFC_T4T_NONE;
+        if(tag->app){
+            rsp->sw = NFC_SW_OK;
+        }
+        return;
+    }
+    if(capdu[2] != 0x00 || capdu[4] != 2 || !tag->app){
+        return;
+    }
+    /** select by file identifier */
+    fid = (capdu[5] << 8) | capdu[6];
+    if(fid == 0xE103){
+        tag->sel = NFC_T4T_CC;
+        rsp->sw = NFC_SW_OK;
+    }else if(fid == 0xE104){
+        tag->sel = NFC_T4T_NDEF;
+        rsp->sw = NFC_SW_OK;
+    }
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Type 4 Tag READ BINARY handler, the NDEF file is served straight
+        from PROGMEM.
+	@param  capdu, len, rsp, ctx - see nfc_apdu_handler_t, ctx is nfc_t4t_t
+	@return NONE
+*/
+/*****************************************************************************/
+static void t4t_read(const u8 *capdu, u8 len, nfc_rapdu_t *rsp, void *ctx)
+{
+    nfc_t4t_t *tag = (nfc_t4t_t *)ctx;
+    const u8 *file;
+    u16 size, offset, le;
+
+    if(tag->sel == NFC_T4T_CC){
+        file = tag->cc;
+        size = sizeof(tag->cc);
+    }else if(tag->sel == NFC_T4T_NDEF){
+        file = tag->file;
+        size = tag->len;
+    }else{
+        rsp->sw = NFC_SW_FILE_NOT_FOUND;
+        return;
+    }
+
+    offset = (capdu[2] << 8) | capdu[3];
+    if(capdu[2] & 0x80 || offset > size){
+        rsp->sw = NFC_SW_WRONG_P1P2;
+        return;
+    }
+    /** Le 0x00 means 256 */
+    le = (len > 4 && capdu[4]) ? capdu[4] : 256;
+    if(le > size-offset){
+        le = size-offset;
+    }
+    if(le > NFC_DEP_CHUNK-2){
+        le = NFC_DEP_CHUNK-2;
+    }
+    rsp->data = file + offset;
+    rsp->len = le;
+    rsp->pgm = (tag->sel == NFC_T4T_NDEF);
+    rsp->sw = NFC_SW_OK;
+}
+
+static const nfc_apdu_entry_t t4t_table[2] = {
+    { 0x00, 0xA4, t4t_select },
+    { 0x00, 0xB0, t4t_read },
+};
+
+/*****************************************************************************/
+/*!
+	@brief  Emulate an NFC Forum Type 4 Tag presenting a read-only NDEF
+        message. Registers the SELECT/READ BINARY handlers, then call
+        TargetPolling() from loop().
+	@param  tag - Type 4 Tag state, it must stay valid while emulating
+	@param  file - NDEF file in PROGMEM, NLEN (2 bytes, MSB first) followed
+                   by the NDEF message
+	@param  len - NDEF file length, NLEN + 2
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Module::Type4Tag(nfc_t4t_t *tag, const u8 *file, u16 len)
+{
+    tag->file = file;
+    tag->len = len;
+    /** the CC advertises the size of the file actually served */
+    memcpy_P(tag->cc, t4t_cc, sizeof(t4t_cc));
+    tag->cc[11] = len >> 8;
+    tag->cc[12] = len;
+    tag->app = 0;
+    tag->sel = NFC_T4T_NONE;
+    SetApduHandlers(t4t_table, 2, tag);
+}
+
+#endif /** NFC_USE_EMULATION */
@@ -0,0 +1,217 @@
+/*****************************************************************************/
+/*!
+    @file     nfc_felica.cpp
+    @author   www.elechouse.com
+	@brief      NFC Module I2C library, FeliCa commands.
+	Built when NFC_USE_FELICA is set in nfc_config.h.
+
+    Copyright (c) 2012 www.elechouse.com  All right reserved.
+*/
+/*****************************************************************************/
+
+#include "nfc.h"
+
+#if NFC_USE_FELICA
+
+/*****************************************************************************/
+/*!
+	@brief  FeliCa polling, raw form.
+	@param  buf - buf[0] POL_RES length; buf[1]... IDm, PMm, [system code]
+	@param  len - length of idata
+	@param  idata - polling request: 00 SC SC RC TSN
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::FelicaPoll(u8 *buf, u8 len, u8 *idata)
+{
+    return InListPassiveTarget(buf, PN532_BRTY_424KBPS, len, idata, 2);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  FeliCa polling.
+	@param  card - returns IDm, PMm and system code of the card
+	@param  sys - system code to poll, 0xFFFF any
+	@param  rc - request code, NFC_FELICA_RC_SYSCODE to get the system code
+	@param  brty - PN532_BRTY_212KBPS or PN532_BRTY_424KBPS
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::FelicaPoll(nfc_felica_t *card, u16 sys, u8 rc, u8 brty)
+{
+    u8 idata[5], buf[1+18];
+
+    idata[0] = FELICA_CMD_POLLING;
+    idata[1] = sys >> 8;
+    idata[2] = sys;
+    idata[3] = rc;
+    idata[4] = 0x00;    // TSN, 1 time slot
+    if(!InListPassiveTarget(buf, brty, 5, idata, 1)){
+        return 0;
+    }
+
+    memcpy(card->idm, buf+1, 8);
+    memcpy(card->pmm, buf+9, 8);
+    card->sys = (buf[0] >= 18) ? (buf[17] << 8) | buf[18] : 0xFFFF;
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Build and send a FeliCa Read/Write Without Encryption command.
+	@param  code - FELICA_CMD_READ_WO_ENC or FELICA_CMD_WRITE_WO_ENC
+	@param  card - card to address
+	@param  svc - service code list
+	@param  nsvc - number of services
+	@param  blk - block list
+	@param  nblk - number of blocks
+	@param  wdata - data to write, 16 bytes per block, NULL for read
+	@param  rdata - returns read data, 16 bytes per block, NULL for write
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::felica_cmd(u8 code, const nfc_felica_t *card,
+                          const u16 *svc, u8 nsvc,
+                          const nfc_felica_blk_t *blk, u8 nblk,
+                          const u8 *wdata, u8 *rdata)
+{
+    u8 i, len, rlen;
+
+    len = 1;
+    nfc_buf[len++] = code;
+    memcpy(nfc_buf+len, card->idm, 8);
+    len += 8;
+    nfc_buf[len++] = nsvc;
+    for(i=0; i<nsvc; i++){
+        /** service codes are little endian */
+        nfc_buf[len++] = svc[i];
+        nfc_buf[len++] = svc[i] >> 8;
+    }
+    nfc_buf[len++] = nblk;
+    for(i=0; i<nblk; i++){
+        if(blk[i].num < 0x100){
+            /** 2 bytes block list element */
+            nfc_buf[len++] = 0x80 | blk[i].svc;
+            nfc_buf[len++] = blk[i].num;
+        }else{
+            nfc_buf[len++] = blk[i].svc;
+            nfc_buf[len++] = blk[i].num;
+            nfc_buf[len++] = blk[i].num >> 8;
+        }
+    }
+    if(wdata){
+        memcpy(nfc_buf+len, wdata, 16*nblk);
+        len += 16*nblk;
+    }
+    nfc_buf[0] = len;
+
+    rlen = NFC_CMD_BUF_LEN;
+    if(InDataExchange(0, 1, nfc_buf, len, nfc_buf, &rlen) != 1){
+        return 0;
+    }
+
+    /** LEN CODE+1 IDm(8) SF1 SF2 [NBLK data] */
+    if(rlen < 12 || nfc_buf[1] != code+1 || nfc_buf[10] || nfc_buf[11]){
+        return 0;
+    }
+    if(rdata){
+        if(rlen < 13+16*nblk){
+            return 0;
+        }
+        memcpy(rdata, nfc_buf+13, 16*nblk);
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  FeliCa Read Without Encryption. Blocks are packed into as few
+        commands as the card and the frame size allow.
+	@param  card - card to address
+	@param  svc - service code list, 16 services at most
+	@param  nsvc - number of services
+	@param  blk - block list, svc is an index into the service code list
+	@param  nblk - number of blocks
+	@param  data - returns 16 bytes per block
+	@param  max - max blocks per command of the card, 0 - frame limit only
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::FelicaRead(const nfc_felica_t *card, const u16 *svc, u8 nsvc,
+                          const nfc_felica_blk_t *blk, u8 nblk, u8 *data,
+                          u8 max)
+{
+    /** reply: LEN CODE IDm SF1 SF2 NBLK data */
+    u8 n = (NFC_CMD_BUF_LEN-9-13) / 16;
+
+    if(max && max < n){
+        n = max;
+    }
+    while(nblk){
+        if(n > nblk){
+            n = nblk;
+        }
+        if(!felica_cmd(FELICA_CMD_READ_WO_ENC, card, svc, nsvc, blk, n,
+                       NULL, data)){
+            return 0;
+        }
+        blk += n;
+        nblk -= n;
+        data += 16*n;
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  FeliCa Write Without Encryption. Blocks are packed into as few
+        commands as the card and the frame size allow.
+	@param  card - card to address
+	@param  svc - service code list, 16 services at most
+	@param  nsvc - number of services
+	@param  blk - block list, svc is an index into the service code list
+	@param  nblk - number of blocks
+	@param  data - 16 bytes per block
+	@param  max - max blocks per command of the card, 0 - frame limit only
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::FelicaWrite(const nfc_felica_t *card, const u16 *svc, u8 nsvc,
+                           const nfc_felica_blk_t *blk, u8 nblk,
+                           const u8 *data, u8 max)
+{
+    /** command: InDataExchange header, LEN CODE IDm services blocks data */
+    s16 room = NFC_CMD_BUF_LEN-8-2 - (12+2*nsvc);
+    u8 n = 0;
+
+    while(room >= 16+3){
+        room -= 16+3;
+        n++;
+    }
+    if(max && max < n){
+        n = max;
+    }
+    if(!n){
+        return 0;
+    }
+    while(nblk){
+        if(n > nblk){
+            n = nblk;
+        }
+        if(!felica_cmd(FELICA_CMD_WRITE_WO_ENC, card, svc, nsvc, blk, n,
+                       data, NULL)){
+            return 0;
+        }
+        blk += n;
+        nblk -= n;
+        data += 16*n;
+    }
+    return 1;
+}
+
+#endif /** NFC_USE_FELICA */
@@ -0,0 +1,1474 @@
+/*****************************************************************************/
+/*!
+    @file     nfc_iso14443.cpp
+    @author   www.elechouse.com
+	@brief      NFC Module I2C library, ISO14443 targets.
+	Mifare Classic, NTAG, ISO-DEP, Type B and Jewel/Topaz.
+	Built when NFC_USE_ISO14443 is set in nfc_config.h.
+
+    Copyright (c) 2012 www.elechouse.com  All right reserved.
+*/
+/*****************************************************************************/
+
+#include "nfc.h"
+#include <avr/eeprom.h>
+
+#if NFC_USE_ISO14443
+
+/*****************************************************************************/
+/*!
+	@brief  Send data of any length to a target with MI chaining and collect
+        the whole chained reply.
+	@param  tg - logical number of the target
+	@param  t_buf - data to send
+	@param  t_len - data length
+	@param  le - >= 0, replaces the last byte of t_buf; < 0, unused
+	@param  r_buf - buffer of the received data
+	@param  r_len - in: r_buf size; out: received length
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::in_chain(u8 tg, const u8 *t_buf, u16 t_len, s16 le,
+                        u8 *r_buf, u16 *r_len)
+{
+    nfc_seg_t seg[2];
+    u8 le8 = le, n, sta;
+    u16 pos = 0, off = 0;
+
+    do{
+        n = (t_len-pos > NFC_DEP_CHUNK) ? NFC_DEP_CHUNK : t_len-pos;
+        seg[0].buf = t_buf+pos;
+        seg[0].len = n;
+        seg[0].pgm = 0;
+        seg[1].buf = &le8;
+        seg[1].len = 0;
+        seg[1].pgm = 0;
+        pos += n;
+        if(pos == t_len && le >= 0){
+            seg[0].len--;
+            seg[1].len = 1;
+        }
+        n = (*r_len-off > 0xFF) ? 0xFF : *r_len-off;
+        sta = in_exchange(pos < t_len ? NFC_MI : 0, tg, seg, 2, r_buf+off, &n);
+        if(!sta){
+            return 0;
+        }
+    }while(pos < t_len);
+
+    /** reply, more parts are fetched with empty frames */
+    off += n;
+    while(sta == NFC_DEP_MORE){
+        n = (*r_len-off > 0xFF) ? 0xFF : *r_len-off;
+        sta = in_exchange(0, tg, seg, 0, r_buf+off, &n);
+        if(!sta){
+            return 0;
+        }
+        off += n;
+    }
+    *r_len = off;
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  ISO-DEP APDU exchange with an ISO14443-4 target. Commands and
+        responses longer than a frame are chained, 61xx is answered with
+        GET RESPONSE and 6Cxx by resending with the right Le, in place of
+        the Le of a case 2/4 APDU or appended to a case 1/3 APDU. Response
+        data goes straight into rapdu.
+        A response frame holds NFC_APDU_MAX_LE data bytes at most, so a
+        larger or 0 (256) Le of a short APDU is lowered to it. A card with
+        more data answers 61xx, and the rest is fetched by GET RESPONSE.
+	@param  tg - logical number of the target
+	@param  capdu - C-APDU
+	@param  clen - C-APDU length
+	@param  rapdu - R-APDU buffer
+	@param  rlen - in: rapdu size; out: R-APDU length including SW1 SW2
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::ApduTransceive(u8 tg, const u8 *capdu, u16 clen,
+                              u8 *rapdu, u16 *rlen)
+{
+    u8 getrsp[5];
+    const u8 *tx = capdu;
+    u16 tlen = clen, off = 0, n;
+    s16 le = -1;
+    u8 resent = 0, has_le = 0;
+
+    /** short case 2 or 4 APDU: CLA INS P1 P2 [Lc data] Le */
+    if(clen == 5 || (clen > 5 && clen == 6+capdu[4])){
+        has_le = 1;
+        if(!capdu[clen-1] || capdu[clen-1] > NFC_APDU_MAX_LE){
+            le = NFC_APDU_MAX_LE;
+        }
+    }
+
+    for(u8 i=0; i<NFC_APDU_MAX_ROUNDS; i++){
+        n = *rlen - off;
+        if(!in_chain(tg, tx, tlen, le, rapdu+off, &n) || n < 2){
+            return 0;
+        }
+        off += n;
+        if(rapdu[off-2] == 0x61){
+            /** drop SW, GET RESPONSE appends the remaining data */
+            getrsp[0] = capdu[0];
+            getrsp[1] = 0xC0;
+            getrsp[2] = 0x00;
+            getrsp[3] = 0x00;
+            getrsp[4] = rapdu[off-1];
+            if(!getrsp[4] || getrsp[4] > NFC_APDU_MAX_LE){
+                getrsp[4] = NFC_APDU_MAX_LE;
+            }
+            off -= 2;
+            tx = getrsp;
+            tlen = 5;
+            le = -1;
+            has_le = 1;
+        }else if(rapdu[off-2] == 0x6C && !resent){
+            /** wrong Le, resend the same command with Le = SW2 */
+            resent = 1;
+            le = rapdu[off-1];
+            if(!le || le > NFC_APDU_MAX_LE){
+                le = NFC_APDU_MAX_LE;
+            }
+            if(!has_le){
+                /**
+                    case 1 or 3, Le is appended: in_chain() sends it in
+                    place of the byte past the C-APDU, which is not read
+                */
+                tlen++;
+                has_le = 1;
+            }
+            off -= n;
+        }else{
+            *rlen = off;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Set the highest bit rate InListPassiveTarget() negotiates with
+        an ISO14443-4A target. NFC_PSL_OFF keeps 106Kbps.
+	@param  tg - logical number of the target, 1 or 2
+	@param  max_br - NFC_PSL_OFF, PN532_BRTY_212KBPS or PN532_BRTY_424KBPS
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Module::SetPSLPolicy(u8 tg, u8 max_br)
+{
+    if(tg == 1 || tg == 2){
+        psl_max[tg-1] = max_br;
+    }
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Choose bit rates from TA(1) of an ATS.
+	@param  ats - ATS, starting with TL
+	@param  max_br - highest bit rate allowed, PN532_BRTY_*KBPS
+	@param  brit - returns bit rate initiator to target (DR)
+	@param  brti - returns bit rate target to initiator (DS)
+	@return 0 - 106Kbps only, no PSL needed
+            1 - brit/brti are set, at least one is above 106Kbps
+*/
+/*****************************************************************************/
+u8 NFC_Module::ats_baud(const u8 *ats, u8 max_br, u8 *brit, u8 *brti)
+{
+    u8 ta, dr, ds;
+
+    /** TL T0 TA(1), TA(1) present if T0 bit 4 is set */
+    if(ats[0] < 3 || !(ats[1] & 0x10) || max_br == NFC_PSL_OFF){
+        return 0;
+    }
+    ta = ats[2];
+    dr = ta & 0x07;             // PCD to PICC: 212, 424, 848
+    ds = (ta >> 4) & 0x07;      // PICC to PCD: 212, 424, 848
+    if(ta & 0x80){
+        /** same divisor in both directions */
+        dr &= ds;
+        ds = dr;
+    }
+    /** PN532 goes up to 424Kbps */
+    dr &= (1 << max_br) - 1;
+    ds &= (1 << max_br) - 1;
+
+    *brit = (dr & 0x02) ? PN532_BRTY_424KBPS : (dr & 0x01);
+    *brti = (ds & 0x02) ? PN532_BRTY_424KBPS : (ds & 0x01);
+    return *brit || *brti;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  ISO14443B inventory.
+	@param  card - returns ATQB and ATTRIB_RES
+	@param  afi - application family identifier, 0x00 all families
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::InListTypeB(nfc_typeb_t *card, u8 afi)
+{
+    u8 buf[1+4];
+
+    if(!InListPassiveTarget(buf, PN532_BRTY_ISO14443B, 1, &afi, 1)){
+        return 0;
+    }
+    /** nfc_buf still holds the frame: Tg, ATQB(12), ATTRIB_RES length, ... */
+    memcpy(card->atqb, nfc_buf+9, 12);
+    card->attrib_len = nfc_buf[21];
+    if(card->attrib_len > sizeof(card->attrib)){
+        card->attrib_len = sizeof(card->attrib);
+    }
+    memcpy(card->attrib, nfc_buf+22, card->attrib_len);
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Jewel/Topaz inventory.
+	@param  card - returns SENS_RES and JEWELID
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::InListJewel(nfc_jewel_t *card)
+{
+    u8 buf[1+4];
+
+    if(!InListPassiveTarget(buf, PN532_BRTY_JEWEL)){
+        return 0;
+    }
+    card->sens_res[0] = nfc_buf[9];
+    card->sens_res[1] = nfc_buf[10];
+    memcpy(card->id, buf+1, 4);
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Send a Topaz command to the selected Jewel target.
+	@param  cmd - command, TOPAZ_CMD_*
+	@param  add - address byte
+	@param  data - data bytes, NULL - zeros
+	@param  dlen - data length, 1 or 8
+	@param  rbuf - returns the reply
+	@param  rlen - in: rbuf size; out: reply length
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::topaz_cmd(u8 cmd, u8 add, const u8 *data, u8 dlen,
+                         u8 *rbuf, u8 *rlen)
+{
+    u8 req[2+8+4];
+
+    /** CMD ADD DATA UID0..3, PN532 adds the CRC */
+    req[0] = cmd;
+    req[1] = add;
+    if(data){
+        memcpy(req+2, data, dlen);
+    }else{
+        memset(req+2, 0, dlen);
+    }
+    if(cmd == TOPAZ_CMD_RID){
+        /** RID is sent before the UID is known */
+        memset(req+2+dlen, 0, 4);
+    }else{
+        memcpy(req+2+dlen, jewel_id, 4);
+    }
+    return InDataExchange(0, 1, req, 2+dlen+4, rbuf, rlen) == 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Read HR0, HR1 and the 120 bytes of blocks 0..E of a Topaz tag.
+        When NFC_CMD_BUF_LEN is 132 or more this is one RALL. With the
+        default 64-byte frames the RALL reply does not fit, so it costs RID
+        plus one READ8 per block, 16 commands, on a Topaz 512, and RID plus
+        120 byte READs on a Topaz 96, which has no READ8. Blocks 10h and up
+        of a Topaz 512 are not read; RSEG would need 139-byte frames.
+	@param  buf - returns HR0 HR1 and 120 data bytes
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::TopazReadAll(u8 *buf)
+{
+    u8 rlen;
+
+#if NFC_RSP_DATA_MAX > TOPAZ_RALL_LEN
+    /** RALL: HR0 HR1 blocks 0..E, straight into buf */
+    rlen = TOPAZ_RALL_LEN;
+    return topaz_cmd(TOPAZ_CMD_RALL, 0x00, NULL, 1, buf, &rlen) &&
+           rlen == TOPAZ_RALL_LEN;
+#else
+    u8 i, j;
+
+    /** RID: HR0 HR1 UID0..3 */
+    rlen = 6;
+    if(!topaz_cmd(TOPAZ_CMD_RID, 0x00, NULL, 1, nfc_buf, &rlen) || rlen != 6){
+        return 0;
+    }
+    buf[0] = nfc_buf[0];
+    buf[1] = nfc_buf[1];
+
+    for(i=0; i<15; i++){
+        if((buf[0] & 0x0F) >= 0x02){
+            /** READ8: ADD8 + 8 bytes */
+            rlen = 9;
+            if(!topaz_cmd(TOPAZ_CMD_READ8, i, NULL, 8, nfc_buf, &rlen) ||
+               rlen != 9){
+                return 0;
+            }
+            memcpy(buf+2+8*i, nfc_buf+1, 8);
+            continue;
+        }
+        for(j=0; j<8; j++){
+            /** READ: ADD + 1 byte */
+            rlen = 2;
+            if(!topaz_cmd(TOPAZ_CMD_READ, (i<<3) | j, NULL, 1, nfc_buf,
+                          &rlen) || rlen != 2){
+                return 0;
+            }
+            buf[2+8*i+j] = nfc_buf[1];
+        }
+    }
+    return 1;
+#endif
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mifare funciton. Authentication a block for more operation.
+	@param  type - key type. 0-KEYA, 1-KEYB
+	@param  block - block to Authentication
+	@param  uuid - pointer to selected card's UUID
+	@param  uuid_len - UUID length
+	@param  key - pointer to key buffer.
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::MifareAuthentication(u8 type, u8 block,
+                                    u8 *uuid, u8 uuid_len, u8 *key)
+{
+    u8 i;
+    nfc_buf[0] = PN532_COMMAND_INDATAEXCHANGE;
+    nfc_buf[1] = 1; // logical number of the relevant target
+    nfc_buf[2] = MIFARE_CMD_AUTH_A+type;
+    nfc_buf[3] = block;
+
+    for(i=0; i<6; i++){
+        nfc_buf[4+i] = key[i];
+    }
+    for(i=0; i<uuid_len; i++){
+        nfc_buf[10+i] = uuid[i];
+    }
+
+    if(!write_cmd_check_ack( nfc_buf, (10+uuid_len) )){
+        return 0;
+    }
+
+    wait_ready();
+    read_dt(nfc_buf, 8);
+#if 0
+    if(nfc_buf[5] == 0xD5){
+        Serial.print("Authentication receive:");
+        puthex(nfc_buf, nfc_buf[3]+6);
+        Serial.println();
+    }
+#endif
+    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_INDATAEXCHANGE+1)){
+#ifdef PN532DEBUG
+        puthex(nfc_buf, 20);
+        Serial.println("Authentication fail.");
+#endif
+        return 0;
+    }
+    if(nfc_buf[NFC_FRAME_ID_INDEX+1]){
+        return 0;
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mifare funciton. Read a block.
+	@param  block - block to read
+	@param  buf - pointer to data buffer.
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::MifareReadBlock(u8 block, u8 *buf)
+{
+    nfc_buf[0] = PN532_COMMAND_INDATAEXCHANGE;
+    nfc_buf[1] = 1; // logical number of the relevant target
+    nfc_buf[2] = MIFARE_CMD_READ;
+    nfc_buf[3] = block;
+
+    if(!write_cmd_check_ack(nfc_buf, 4)){
+        return 0;
+    }
+    wait_ready();
+    read_dt(nfc_buf, 26);
+/**
+    if(nfc_buf[5] == 0xD5){
+        Serial.print("Block receive:");
+        puthex(nfc_buf, nfc_buf[3]+6);
+        Serial.println();
+    }
+*/
+    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_INDATAEXCHANGE+1)){
+#ifdef PN532DEBUG
+        puthex(nfc_buf, 20);
+        Serial.println("Authentication fail.");
+#endif
+        return 0;
+    }
+    if(nfc_buf[NFC_FRAME_ID_INDEX+1]){
+        return 0;
+    }
+
+    memcpy(buf, nfc_buf+8, 16);
+
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mifare funciton. Write to a block.
+	@param  block - block to write
+	@param  buf - pointer to data buffer.
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::MifareWriteBlock(u8 block, u8 *buf)
+{
+    nfc_buf[0] = PN532_COMMAND_INDATAEXCHANGE;
+    nfc_buf[1] = 1; // logical number of the relevant target
+    nfc_buf[2] = MIFARE_CMD_WRITE;
+    nfc_buf[3] = block;
+
+    memcpy(nfc_buf+4, buf, 16);
+
+    if(!write_cmd_check_ack(nfc_buf, 20)){
+        return 0;
+    }
+    wait_ready();
+    read_dt(nfc_buf, 26);
+    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_INDATAEXCHANGE+1)){
+#ifdef PN532DEBUG
+        puthex(nfc_buf, 20);
+        Serial.println("Authentication fail.");
+#endif
+        return 0;
+    }
+    if(nfc_buf[NFC_FRAME_ID_INDEX+1]){
+        return 0;
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  MifareAuthentication() as a step of CmdStep(), for a
+        protothread. The command is built in cmd when the engine is free,
+        and cmd identifies the caller.
+	@param  cmd - command buffer of the caller, NFC_STEP_CMD_LEN bytes
+	@param  type - key type. 0-KEYA, 1-KEYB
+	@param  block - block to authenticate
+	@param  uuid - selected card's UUID
+	@param  uuid_len - UUID length
+	@param  key - 6 bytes key
+	@param  ms - abort after ms, 0 - no timeout
+	@return NFC_CMD_BUSY - call again
+            NFC_CMD_DONE - authenticated
+            NFC_CMD_FAILED - failed or timed out
+*/
+/*****************************************************************************/
+u8 NFC_Module::StepMifareAuth(u8 *cmd, u8 type, u8 block, const u8 *uuid,
+                              u8 uuid_len, const u8 *key, u16 ms)
+{
+    if(uuid_len > NFC_STEP_CMD_LEN-10){
+        return NFC_CMD_FAILED;
+    }
+    if(!cmd_rlen){
+        cmd[0] = PN532_COMMAND_INDATAEXCHANGE;
+        cmd[1] = 1; // logical number of the relevant target
+        cmd[2] = MIFARE_CMD_AUTH_A+type;
+        cmd[3] = block;
+        memcpy(cmd+4, key, 6);
+        memcpy(cmd+10, uuid, uuid_len);
+    }
+    return step_exchange(cmd, 10+uuid_len, 10, ms);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  MifareReadBlock() as a step of CmdStep(), see StepMifareAuth().
+	@param  cmd - command buffer of the caller, NFC_STEP_CMD_LEN bytes
+	@param  block - block to read
+	@param  buf - 16 bytes, filled when done
+	@param  ms - abort after ms, 0 - no timeout
+	@return NFC_CMD_BUSY - call again
+            NFC_CMD_DONE - block read into buf
+            NFC_CMD_FAILED - failed or timed out
+*/
+/*****************************************************************************/
+u8 NFC_Module::StepMifareRead(u8 *cmd, u8 block, u8 *buf, u16 ms)
+{
+    u8 ret;
+
+    if(!cmd_rlen){
+        cmd[0] = PN532_COMMAND_INDATAEXCHANGE;
+        cmd[1] = 1; // logical number of the relevant target
+        cmd[2] = MIFARE_CMD_READ;
+        cmd[3] = block;
+    }
+    /** 8 bytes header and status, 16 data, DCS and postamble */
+    ret = step_exchange(cmd, 4, 26, ms);
+    if(ret != NFC_CMD_DONE){
+        return ret;
+    }
+    if(nfc_buf[3] != 3+16){
+        return NFC_CMD_FAILED;
+    }
+    memcpy(buf, nfc_buf+8, 16);
+    return NFC_CMD_DONE;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  MifareWriteBlock() as a step of CmdStep(), see StepMifareAuth().
+	@param  cmd - command buffer of the caller, NFC_STEP_CMD_LEN bytes
+	@param  block - block to write
+	@param  buf - 16 bytes, copied into cmd when the command starts
+	@param  ms - abort after ms, 0 - no timeout
+	@return NFC_CMD_BUSY - call again
+            NFC_CMD_DONE - block written
+            NFC_CMD_FAILED - failed or timed out
+*/
+/*****************************************************************************/
+u8 NFC_Module::StepMifareWrite(u8 *cmd, u8 block, const u8 *buf, u16 ms)
+{
+    if(!cmd_rlen){
+        cmd[0] = PN532_COMMAND_INDATAEXCHANGE;
+        cmd[1] = 1; // logical number of the relevant target
+        cmd[2] = MIFARE_CMD_WRITE;
+        cmd[3] = block;
+        memcpy(cmd+4, buf, 16);
+    }
+    return step_exchange(cmd, 20, 10, ms);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mifare Classic sector of a block, 1K and 4K layout.
+*/
+/*****************************************************************************/
+static u8 mf_sector(u8 block)
+{
+    return (block < 128) ? block/4 : 32+(block-128)/16;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Whether the block is a sector trailer (keys and access bits).
+*/
+/*****************************************************************************/
+static u8 mf_is_trailer(u8 block)
+{
+    return (block < 128) ? (block%4 == 3) : ((block-128)%16 == 15);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mifare WRITE of one block through in_exchange(), the data is
+        sent from the caller's buffer.
+	@param  block - block to write
+	@param  data - 16 bytes
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::mifare_write(u8 block, const u8 *data)
+{
+    nfc_seg_t seg[2];
+    u8 cmd[2], rlen = 0;
+
+    cmd[0] = MIFARE_CMD_WRITE;
+    cmd[1] = block;
+    seg[0].buf = cmd;
+    seg[0].len = 2;
+    seg[0].pgm = 0;
+    seg[1].buf = data;
+    seg[1].len = 16;
+    seg[1].pgm = 0;
+    return in_exchange(0, 1, seg, 2, NULL, &rlen) == 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mifare funciton. Write several blocks as one transaction. The
+        list is sorted by block in place, each sector is authenticated once
+        and written in order, then optionally read back before moving on.
+        Sector trailers and the manufacturer block 0 are refused unless
+        NFC_MF_ALLOW_TRAILER is set.
+	@param  wr - blocks to write, reordered by block number
+	@param  num - number of blocks
+	@param  type - key type. 0-KEYA, 1-KEYB
+	@param  key - key for all sectors
+	@param  uuid - pointer to selected card's UUID
+	@param  uuid_len - UUID length
+	@param  flags - NFC_MF_VERIFY, NFC_MF_ALLOW_TRAILER
+	@return 0 - failed, nothing written if a block was refused
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::MifareWriteBlocks(nfc_mf_write_t *wr, u8 num, u8 type,
+                                 u8 *key, u8 *uuid, u8 uuid_len, u8 flags)
+{
+    nfc_mf_write_t t;
+    u8 i, j, first, sector, rd[2], buf[16], rlen;
+
+    for(i=1; i<num; i++){
+        t = wr[i];
+        for(j=i; j>0 && wr[j-1].block > t.block; j--){
+            wr[j] = wr[j-1];
+        }
+        wr[j] = t;
+    }
+    if(!(flags & NFC_MF_ALLOW_TRAILER)){
+        for(i=0; i<num; i++){
+            if(wr[i].block == 0 || mf_is_trailer(wr[i].block)){
+                return 0;
+            }
+        }
+    }
+
+    for(first=0; first<num; first=i){
+        sector = mf_sector(wr[first].block);
+        if(!MifareAuthentication(type, wr[first].block, uuid, uuid_len, key)){
+            return 0;
+        }
+        for(i=first; i<num && mf_sector(wr[i].block) == sector; i++){
+            if(!mifare_write(wr[i].block, wr[i].data)){
+                return 0;
+            }
+        }
+        if(!(flags & NFC_MF_VERIFY)){
+            continue;
+        }
+        /** a READ returns one block, so only the written blocks are read */
+        for(j=first; j<i; j++){
+            rd[0] = MIFARE_CMD_READ;
+            rd[1] = wr[j].block;
+            rlen = 16;
+            if(InDataExchange(0, 1, rd, 2, buf, &rlen) != 1 || rlen != 16 ||
+               memcmp(buf, wr[j].data, 16)){
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Keep a card image cache in step with a write to the card: a
+        cached block gets the written bytes, a failed write drops the image
+        since the block on the card is unknown.
+	@param  cache - card image cache, NULL - none
+	@param  uid - pointer to UID
+	@param  uid_len - UID length
+	@param  blk - cache block, 16 bytes
+	@param  off - offset of the written bytes in the block
+	@param  data - written bytes, NULL - write failed
+	@param  len - number of written bytes
+	@return NONE
+*/
+/*****************************************************************************/
+static void cache_write(NFC_CardCache *cache, const u8 *uid, u8 uid_len,
+                        u8 blk, u8 off, const u8 *data, u8 len)
+{
+    nfc_card_hdr_t *e;
+    u8 *p;
+
+    if(!cache || !uid_len || !(e = cache->find(uid, uid_len))){
+        return;
+    }
+    if(!data){
+        cache->invalidate(e);
+        return;
+    }
+    p = cache->block(e, blk);
+    if(p && cache->valid(e, blk)){
+        memcpy(p+off, data, len);
+    }
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mifare funciton. Bring a range of blocks to a new image, writing
+        only the blocks that differ. Sectors without changes are not even
+        authenticated. Sector trailers and block 0 in the range are refused
+        unless NFC_MF_ALLOW_TRAILER is set, a range past block 255 always.
+        Blocks held by cache are updated with what is written.
+	@param  first - first block
+	@param  num - number of blocks
+	@param  image - num*16 bytes wanted
+	@param  current - num*16 bytes on the card, e.g. from MifareReadCached();
+                      NULL - each block is read before it is compared
+	@param  type - key type. 0-KEYA, 1-KEYB
+	@param  key - key for all sectors
+	@param  uuid - pointer to selected card's UUID
+	@param  uuid_len - UUID length
+	@param  flags - NFC_MF_VERIFY, NFC_MF_ALLOW_TRAILER
+	@param  cache - optional, card image cache of MifareReadCached()
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::MifareWriteDiff(u8 first, u8 num, const u8 *image,
+                               const u8 *current, u8 type, u8 *key,
+                               u8 *uuid, u8 uuid_len, u8 flags,
+                               NFC_CardCache *cache)
+{
+    u8 i, blk, sector = 0xFF, buf[16];
+
+    /** block numbers are u8, past block 255 the range would wrap to 0 */
+    if(first+num > 0x100){
+        return 0;
+    }
+    if(!(flags & NFC_MF_ALLOW_TRAILER)){
+        for(i=0; i<num; i++){
+            if(first+i == 0 || mf_is_trailer(first+i)){
+                return 0;
+            }
+        }
+    }
+
+    for(i=0; i<num; i++, image+=16){
+        blk = first+i;
+        if(current && !memcmp(image, current+16*i, 16)){
+            continue;
+        }
+        if(mf_sector(blk) != sector){
+            sector = mf_sector(blk);
+            if(!MifareAuthentication(type, blk, uuid, uuid_len, key)){
+                return 0;
+            }
+        }
+        if(!current){
+            if(!MifareReadBlock(blk, buf)){
+                return 0;
+            }
+            if(!memcmp(image, buf, 16)){
+                continue;
+            }
+        }
+        if(!mifare_write(blk, image)){
+            cache_write(cache, uuid, uuid_len, blk, 0, NULL, 0);
+            return 0;
+        }
+        if(flags & NFC_MF_VERIFY){
+            if(!MifareReadBlock(blk, buf) || memcmp(image, buf, 16)){
+                cache_write(cache, uuid, uuid_len, blk, 0, NULL, 0);
+                return 0;
+            }
+        }
+        cache_write(cache, uuid, uuid_len, blk, 0, image, 16);
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  NTAG funciton. Bring a range of pages to a new image, writing
+        only the pages that differ. Writes to UID, lock, OTP and CC pages
+        (0..3) and to the dynamic lock and configuration pages behind the
+        user memory can not be undone, so the range must be user memory
+        unless NFC_NTAG_ALLOW_CONFIG is set, a range past page 255 always.
+        Ranges past page 39, the end of the smallest NTAG21x, cost a
+        GET_VERSION to find the user memory before anything is written.
+        Blocks held by cache are updated with what is written.
+	@param  page - first page
+	@param  num - number of pages
+	@param  image - num*4 bytes wanted
+	@param  current - num*4 bytes on the tag; NULL - read 4 pages at a
+                      time before comparing
+	@param  flags - NFC_NTAG_ALLOW_CONFIG
+	@param  cache - optional, card image cache of NtagReadCached()
+	@param  uid - UID of the tag in cache
+	@param  uid_len - UID length
+	@return 0 - failed, or the range is not user memory
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::NtagWriteDiff(u8 page, u8 num, const u8 *image,
+                             const u8 *current, u8 flags,
+                             NFC_CardCache *cache, const u8 *uid, u8 uid_len)
+{
+    u8 i, cmd[6], buf[16], rlen, base = 0, have = 0;
+    const u8 *cur;
+
+    /** page numbers are u8, past page 255 the range would wrap to 0 */
+    if(page+num > 0x100){
+        return 0;
+    }
+    if(!(flags & NFC_NTAG_ALLOW_CONFIG)){
+        if(page < NTAG_USER_FIRST ||
+           (page+num > 40 && page+num > ntag_user_end())){
+            return 0;
+        }
+    }
+
+    for(i=0; i<num; i++, image+=4){
+        if(current){
+            cur = current+4*i;
+        }else{
+            /** one READ returns 4 pages */
+            if(!have || page+i >= base+4){
+                base = page+i;
+                cmd[0] = MIFARE_CMD_READ;
+                cmd[1] = base;
+                rlen = 16;
+                if(InDataExchange(0, 1, cmd, 2, buf, &rlen) != 1 ||
+                   rlen != 16){
+                    return 0;
+                }
+                have = 1;
+            }
+            cur = buf+4*(page+i-base);
+        }
+        if(!memcmp(image, cur, 4)){
+            continue;
+        }
+        cmd[0] = NTAG_CMD_WRITE;
+        cmd[1] = page+i;
+        memcpy(cmd+2, image, 4);
+        rlen = 0;
+        if(InDataExchange(0, 1, cmd, 6, NULL, &rlen) != 1){
+            cache_write(cache, uid, uid_len, 0, 0, NULL, 0);
+            return 0;
+        }
+        /** cache block n holds pages 4n..4n+3 */
+        cache_write(cache, uid, uid_len, (page+i)/4, 4*((page+i)%4), image, 4);
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  End of the NTAG21x user memory, from GET_VERSION.
+	@param  NONE
+	@return first page after the user memory, 0 - unknown tag
+*/
+/*****************************************************************************/
+u8 NFC_Module::ntag_user_end(void)
+{
+    u8 cmd[1], ver[8], rlen = 8;
+
+    cmd[0] = NTAG_CMD_GET_VERSION;
+    if(InDataExchange(0, 1, cmd, 1, ver, &rlen) != 1 || rlen != 8){
+        return 0;
+    }
+    switch(ver[NTAG_VERSION_SIZE_INDEX]){
+        case 0x0F:
+            return 40;      // NTAG213, 144 bytes
+        case 0x11:
+            return 130;     // NTAG215, 504 bytes
+        case 0x13:
+            return 226;     // NTAG216, 888 bytes
+        default:
+            return 0;
+    }
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mifare funciton. Encode a value block: value, ~value, value,
+        addr, ~addr, addr, ~addr.
+	@param  value - signed value
+	@param  addr - address byte, usually the block number
+	@param  block - returns the 16 bytes block
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Module::MifareValueEncode(s32 value, u8 addr, u8 *block)
+{
+    for(u8 i=0; i<4; i++){
+        block[i] = (u32)value >> (8*i);
+        block[4+i] = ~block[i];
+        block[8+i] = block[i];
+    }
+    block[12] = addr;
+    block[13] = ~addr;
+    block[14] = addr;
+    block[15] = ~addr;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mifare funciton. Decode and validate a value block.
+	@param  block - 16 bytes block
+	@param  value - returns the value
+	@param  addr - optional, returns the address byte
+	@return 0 - not a valid value block
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::MifareValueDecode(const u8 *block, s32 *value, u8 *addr)
+{
+    u32 v = 0;
+
+    for(u8 i=0; i<4; i++){
+        if(block[i] != block[8+i] || (u8)~block[i] != block[4+i]){
+            return 0;
+        }
+        v |= (u32)block[i] << (8*i);
+    }
+    if(block[12] != block[14] || block[13] != block[15] ||
+       (u8)~block[12] != block[13]){
+        return 0;
+    }
+    *value = (s32)v;
+    if(addr){
+        *addr = block[12];
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mifare funciton. Format a block as value block.
+	@param  block - block to write
+	@param  value - initial value
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::MifareValueWrite(u8 block, s32 value)
+{
+    u8 buf[16];
+
+    MifareValueEncode(value, block, buf);
+    return MifareWriteBlock(block, buf);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mifare funciton. Read a value block.
+	@param  block - block to read
+	@param  value - returns the value
+	@return 0 - failed, or not a valid value block
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::MifareValueRead(u8 block, s32 *value)
+{
+    u8 buf[16];
+
+    if(!MifareReadBlock(block, buf)){
+        return 0;
+    }
+    return MifareValueDecode(buf, value, NULL);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mifare value operation followed at once by TRANSFER. The card
+        only commits its internal register on TRANSFER, so the stored value
+        is never half written.
+	@param  cmd - MIFARE_CMD_DECREMENT, MIFARE_CMD_INCREMENT or
+                  MIFARE_CMD_RESTORE
+	@param  block - source value block
+	@param  operand - amount, 0 for RESTORE
+	@param  dst - block the result is transferred to
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::mifare_value_op(u8 cmd, u8 block, u32 operand, u8 dst)
+{
+    u8 req[6], rlen;
+
+    req[0] = cmd;
+    req[1] = block;
+    for(u8 i=0; i<4; i++){
+        req[2+i] = operand >> (8*i);
+    }
+    rlen = 0;
+    if(InDataExchange(0, 1, req, 6, NULL, &rlen) != 1){
+        return 0;
+    }
+
+    req[0] = MIFARE_CMD_TRANSFER;
+    req[1] = dst;
+    rlen = 0;
+    return InDataExchange(0, 1, req, 2, NULL, &rlen) == 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mifare funciton. Decrement a value block.
+	@param  block - value block
+	@param  amount - amount to subtract
+	@param  dst - block to store the result, 0xFF - same block
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::ValueDebit(u8 block, u32 amount, u8 dst)
+{
+    return mifare_value_op(MIFARE_CMD_DECREMENT, block, amount,
+                           dst == 0xFF ? block : dst);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mifare funciton. Increment a value block.
+	@param  block - value block
+	@param  amount - amount to add
+	@param  dst - block to store the result, 0xFF - same block
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::ValueCredit(u8 block, u32 amount, u8 dst)
+{
+    return mifare_value_op(MIFARE_CMD_INCREMENT, block, amount,
+                           dst == 0xFF ? block : dst);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mifare funciton. Copy a value block to another block of the
+        same sector, e.g. a backup, with RESTORE and TRANSFER.
+	@param  src - source value block
+	@param  dst - destination block
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::ValueCopy(u8 src, u8 dst)
+{
+    return mifare_value_op(MIFARE_CMD_RESTORE, src, 0, dst);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Reduce a change marker to the 4 bytes kept by the card cache:
+        up to 4 bytes are kept as they are, longer markers as their CRC-32,
+        so any change of a single marker block is seen.
+*/
+/*****************************************************************************/
+static void card_marker(const u8 *data, u8 len, u8 *marker)
+{
+    u32 crc = 0xFFFFFFFF;
+
+    memset(marker, 0, 4);
+    if(len <= 4){
+        memcpy(marker, data, len);
+        return;
+    }
+    for(u8 i=0; i<len; i++){
+        crc ^= data[i];
+        for(u8 j=0; j<8; j++){
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320UL : 0);
+        }
+    }
+    crc = ~crc;
+    marker[0] = crc;
+    marker[1] = crc >> 8;
+    marker[2] = crc >> 16;
+    marker[3] = crc >> 24;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mifare funciton. Read blocks through a card image cache. The
+        marker block, e.g. a counter the issuer bumps on every update, is
+        always read; when it is unchanged only blocks missing from the image
+        are read, each sector being authenticated once.
+	@param  cache - card image cache
+	@param  uuid - pointer to selected card's UUID
+	@param  uuid_len - UUID length
+	@param  type - key type. 0-KEYA, 1-KEYB
+	@param  key - key for all sectors
+	@param  marker - change marker block
+	@param  first - first block to read
+	@param  num - number of blocks
+	@param  buf - returns num*16 bytes
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::MifareReadCached(NFC_CardCache &cache, u8 *uuid, u8 uuid_len,
+                                u8 type, u8 *key, u8 marker, u8 first, u8 num,
+                                u8 *buf)
+{
+    nfc_card_hdr_t *e;
+    u8 mk[4], blk[16], *p, i, sector;
+
+    if(!MifareAuthentication(type, marker, uuid, uuid_len, key) ||
+       !MifareReadBlock(marker, blk)){
+        return 0;
+    }
+    sector = mf_sector(marker);
+    card_marker(blk, 16, mk);
+
+    e = cache.find(uuid, uuid_len);
+    if(!e){
+        e = cache.add(uuid, uuid_len);
+    }else if(memcmp(e->marker, mk, 4)){
+        cache.invalidate(e);
+    }
+    if(e){
+        memcpy(e->marker, mk, 4);
+    }
+    p = cache.block(e, marker);
+    if(p){
+        memcpy(p, blk, 16);
+        cache.set_valid(e, marker);
+    }
+
+    for(i=0; i<num; i++, buf+=16){
+        p = cache.block(e, first+i);
+        if(p && cache.valid(e, first+i)){
+            memcpy(buf, p, 16);
+            cache.count(1);
+            continue;
+        }
+        if(mf_sector(first+i) != sector){
+            sector = mf_sector(first+i);
+            if(!MifareAuthentication(type, first+i, uuid, uuid_len, key)){
+                return 0;
+            }
+        }
+        if(!MifareReadBlock(first+i, buf)){
+            return 0;
+        }
+        cache.count(0);
+        if(p){
+            memcpy(p, buf, 16);
+            cache.set_valid(e, first+i);
+        }
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  NTAG funciton. Read 4-page blocks through a card image cache,
+        the NFC counter from READ_CNT is the change marker. Reading the tag
+        bumps the counter, so it is read again after cache misses.
+	@param  cache - card image cache
+	@param  uid - 7 bytes UID
+	@param  uid_len - UID length
+	@param  first - first block, pages 4*first..4*first+3
+	@param  num - number of blocks
+	@param  buf - returns num*16 bytes
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::NtagReadCached(NFC_CardCache &cache, const u8 *uid,
+                              u8 uid_len, u8 first, u8 num, u8 *buf)
+{
+    nfc_card_hdr_t *e;
+    u8 mk[4], cmd[2], *p, i, rlen, missed = 0;
+
+    if(!ntag_read_cnt(mk)){
+        return 0;
+    }
+    e = cache.find(uid, uid_len);
+    if(!e){
+        e = cache.add(uid, uid_len);
+    }else if(memcmp(e->marker, mk, 4)){
+        cache.invalidate(e);
+    }
+
+    for(i=0; i<num; i++, buf+=16){
+        p = cache.block(e, first+i);
+        if(p && cache.valid(e, first+i)){
+            memcpy(buf, p, 16);
+            cache.count(1);
+            continue;
+        }
+        cmd[0] = MIFARE_CMD_READ;
+        cmd[1] = 4*(first+i);
+        rlen = 16;
+        if(InDataExchange(0, 1, cmd, 2, buf, &rlen) != 1 || rlen != 16){
+            return 0;
+        }
+        cache.count(0);
+        missed = 1;
+        if(p){
+            memcpy(p, buf, 16);
+            cache.set_valid(e, first+i);
+        }
+    }
+    if(!e){
+        return 1;
+    }
+    if(missed && !ntag_read_cnt(mk)){
+        /** unknown marker, do not trust the image next time */
+        cache.invalidate(e);
+        return 1;
+    }
+    memcpy(e->marker, mk, 4);
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Read the NTAG NFC counter as a cache marker.
+	@param  marker - returns 4 bytes
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::ntag_read_cnt(u8 *marker)
+{
+    u8 cmd[2], cnt[3], rlen = 3;
+
+    cmd[0] = NTAG_CMD_READ_CNT;
+    cmd[1] = NTAG_NFC_COUNTER;
+    if(InDataExchange(0, 1, cmd, 2, cnt, &rlen) != 1 || rlen != 3){
+        return 0;
+    }
+    card_marker(cnt, 3, marker);
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Card image cache constructor.
+	@param  mem - buffer holding the cache, its size is the RAM budget
+	@param  size - buffer size
+	@param  blocks - 16 bytes blocks kept per card, starting at block 0
+*/
+/*****************************************************************************/
+NFC_CardCache::NFC_CardCache(u8 *mem, u16 size, u8 blocks)
+{
+    this->mem = mem;
+    nblk = blocks;
+    esize = sizeof(nfc_card_hdr_t) + (blocks+7)/8 + 16*(u16)blocks;
+    num = (size/esize > 255) ? 255 : size/esize;
+    clear();
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Forget all cards.
+	@param  NONE
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_CardCache::clear(void)
+{
+    for(u8 i=0; i<num; i++){
+        entry(i)->uid_len = 0;
+        entry(i)->age = 0xFF;
+    }
+    hit = 0;
+    miss = 0;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Address of a cache entry.
+*/
+/*****************************************************************************/
+nfc_card_hdr_t *NFC_CardCache::entry(u8 i)
+{
+    return (nfc_card_hdr_t *)(mem + (u16)i*esize);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Make an entry the most recently used one.
+*/
+/*****************************************************************************/
+void NFC_CardCache::touch(nfc_card_hdr_t *e)
+{
+    nfc_card_hdr_t *o;
+
+    for(u8 i=0; i<num; i++){
+        o = entry(i);
+        if(o != e && o->uid_len && o->age < e->age){
+            o->age++;
+        }
+    }
+    e->age = 0;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Look up a card, a hit makes it the most recently used.
+	@param  uid - pointer to UID
+	@param  uid_len - UID length
+	@return entry, NULL if the card is not cached
+*/
+/*****************************************************************************/
+nfc_card_hdr_t *NFC_CardCache::find(const u8 *uid, u8 uid_len)
+{
+    nfc_card_hdr_t *e;
+
+    for(u8 i=0; i<num; i++){
+        e = entry(i);
+        if(e->uid_len == uid_len && !memcmp(e->uid, uid, uid_len)){
+            touch(e);
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Add a card with an empty image, evicting the least recently
+        used card if there is no free entry.
+	@param  uid - pointer to UID
+	@param  uid_len - UID length
+	@return entry, NULL if the buffer holds no card at all
+*/
+/*****************************************************************************/
+nfc_card_hdr_t *NFC_CardCache::add(const u8 *uid, u8 uid_len)
+{
+    nfc_card_hdr_t *e = NULL, *o;
+
+    for(u8 i=0; i<num; i++){
+        o = entry(i);
+        if(!o->uid_len){
+            e = o;
+            break;
+        }
+        if(!e || o->age > e->age){
+            e = o;
+        }
+    }
+    if(!e){
+        return NULL;
+    }
+    if(uid_len > NFC_UID_MAX_LEN){
+        uid_len = NFC_UID_MAX_LEN;
+    }
+    memcpy(e->uid, uid, uid_len);
+    e->uid_len = uid_len;
+    e->age = 0xFF;
+    memset(e->marker, 0, 4);
+    invalidate(e);
+    touch(e);
+    return e;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Block storage of a card.
+	@param  e - entry, may be NULL
+	@param  blk - block number
+	@return 16 bytes, NULL if the block is not kept
+*/
+/*****************************************************************************/
+u8 *NFC_CardCache::block(nfc_card_hdr_t *e, u8 blk)
+{
+    if(!e || blk >= nblk){
+        return NULL;
+    }
+    return (u8 *)(e+1) + (nblk+7)/8 + 16*(u16)blk;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Whether a block of the image has been read.
+*/
+/*****************************************************************************/
+u8 NFC_CardCache::valid(nfc_card_hdr_t *e, u8 blk)
+{
+    return (((u8 *)(e+1))[blk/8] >> (blk%8)) & 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Mark a block of the image as read.
+*/
+/*****************************************************************************/
+void NFC_CardCache::set_valid(nfc_card_hdr_t *e, u8 blk)
+{
+    ((u8 *)(e+1))[blk/8] |= 1 << (blk%8);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Drop the image of a card, keeping the entry.
+*/
+/*****************************************************************************/
+void NFC_CardCache::invalidate(nfc_card_hdr_t *e)
+{
+    memset(e+1, 0, (nblk+7)/8);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Count a block served from the cache or read from the card.
+*/
+/*****************************************************************************/
+void NFC_CardCache::count(u8 is_hit)
+{
+    if(is_hit){
+        hit++;
+    }else{
+        miss++;
+    }
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Blocks served from the cache and read from cards since clear().
+	@param  hit - returns cache hits
+	@param  miss - returns blocks read
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_CardCache::stats(u16 *hit, u16 *miss)
+{
+    *hit = this->hit;
+    *miss = this->miss;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Keep the cache across resets, EEPROM cells are only written
+        where they differ.
+	@param  ee_addr - EEPROM address, the whole buffer is stored
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_CardCache::save(u16 ee_addr)
+{
+    eeprom_update_block(mem, (void *)(uintptr_t)ee_addr, (u16)num*esize);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Restore a cache stored by save() with the same size and blocks.
+	@param  ee_addr - EEPROM address
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_CardCache::load(u16 ee_addr)
+{
+    eeprom_read_block(mem, (const void *)(uintptr_t)ee_addr, (u16)num*esize);
+}
+
+#endif /** NFC_USE_ISO14443 */
@@ -0,0 +1,599 @@
+/*****************************************************************************/
+/*!
+    @file     nfc_p2p.cpp
+    @author   www.elechouse.com
+	@brief      NFC Module I2C library, Peer to Peer communication.
+	Built when NFC_USE_P2P is set in nfc_config.h.
+
+    Copyright (c) 2012 www.elechouse.com  All right reserved.
+*/
+/*****************************************************************************/
+
+#include "nfc.h"
+
+#if NFC_USE_P2P
+
+const u8 tg_init_default[34] PROGMEM = { TG_INIT_DEFAULT(0x40) };
+
+/** P2PTargetInit() default: DEP, SEL_RES 0x40, no general/historical bytes */
+const u8 frame_tg_init_dep[] PROGMEM =
+    NFC_FRAME(PN532_COMMAND_TGINITASTARGET, 0x00, TG_INIT_DEFAULT(0x40), 0, 0);
+
+/*****************************************************************************/
+/*!
+	@brief  Configure PN532 as Initiator, with the session configuration
+        of P2PConfig().
+	@param  NONE
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::P2PInitiatorInit()
+{
+    const nfc_p2p_cfg_t *cfg = p2p_cfg;
+    u8 len, cmd = PN532_COMMAND_INJUMPFORDEP;
+
+    if(cfg && cfg->psl_baud != NFC_P2P_NO_PSL){
+        /** activate at cfg->baud, P2PInitiatorPSL() switches speed */
+        cmd = PN532_COMMAND_INJUMPFORPSL;
+    }
+    nfc_buf[0] = cmd;
+    nfc_buf[1] = cfg ? cfg->mode : NFC_P2P_ACTIVE;
+    nfc_buf[2] = cfg ? cfg->baud : NFC_P2P_424K;
+    nfc_buf[3] = 0x00;  // Next: PassiveInitiatorData, NFCID3i, Gi
+    len = 4;
+
+    if(nfc_buf[2] != NFC_P2P_106K){
+        /** FeliCa polling request, system code FFFF */
+        nfc_buf[3] |= 0x01;
+        nfc_buf[len++] = 0x00;
+        nfc_buf[len++] = 0xFF;
+        nfc_buf[len++] = 0xFF;
+        nfc_buf[len++] = 0x00;
+        nfc_buf[len++] = 0x00;
+    }
+    if(cfg && cfg->nfcid3){
+        nfc_buf[3] |= 0x02;
+        memcpy(nfc_buf+len, cfg->nfcid3, 10);
+        len += 10;
+    }
+    if(cfg && cfg->gb_len){
+        if(len+cfg->gb_len > NFC_CMD_BUF_LEN-8){
+            return 0;
+        }
+        nfc_buf[3] |= 0x04;
+        memcpy(nfc_buf+len, cfg->gb, cfg->gb_len);
+        len += cfg->gb_len;
+    }
+
+    /** avoid resend command while PN532 still looks for a target */
+    if(!dep_sent){
+        if(!write_cmd_check_ack(nfc_buf, len)){
+#ifdef PN532_P2P_DEBUG
+            Serial.println("InJumpForDEP sent fialed\n");
+#endif
+            return 0;
+        }
+        dep_sent = 1;
+#ifdef PN532_P2P_DEBUG
+        Serial.println("InJumpForDEP sent ******\n");
+#endif
+    }
+    if(wait_ready(10) != PN532_I2C_READY){
+        /** no target yet, the next call reads the reply */
+        return 0;
+    }
+    read_dt(nfc_buf, NFC_CMD_BUF_LEN-2);
+    /** the reply is read, whatever it says the next call sends again */
+    dep_sent = 0;
+
+    if(nfc_buf[5] != 0xD5){
+//        Serial.println("InJumpForDEP sent read failed");
+        return 0;
+    }
+
+    if(nfc_buf[NFC_FRAME_ID_INDEX] != (cmd+1)){
+#ifdef PN532_P2P_DEBUG
+        puthex(nfc_buf, nfc_buf[3]+7);
+        Serial.println("Initiator init failed");
+#endif
+        return 0;
+    }
+    if(nfc_buf[NFC_FRAME_ID_INDEX+1]){
+        return 0;
+    }
+
+#ifdef PN532_P2P_DEBUG
+    Serial.println("InJumpForDEP read success");
+#endif
+    if(cmd == PN532_COMMAND_INJUMPFORPSL){
+        return P2PInitiatorPSL(cfg->psl_baud);
+    }
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Configure PN532 as Target, with the session configuration of
+        P2PConfig().
+	@param  NONE.
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::P2PTargetInit()
+{
+    u8 mode = 0x00, len;
+
+    if(p2p_cfg){
+        mode = PN532_TG_DEP_ONLY;
+        if(p2p_cfg->mode == NFC_P2P_PASSIVE){
+            mode |= PN532_TG_PASSIVE_ONLY;
+        }
+    }
+
+    /** avoid resend command while waiting for an initiator */
+    if(tg_state != NFC_STA_TAG){
+        /** SEL_RES 0x40, DEP only mode */
+        if(!p2p_cfg){
+            if(!write_frame_check_ack(frame_tg_init_dep)){
+                return 0;
+            }
+        }else{
+            len = tg_init_frame(mode, 0x40, p2p_cfg);
+            if(!len || !write_cmd_check_ack(nfc_buf, len)){
+                return 0;
+            }
+        }
+        tg_state = NFC_STA_TAG;
+#ifdef PN532_P2P_DEBUG
+        Serial.println("Target init sent.");
+#endif
+    }
+
+    if(wait_ready(10) != PN532_I2C_READY){
+        return 0;
+    }
+    read_dt(nfc_buf, NFC_CMD_BUF_LEN-2);
+
+    if(nfc_buf[5] != 0xD5){
+        return 0;
+    }
+
+    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_TGINITASTARGET+1)){
+#ifdef PN532_P2P_DEBUG
+        puthex(nfc_buf, nfc_buf[3]+7);
+        Serial.println("Target init fail.");
+#endif
+        tg_state = NFC_STA_IDLE;
+        return 0;
+    }
+
+    tg_state = NFC_STA_IDLE;
+#ifdef PN532_P2P_DEBUG
+    Serial.println("TgInitAsTarget read success");
+#endif
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Set P2P session configuration used by P2PInitiatorInit() and
+        P2PTargetInit().
+	@param  cfg - pointer to configuration, it must stay valid while used.
+                  NULL restores defaults: active mode, 424Kbps, no general
+                  bytes.
+	@return NONE
+*/
+/*****************************************************************************/
+void NFC_Module::P2PConfig(const nfc_p2p_cfg_t *cfg)
+{
+    p2p_cfg = cfg;
+    dep_sent = 0;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Initiator switches bit rate of the activated target with PSL.
+	@param  baud - NFC_P2P_106K, NFC_P2P_212K or NFC_P2P_424K
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::P2PInitiatorPSL(u8 baud)
+{
+    return in_psl(0x01, baud, baud);
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Build TgInitAsTarget command in nfc_buf.
+	@param  mode - PN532_TG_* flags
+	@param  sel_res - SEL_RES of the emulated ISO14443A target
+	@param  cfg - NFCID1, NFCID3t and general bytes, NULL - defaults
+	@return command length, 0 - general bytes too long
+*/
+/*****************************************************************************/
+u8 NFC_Module::tg_init_frame(u8 mode, u8 sel_res, const nfc_p2p_cfg_t *cfg)
+{
+    u8 len;
+
+    nfc_buf[0] = PN532_COMMAND_TGINITASTARGET;
+    nfc_buf[1] = mode;
+    /** SENS_RES, NFCID1, FeliCa POL_RES parameters, NFCID3t */
+    memcpy_P(nfc_buf+2, tg_init_default, sizeof(tg_init_default));
+    nfc_buf[7] = sel_res;
+    if(cfg && cfg->nfcid1){
+        memcpy(nfc_buf+4, cfg->nfcid1, 3);
+    }
+    if(cfg && cfg->nfcid3){
+        memcpy(nfc_buf+26, cfg->nfcid3, 10);
+    }
+
+    len = 36;
+    /** Length of general bytes  */
+    nfc_buf[len++] = 0;
+    if(cfg && cfg->gb_len){
+        if(len+cfg->gb_len+1 > NFC_CMD_BUF_LEN-8){
+            return 0;
+        }
+        nfc_buf[len-1] = cfg->gb_len;
+        memcpy(nfc_buf+len, cfg->gb, cfg->gb_len);
+        len += cfg->gb_len;
+    }
+    /** Length of historical bytes  */
+    nfc_buf[len++] = 0;
+    return len;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Initiator send and reciev data.
+    @param  tx_buf --- data send buffer, user sets
+            tx_len --- data send legth, user sets.
+            rx_buf --- data recieve buffer, returned by P2PInitiatorTxRx
+            rx_len --- data receive length, returned by P2PInitiatorTxRx
+	@return 0 - send failed
+            1 - send successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::P2PInitiatorTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len)
+{
+//    wait_ready();
+//    wait_ready();
+    wait_ready(15);
+    nfc_buf[0] = PN532_COMMAND_INDATAEXCHANGE;
+    nfc_buf[1] = 0x01; // logical number of the relevant target
+
+    memcpy(nfc_buf+2, t_buf, t_len);
+
+    if(!write_cmd_check_ack(nfc_buf, t_len+2)){
+        return 0;
+    }
+#ifdef PN532_P2P_DEBUG
+    Serial.println("Initiator DataExchange sent.");
+#endif
+
+    wait_ready(200);
+
+    read_dt(nfc_buf, 60);
+    if(nfc_buf[5] != 0xD5){
+        return 0;
+    }
+
+#ifdef PN532_P2P_DEBUG
+    Serial.println("Initiator DataExchange Get.");
+#endif
+
+    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_INDATAEXCHANGE+1)){
+#ifdef PN532_P2P_DEBUG
+        puthex(nfc_buf, nfc_buf[3]+7);
+        Serial.println("Send data failed");
+#endif
+        return 0;
+    }
+
+    if(nfc_buf[NFC_FRAME_ID_INDEX+1]){
+#ifdef PN532_P2P_DEBUG
+        Serial.print("InExchangeData Error:");
+        puthex(nfc_buf, nfc_buf[3]+7);
+        Serial.println();
+#endif
+        return 0;
+    }
+
+#ifdef PN532_P2P_DEBUG
+    puthex(nfc_buf, nfc_buf[3]+7);
+    Serial.println();
+#endif
+    /** longer frames are truncated by read_dt(), use P2PInitiatorStream() */
+    if(nfc_buf[3] > 60-5){
+        return 0;
+    }
+    /** return read data */
+    *r_len = nfc_buf[3]-3;
+    memcpy(r_buf, nfc_buf+8, *r_len);
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Target sends and recievs data.
+    @param  tx_buf --- data send buffer, user sets
+            tx_len --- data send legth, user sets.
+            rx_buf --- data recieve buffer, returned by P2PInitiatorTxRx
+            rx_len --- data receive length, returned by P2PInitiatorTxRx
+	@return 0 - send failed
+            1 - send successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::P2PTargetTxRx(u8 *t_buf, u8 t_len, u8 *r_buf, u8 *r_len)
+{
+    if(!write_frame_check_ack(frame_tg_get_data)){
+        return 0;
+    }
+    wait_ready(100);
+    read_dt(nfc_buf, 60);
+    if(nfc_buf[5] != 0xD5){
+        return 0;
+    }
+
+    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_TGGETDATA+1)){
+#ifdef PN532_P2P_DEBUG
+        puthex(nfc_buf, 20);
+        Serial.println("Target GetData failed");
+#endif
+        return 0;
+    }
+    if(nfc_buf[NFC_FRAME_ID_INDEX+1]){
+ #ifdef PN532_P2P_DEBUG
+        Serial.print("TgGetData Error:");
+        puthex(nfc_buf, nfc_buf[3]+7);
+        Serial.println();
+#endif
+        return 0;
+    }
+
+#ifdef PN532_P2P_DEBUG
+    Serial.println("TgGetData:");
+    puthex(nfc_buf, nfc_buf[3]+7);
+    Serial.println();
+#endif
+
+    /** longer frames are truncated by read_dt(), use P2PTargetStream() */
+    if(nfc_buf[3] > 60-5){
+        return 0;
+    }
+    /** return read data */
+    *r_len = nfc_buf[3]-3;
+    memcpy(r_buf, nfc_buf+8, *r_len);
+
+    nfc_buf[0] = PN532_COMMAND_TGSETDATA;
+    memcpy(nfc_buf+1, t_buf, t_len);
+
+    if(!write_cmd_check_ack(nfc_buf, 1+t_len)){
+        return 0;
+    }
+    wait_ready(100);
+    read_dt(nfc_buf, 26);
+
+    if(nfc_buf[5] != 0xD5){
+        return 0;
+    }
+    if(nfc_buf[NFC_FRAME_ID_INDEX] != (PN532_COMMAND_TGSETDATA+1)){
+#ifdef PN532_P2P_DEBUG
+        puthex(nfc_buf, 20);
+        Serial.println("Send data failed");
+#endif
+        return 0;
+    }
+    if(nfc_buf[NFC_FRAME_ID_INDEX+1]){
+        return 0;
+    }
+
+    return 1;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Non-blocking P2P target server, call it from loop(). It arms
+        TgInitAsTarget once, then answers each TgGetData request through
+        handler with TgSetData. PN532 is only read when its status byte
+        reports ready, and the target is re-armed when the initiator leaves.
+        Requests and replies must fit in one frame, see P2PTargetStream()
+        for longer transfers.
+	@param  handler - request handler
+	@param  ctx - user pointer passed to handler
+	@return NFC_SRV_IDLE - nothing happened
+            NFC_SRV_ACTIVATED - an initiator activated the target
+            NFC_SRV_REQUEST - a request has been answered
+            NFC_SRV_RELEASED - initiator left, target is re-armed
+*/
+/*****************************************************************************/
+u8 NFC_Module::P2PTargetServe(nfc_p2p_handler_t handler, void *ctx)
+{
+    const u8 *tx;
+    u8 len, ret = NFC_SRV_IDLE;
+
+    if(tg_state == NFC_STA_IDLE){
+        len = PN532_TG_DEP_ONLY;
+        if(p2p_cfg && p2p_cfg->mode == NFC_P2P_PASSIVE){
+            len |= PN532_TG_PASSIVE_ONLY;
+        }
+        /** SEL_RES 0x40, DEP only mode */
+        len = tg_init_frame(len, 0x40, p2p_cfg);
+        if(len && write_cmd_check_ack(nfc_buf, len)){
+            tg_state = NFC_STA_TAG;
+        }
+        return NFC_SRV_IDLE;
+    }
+
+    if(read_sta() != PN532_I2C_READY){
+        return NFC_SRV_IDLE;
+    }
+    read_dt(nfc_buf, NFC_CMD_BUF_LEN-2);
+
+    if(nfc_buf[5] != 0xD5 ||
+       (tg_state == NFC_STA_TAG ?
+        !(nfc_buf[NFC_FRAME_ID_INDEX+1] & PN532_TG_MODE_DEP) :
+        (nfc_buf[NFC_FRAME_ID_INDEX+1] & NFC_STATUS_ERR_MASK)) ||
+       (tg_state == NFC_STA_GETDATA && nfc_buf[3] > NFC_CMD_BUF_LEN-9)){
+        /** released, timeout or broken frame, wait for next initiator */
+        tg_state = NFC_STA_IDLE;
+        return NFC_SRV_RELEASED;
+    }
+
+    switch(tg_state){
+        case NFC_STA_TAG:
+            ret = NFC_SRV_ACTIVATED;
+            break;
+        case NFC_STA_GETDATA:
+            len = handler(nfc_buf+8, nfc_buf[3]-3, &tx, ctx);
+            if(len > NFC_DEP_CHUNK){
+                len = NFC_DEP_CHUNK;
+            }
+            memmove(nfc_buf+1, tx, len);
+            nfc_buf[0] = PN532_COMMAND_TGSETDATA;
+            if(!write_cmd_check_ack(nfc_buf, 1+len)){
+                tg_state = NFC_STA_IDLE;
+                return NFC_SRV_RELEASED;
+            }
+            tg_state = NFC_STA_SETDATA;
+            return NFC_SRV_REQUEST;
+        default:
+            break;
+    }
+
+    if(!write_frame_check_ack(frame_tg_get_data)){
+        tg_state = NFC_STA_IDLE;
+        return NFC_SRV_RELEASED;
+    }
+    tg_state = NFC_STA_GETDATA;
+    return ret;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  P2PInitiatorTxRx() as a step of CmdStep(), for a protothread:
+        one DEP frame exchange with the activated target. The command is
+        built in cmd when the engine is free, and cmd identifies the caller.
+	@param  cmd - command buffer of the caller, 2+t_len bytes
+	@param  t_buf - data to send, NFC_DEP_CHUNK at most
+	@param  t_len - data length
+	@param  r_buf - buffer of the received data
+	@param  r_len - in: r_buf size; out: received length
+	@param  ms - abort after ms, 0 - no timeout
+	@return NFC_CMD_BUSY - call again
+            NFC_CMD_DONE - reply in r_buf
+            NFC_CMD_FAILED - failed, timed out or reply too long
+*/
+/*****************************************************************************/
+u8 NFC_Module::StepP2PTxRx(u8 *cmd, const u8 *t_buf, u8 t_len, u8 *r_buf,
+                           u8 *r_len, u16 ms)
+{
+    u8 ret;
+
+    if(t_len > NFC_DEP_CHUNK){
+        return NFC_CMD_FAILED;
+    }
+    if(!cmd_rlen){
+        cmd[0] = PN532_COMMAND_INDATAEXCHANGE;
+        cmd[1] = 0x01; // logical number of the relevant target
+        memcpy(cmd+2, t_buf, t_len);
+    }
+    ret = step_exchange(cmd, 2+t_len, NFC_CMD_BUF_LEN-2, ms);
+    if(ret != NFC_CMD_DONE){
+        return ret;
+    }
+    /** chained replies need P2PInitiatorStream() */
+    if((nfc_buf[NFC_FRAME_ID_INDEX+1] & NFC_MI) || nfc_buf[3]-3 > *r_len){
+        return NFC_CMD_FAILED;
+    }
+    *r_len = nfc_buf[3]-3;
+    memcpy(r_buf, nfc_buf+8, *r_len);
+    return NFC_CMD_DONE;
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Initiator sends a stream of any length and receives the reply
+        stream, chaining DEP frames with the MI bit. Only one frame is buffered
+        at a time, NFC_DEP_CHUNK bytes.
+	@param  src - source of the data to send
+	@param  sink - sink of the received data
+	@param  ctx - user pointer passed to src and sink
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::P2PInitiatorStream(nfc_source_t src, nfc_sink_t sink, void *ctx)
+{
+    u8 len, more;
+
+    do{
+        more = 0;
+        len = src(nfc_buf+2, NFC_DEP_CHUNK, &more, ctx);
+        nfc_buf[0] = PN532_COMMAND_INDATAEXCHANGE;
+        nfc_buf[1] = 0x01 | (more ? NFC_MI : 0);
+        if(!exchange(2+len, NFC_CMD_BUF_LEN-2, 200)){
+            return 0;
+        }
+    }while(more);
+
+    /** last frame is answered with the first part of the reply */
+    while(1){
+        if(!sink(nfc_buf+8, nfc_buf[3]-3, ctx)){
+            return 0;
+        }
+        if(!(nfc_buf[NFC_FRAME_ID_INDEX+1] & NFC_MI)){
+            return 1;
+        }
+        nfc_buf[0] = PN532_COMMAND_INDATAEXCHANGE;
+        nfc_buf[1] = 0x01;
+        if(!exchange(2, NFC_CMD_BUF_LEN-2, 200)){
+            return 0;
+        }
+    }
+}
+
+/*****************************************************************************/
+/*!
+	@brief  Target receives a stream of any length and sends the reply
+        stream, chaining DEP frames with the MI bit. Only one frame is buffered
+        at a time, NFC_DEP_CHUNK bytes.
+	@param  sink - sink of the received data
+	@param  src - source of the data to send
+	@param  ctx - user pointer passed to sink and src
+	@return 0 - failed
+            1 - successfully
+*/
+/*****************************************************************************/
+u8 NFC_Module::P2PTargetStream(nfc_sink_t sink, nfc_source_t src, void *ctx)
+{
+    u8 len, more;
+
+    do{
+        nfc_buf[0] = PN532_COMMAND_TGGETDATA;
+        if(!exchange(1, NFC_CMD_BUF_LEN-2, 100)){
+            return 0;
+        }
+        if(!sink(nfc_buf+8, nfc_buf[3]-3, ctx)){
+            return 0;
+        }
+    }while(nfc_buf[NFC_FRAME_ID_INDEX+1] & NFC_MI);
+
+    do{
+        more = 0;
+        len = src(nfc_buf+1, NFC_DEP_CHUNK, &more, ctx);
+        /** TgSetMetaData sends a frame with MI set */
+        nfc_buf[0] = more ? PN532_COMMAND_TGSETMETADATA :
+                            PN532_COMMAND_TGSETDATA;
+        if(!exchange(1+len, 10, 100)){
+            return 0;
+        }
+    }while(more);
+
+    return 1;
+}
+
+#endif /** NFC_USE_P2P */
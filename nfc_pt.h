@@ -0,0 +1,103 @@
+/*****************************************************************************/
+/*!
+    @file     nfc_pt.h
+    @author   www.elechouse.com
+	@brief      Stackless protothreads for NFC workflows.
+	A workflow is a function called from loop() that returns at every wait
+	and resumes there on the next call, so several workflows and other
+	tasks share loop() without blocking it. It only costs the nfc_pt_t
+	state, there is no stack per thread.
+
+    NOTE:
+        1. Local variables are lost at every wait, keep state in static or
+           global variables.
+        2. switch statements can not be used around a wait.
+        3. Each NFC_PT_STEP()/NFC_PT_AWAIT() needs a command buffer of its
+           own workflow, the buffer address identifies who owns the PN532.
+           Do not call blocking NFC_Module functions while a workflow awaits
+           a command.
+
+    Copyright (c) 2012 www.elechouse.com  All right reserved.
+*/
+/*****************************************************************************/
+
+#ifndef __NFC_PT_H
+#define __NFC_PT_H
+
+#include "nfc.h"
+
+/** protothread state */
+typedef struct{
+    u16 lc;             // resume point, 0 - start
+    u32 t;              // start of NFC_PT_DELAY()
+}nfc_pt_t;
+
+/** workflow function results */
+#define NFC_PT_WAITING                      0
+#define NFC_PT_ENDED                        1
+
+#define NFC_PT_INIT(pt)                     ((pt)->lc = 0)
+
+#define NFC_PT_BEGIN(pt)                    switch((pt)->lc){ case 0:
+
+#define NFC_PT_END(pt)                                                      \
+    }                                                                       \
+    (pt)->lc = 0;                                                           \
+    return NFC_PT_ENDED
+
+/** return until cond is true, cond is checked on every call */
+#define NFC_PT_WAIT_UNTIL(pt, cond)                                         \
+    do{                                                                     \
+        (pt)->lc = __LINE__; case __LINE__:                                 \
+        if(!(cond)){                                                        \
+            return NFC_PT_WAITING;                                          \
+        }                                                                   \
+    }while(0)
+
+#define NFC_PT_WAIT_WHILE(pt, cond)         NFC_PT_WAIT_UNTIL(pt, !(cond))
+
+/** give other tasks one turn */
+#define NFC_PT_YIELD(pt)                                                    \
+    do{                                                                     \
+        (pt)->lc = __LINE__;                                                \
+        return NFC_PT_WAITING;                                              \
+        case __LINE__:;                                                     \
+    }while(0)
+
+#define NFC_PT_DELAY(pt, ms)                                                \
+    do{                                                                     \
+        (pt)->t = millis();                                                 \
+        NFC_PT_WAIT_UNTIL(pt, (u32)(millis() - (pt)->t) >= (u32)(ms));      \
+    }while(0)
+
+#define NFC_PT_RESTART(pt)                                                  \
+    do{                                                                     \
+        (pt)->lc = 0;                                                       \
+        return NFC_PT_WAITING;                                              \
+    }while(0)
+
+#define NFC_PT_EXIT(pt)                                                     \
+    do{                                                                     \
+        (pt)->lc = 0;                                                       \
+        return NFC_PT_ENDED;                                                \
+    }while(0)
+
+/**
+    Wait for a step function of NFC_Module without blocking, step is
+    called again on every call of the workflow until it is done:
+        NFC_PT_STEP(pt, nfc.StepMifareRead(cmd_buf, 4, data, 100), ret);
+    ret gets NFC_CMD_DONE or NFC_CMD_FAILED.
+*/
+#define NFC_PT_STEP(pt, step, ret)                                          \
+    NFC_PT_WAIT_UNTIL(pt, ((ret) = (step)) != NFC_CMD_BUSY)
+
+/**
+    Send a command and wait for its response without blocking, see
+    NFC_Module::CmdStep(). ret gets NFC_CMD_DONE or NFC_CMD_FAILED, the
+    response is read with NFC_Module::CmdResponse(). For the commands of
+    the Step*() functions, NFC_PT_STEP() builds and checks the frames.
+*/
+#define NFC_PT_AWAIT(pt, nfc, cmd, len, rlen, ms, ret)                      \
+    NFC_PT_STEP(pt, (nfc).CmdStep(cmd, len, rlen, ms), ret)
+
+#endif /** __NFC_PT_H */